@@ -16,14 +16,18 @@ LOCAL_C_INCLUDES := $(LOCAL_PATH)/$(SDL_PATH)/include \
 
 # Add your application source files here...
 LOCAL_SRC_FILES := $(SDL_PATH)/src/main/android/SDL_android_main.c \
+	command.cpp \
 	game.cpp \
 	gamestate.cpp \
 	gui.cpp \
 	image.cpp \
+	imagepack.cpp \
 	main.cpp \
+	network.cpp \
 	panel.cpp \
 	player.cpp \
 	resources.cpp \
+	savestate.cpp \
 	screen.cpp \
 	sector.cpp \
 	sound.cpp \
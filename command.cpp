@@ -0,0 +1,211 @@
+//---------------------------------------------------------------------------
+#include "stdafx.h"
+
+#include <cassert>
+#include <cstdlib>
+
+#include <stdexcept> // needed for Android at least
+
+#include <sstream>
+
+#include "command.h"
+#include "sector.h"
+#include "utils.h"
+
+//---------------------------------------------------------------------------
+
+Command::Command() : type(COMMAND_NONE), player(-1), sector_x(-1), sector_y(-1) {
+	for(int i=0;i<n_args_c;i++) {
+		args[i] = -1;
+	}
+}
+
+Command::Command(CommandType type, int player, int sector_x, int sector_y) : type(type), player(player), sector_x(sector_x), sector_y(sector_y) {
+	for(int i=0;i<n_args_c;i++) {
+		args[i] = -1;
+	}
+}
+
+const char *Command::getName(CommandType type) {
+	switch( type ) {
+		case COMMAND_SET_N_DESIGNERS:
+			return "set_n_designers";
+		case COMMAND_SET_N_WORKERS:
+			return "set_n_workers";
+		case COMMAND_SET_F_AMOUNT:
+			return "set_f_amount";
+		case COMMAND_SET_N_MINERS:
+			return "set_n_miners";
+		case COMMAND_SET_N_BUILDERS:
+			return "set_n_builders";
+		case COMMAND_SET_CURRENT_DESIGN:
+			return "set_current_design";
+		case COMMAND_SET_CURRENT_MANUFACTURE:
+			return "set_current_manufacture";
+		case COMMAND_ASSEMBLED_ARMY_EMPTY:
+			return "assembled_army_empty";
+		case COMMAND_ASSEMBLE_ARMY_UNARMED:
+			return "assemble_army_unarmed";
+		case COMMAND_ASSEMBLE_ARMY:
+			return "assemble_army";
+		case COMMAND_ASSEMBLE_ALL:
+			return "assemble_all";
+		case COMMAND_RETURN_ASSEMBLED_ARMY:
+			return "return_assembled_army";
+		case COMMAND_RETURN_ARMY:
+			return "return_army";
+		case COMMAND_MOVE_ARMY_TO:
+			return "move_army_to";
+		case COMMAND_MOVE_ASSEMBLED_ARMY_TO:
+			return "move_assembled_army_to";
+		case COMMAND_NUKE_SECTOR:
+			return "nuke_sector";
+		case COMMAND_DEPLOY_DEFENDER:
+			return "deploy_defender";
+		case COMMAND_RETURN_DEFENDER:
+			return "return_defender";
+		case COMMAND_USE_SHIELD:
+			return "use_shield";
+		case COMMAND_TRASH_DESIGN:
+			return "trash_design";
+		case COMMAND_SHUTDOWN:
+			return "shutdown";
+		default:
+			break;
+	}
+	return "none";
+}
+
+void Command::setDesignArgs(const Design *design) {
+	// args[0..2]: invention type, invention epoch, design save id (all -1 for no design)
+	if( design == NULL ) {
+		args[0] = -1;
+		args[1] = -1;
+		args[2] = -1;
+	}
+	else {
+		ASSERT( design->getSaveId() >= 0 );
+		args[0] = design->getInvention()->getType();
+		args[1] = design->getInvention()->getEpoch();
+		args[2] = design->getSaveId();
+	}
+}
+
+Design *Command::getDesignArg() const {
+	Invention *invention = this->getInventionArg();
+	if( invention == NULL || args[2] < 0 ) {
+		return NULL;
+	}
+	return invention->findDesign(args[2]);
+}
+
+void Command::setInventionArgs(const Invention *invention) {
+	// args[0..1]: invention type, invention epoch (both -1 for no invention)
+	if( invention == NULL ) {
+		args[0] = -1;
+		args[1] = -1;
+	}
+	else {
+		args[0] = invention->getType();
+		args[1] = invention->getEpoch();
+	}
+}
+
+Invention *Command::getInventionArg() const {
+	if( args[0] < 0 || args[0] >= Invention::N_TYPES || args[1] < 0 || args[1] >= n_epochs_c ) {
+		return NULL;
+	}
+	return Invention::getInvention(static_cast<Invention::Type>(args[0]), args[1]);
+}
+
+CommandQueue::CommandQueue() {
+#if SDL_MAJOR_VERSION == 1
+	mutex = SDL_CreateMutex();
+	head = 0;
+	tail = 0;
+#else
+	SDL_AtomicSet(&head, 0);
+	SDL_AtomicSet(&tail, 0);
+#endif
+}
+
+CommandQueue::~CommandQueue() {
+#if SDL_MAJOR_VERSION == 1
+	if( mutex != NULL ) {
+		SDL_DestroyMutex(mutex);
+	}
+#endif
+}
+
+bool CommandQueue::push(const Command &command) {
+#if SDL_MAJOR_VERSION == 1
+	SDL_mutexP(mutex);
+	bool ok = false;
+	if( tail - head < capacity_c ) {
+		commands[tail & (capacity_c-1)] = command;
+		tail++;
+		ok = true;
+	}
+	SDL_mutexV(mutex);
+	return ok;
+#else
+	int t = SDL_AtomicGet(&tail);
+	int h = SDL_AtomicGet(&head);
+	if( t - h >= capacity_c ) {
+		return false;
+	}
+	commands[t & (capacity_c-1)] = command;
+	// make sure the command is written before the consumer can see the new tail
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&tail, t+1);
+	return true;
+#endif
+}
+
+bool CommandQueue::pop(Command *command) {
+#if SDL_MAJOR_VERSION == 1
+	SDL_mutexP(mutex);
+	bool ok = false;
+	if( head != tail ) {
+		*command = commands[head & (capacity_c-1)];
+		head++;
+		ok = true;
+	}
+	SDL_mutexV(mutex);
+	return ok;
+#else
+	int h = SDL_AtomicGet(&head);
+	int t = SDL_AtomicGet(&tail);
+	if( h == t ) {
+		return false;
+	}
+	SDL_MemoryBarrierAcquire();
+	*command = commands[h & (capacity_c-1)];
+	SDL_AtomicSet(&head, h+1);
+	return true;
+#endif
+}
+
+bool CommandQueue::isEmpty() const {
+#if SDL_MAJOR_VERSION == 1
+	SDL_mutexP(mutex);
+	bool empty = head == tail;
+	SDL_mutexV(mutex);
+	return empty;
+#else
+	CommandQueue *queue = const_cast<CommandQueue *>(this);
+	return SDL_AtomicGet(&queue->head) == SDL_AtomicGet(&queue->tail);
+#endif
+}
+
+void CommandQueue::clear() {
+#if SDL_MAJOR_VERSION == 1
+	SDL_mutexP(mutex);
+	head = 0;
+	tail = 0;
+	SDL_mutexV(mutex);
+#else
+	SDL_AtomicSet(&head, 0);
+	SDL_AtomicSet(&tail, 0);
+#endif
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+/** Commands requesting a modification to the game world, and the queue that
+*   carries them from the client (GUI/input) to the simulation.
+*/
+
+#include "common.h"
+
+class Design;
+class Invention;
+
+/* A Command is a plain value type, so that it can be copied across threads,
+*  and sent without referring to any pointers (designs and inventions are
+*  referred to by type/epoch/save id). It's encoded by writeNetCommand() and
+*  readNetCommand() in network.h.
+*/
+class Command {
+public:
+	enum CommandType {
+		COMMAND_NONE = -1,
+		COMMAND_SET_N_DESIGNERS = 0,
+		COMMAND_SET_N_WORKERS,
+		COMMAND_SET_F_AMOUNT,
+		COMMAND_SET_N_MINERS,
+		COMMAND_SET_N_BUILDERS,
+		COMMAND_SET_CURRENT_DESIGN,
+		COMMAND_SET_CURRENT_MANUFACTURE,
+		COMMAND_ASSEMBLED_ARMY_EMPTY,
+		COMMAND_ASSEMBLE_ARMY_UNARMED,
+		COMMAND_ASSEMBLE_ARMY,
+		COMMAND_ASSEMBLE_ALL,
+		COMMAND_RETURN_ASSEMBLED_ARMY,
+		COMMAND_RETURN_ARMY,
+		COMMAND_MOVE_ARMY_TO,
+		COMMAND_MOVE_ASSEMBLED_ARMY_TO,
+		COMMAND_NUKE_SECTOR,
+		COMMAND_DEPLOY_DEFENDER,
+		COMMAND_RETURN_DEFENDER,
+		COMMAND_USE_SHIELD,
+		COMMAND_TRASH_DESIGN,
+		COMMAND_SHUTDOWN,
+		N_COMMAND_TYPES
+	};
+	static const int n_args_c = 4;
+
+	CommandType type;
+	int player;
+	int sector_x, sector_y;
+	int args[n_args_c]; // meaning depends on the type
+
+	Command();
+	Command(CommandType type, int player, int sector_x, int sector_y);
+
+	static const char *getName(CommandType type);
+
+	// helpers for referring to designs/inventions by value
+	void setDesignArgs(const Design *design);
+	Design *getDesignArg() const;
+	void setInventionArgs(const Invention *invention);
+	Invention *getInventionArg() const;
+};
+
+/* Fixed size queue of Commands, for a single producer (the client) and a
+*  single consumer (the simulation). With SDL 2 this doesn't need a lock, as
+*  each index is only ever written by one side; SDL 1 has no atomics, so we
+*  fall back to a mutex.
+*/
+class CommandQueue {
+	static const int capacity_c = 256; // must be a power of 2
+
+	Command commands[capacity_c];
+#if SDL_MAJOR_VERSION == 1
+	SDL_mutex *mutex;
+	int head; // next slot to read
+	int tail; // next slot to write
+#else
+	SDL_atomic_t head; // next slot to read
+	SDL_atomic_t tail; // next slot to write
+#endif
+
+	CommandQueue(const CommandQueue &); // not copyable
+	CommandQueue &operator=(const CommandQueue &);
+public:
+	CommandQueue();
+	~CommandQueue();
+
+	bool push(const Command &command); // returns false if the queue is full
+	bool pop(Command *command); // returns false if the queue is empty
+	bool isEmpty() const;
+	void clear(); // only call when neither side is using the queue
+};
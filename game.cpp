@@ -4,6 +4,7 @@
 #include <cassert>
 #include <ctime>
 #include <cerrno> // n.b., needed on Linux at least
+#include <climits>
 
 #include <stdexcept> // needed for Android at least
 
@@ -41,6 +42,9 @@ using std::stringstream;
 #include "gui.h"
 #include "player.h"
 #include "tutorial.h"
+#include "savestate.h"
+#include "imagepack.h"
+#include "network.h"
 
 #include "screen.h"
 #include "image.h"
@@ -117,6 +121,28 @@ Game::Game() {
 	n_men_store = 0;
 	n_player_suspended = 0;
 
+	use_simulation_thread = false;
+	simulation_thread = NULL;
+	world_mutex = NULL;
+#if SDL_MAJOR_VERSION == 1
+#else
+	SDL_AtomicSet(&simulation_thread_quit, 0);
+#endif
+
+	background_saver = NULL;
+	last_periodic_autosave_time = -1;
+	periodic_autosave_index = 0;
+	periodic_autosave_pending = false;
+
+	net_server = NULL;
+	net_client = NULL;
+
+	image_pack = NULL;
+
+	for(int i=0;i<n_epochs_c;i++) {
+		epoch_sprites_loaded[i] = false;
+	}
+
 	background = NULL;
 	background_stars = NULL;
 	for(int i=0;i<n_players_c;i++) {
@@ -328,6 +354,20 @@ Game::Game() {
 }
 
 Game::~Game() {
+	stopSimulationThread();
+	if( net_server != NULL ) {
+		delete net_server;
+		net_server = NULL;
+	}
+	if( net_client != NULL ) {
+		delete net_client;
+		net_client = NULL;
+	}
+	if( background_saver != NULL ) {
+		LOG("delete background saver\n");
+		delete background_saver; // finishes writing any pending save
+		background_saver = NULL;
+	}
 	if( gamestate != NULL ) {
 		LOG("delete gamestate %d\n", gamestate);
 		delete gamestate;
@@ -355,6 +395,12 @@ Game::~Game() {
 	}
 	LOG("clean up tracked objects\n");
 	TrackedObject::cleanup();
+	Gigalomania::Image::freeAtlases();
+	if( image_pack != NULL ) {
+		// must be after the images are deleted
+		delete image_pack;
+		image_pack = NULL;
+	}
 	// no longer need to stop music, as it's deleted as a TrackedObject
 	//stopMusic();
 	LOG("free sound\n");
@@ -396,6 +442,10 @@ bool Game::isDemo() const {
 const char autosave_filename[] = "autosave.sav";
 const char autosave_bad_filename[] = "autosave_bad.sav";
 const char autosave_old_filename[] = "autosave_old.sav";
+const char autosave_xml_filename[] = "autosave_debug.xml";
+const char autosave_periodic_filename[] = "autosave_periodic_"; // followed by the index and ".sav"
+const int n_periodic_autosaves_c = 3; // number of periodic autosaves kept, to allow rolling back (by copying one over the autosave)
+const int periodic_autosave_interval_c = (int)(2 * 60 * 1000 * time_ratio_c); // game time between periodic autosaves - 2 minutes at normal speed
 const bool autosave_survive_uninstall = false; // important for autosave state to be deleted upon uninstall if possible, so that any problems can be fixed by a reinstall
 
 bool validDifficulty(DifficultyLevel difficulty) {
@@ -454,6 +504,9 @@ Map::Map(MapColour colour,int n_opponents,const char *name) {
 			sector_at[x][y] = false;
 			sectors[x][y] = NULL;
 			reserved[x][y] = false;
+			for(int i=0;i<N_ID;i++) {
+				elements[x][y][i] = 0;
+			}
 			//panels[x][y] = NULL;
 		}
 	}
@@ -500,6 +553,12 @@ void Map::newSquareAt(int x,int y) {
 	this->sector_at[x][y] = true;
 }
 
+void Map::setElements(int x, int y, Id id, int n_elements) {
+	ASSERT(x >= 0 && x < map_width_c && y >= 0 && y < map_height_c);
+	ASSERT_ELEMENT_ID(id);
+	this->elements[x][y][id] = n_elements;
+}
+
 void Map::createSectors(PlayingGameState *gamestate, int epoch) {
 	ASSERT_EPOCH(epoch);
 	for(int x=0;x<map_width_c;x++) {
@@ -514,6 +573,20 @@ void Map::createSectors(PlayingGameState *gamestate, int epoch) {
 	}
 }
 
+/* Sets the starting elements of each sector, as read from the map file.
+*/
+void Map::setupSectorElements() {
+	for(int x=0;x<map_width_c;x++) {
+		for(int y=0;y<map_height_c;y++) {
+			if( sectors[x][y] != NULL ) {
+				for(int i=0;i<N_ID;i++) {
+					sectors[x][y]->setElements((Id)i, this->elements[x][y][i]);
+				}
+			}
+		}
+	}
+}
+
 #if 0
 void Map::checkSectors() const {
 	//LOG("Map::checkSectors()\n");
@@ -547,6 +620,7 @@ void Map::freeSectors() {
 			}
 		}
 	}
+	island_arena.releaseAll();
 	//current_sector = NULL;
     //LOG("Map::freeSectors exit\n");
 }
@@ -651,12 +725,12 @@ void Map::calculateStats() const {
 	}*/
 }
 
-void Map::saveStateSectors(stringstream &stream) const {
+void Map::saveStateSectors(SaveWriter &writer) const {
 	for(int x=0;x<map_width_c;x++) {
 		for(int y=0;y<map_height_c;y++) {
 			if( this->sector_at[x][y] ) {
 				Sector *sector = this->sectors[x][y];
-				sector->saveState(stream);
+				sector->saveState(writer);
 			}
 		}
 	}
@@ -1317,6 +1391,58 @@ void Game::processImage(Gigalomania::Image *image, bool old_smooth) const {
     //LOG("    done\n");
 }
 
+/* Sets player_images to the versions of image for each player, with the
+*  pixels of colour (240, 0, 0) in the player's colour, and takes ownership
+*  of image. With SDL 2 the players share the one image, with the player
+*  colour drawn from a tinted mask on top (see Image::createTinted()), rather
+*  than each having their own remapped copy. Use deletePlayerImages() to
+*  free them.
+*/
+void Game::createPlayerImages(Gigalomania::Image *player_images[n_players_c], Gigalomania::Image *image) const {
+#if SDL_MAJOR_VERSION == 1
+#else
+	const SDL_Surface *surface = image->getSurface();
+	if( !using_old_gfx && surface->format->BitsPerPixel == 32 && surface->format->Amask != 0 ) {
+		// as with remapping, extract the mask before scaling, so that it only has the pixels that are exactly the player
+		// colour, and the blended edges scale along with the rest of the mask rather than staying in the image
+		Gigalomania::Image *mask = NULL;
+		if( image->extractTintMask(&mask, 240, 0, 0) ) {
+			processImage(image);
+			if( mask != NULL ) {
+				processImage(mask);
+			}
+			for(int i=0;i<n_players_c;i++) {
+				int r = 0, g = 0, b = 0;
+				PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)i);
+				player_images[i] = Gigalomania::Image::createTinted(image, mask, (unsigned char)r, (unsigned char)g, (unsigned char)b);
+			}
+			return;
+		}
+	}
+#endif
+	// do remapping before scaling
+	for(int i=0;i<n_players_c;i++) {
+		player_images[i] = i == n_players_c-1 ? image : image->copy();
+		int r = 0, g = 0, b = 0;
+		PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)i);
+		player_images[i]->remap(240, 0, 0, r, g, b);
+		processImage(player_images[i]);
+	}
+}
+
+void Game::deletePlayerImages(Gigalomania::Image *player_images[n_players_c]) {
+	Gigalomania::Image *base = player_images[0] == NULL ? NULL : player_images[0]->getTintBase();
+	Gigalomania::Image *mask = player_images[0] == NULL ? NULL : player_images[0]->getTintMask();
+	for(int i=0;i<n_players_c;i++) {
+		delete player_images[i];
+		player_images[i] = NULL;
+	}
+	delete base;
+	delete mask;
+}
+
+static const char attacker_walking_dir_filename_c[] = "attacker_walking_%d_%d.png";
+
 bool Game::loadAttackersWalkingImages(const string &gfx_dir, int epoch) {
 	char filename[300] = "";
 	sprintf(filename, "attacker_walking_%d.png", epoch);
@@ -1331,7 +1457,7 @@ bool Game::loadAttackersWalkingImages(const string &gfx_dir, int epoch) {
 			// load direction specific image
 			//LOG("try loading direction specific images for epoch %d dir %d\n", epoch, dir);
 			direction_specific = true;
-			sprintf(filename, "attacker_walking_%d_%d.png", epoch, dir);
+			sprintf(filename, attacker_walking_dir_filename_c, epoch, dir);
 			gfx_image = Gigalomania::Image::loadImage(gfx_dir + filename);
 			if( gfx_image == NULL ) {
 				LOG("failed to load attacker walking image for epoch %d dir %d\n", epoch, dir);
@@ -1345,14 +1471,11 @@ bool Game::loadAttackersWalkingImages(const string &gfx_dir, int epoch) {
 		//LOG("epoch %d, direction %d has %d frames\n", epoch, dir, n_attacker_frames[epoch][dir]);
 		// need to update max_attacker_frames_c if we ever want to allow more frames!
 		ASSERT( n_attacker_frames[epoch][dir] <= max_attacker_frames_c );
-		for(int player=0;player<n_players_c;player++) {
-			int n_frames = n_attacker_frames[epoch][dir];
-			for(int frame=0;frame<n_frames;frame++) {
-				attackers_walking[player][epoch][dir][frame] = gfx_image->copy(width_per_frame*frame, 0, width_per_frame, height_per_frame);
-				int r = 0, g = 0, b = 0;
-				PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)player);
-				attackers_walking[player][epoch][dir][frame]->remap(240, 0, 0, r, g, b);
-				processImage(attackers_walking[player][epoch][dir][frame]);
+		for(int frame=0;frame<n_attacker_frames[epoch][dir];frame++) {
+			Gigalomania::Image *player_images[n_players_c];
+			createPlayerImages(player_images, gfx_image->copy(width_per_frame*frame, 0, width_per_frame, height_per_frame));
+			for(int player=0;player<n_players_c;player++) {
+				attackers_walking[player][epoch][dir][frame] = player_images[player];
 			}
 		}
 		if( direction_specific ) {
@@ -1366,6 +1489,190 @@ bool Game::loadAttackersWalkingImages(const string &gfx_dir, int epoch) {
 	return true;
 }
 
+/* The shipped attacker graphics have a separate image for each direction
+*  (see loadAttackersWalkingImages()).
+*/
+static void addAttackerWalkingFilenames(vector<string> *filenames, const string &gfx_dir, int epoch) {
+	for(int dir=0;dir<n_attacker_directions_c;dir++) {
+		char filename[300] = "";
+		sprintf(filename, attacker_walking_dir_filename_c, epoch, dir);
+		filenames->push_back(gfx_dir + filename);
+	}
+}
+
+Gigalomania::Image *Game::loadBuildingImage(const char *name, int epoch, int x, int y, int w, int h) const {
+	stringstream filename;
+	filename << epoch_sprites_gfx_dir << name << epoch << ".png";
+	Gigalomania::Image *temp = Gigalomania::Image::loadImage(filename.str().c_str());
+	if( temp == NULL ) {
+		return NULL;
+	}
+	processImage(temp);
+	Gigalomania::Image *image = temp->copy(x, y, w, h);
+	delete temp;
+	return image;
+}
+
+/* The buildings and armed attackers are only needed for the epochs of the
+*  current island, so are loaded when an island starts rather than at
+*  startup. Attackers from epoch 6 onwards are copied from the sheets that
+*  are loaded at startup, so there's nothing to load for them here.
+*/
+bool Game::loadEpochSprites(int epoch) {
+	ASSERT_EPOCH(epoch);
+	ASSERT( !epoch_sprites_loaded[epoch] );
+	LOG("load sprites for epoch %d\n", epoch);
+
+	bool has_mine = epoch >= mine_epoch_c && epoch < n_epochs_c-1;
+	bool has_factory = epoch >= factory_epoch_c && epoch < n_epochs_c-1;
+	bool has_lab = epoch >= lab_epoch_c && epoch < n_epochs_c-1;
+	vector<string> filenames;
+	const char *building_names[] = {"building_tower_", "building_mine_", "building_factory_", "building_lab_"};
+	bool has_building[] = {true, has_mine, has_factory, has_lab};
+	for(int i=0;i<4;i++) {
+		if( has_building[i] ) {
+			stringstream filename;
+			filename << epoch_sprites_gfx_dir << building_names[i] << epoch << ".png";
+			filenames.push_back(filename.str());
+		}
+	}
+	if( epoch <= 5 ) {
+		addAttackerWalkingFilenames(&filenames, epoch_sprites_gfx_dir, epoch);
+	}
+	Gigalomania::Image::prefetchImages(filenames);
+
+	fortress[epoch] = loadBuildingImage(building_names[0], epoch, 27, 9, 64, 51);
+	bool ok = fortress[epoch] != NULL;
+	if( ok && has_mine ) {
+		mine[epoch] = loadBuildingImage(building_names[1], epoch, 28, 12, 66, 51);
+		ok = mine[epoch] != NULL;
+	}
+	if( ok && has_factory ) {
+		factory[epoch] = loadBuildingImage(building_names[2], epoch, 25, 1, 68, 62);
+		ok = factory[epoch] != NULL;
+	}
+	if( ok && has_lab ) {
+		lab[epoch] = loadBuildingImage(building_names[3], epoch, 31, 12, 52, 51);
+		ok = lab[epoch] != NULL;
+	}
+	if( ok && epoch <= 5 ) {
+		ok = loadAttackersWalkingImages(epoch_sprites_gfx_dir, epoch);
+	}
+	Gigalomania::Image::endPrefetch();
+
+	// these weren't around when the other images were converted at startup
+	Gigalomania::Image *images[] = {fortress[epoch], mine[epoch], factory[epoch], lab[epoch]};
+	for(int i=0;i<4 && ok;i++) {
+		if( images[i] != NULL && !images[i]->convertToDisplayFormat() ) {
+			ok = false;
+		}
+	}
+	for(int player=0;player<n_players_c && ok;player++) {
+		for(int dir=0;dir<n_attacker_directions_c && ok;dir++) {
+			for(int frame=0;frame<n_attacker_frames[epoch][dir] && ok;frame++) {
+				if( !attackers_walking[player][epoch][dir][frame]->convertToDisplayFormat() ) {
+					ok = false;
+				}
+			}
+		}
+	}
+
+	if( !ok ) {
+		LOG("failed to load sprites for epoch %d\n", epoch);
+		freeEpochSprites(epoch);
+		return false;
+	}
+	epoch_sprites_loaded[epoch] = true;
+	return true;
+}
+
+void Game::freeEpochSprites(int epoch) {
+	ASSERT_EPOCH(epoch);
+	LOG("free sprites for epoch %d\n", epoch);
+	delete fortress[epoch];
+	fortress[epoch] = NULL;
+	delete mine[epoch];
+	mine[epoch] = NULL;
+	delete factory[epoch];
+	factory[epoch] = NULL;
+	delete lab[epoch];
+	lab[epoch] = NULL;
+	if( epoch <= 5 ) {
+		for(int dir=0;dir<n_attacker_directions_c;dir++) {
+			for(int frame=0;frame<max_attacker_frames_c;frame++) {
+				Gigalomania::Image *player_images[n_players_c];
+				for(int player=0;player<n_players_c;player++) {
+					player_images[player] = attackers_walking[player][epoch][dir][frame];
+				}
+				deletePlayerImages(player_images);
+				for(int player=0;player<n_players_c;player++) {
+					attackers_walking[player][epoch][dir][frame] = NULL;
+				}
+			}
+		}
+		for(int dir=0;dir<n_attacker_directions_c;dir++) {
+			n_attacker_frames[epoch][dir] = 0;
+		}
+	}
+	epoch_sprites_loaded[epoch] = false;
+}
+
+/* The epochs whose sprites the current island can use: those of its sub
+*  epochs, and those its buildings are drawn with (see
+*  Sector::getBuildingEpoch()), which aren't always the same.
+*/
+void Game::getIslandSpriteEpochs(vector<int> *epochs) const {
+	epochs->clear();
+	int n_epochs = n_sub_epochs > 0 ? n_sub_epochs : 1;
+	for(int i=start_epoch;i<start_epoch+n_epochs;i++) {
+		int candidates[] = {i, Sector::getBuildingEpoch(i, false), Sector::getBuildingEpoch(i, true)};
+		for(int j=0;j<3;j++) {
+			if( j == 2 && i != n_epochs_c-1 ) {
+				continue; // sectors can only be shut down in the last epoch
+			}
+			if( std::find(epochs->begin(), epochs->end(), candidates[j]) == epochs->end() ) {
+				epochs->push_back(candidates[j]);
+			}
+		}
+	}
+}
+
+/* Makes sure the sprites for the epochs of the current island are loaded.
+*  The sets for the most recently used epochs are kept, so that replaying or
+*  moving on to a neighbouring island doesn't reload them, and the rest are
+*  freed.
+*/
+bool Game::requireEpochSprites() {
+	if( using_old_gfx ) {
+		// all loaded at startup
+		return true;
+	}
+	const int max_resident_epochs_c = 6; // must be at least the most epochs an island can need
+	vector<int> epochs;
+	getIslandSpriteEpochs(&epochs);
+	ASSERT( (int)epochs.size() <= max_resident_epochs_c );
+	bool ok = true;
+	for(vector<int>::const_reverse_iterator epoch_iter = epochs.rbegin(); epoch_iter != epochs.rend(); ++epoch_iter) {
+		int i = *epoch_iter;
+		vector<int>::iterator iter = std::find(epoch_sprites_lru.begin(), epoch_sprites_lru.end(), i);
+		if( iter != epoch_sprites_lru.end() ) {
+			epoch_sprites_lru.erase(iter);
+		}
+		epoch_sprites_lru.insert(epoch_sprites_lru.begin(), i);
+		if( !epoch_sprites_loaded[i] && !loadEpochSprites(i) ) {
+			ok = false;
+		}
+	}
+	while( (int)epoch_sprites_lru.size() > max_resident_epochs_c ) {
+		int epoch = epoch_sprites_lru.back();
+		epoch_sprites_lru.pop_back();
+		if( epoch_sprites_loaded[epoch] ) {
+			freeEpochSprites(epoch);
+		}
+	}
+	return ok;
+}
+
 void Game::calculateScale(const Gigalomania::Image *image) {
 #if SDL_MAJOR_VERSION == 1
 	scale_factor_w = ((float)(scale_width*default_width_c))/(float)image->getWidth();
@@ -1973,22 +2280,372 @@ bool Game::loadOldImages() {
 	return true;
 }
 
+static bool fileExists(const string &filename) {
+	SDL_RWops *src = SDL_RWFromFile(filename.c_str(), "rb");
+	if( src == NULL ) {
+		return false;
+	}
+	SDL_RWclose(src);
+	return true;
+}
+
+const char image_pack_filename[] = "gfx_cache.pack";
+const unsigned int image_pack_game_version_c = 3; // increment if loadImagesFromSources() changes how the images are created
+
+static void addImageSlots(vector<Gigalomania::Image **> *slots, Gigalomania::Image **images, size_t n_images) {
+	for(size_t i=0;i<n_images;i++) {
+		slots->push_back(&images[i]);
+	}
+}
+
+/* Returns the location of every image that loadImagesFromSources() sets up,
+*  in a fixed order, for the image pack. icon_clutter and icon_clutter_nuked
+*  must already be the right size.
+*/
+void Game::getImageSlots(vector<Gigalomania::Image **> *slots) {
+	const size_t ptr_size = sizeof(Gigalomania::Image *);
+	slots->push_back(&background);
+	slots->push_back(&background_stars);
+	addImageSlots(slots, &player_heads_select[0], sizeof(player_heads_select)/ptr_size);
+	addImageSlots(slots, &player_heads_alliance[0], sizeof(player_heads_alliance)/ptr_size);
+	slots->push_back(&grave);
+	addImageSlots(slots, &land[0], sizeof(land)/ptr_size);
+	addImageSlots(slots, &fortress[0], sizeof(fortress)/ptr_size);
+	addImageSlots(slots, &mine[0], sizeof(mine)/ptr_size);
+	addImageSlots(slots, &factory[0], sizeof(factory)/ptr_size);
+	addImageSlots(slots, &lab[0], sizeof(lab)/ptr_size);
+	addImageSlots(slots, &men[0], sizeof(men)/ptr_size);
+	slots->push_back(&unarmed_man);
+	addImageSlots(slots, &flags[0][0], sizeof(flags)/ptr_size);
+	slots->push_back(&panel_design);
+	slots->push_back(&panel_lab);
+	slots->push_back(&panel_factory);
+	slots->push_back(&panel_shield);
+	slots->push_back(&panel_defence);
+	slots->push_back(&panel_attack);
+	slots->push_back(&panel_bloody_attack);
+	slots->push_back(&panel_twoattack);
+	addImageSlots(slots, &panel_build[0], sizeof(panel_build)/ptr_size);
+	addImageSlots(slots, &panel_building[0], sizeof(panel_building)/ptr_size);
+	slots->push_back(&panel_knowndesigns);
+	slots->push_back(&panel_bigdesign);
+	slots->push_back(&panel_biglab);
+	slots->push_back(&panel_bigfactory);
+	slots->push_back(&panel_bigshield);
+	slots->push_back(&panel_bigdefence);
+	slots->push_back(&panel_bigattack);
+	slots->push_back(&panel_bigbuild);
+	slots->push_back(&panel_bigknowndesigns);
+	addImageSlots(slots, &numbers_blue[0], sizeof(numbers_blue)/ptr_size);
+	addImageSlots(slots, &numbers_grey[0], sizeof(numbers_grey)/ptr_size);
+	addImageSlots(slots, &numbers_white[0], sizeof(numbers_white)/ptr_size);
+	addImageSlots(slots, &numbers_orange[0], sizeof(numbers_orange)/ptr_size);
+	addImageSlots(slots, &numbers_yellow[0], sizeof(numbers_yellow)/ptr_size);
+	addImageSlots(slots, &numbers_largegrey[0], sizeof(numbers_largegrey)/ptr_size);
+	addImageSlots(slots, &numbers_largeshiny[0], sizeof(numbers_largeshiny)/ptr_size);
+	addImageSlots(slots, &numbers_small[0][0], sizeof(numbers_small)/ptr_size);
+	slots->push_back(&numbers_half);
+	addImageSlots(slots, &letters_large[0], sizeof(letters_large)/ptr_size);
+	addImageSlots(slots, &letters_small[0], sizeof(letters_small)/ptr_size);
+	addImageSlots(slots, &mouse_pointers[0], sizeof(mouse_pointers)/ptr_size);
+	addImageSlots(slots, &playershields[0], sizeof(playershields)/ptr_size);
+	slots->push_back(&building_health);
+	slots->push_back(&dash_grey);
+	slots->push_back(&icon_shield);
+	slots->push_back(&icon_defence);
+	slots->push_back(&icon_weapon);
+	addImageSlots(slots, &icon_shields[0], sizeof(icon_shields)/ptr_size);
+	addImageSlots(slots, &icon_defences[0], sizeof(icon_defences)/ptr_size);
+	addImageSlots(slots, &icon_weapons[0], sizeof(icon_weapons)/ptr_size);
+	addImageSlots(slots, &numbered_defences[0], sizeof(numbered_defences)/ptr_size);
+	addImageSlots(slots, &numbered_weapons[0], sizeof(numbered_weapons)/ptr_size);
+	addImageSlots(slots, &icon_elements[0], sizeof(icon_elements)/ptr_size);
+	addImageSlots(slots, &icon_clocks[0], sizeof(icon_clocks)/ptr_size);
+	slots->push_back(&icon_infinity);
+	slots->push_back(&icon_bc);
+	slots->push_back(&icon_ad);
+	slots->push_back(&icon_ad_shiny);
+	addImageSlots(slots, &icon_towers[0], sizeof(icon_towers)/ptr_size);
+	addImageSlots(slots, &icon_armies[0], sizeof(icon_armies)/ptr_size);
+	slots->push_back(&icon_nuke_hole);
+	slots->push_back(&mine_gatherable_small);
+	slots->push_back(&mine_gatherable_large);
+	slots->push_back(&icon_ergo);
+	slots->push_back(&icon_trash);
+	addImageSlots(slots, &coast_icons[0], sizeof(coast_icons)/ptr_size);
+	addImageSlots(slots, &map_sq[0][0], sizeof(map_sq)/ptr_size);
+	addImageSlots(slots, &defenders[0][0][0], sizeof(defenders)/ptr_size);
+	addImageSlots(slots, &nuke_defences[0], sizeof(nuke_defences)/ptr_size);
+	addImageSlots(slots, &attackers_walking[0][0][0][0], sizeof(attackers_walking)/ptr_size);
+	addImageSlots(slots, &planes[0][0], sizeof(planes)/ptr_size);
+	addImageSlots(slots, &nukes[0][0], sizeof(nukes)/ptr_size);
+	addImageSlots(slots, &saucers[0][0], sizeof(saucers)/ptr_size);
+	addImageSlots(slots, &attackers_ammo[0][0], sizeof(attackers_ammo)/ptr_size);
+	slots->push_back(&icon_openpitmine);
+	addImageSlots(slots, &icon_trees[0][0], sizeof(icon_trees)/ptr_size);
+	if( icon_clutter.size() > 0 ) {
+		addImageSlots(slots, &icon_clutter[0], icon_clutter.size());
+	}
+	if( icon_clutter_nuked.size() > 0 ) {
+		addImageSlots(slots, &icon_clutter_nuked[0], icon_clutter_nuked.size());
+	}
+	slots->push_back(&flashingmapsquare);
+	slots->push_back(&mapsquare);
+	slots->push_back(&arrow_left);
+	slots->push_back(&arrow_right);
+	addImageSlots(slots, &death_flashes[0], sizeof(death_flashes)/ptr_size);
+	addImageSlots(slots, &blue_flashes[0], sizeof(blue_flashes)/ptr_size);
+	addImageSlots(slots, &explosions[0], sizeof(explosions)/ptr_size);
+	addImageSlots(slots, &icon_mice[0], sizeof(icon_mice)/ptr_size);
+	addImageSlots(slots, &icon_speeds[0], sizeof(icon_speeds)/ptr_size);
+	slots->push_back(&smoke_image);
+	slots->push_back(&background_islands);
+}
+
+static int floatToInt(float value) {
+	int bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static float intToFloat(int bits) {
+	float value = 0.0f;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// the state other than images that loadImagesFromSources() sets up
+void Game::getImagePackValues(vector<int> *values) const {
+	values->push_back((int)icon_clutter.size());
+	values->push_back((int)icon_clutter_nuked.size());
+	values->push_back(floatToInt(scale_factor_w));
+	values->push_back(floatToInt(scale_factor_h));
+	values->push_back(floatToInt(scale_width));
+	values->push_back(floatToInt(scale_height));
+	values->push_back(map_sq_offset);
+	values->push_back(map_sq_coast_offset);
+	for(int i=0;i<n_epochs_c;i++) {
+		values->push_back(n_defender_frames[i]);
+	}
+	for(int i=0;i<=n_epochs_c;i++) {
+		for(int j=0;j<n_attacker_directions_c;j++) {
+			values->push_back(n_attacker_frames[i][j]);
+		}
+	}
+}
+
+bool Game::setImagePackValues(const vector<int> &values) {
+	if( values.size() != 8 + n_epochs_c + (n_epochs_c+1)*n_attacker_directions_c ) {
+		return false;
+	}
+	size_t indx = 0;
+	icon_clutter.resize(values[indx++]);
+	icon_clutter_nuked.resize(values[indx++]);
+	scale_factor_w = intToFloat(values[indx++]);
+	scale_factor_h = intToFloat(values[indx++]);
+	scale_width = intToFloat(values[indx++]);
+	scale_height = intToFloat(values[indx++]);
+	map_sq_offset = values[indx++];
+	map_sq_coast_offset = values[indx++];
+	for(int i=0;i<n_epochs_c;i++) {
+		n_defender_frames[i] = values[indx++];
+	}
+	for(int i=0;i<=n_epochs_c;i++) {
+		for(int j=0;j<n_attacker_directions_c;j++) {
+			n_attacker_frames[i][j] = values[indx++];
+		}
+	}
+	return true;
+}
+
+unsigned int Game::getImagePackKey() const {
+	// anything other than the source images that affects the images created
+	unsigned int key = image_pack_game_version_c;
+	key = key * 31 + SDL_MAJOR_VERSION;
+#if SDL_MAJOR_VERSION == 1
+	// with SDL 1, images are scaled to the screen resolution
+	key = key * 31 + (unsigned int)floatToInt(scale_width);
+	key = key * 31 + (unsigned int)floatToInt(scale_height);
+#endif
+	return key;
+}
+
+bool Game::loadImagePack() {
+	const char *pack_fullfilename = getApplicationFilename(image_pack_filename, false);
+	ImagePack *pack = new ImagePack();
+	bool ok = pack->open(pack_fullfilename);
+	delete [] pack_fullfilename;
+	if( ok ) {
+		unsigned int key = getImagePackKey();
+		ok = ImagePack::hashSources(&key, pack->getSources()) && key == pack->getKey();
+		if( !ok ) {
+			LOG("image pack is out of date\n");
+		}
+	}
+	vector<Gigalomania::Image *> slot_images;
+	ok = ok && setImagePackValues(pack->getValues());
+	vector<Gigalomania::Image **> slots;
+	if( ok ) {
+		getImageSlots(&slots);
+		ok = pack->getNSlots() == (int)slots.size() && pack->createImages(&slot_images);
+	}
+	if( !ok ) {
+		icon_clutter.clear();
+		icon_clutter_nuked.clear();
+		delete pack;
+		return false;
+	}
+	for(size_t i=0;i<slots.size();i++) {
+		*slots[i] = slot_images[i];
+	}
+#if SDL_MAJOR_VERSION == 1
+#else
+	screen->setLogicalSize((int)(scale_width*default_width_c), (int)(scale_height*default_height_c), true);
+#endif
+	LOG("loaded images from image pack\n");
+	image_pack = pack;
+	return true;
+}
+
+void Game::saveImagePack(const vector<string> &sources) {
+	unsigned int key = getImagePackKey();
+	if( !ImagePack::hashSources(&key, sources) ) {
+		return;
+	}
+	vector<int> values;
+	getImagePackValues(&values);
+	vector<Gigalomania::Image **> slots;
+	getImageSlots(&slots);
+	vector<Gigalomania::Image *> slot_images;
+	for(vector<Gigalomania::Image **>::const_iterator iter = slots.begin(); iter != slots.end(); ++iter) {
+		slot_images.push_back(**iter);
+	}
+	const char *pack_fullfilename = getApplicationFilename(image_pack_filename, false);
+	if( ImagePack::write(pack_fullfilename, key, sources, values, slot_images) ) {
+		LOG("saved image pack: %s\n", pack_fullfilename);
+	}
+	delete [] pack_fullfilename;
+}
+
+static const char *clutter_filenames[] = {
+	"boulders.png",
+	"boulders2.png",
+	"bigboulder.png",
+	"rocks.png",
+	"plant.png",
+	"grass.png",
+	"grasses01.png",
+	"grasses02.png",
+	"grasses04.png",
+	"grasses05.png",
+	"shrub2-01.png",
+	"swirl01.png",
+	"weed01.png",
+	"weed02.png",
+	"weed03.png",
+	"weed04.png"
+};
+static const int n_clutter_filenames_c = sizeof(clutter_filenames)/sizeof(clutter_filenames[0]);
+static const char *clutter_nuked_filenames[] = {
+	"bones.png",
+	"skulls.png"
+};
+static const int n_clutter_nuked_filenames_c = sizeof(clutter_nuked_filenames)/sizeof(clutter_nuked_filenames[0]);
+
+/* The images that loadImagesFromSources() loads by name, in the order it
+*  loads them. The tables are shared with getImageSourceFilenames(), so the
+*  list of images to prefetch can't get out of step with the loader.
+*/
+enum ImageSource {
+	IMAGESOURCE_STARS = 0,
+	IMAGESOURCE_SLABS,
+	IMAGESOURCE_PLAYER_HEADS_SELECT,
+	IMAGESOURCE_PLAYER_HEADS_ALLIANCE,
+	IMAGESOURCE_GRAVE,
+	IMAGESOURCE_ICONS,
+	IMAGESOURCE_EXPLOSIONS,
+	IMAGESOURCE_ICONS64,
+	IMAGESOURCE_FONT,
+	IMAGESOURCE_FONT_LARGE,
+	IMAGESOURCE_DEFENDERS,
+	IMAGESOURCE_DEFENDER_9,
+	IMAGESOURCE_ATTACKER_FLYING,
+	IMAGESOURCE_ATTACKER_AMMO,
+	IMAGESOURCE_FEATURES,
+	N_IMAGESOURCES
+};
+static const char *image_source_filenames[N_IMAGESOURCES] = {
+#if defined(__ANDROID__)
+	"stars.png",
+#else
+	"stars.jpg",
+#endif
+	"slabs.png",
+	"player_heads_select.png",
+	"player_heads_alliance.png",
+	"grave1.png",
+	"icons.png",
+	"explosions_test4.png",
+	"icons64.png",
+	"font.png",
+	"font_large.png",
+	"defenders.png",
+	"defender_9.png",
+	"attacker_flying.png",
+	"attacker_ammo.png",
+	"features.png",
+};
+static const char *tree_filenames[n_trees_c][n_tree_frames_c] = {
+	{"tree2_00.png", "tree2_01.png", "tree2_02.png", "tree2_03.png"},
+	{"tree3_00.png", "tree3_01.png", "tree3_02.png", "tree3_03.png"},
+	{"deadtree1_00.png", NULL, NULL, NULL}, // the nuked tree isn't animated, so the other frames are copies
+	{"tree5_00.png", "tree5_01.png", "tree5_02.png", "tree5_03.png"}
+};
+
+/* The images that loadImagesFromSources() loads, in the order it loads them,
+*  so that they can be decoded in parallel ahead of time.
+*/
+static void getImageSourceFilenames(vector<string> *filenames, const string &gfx_dir, const string &background_filename) {
+	filenames->push_back(gfx_dir + background_filename);
+	for(int i=0;i<N_IMAGESOURCES;i++) {
+		filenames->push_back(gfx_dir + image_source_filenames[i]);
+		if( i == IMAGESOURCE_DEFENDER_9 ) {
+			addAttackerWalkingFilenames(filenames, gfx_dir, n_epochs_c);
+		}
+	}
+	for(int i=0;i<n_trees_c;i++) {
+		for(int j=0;j<n_tree_frames_c;j++) {
+			if( tree_filenames[i][j] != NULL ) {
+				filenames->push_back(gfx_dir + tree_filenames[i][j]);
+			}
+		}
+	}
+	for(int i=0;i<n_clutter_filenames_c;i++) {
+		filenames->push_back(gfx_dir + clutter_filenames[i]);
+	}
+	for(int i=0;i<n_clutter_nuked_filenames_c;i++) {
+		filenames->push_back(gfx_dir + clutter_nuked_filenames[i]);
+	}
+}
+
 bool Game::loadImages() {
     //int time_s = clock();
 	// progress should go from 0 to 80%
 	string gfx_dir = "gfx/";
 
 #if defined(__ANDROID__)
-	background = Gigalomania::Image::loadImage(gfx_dir + "starfield.png");
+	const string background_filename = "starfield.png";
 #else
-	background = Gigalomania::Image::loadImage(gfx_dir + "starfield.jpg");
+	const string background_filename = "starfield.jpg";
 #endif
+	// n.b., only check the file exists for now, so that we don't have to decode it if we can use the image pack
+	bool found_gfx = fileExists(gfx_dir + background_filename);
 
 #ifdef DATADIR
-	if( background == NULL ) {
+	if( !found_gfx ) {
 		gfx_dir = datadir + "/" + gfx_dir;
 		LOG("look in %s for gfx\n", gfx_dir.c_str());
-		background = Gigalomania::Image::loadImage(gfx_dir + "starfield.jpg");
+		found_gfx = fileExists(gfx_dir + background_filename);
 	}
 #endif
 
@@ -2005,7 +2662,7 @@ bool Game::loadImages() {
 	std::wstring application_exe_path_s = std::wstring(application_exe_path);
 	std::wstring application_path = application_exe_path_s.substr(0, application_exe_path_s.find_last_of(L"\\/"));
 	LOG("application_install_path: %S\n", application_path.c_str());
-	if( background == NULL ) {
+	if( !found_gfx ) {
 		WCHAR old_application_path[MAX_PATH] = L"";
 		GetCurrentDirectoryW(MAX_PATH, old_application_path);
 		LOG("old_application_path: %S\n", old_application_path);
@@ -2014,9 +2671,9 @@ bool Game::loadImages() {
 		GetCurrentDirectoryW(MAX_PATH, new_application_path);
 		LOG("new_application_path: %S\n", new_application_path);
 
-		background = Gigalomania::Image::loadImage(gfx_dir + "starfield.jpg");
+		found_gfx = fileExists(gfx_dir + background_filename);
 
-		if( background == NULL ) {
+		if( !found_gfx ) {
 			// need to put it back, in case user is using "old" gfx
 			LOG("still can't find gfx data\n");
 			SetCurrentDirectoryW(old_application_path);
@@ -2024,10 +2681,35 @@ bool Game::loadImages() {
 	}
 #endif
 
-	if( background == NULL ) {
+	if( !found_gfx ) {
 		//return false;
 		return loadOldImages();
 	}
+	epoch_sprites_gfx_dir = gfx_dir;
+
+	if( loadImagePack() ) {
+		drawProgress(80);
+		return true;
+	}
+	// record the source images, so we can write the image pack once they've all been loaded
+	vector<string> image_pack_sources;
+	Gigalomania::Image::setLoadedFilenames(&image_pack_sources);
+	vector<string> prefetch_filenames;
+	getImageSourceFilenames(&prefetch_filenames, gfx_dir, background_filename);
+	Gigalomania::Image::prefetchImages(prefetch_filenames);
+	bool ok = loadImagesFromSources(gfx_dir, background_filename);
+	Gigalomania::Image::endPrefetch();
+	Gigalomania::Image::setLoadedFilenames(NULL);
+	if( ok ) {
+		saveImagePack(image_pack_sources);
+	}
+	return ok;
+}
+
+bool Game::loadImagesFromSources(const string &gfx_dir, const string &background_filename) {
+	background = Gigalomania::Image::loadImage(gfx_dir + background_filename);
+	if( background == NULL )
+		return false;
 	drawProgress(20);
 	//scale_factor = ((float)(scale_width*default_width_c))/(float)player_select->getWidth();
 	//LOG("scale factor for images = %f\n", scale_factor);
@@ -2036,11 +2718,7 @@ bool Game::loadImages() {
 	// nb, still scale if scale_factor==1, as this is a way of converting to 8bit
 	processImage(background);
 
-#if defined(__ANDROID__)
-	background_stars = Gigalomania::Image::loadImage(gfx_dir + "stars.png");
-#else
-	background_stars = Gigalomania::Image::loadImage(gfx_dir + "stars.jpg");
-#endif
+	background_stars = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_STARS]);
 	if( background_stars == NULL )
 		return false;
 	processImage(background_stars);
@@ -2048,7 +2726,7 @@ bool Game::loadImages() {
 	drawProgress(25);
 
 	Gigalomania::Image *image_slabs = NULL;
-	image_slabs = Gigalomania::Image::loadImage(gfx_dir + "slabs.png");
+	image_slabs = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_SLABS]);
 	if( image_slabs == NULL )
 		return false;
 	drawProgress(30);
@@ -2068,7 +2746,7 @@ bool Game::loadImages() {
 	delete image_slabs;
 	image_slabs = NULL;
 
-	Gigalomania::Image *player_heads_select_all = Gigalomania::Image::loadImage(gfx_dir + "player_heads_select.png");
+	Gigalomania::Image *player_heads_select_all = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_PLAYER_HEADS_SELECT]);
 	if( player_heads_select_all == NULL )
 		return false;
 	processImage(player_heads_select_all);
@@ -2077,7 +2755,7 @@ bool Game::loadImages() {
 	}
 	delete player_heads_select_all;
 
-	Gigalomania::Image *player_heads_alliance_all = Gigalomania::Image::loadImage(gfx_dir + "player_heads_alliance.png");
+	Gigalomania::Image *player_heads_alliance_all = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_PLAYER_HEADS_ALLIANCE]);
 	processImage(player_heads_alliance_all);
 	if( player_heads_alliance_all == NULL )
 		return false;
@@ -2086,7 +2764,7 @@ bool Game::loadImages() {
 	}
 	delete player_heads_alliance_all;
 
-	grave = Gigalomania::Image::loadImage(gfx_dir + "grave1.png");
+	grave = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_GRAVE]);
 	if( grave == NULL )
 		return false;
 	processImage(grave);
@@ -2108,61 +2786,11 @@ bool Game::loadImages() {
 		mine[i] = NULL;
 		factory[i] = NULL;
 	}
-	for(int i=0;i<n_epochs_c;i++) {
-		stringstream filename;
-		filename << gfx_dir << "building_tower_" << i << ".png";
-		Gigalomania::Image *temp = Gigalomania::Image::loadImage(filename.str().c_str());
-		if( temp == NULL ) {
-			return false;
-		}
-		processImage(temp);
-		//delete fortress[i];
-		//fortress[i] = temp->copy(29, 9, 62, 51);
-		fortress[i] = temp->copy(27, 9, 64, 51);
-		delete temp;
-	}
-	drawProgress(34);
-	for(int i=mine_epoch_c;i<n_epochs_c-1;i++) {
-		stringstream filename;
-		filename << gfx_dir << "building_mine_" << i << ".png";
-		Gigalomania::Image *temp = Gigalomania::Image::loadImage(filename.str().c_str());
-		if( temp == NULL ) {
-			return false;
-		}
-		processImage(temp);
-		mine[i] = temp->copy(28, 12, 66, 51);
-		delete temp;
-	}
-	drawProgress(36);
-	for(int i=factory_epoch_c;i<n_epochs_c-1;i++) {
-		stringstream filename;
-		filename << gfx_dir << "building_factory_" << i << ".png";
-		Gigalomania::Image *temp = Gigalomania::Image::loadImage(filename.str().c_str());
-		if( temp == NULL ) {
-			return false;
-		}
-		processImage(temp);
-		//factory[i] = temp->copy(24, 1, 70, 62);
-		factory[i] = temp->copy(25, 1, 68, 62);
-		delete temp;
-	}
-	drawProgress(38);
-	for(int i=lab_epoch_c;i<n_epochs_c-1;i++) {
-		stringstream filename;
-		filename << gfx_dir << "building_lab_" << i << ".png";
-		Gigalomania::Image *temp = Gigalomania::Image::loadImage(filename.str().c_str());
-		if( temp == NULL ) {
-			return false;
-		}
-		processImage(temp);
-		//lab[i] = temp->copy(28, 12, 66, 51);
-		lab[i] = temp->copy(31, 12, 52, 51);
-		delete temp;
-	}
+	// the buildings for each epoch are loaded when needed, see loadEpochSprites()
 
 	drawProgress(40);
 
-	Gigalomania::Image *icons = Gigalomania::Image::loadImage(gfx_dir + "icons.png");
+	Gigalomania::Image *icons = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_ICONS]);
 	if( icons == NULL )
 		return false;
 	/*if( !icons->scaleTo(scale_width*default_width_c) )
@@ -2170,17 +2798,11 @@ bool Game::loadImages() {
 
     // need to do flags beforehand, due to colour remapping
     icons->setScale(scale_width/scale_factor_w, scale_height/scale_factor_h); // so the copying will work at the right scale for the input image
-    for(int i=0;i<n_players_c;i++) { // different locations
-        /*for(int j=0;j<3;j++)
-            flags[i][j] = icons->copy(160 + 16*j, 144, 16, 16);
-        flags[i][3] = icons->copy(160 + 16*1, 144, 16, 16);*/
-        for(int j=0;j<4;j++)
-            flags[i][j] = icons->copy(144 + 16*j, 144, 16, 16);
-        for(int j=0;j<n_flag_frames_c;j++) {
-            int r = 0, g = 0, b = 0;
-            PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)i);
-            flags[i][j]->remap(240, 0, 0, r, g, b);
-            processImage(flags[i][j]);
+    for(int j=0;j<n_flag_frames_c;j++) {
+        Gigalomania::Image *player_images[n_players_c];
+        createPlayerImages(player_images, icons->copy(144 + 16*j, 144, 16, 16));
+        for(int i=0;i<n_players_c;i++) {
+            flags[i][j] = player_images[i];
         }
     }
 
@@ -2307,7 +2929,7 @@ bool Game::loadImages() {
 	icon_ergo = icons->copy(176, 112, 16, 16);
 	icon_trash = icons->copy(192, 112, 16, 16);
 
-	icons = Gigalomania::Image::loadImage(gfx_dir + "explosions_test4.png");
+	icons = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_EXPLOSIONS]);
 	if( icons == NULL )
 		return false;
 	drawProgress(42);
@@ -2319,7 +2941,7 @@ bool Game::loadImages() {
 		explosions[i] = icons->copy(x*w, y*h, w, h);
 	}
 
-	icons = Gigalomania::Image::loadImage(gfx_dir + "icons64.png");
+	icons = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_ICONS64]);
 	if( icons == NULL )
 		return false;
 	drawProgress(45);
@@ -2335,7 +2957,7 @@ bool Game::loadImages() {
 	arrow_right = icons->copy(96, 0, 32, 32);
 	arrow_right->scaleAlpha(0.75f);
 
-	icons = Gigalomania::Image::loadImage(gfx_dir + "font.png");
+	icons = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_FONT]);
 	if( icons == NULL )
 		return false;
 	drawProgress(48);
@@ -2411,7 +3033,7 @@ bool Game::loadImages() {
 	delete icons;
 	drawProgress(50);
 
-	icons = Gigalomania::Image::loadImage(gfx_dir + "font_large.png");
+	icons = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_FONT_LARGE]);
 	if( icons == NULL )
 		return false;
 	drawProgress(48);
@@ -2551,60 +3173,51 @@ bool Game::loadImages() {
 			for(int j=0;j<N_ATTACKER_AMMO_DIRS;j++)
 				attackers_ammo[i][j] = NULL;
 
-		Gigalomania::Image *gfx_def_image = Gigalomania::Image::loadImage(gfx_dir + "defenders.png");
+		Gigalomania::Image *gfx_def_image = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_DEFENDERS]);
 		if( gfx_def_image == NULL )
 			return false;
 		drawProgress(58);
         gfx_def_image->setScale(scale_width/scale_factor_w, scale_height/scale_factor_h); // so the copying will work at the right scale for the input image
-        for(int k=0;k<n_players_c;k++) {
-            int r = 0, g = 0, b = 0;
-            PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)k);
-            for(int i=0;i<9;i++) {
-				n_defender_frames[i] = 8;
-				ASSERT( n_defender_frames[i] <= max_defender_frames_c );
-				for(int j=0;j<n_defender_frames[i];j++) {
-					defenders[k][i][j] = gfx_def_image->copy(16*i, 0, 16, 16);
-                    defenders[k][i][j]->remap(240, 0, 0, r, g, b);
-                    processImage(defenders[k][i][j]);
+        for(int i=0;i<9;i++) {
+			n_defender_frames[i] = 8;
+			ASSERT( n_defender_frames[i] <= max_defender_frames_c );
+			for(int j=0;j<n_defender_frames[i];j++) {
+				Gigalomania::Image *player_images[n_players_c];
+				createPlayerImages(player_images, gfx_def_image->copy(16*i, 0, 16, 16));
+				for(int k=0;k<n_players_c;k++) {
+					defenders[k][i][j] = player_images[k];
 					if( i == 8 ) {
 						defenders[k][i][j]->setOffset(-1, 0);
 					}
-                }
+				}
 			}
 		}
 		delete gfx_def_image;
 
-		gfx_def_image = Gigalomania::Image::loadImage(gfx_dir + "defender_9.png");
+		gfx_def_image = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_DEFENDER_9]);
 		if( gfx_def_image == NULL )
 			return false;
         gfx_def_image->setScale(scale_width/scale_factor_w, scale_height/scale_factor_h); // so the copying will work at the right scale for the input image
-        for(int k=0;k<n_players_c;k++) {
-            int r = 0, g = 0, b = 0;
-            PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)k);
-			n_defender_frames[9] = 11;
-			ASSERT( n_defender_frames[9] <= max_defender_frames_c );
-			for(int j=0;j<n_defender_frames[9];j++) {
-				//defenders[k][9][j] = gfx_def_image->copy(16*j, 0, 16, 16);
-				defenders[k][9][j] = gfx_def_image->copy(32*j+8, 9, 16, 18);
-                defenders[k][9][j]->remap(240, 0, 0, r, g, b);
-                processImage(defenders[k][9][j]);
+		n_defender_frames[9] = 11;
+		ASSERT( n_defender_frames[9] <= max_defender_frames_c );
+		for(int j=0;j<n_defender_frames[9];j++) {
+			Gigalomania::Image *player_images[n_players_c];
+			//createPlayerImages(player_images, gfx_def_image->copy(16*j, 0, 16, 16));
+			createPlayerImages(player_images, gfx_def_image->copy(32*j+8, 9, 16, 18));
+			for(int k=0;k<n_players_c;k++) {
+				defenders[k][9][j] = player_images[k];
 				defenders[k][9][j]->setOffset(0, -4);
-            }
-		}
-		delete gfx_def_image;
-
-		for(int i=0;i<=5;i++) {
-			if( !loadAttackersWalkingImages(gfx_dir, i) ) {
-				return false;
 			}
 		}
+		delete gfx_def_image;
 
+		// the armed attackers are loaded when needed, see loadEpochSprites()
 		if( !loadAttackersWalkingImages(gfx_dir, n_epochs_c) ) {
 			return false;
 		}
 		drawProgress(60);
 
-		Gigalomania::Image *gfx_planes = Gigalomania::Image::loadImage(gfx_dir + "attacker_flying.png");
+		Gigalomania::Image *gfx_planes = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_ATTACKER_FLYING]);
 		if( gfx_planes == NULL )
 			return false;
 		drawProgress(62);
@@ -2612,26 +3225,21 @@ bool Game::loadImages() {
 		return false;*/
         gfx_planes->setScale(scale_width/scale_factor_w, scale_height/scale_factor_h); // so the copying will work at the right scale for the input image
         // do remapping before scaling
-        for(int i=0;i<n_players_c;i++) {
-            int r = 0, g = 0, b = 0;
-            PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)i);
-            for(int j=0;j<n_saucer_frames_c;j++) {
-                saucers[i][j] = gfx_planes->copy(32*j, 64, 32, 32);
-                saucers[i][j]->remap(240, 0, 0, r, g, b);
-                processImage(saucers[i][j]);
+        for(int j=0;j<n_saucer_frames_c;j++) {
+            Gigalomania::Image *player_images[n_players_c];
+            createPlayerImages(player_images, gfx_planes->copy(32*j, 64, 32, 32));
+            for(int i=0;i<n_players_c;i++) {
+                saucers[i][j] = player_images[i];
             }
         }
         // do remapping before scaling
-		for(int i=0;i<n_players_c;i++) {
+		for(int j=0;j<2;j++) {
 			//nukes[i][0] = gfx_planes->copy(64*i, 32, 32, 32);
 			//nukes[i][1] = gfx_planes->copy(64*i+32, 32, 32, 32);
-			nukes[i][0] = gfx_planes->copy(0, 32, 32, 32);
-			nukes[i][1] = gfx_planes->copy(32, 32, 32, 32);
-			int r = 0, g = 0, b = 0;
-			PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)i);
-			for(int j=0;j<2;j++) {
-				nukes[i][j]->remap(240, 0, 0, r, g, b);
-                processImage(nukes[i][j]);
+			Gigalomania::Image *player_images[n_players_c];
+			createPlayerImages(player_images, gfx_planes->copy(32*j, 32, 32, 32));
+			for(int i=0;i<n_players_c;i++) {
+				nukes[i][j] = player_images[i];
 			}
 		}
 		// now remap
@@ -2644,7 +3252,7 @@ bool Game::loadImages() {
 		}
 		delete gfx_planes;
 
-		Gigalomania::Image *gfx_ammo = Gigalomania::Image::loadImage(gfx_dir + "attacker_ammo.png");
+		Gigalomania::Image *gfx_ammo = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_ATTACKER_AMMO]);
 		if( gfx_ammo == NULL )
 			return false;
 		drawProgress(65);
@@ -2672,44 +3280,10 @@ bool Game::loadImages() {
 		attackers_ammo[7][ATTACKER_AMMO_BOMB] = attackers_ammo[6][ATTACKER_AMMO_BOMB];
 		attackers_ammo[9][ATTACKER_AMMO_BOMB] = Gigalomania::Image::createRadial((int)(scale_width * 16), (int)(scale_height * 16), 1.0f, 0, 255, 255);
 		processImage(attackers_ammo[9][ATTACKER_AMMO_BOMB]);
-
-        for(int i=0;i<=n_epochs_c;i++) {
-            if( i == 6 || i == 7 || i == 8 || i == 9 )
-                continue;
-			for(int player=0;player<n_players_c;player++) {
-				for(int dir=0;dir<n_attacker_directions_c;dir++) {
-					int n_frames = n_attacker_frames[i][dir];
-					for(int frame=0;frame<n_frames;frame++) {
-						int r = 0, g = 0, b = 0;
-						PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)player);
-						ASSERT(attackers_walking[player][i][dir][frame] != NULL);
-						attackers_walking[player][i][dir][frame]->remap(240, 0, 0, r, g, b);
-					}
-				}
-			}
-        }
-        for(int i=0;i<n_saucer_frames_c;i++) {
-            for(int k=0;k<n_players_c;k++) {
-                int r = 0, g = 0, b = 0;
-                PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)k);
-                saucers[k][i]->remap(240, 0, 0, r, g, b);
-            }
-        }
-        for(int i=0;i<n_epochs_c;i++) {
-            if( defenders[0][i][0] == NULL )
-                continue;
-            for(int j=0;j<n_defender_frames[i];j++) {
-                for(int k=0;k<n_players_c;k++) {
-                    int r = 0, g = 0, b = 0;
-                    PlayerType::getColour(&r, &g, &b, (PlayerType::PlayerTypeID)k);
-                    defenders[k][i][j]->remap(240, 0, 0, r, g, b);
-                }
-            }
-        }
     }
 
 	// features
-	Gigalomania::Image *gfx_features = Gigalomania::Image::loadImage(gfx_dir + "features.png");
+	Gigalomania::Image *gfx_features = Gigalomania::Image::loadImage(gfx_dir + image_source_filenames[IMAGESOURCE_FEATURES]);
 	if( gfx_features == NULL )
 		return false;
 	/*if( !gfx_features->scaleTo(scale_width*default_width_c) )
@@ -2717,27 +3291,16 @@ bool Game::loadImages() {
 	processImage(gfx_features);
 	icon_openpitmine = gfx_features->copy(0, 0, 47, 24);
 
-	icon_trees[0][0] = Gigalomania::Image::loadImage(gfx_dir + "tree2_00.png");
-	icon_trees[0][1] = Gigalomania::Image::loadImage(gfx_dir + "tree2_01.png");
-	icon_trees[0][2] = Gigalomania::Image::loadImage(gfx_dir + "tree2_02.png");
-	icon_trees[0][3] = Gigalomania::Image::loadImage(gfx_dir + "tree2_03.png");
-
-	icon_trees[1][0] = Gigalomania::Image::loadImage(gfx_dir + "tree3_00.png");
-	icon_trees[1][1] = Gigalomania::Image::loadImage(gfx_dir + "tree3_01.png");
-	icon_trees[1][2] = Gigalomania::Image::loadImage(gfx_dir + "tree3_02.png");
-	icon_trees[1][3] = Gigalomania::Image::loadImage(gfx_dir + "tree3_03.png");
-
 	// [2][] is the nuked tree image
-	icon_trees[2][0] = Gigalomania::Image::loadImage(gfx_dir + "deadtree1_00.png");
-	for(int j=1;j<n_tree_frames_c;j++) {
-		icon_trees[2][j] = icon_trees[2][0]->copy(); // no animation for nuked tree
+	for(int i=0;i<n_trees_c;i++) {
+		for(int j=0;j<n_tree_frames_c;j++) {
+			if( tree_filenames[i][j] != NULL )
+				icon_trees[i][j] = Gigalomania::Image::loadImage(gfx_dir + tree_filenames[i][j]);
+			else
+				icon_trees[i][j] = icon_trees[i][0] == NULL ? NULL : icon_trees[i][0]->copy();
+		}
 	}
 
-	icon_trees[3][0] = Gigalomania::Image::loadImage(gfx_dir + "tree5_00.png");
-	icon_trees[3][1] = Gigalomania::Image::loadImage(gfx_dir + "tree5_01.png");
-	icon_trees[3][2] = Gigalomania::Image::loadImage(gfx_dir + "tree5_02.png");
-	icon_trees[3][3] = Gigalomania::Image::loadImage(gfx_dir + "tree5_03.png");
-
 	for(int i=0;i<n_trees_c;i++) {
 		for(int j=0;j<n_tree_frames_c;j++) {
 			if( icon_trees[i][j] == NULL )
@@ -2746,29 +3309,17 @@ bool Game::loadImages() {
 		}
 	}
 
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "boulders.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "boulders2.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "bigboulder.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "rocks.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "plant.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "grass.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "grasses01.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "grasses02.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "grasses04.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "grasses05.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "shrub2-01.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "swirl01.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "weed01.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "weed02.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "weed03.png"));
-	icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + "weed04.png"));
+	for(int i=0;i<n_clutter_filenames_c;i++) {
+		icon_clutter.push_back(Gigalomania::Image::loadImage(gfx_dir + clutter_filenames[i]));
+	}
 	for(size_t i=0;i<icon_clutter.size();i++) {
 		if( icon_clutter[i] == NULL )
 			return false;
 		processImage(icon_clutter[i]);
 	}
-	icon_clutter_nuked.push_back(Gigalomania::Image::loadImage(gfx_dir + "bones.png"));
-	icon_clutter_nuked.push_back(Gigalomania::Image::loadImage(gfx_dir + "skulls.png"));
+	for(int i=0;i<n_clutter_nuked_filenames_c;i++) {
+		icon_clutter_nuked.push_back(Gigalomania::Image::loadImage(gfx_dir + clutter_nuked_filenames[i]));
+	}
 	for(size_t i=0;i<icon_clutter_nuked.size();i++) {
 		if( icon_clutter_nuked[i] == NULL )
 			return false;
@@ -3064,13 +3615,11 @@ bool Game::openScreen(bool fullscreen) {
 	return true;
 }
 
-bool Game::readMapProcessLine(int *epoch, int *index, Map **l_map, char *line, const int MAX_LINE, const char *filename) {
+bool Game::readMapProcessLine(int *epoch, int *index, Map **l_map, int *sec_x, int *sec_y, TextToken line, const char *filename) {
 	bool ok = true;
-	line[ strlen(line) - 1 ] = '\0'; // trim new line
-	line[ strlen(line) - 1 ] = '\0'; // trim carriage return
-	//LOG("line: %s\n", line);
+	//LOG("line: %s\n", line.toString().c_str());
 	if( *l_map == NULL ) {
-		if( line[0] != '#' ) {
+		if( line.empty() || line.str[0] != '#' ) {
 			LOG("expected first character to be '#'\n");
 			ok = false;
 			return ok;
@@ -3080,64 +3629,63 @@ bool Game::readMapProcessLine(int *epoch, int *index, Map **l_map, char *line, c
 		int n_opponents = -1;
 		//char colname[MAX_LINE+1] = "";
 
-		char *ptr = strtok(&line[1], " ");
-		if( ptr == NULL ) {
+		line.str++;
+		line.length--;
+		TextToken ptr;
+		if( !line.nextToken(&ptr) ) {
 			LOG("can't find map name\n");
 			ok = false;
 			return ok;
 		}
 		//strcpy(name, ptr);
-		string name = ptr;
+		string name = ptr.toString();
 
-		ptr = strtok(NULL, " ");
-		if( ptr == NULL ) {
+		if( !line.nextToken(&ptr) ) {
 			LOG("can't find epoch\n");
 			ok = false;
 			return ok;
 		}
-		*epoch = atoi(ptr);
+		*epoch = ptr.toInt();
 
-		ptr = strtok(NULL, " ");
-		if( ptr == NULL ) {
+		if( !line.nextToken(&ptr) ) {
 			LOG("can't find n_opponents\n");
 			ok = false;
 			return ok;
 		}
-		n_opponents = atoi(ptr);
+		n_opponents = ptr.toInt();
 
-		ptr = strtok(NULL, " ");
-		if( ptr == NULL ) {
+		if( !line.nextToken(&ptr) ) {
 			LOG("can't find colour name\n");
 			ok = false;
 			return ok;
 		}
 		//strcpy(colname, ptr);
-		string colname = ptr;
+		const TextToken &colname = ptr;
 
 		MapColour map_colour = MAP_UNDEFINED_COL;
-		if( strcmp(colname.c_str(), "ORANGE") == 0 ) {
+		if( colname.equals("ORANGE") ) {
 			map_colour = MAP_ORANGE;
 		}
-		else if( strcmp(colname.c_str(), "GREEN") == 0 ) {
+		else if( colname.equals("GREEN") ) {
 			map_colour = MAP_GREEN;
 		}
-		else if( strcmp(colname.c_str(), "BROWN") == 0 ) {
+		else if( colname.equals("BROWN") ) {
 			map_colour = MAP_BROWN;
 		}
-		else if( strcmp(colname.c_str(), "WHITE") == 0 ) {
+		else if( colname.equals("WHITE") ) {
 			map_colour = MAP_WHITE;
 		}
-		else if( strcmp(colname.c_str(), "DBROWN") == 0 ) {
+		else if( colname.equals("DBROWN") ) {
 			map_colour = MAP_DBROWN;
 		}
-		else if( strcmp(colname.c_str(), "DGREEN") == 0 ) {
+		else if( colname.equals("DGREEN") ) {
 			map_colour = MAP_DGREEN;
 		}
-		else if( strcmp(colname.c_str(), "GREY") == 0 ) {
+		else if( colname.equals("GREY") ) {
 			map_colour = MAP_GREY;
 		}
 		else {
-			LOG("unknown map colour: %s\n", colname.c_str());
+			LOG("unknown map colour: %s\n", colname.toString().c_str());
 			ok = false;
 			return ok;
 		}
@@ -3154,152 +3702,112 @@ bool Game::readMapProcessLine(int *epoch, int *index, Map **l_map, char *line, c
 		(*l_map)->setFilename(filename);
 	}
 	else {
-		char *line_ptr = line;
-		while( *line_ptr == ' ' || *line_ptr == '\t' )
-			line_ptr++;
-		char *ptr = strtok(line_ptr, " ");
-		if( ptr == NULL ) {
+		TextToken ptr;
+		if( !line.nextToken(&ptr) ) {
 			LOG("can't find first word\n");
 			ok = false;
 			return ok;
 		}
-		else if( strcmp(ptr, "SECTOR") == 0 ) {
-			ptr = strtok(NULL, " ");
-			if( ptr == NULL ) {
+		else if( ptr.equals("SECTOR") ) {
+			if( !line.nextToken(&ptr) ) {
 				LOG("can't find sec_x\n");
 				ok = false;
 				return ok;
 			}
-			int sec_x = atoi(ptr);
-			if( sec_x < 0 || sec_x >= map_width_c ) {
-				LOG("invalid map x %d\n", sec_x);
+			*sec_x = ptr.toInt();
+			if( *sec_x < 0 || *sec_x >= map_width_c ) {
+				LOG("invalid map x %d\n", *sec_x);
 				ok = false;
 				return ok;
 			}
 
-			ptr = strtok(NULL, " ");
-			if( ptr == NULL ) {
+			if( !line.nextToken(&ptr) ) {
 				LOG("can't find sec_y\n");
 				ok = false;
 				return ok;
 			}
-			int sec_y = atoi(ptr);
-			if( sec_y < 0 || sec_y >= map_height_c ) {
-				LOG("invalid map y %d\n", sec_y);
+			*sec_y = ptr.toInt();
+			if( *sec_y < 0 || *sec_y >= map_height_c ) {
+				LOG("invalid map y %d\n", *sec_y);
 				ok = false;
 				return ok;
 			}
-			(*l_map)->newSquareAt(sec_x, sec_y);
-		}
-		else if( strcmp(ptr, "ELEMENT") == 0 ) {
-			// ignore for now
-		}
-		else if( ptr[0] == '#' ) {
-			// this line is a comment
-		}
-		else {
-			LOG("unknown word: %s\n", ptr);
-			ok = false;
-			return ok;
+			(*l_map)->newSquareAt(*sec_x, *sec_y);
 		}
-	}
-	return ok;
-}
-
-bool Game::readLineFromRWOps(bool &ok, SDL_RWops *file, char *buffer, char *line, int MAX_LINE, int &buffer_offset, int &newline_index, bool &reached_end) {
-	if( newline_index > 1 ) {
-		// not safe to use strcpy on overlapping strings (undefined behaviour)
-		int len = strlen(&buffer[newline_index-1]);
-		memmove(buffer, &buffer[newline_index-1], len);
-		buffer[len] = '\0';
-		if( reached_end && buffer[0] == '\0' ) {
-			return true;
-		}
-		buffer_offset = MAX_LINE - (newline_index-1);
-	}
-	if( !reached_end ) {
-		// fill up buffer
-		for(;;) {
-			int n_read = file->read(file, &buffer[buffer_offset], 1, MAX_LINE-buffer_offset);
-			//LOG("buffer offset %d , read %d\n", buffer_offset, n_read);
-			if( n_read == 0 ) {
-				// error or eof - don't quit yet, still need to finish reading buffer
-				//LOG("read all of file\n");
-				reached_end = true;
-				break;
-			}
-			else {
-				buffer[buffer_offset+n_read] = '\0';
-				if( n_read < MAX_LINE-buffer_offset ) {
-					// we didn't read all of the available buffer, and haven't reached end of file yet
-					buffer_offset += n_read;
-				}
-				else {
-					break;
+		else if( ptr.equals("ELEMENT") ) {
+			if( *sec_x == -1 || *sec_y == -1 ) {
+				LOG("sector not defined\n");
+				ok = false;
+				return ok;
+			}
+			if( !line.nextToken(&ptr) ) {
+				LOG("can't find element name\n");
+				ok = false;
+				return ok;
+			}
+			const TextToken elementname = ptr;
+
+			if( !line.nextToken(&ptr) ) {
+				LOG("can't find n_elements\n");
+				ok = false;
+				return ok;
+			}
+			int n_elements = ptr.toInt();
+
+			Id element = UNDEFINED;
+			for(int i=0;i<N_ID;i++) {
+				if( elementname.equals( elements[i]->getName() ) ) {
+					element = (Id)i;
 				}
 			}
+			if( element == UNDEFINED ) {
+				LOG("unknown element: %s\n", elementname.toString().c_str());
+				ok = false;
+				return ok;
+			}
+
+			(*l_map)->setElements(*sec_x, *sec_y, element, n_elements);
+		}
+		else if( ptr.str[0] == '#' ) {
+			// this line is a comment
+		}
+		else {
+			LOG("unknown word: %s\n", ptr.toString().c_str());
+			ok = false;
+			return ok;
 		}
 	}
-	//LOG("buffer: %s\n", buffer);
-	newline_index = 0;
-	while( buffer[newline_index] != '\n' && buffer[newline_index] != '\0' ) {
-		line[newline_index] = buffer[newline_index];
-		newline_index++;
-	}
-	if( buffer[newline_index] == '\0' ) {
-		LOG("file has too long line\n");
-		ok = false;
-		return true;
-	}
-	line[newline_index++] = '\n';
-	line[newline_index++] = '\0';
-	return false;
+	return ok;
 }
 
 bool Game::readMap(const char *filename) {
 	//LOG("readMap: %s\n", filename); // disabled logging to improve performance on startup
 	bool ok = true;
-	const int MAX_LINE = 4096;
-	//const int MAX_LINE = 64;
-	char line[MAX_LINE+1] = "";
 	Map *l_map = NULL;
 	int epoch = -1;
 	int index = -1;
+	int sec_x = -1, sec_y = -1;
 
     char fullname[4096] = "";
 	sprintf(fullname, "%s/%s", maps_dirname.c_str(), filename);
-	// open in binary mode, so that we parse files in an OS-independent manner
-	// (otherwise, Windows will parse "\r\n" as being "\n", but Linux will still read it as "\n")
-	//FILE *file = fopen(fullname, "rb");
-	SDL_RWops *file = SDL_RWFromFile(fullname, "rb");
+	TextReader file;
+	bool opened = file.open(fullname);
 #ifdef DATADIR
-	if( file == NULL ) {
+	if( !opened ) {
 		LOG("searching in %s for islands\n", alt_maps_dirname.c_str());
 		sprintf(fullname, "%s/%s", alt_maps_dirname.c_str(), filename);
-		file = SDL_RWFromFile(fullname, "rb");
+		opened = file.open(fullname);
 	}
 #endif
-    if( file == NULL ) {
+    if( !opened ) {
 		LOG("failed to open file: %s\n", fullname);
 		return false;
 	}
-	char buffer[MAX_LINE+1] = "";
-	int buffer_offset = 0;
-	bool reached_end = false;
-	int newline_index = 0;
-	while( ok ) {
-		bool done = readLineFromRWOps(ok, file, buffer, line, MAX_LINE, buffer_offset, newline_index, reached_end);
-		if( !ok )  {
-			LOG("failed to read line for: %s\n", filename);
-		}
-		else if( done ) {
-			break;
-		}
-		else {
-			ok = readMapProcessLine(&epoch, &index, &l_map, line, MAX_LINE, filename);
-		}
+	TextToken line;
+	while( ok && file.readLine(&line) ) {
+		ok = readMapProcessLine(&epoch, &index, &l_map, &sec_x, &sec_y, line, filename);
 	}
-	file->close(file);
+	file.close();
 
 	if( !ok && l_map != NULL ) {
 		LOG("delete map that was created\n");
@@ -3432,9 +3940,14 @@ void Game::disposeGameState() {
 	gamestate = NULL;
 }
 
-void Game::setGameStateID(GameStateID state, GameState *new_gamestate) {
+bool Game::setGameStateID(GameStateID state, GameState *new_gamestate) {
 	LOG("setGameStateID(%d, %d)\n", state, new_gamestate);
 	LOG("old gameStateID was %d\n", gameStateID);
+	if( state == GAMESTATEID_PLAYING && new_gamestate == NULL && !requireEpochSprites() ) {
+		// (a loaded gamestate has already loaded them)
+		LOG("failed to load the sprites for this island\n");
+		return false; // the current gamestate is left as it was
+	}
 	gameStateID = state;
 	playMusic();
 
@@ -3497,6 +4010,7 @@ void Game::setGameStateID(GameStateID state, GameState *new_gamestate) {
 		Sector *start_sector = map->getSector(map_x, map_y);
 		start_sector->cheat(human_player);
 	}*/
+	return true;
 }
 
 void Game::setupTutorial(const string &id) {
@@ -3504,13 +4018,23 @@ void Game::setupTutorial(const string &id) {
 	tutorial = TutorialManager::setupTutorial(id);
 }
 
+void Game::cancelTutorial() {
+	// for when the tutorial's island couldn't be started
+	delete tutorial;
+	tutorial = NULL;
+}
+
 void Game::startIsland() {
 	ASSERT(gameStateID == GAMESTATEID_PLACEMEN);
 	/*int map_x = static_cast<PlaceMenGameState *>(gamestate)->getStartMapX();
 	int map_y = static_cast<PlaceMenGameState *>(gamestate)->getStartMapY();*/
 
 	//setupPlayers();
-	setGameStateID(GAMESTATEID_PLAYING);
+	if( !setGameStateID(GAMESTATEID_PLAYING) ) {
+		gamestate->fadeScreen(false, 0, NULL);
+		addTextEffect(new TextEffect("failed to load the island", default_width_c/2, default_height_c/2, 3000));
+		return;
+	}
 	gamestate->fadeScreen(false, 0, NULL);
 	gameResult = GAMERESULT_UNDEFINED;
 }
@@ -3696,6 +4220,21 @@ bool Game::isPaused() const {
 	return paused;
 }
 
+/* Returns true if nothing on screen will change until there's input, so the main loop needn't redraw at the full frame rate.
+*/
+bool Game::isIdle() const {
+	if( screen == NULL ) {
+		return false;
+	}
+	int m_x = 0, m_y = 0;
+	bool m_left = false, m_middle = false, m_right = false;
+	if( screen->getMouseState(&m_x, &m_y, &m_left, &m_middle, &m_right) ) {
+		// holding a mouse button down repeats the click
+		return false;
+	}
+	return gamestate != NULL && gamestate->isIdle();
+}
+
 void Game::setTimeRate(int time_rate) {
 	this->time_rate = time_rate;
 	LOG("time_rate = %d\n", time_rate);
@@ -3773,75 +4312,106 @@ void Game::saveState() const {
 	else if( gameType == GAMETYPE_TUTORIAL && gameStateID == GAMESTATEID_ENDISLAND ) {
 		// no need to save state (and don't want to, otherwise this will resume to the islands screen instead the main menu)
 	}
+	else if( gameMode == GAMEMODE_MULTIPLAYER_CLIENT ) {
+		// the game belongs to the server
+	}
 	else {
-		stringstream stream;
-		const int savegame_version_c = 1;
-		stream << "<?xml version=\"1.0\" ?>\n";
-		stream << "<savegame major=\"" << majorVersion << "\" minor=\"" << minorVersion << "\" savegame_version=\"" << savegame_version_c << "\">\n"; // don't write patchVersion, as save games should not break compatibility between a patch version
-		stream << "<global ";
-		stream << "game_type=\"" << gameType << "\" ";
-		stream << "difficulty_level=\"" << difficulty_level << "\" ";
-		stream << "human_player=\"" << human_player << "\" ";
-		stream << "n_men_store=\"" << n_men_store << "\" ";
-		stream << "n_player_suspended=\"" << n_player_suspended << "\" ";
-		stream << "start_epoch=\"" << start_epoch << "\" ";
-		stream << "selected_island=\"" << selected_island << "\" ";
-		stream << "/>\n";
-
-		stream << "<time real_time=\"" << getRealTime() << "\" game_time=\"" << getGameTime() << "\" />\n";
-
-		for(int i=0;i<max_islands_per_epoch_c;i++) {
-			stream << "<completed_island island_id=\"" << i << "\" complete=\"" << (completed_island[i] ? 1 : 0) << "\"/>\n";
+		// the autosave uses the compact binary format, streamed to the file
+		const char *save_fullfilename = getApplicationFilename(autosave_filename, autosave_survive_uninstall);
+		FileSaveSink sink(save_fullfilename);
+		if( sink.isOpen() ) {
+			BinarySaveWriter writer(&sink);
+			writeState(writer);
+			if( !writer.isOk() || !sink.commit() ) {
+				LOG("failed to write saved state: %s\n", save_fullfilename);
+			}
 		}
+		delete [] save_fullfilename;
+#ifdef _DEBUG
+		// also write a readable copy, for debugging
+		const char *xml_fullfilename = getApplicationFilename(autosave_xml_filename, autosave_survive_uninstall);
+		exportStateXML(xml_fullfilename);
+		delete [] xml_fullfilename;
+#endif
+	}
+}
 
-		gamestate->saveState(stream);
+void Game::writeState(SaveWriter &writer) const {
+	writeState(writer, human_player);
+}
 
-	    stream << "</savegame>\n";
+void Game::writeState(SaveWriter &writer, int client_player) const {
+	const int savegame_version_c = 1;
+	writer.startElement("savegame");
+	writer.addAttribute("major", majorVersion);
+	writer.addAttribute("minor", minorVersion);
+	writer.addAttribute("savegame_version", savegame_version_c);
+	// don't write patchVersion, as save games should not break compatibility between a patch version
+	writer.startElement("global");
+	writer.addAttribute("game_type", gameType);
+	writer.addAttribute("difficulty_level", difficulty_level);
+	writer.addAttribute("human_player", client_player);
+	writer.addAttribute("n_men_store", n_men_store);
+	writer.addAttribute("n_player_suspended", n_player_suspended);
+	writer.addAttribute("start_epoch", start_epoch);
+	writer.addAttribute("selected_island", selected_island);
+	writer.endElement();
+
+	writer.startElement("time");
+	writer.addAttribute("real_time", getRealTime());
+	writer.addAttribute("game_time", getGameTime());
+	writer.endElement();
 
-		const char *save_fullfilename = getApplicationFilename(autosave_filename, autosave_survive_uninstall);
-		SDL_RWops *file = SDL_RWFromFile(save_fullfilename, "w+");
-		if( file == NULL ) {
-			LOG("failed to open: %s\n", save_fullfilename);
-			LOG("error: %s\n", SDL_GetError());
-		}
-		else {
-			size_t length = stream.str().length();
-			char *ptr = new char[length];
-			stream.read(ptr, length);
-			file->write(file, ptr, length, 1);
-			file->close(file);
-		}
-		delete [] save_fullfilename;
+	for(int i=0;i<max_islands_per_epoch_c;i++) {
+		writer.startElement("completed_island");
+		writer.addAttribute("island_id", i);
+		writer.addAttribute("complete", completed_island[i] ? 1 : 0);
+		writer.endElement();
 	}
+
+	gamestate->saveState(writer);
+
+	writer.endElement();
+	writer.finish();
 }
 
-GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
+bool Game::exportStateXML(const char *filename) const {
+	// n.b., XML saves can still be loaded, by renaming to the autosave filename
+	FileSaveSink sink(filename);
+	if( !sink.isOpen() ) {
+		return false;
+	}
+	XMLSaveWriter writer(&sink);
+	writeState(writer);
+	return writer.isOk() && sink.commit();
+}
+
+GameState *Game::loadStateParseXMLNode(SaveNode *parent) {
 	if( parent == NULL ) {
 		return NULL;
 	}
 	bool read_children = true;
 	GameState *new_gamestate = NULL;
 
-	switch( parent->Type() ) {
-		case TiXmlNode::TINYXML_DOCUMENT:
+	switch( parent->getType() ) {
+		case SaveNode::SAVENODE_DOCUMENT:
 			break;
-		case TiXmlNode::TINYXML_ELEMENT:
+		case SaveNode::SAVENODE_ELEMENT:
 			{
-				const char *element_name = parent->Value();
-				const TiXmlElement *element = parent->ToElement();
-				const TiXmlAttribute *attribute = element->FirstAttribute();
+				const char *element_name = parent->getName();
+				const SaveAttribute *attribute = parent->getFirstAttribute();
 				if( strcmp(element_name, "savegame") == 0 ) {
 					int save_major = -1, save_minor = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "major") == 0 ) {
-							save_major = static_cast<DifficultyLevel>(atoi(attribute->Value()));
+							save_major = static_cast<DifficultyLevel>(attribute->getIntValue());
 						}
 						else if( strcmp(attribute_name, "minor") == 0 ) {
-							save_minor = static_cast<DifficultyLevel>(atoi(attribute->Value()));
+							save_minor = static_cast<DifficultyLevel>(attribute->getIntValue());
 						}
 						else if( strcmp(attribute_name, "savegame_version") == 0 ) {
-							int savegame_version = static_cast<DifficultyLevel>(atoi(attribute->Value()));
+							int savegame_version = static_cast<DifficultyLevel>(attribute->getIntValue());
 							LOG("save game version %d\n", savegame_version);
 						}
 						else {
@@ -3849,7 +4419,7 @@ GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
 							LOG("unknown game/savegame attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					LOG("saved game version %d.%d\n", save_major, save_minor);
 					LOG("current game version %d.%d\n", majorVersion, minorVersion);
@@ -3858,39 +4428,39 @@ GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
 					bool set_start_epoch = false;
 					bool set_start_island = false;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "game_type") == 0 ) {
-							gameType = static_cast<GameType>(atoi(attribute->Value()));
+							gameType = static_cast<GameType>(attribute->getIntValue());
 							if( gameType != GAMETYPE_SINGLEISLAND && gameType != GAMETYPE_ALLISLANDS && gameType != GAMETYPE_TUTORIAL ) {
 								throw std::runtime_error("unknown game_type");
 							}
 						}
 						else if( strcmp(attribute_name, "difficulty_level") == 0 ) {
-							difficulty_level = static_cast<DifficultyLevel>(atoi(attribute->Value()));
+							difficulty_level = static_cast<DifficultyLevel>(attribute->getIntValue());
 							if( difficulty_level < 0 || difficulty_level >= DIFFICULTY_N_LEVELS ) {
 								throw std::runtime_error("invalid difficulty_level");
 							}
 						}
 						else if( strcmp(attribute_name, "human_player") == 0 ) {
-							human_player = atoi(attribute->Value());
+							human_player = attribute->getIntValue();
 							if( human_player < 0 || selected_island >= n_players_c ) {
 								throw std::runtime_error("invalid human_player");
 							}
 						}
 						else if( strcmp(attribute_name, "n_men_store") == 0 ) {
-							n_men_store = atoi(attribute->Value());
+							n_men_store = attribute->getIntValue();
 							if( n_men_store < 0 ) {
 								throw std::runtime_error("invalid n_men_store");
 							}
 						}
 						else if( strcmp(attribute_name, "n_player_suspended") == 0 ) {
-							n_player_suspended = atoi(attribute->Value());
+							n_player_suspended = attribute->getIntValue();
 							if( n_player_suspended < 0 ) {
 								throw std::runtime_error("invalid n_player_suspended");
 							}
 						}
 						else if( strcmp(attribute_name, "start_epoch") == 0 ) {
-							start_epoch = atoi(attribute->Value());
+							start_epoch = attribute->getIntValue();
 							if( start_epoch < 0 || start_epoch >= n_epochs_c ) {
 								throw std::runtime_error("invalid start_epoch");
 							}
@@ -3898,7 +4468,7 @@ GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
 							set_start_epoch = true;
 						}
 						else if( strcmp(attribute_name, "selected_island") == 0 ) {
-							selected_island = atoi(attribute->Value());
+							selected_island = attribute->getIntValue();
 							if( selected_island < 0 || selected_island >= max_islands_per_epoch_c ) {
 								throw std::runtime_error("invalid selected_island");
 							}
@@ -3909,7 +4479,7 @@ GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
 							LOG("unknown game/global attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( set_start_epoch && set_start_island ) {
 						map = maps[start_epoch][selected_island];
@@ -3922,22 +4492,22 @@ GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
 					int island_id = -1;
 					bool complete = false;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "island_id") == 0 ) {
-							island_id = atoi(attribute->Value());
+							island_id = attribute->getIntValue();
 							if( island_id < 0 || island_id >= max_islands_per_epoch_c ) {
 								throw std::runtime_error("completed_island invalid island_id");
 							}
 						}
 						else if( strcmp(attribute_name, "complete") == 0 ) {
-							complete = atoi(attribute->Value())==1;
+							complete = attribute->getIntValue()==1;
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown game/completed_island attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( island_id == -1 ) {
 						throw std::runtime_error("completed_island missing island_id");
@@ -3947,13 +4517,13 @@ GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
 				else if( strcmp(element_name, "time") == 0 ) {
 					// we need to set this at the Game level rather than the PlayingGamestate, so that the times are set before creating the map (otherwise messes up the saved times for the particle systems)
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "real_time") == 0 ) {
-							int real_time = atoi(attribute->Value());
+							int real_time = attribute->getIntValue();
 							setRealTime(real_time);
 						}
 						else if( strcmp(attribute_name, "game_time") == 0 ) {
-							int game_time = atoi(attribute->Value());
+							int game_time = attribute->getIntValue();
 							setGameTime(game_time);
 						}
 						else {
@@ -3961,7 +4531,7 @@ GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
 							LOG("unknown game/time attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 				}
 				else if( strcmp(element_name, "playing_gamestate") == 0 ) {
@@ -3970,6 +4540,9 @@ GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
 						if( map == NULL ) {
 							throw std::runtime_error("playing_gamestate map not yet set");
 						}
+						if( !requireEpochSprites() ) {
+							throw std::runtime_error("failed to load epoch sprites");
+						}
 						map->createSectors(playing_gamestate, start_epoch);
 						playing_gamestate->loadStateParseXMLNode(parent);
 						if( gameType == GAMETYPE_TUTORIAL ) {
@@ -3994,17 +4567,9 @@ GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
 				}
 			}
 			break;
-		case TiXmlNode::TINYXML_COMMENT:
-			break;
-		case TiXmlNode::TINYXML_UNKNOWN:
-			break;
-		case TiXmlNode::TINYXML_TEXT:
-			break;
-		case TiXmlNode::TINYXML_DECLARATION:
-			break;
 	}
 
-	for(const TiXmlNode *child=parent->FirstChild();child!=NULL && read_children;child=child->NextSibling())  {
+	for(SaveNode *child=read_children ? parent->nextChild() : NULL;child!=NULL;child=parent->nextChild()) {
 		GameState *sub_gamestate = loadStateParseXMLNode(child);
 		if( sub_gamestate != NULL ) {
 			if( new_gamestate != NULL ) {
@@ -4016,11 +4581,55 @@ GameState *Game::loadStateParseXMLNode(const TiXmlNode *parent) {
 	return new_gamestate;
 }
 
+bool Game::loadStateFromBuffer(const char *buffer, size_t length) {
+	// buffer should be nul terminated, in case it's XML
+	bool ok = false;
+	// a binary save is read directly from its records, only XML is parsed into a document first
+	SaveNode *root = NULL;
+	BinarySaveReader binary_reader(buffer, length);
+	TiXmlDocument doc;
+	XMLSaveNode xml_root;
+	if( isBinarySaveState(buffer, length) ) {
+		root = binary_reader.getDocument();
+		if( root == NULL ) {
+			LOG("failed to read binary save state\n");
+		}
+	}
+	else if( doc.Parse(buffer) == NULL ) {
+		LOG("failed to parse XML file, error row %d col %d\n", doc.ErrorRow(), doc.ErrorCol());
+		LOG("error: %s\n", doc.ErrorDesc());
+	}
+	else {
+		xml_root.set(&doc);
+		root = &xml_root;
+	}
+	if( root != NULL ) {
+		try {
+			GameState *new_gamestate = loadStateParseXMLNode(root);
+			// we create a new gamestate if playing a game
+			if( new_gamestate != NULL ) {
+				LOG("loaded PlayingGameState\n");
+				int c_page = static_cast<PlayingGameState *>(new_gamestate)->getGamePanel()->getPage();
+				setGameStateID(GAMESTATEID_PLAYING, new_gamestate);
+				static_cast<PlayingGameState *>(new_gamestate)->getGamePanel()->setPage(c_page);
+			}
+			else {
+				LOG("loaded PlaceMenGameState\n");
+				setGameStateID(GAMESTATEID_PLACEMEN);
+			}
+			ok = true;
+		}
+		catch(const std::runtime_error &error) {
+			LOG("caught error loading state: %s\n", error.what());
+		}
+	}
+	return ok;
+}
+
 bool Game::loadState() {
 	bool ok = false;
-	stringstream stream;
 	const char *save_fullfilename = getApplicationFilename(autosave_filename, autosave_survive_uninstall);
-	SDL_RWops *file = SDL_RWFromFile(save_fullfilename, "r");
+	SDL_RWops *file = SDL_RWFromFile(save_fullfilename, "rb");
 	if( file == NULL ) {
 		LOG("couldn't find or open saved state file: %s\n", save_fullfilename);
 	}
@@ -4044,31 +4653,7 @@ bool Game::loadState() {
 
 			buffer[size] = '\0';
 
-			TiXmlDocument doc;
-			if( doc.Parse(buffer) == NULL ) {
-				LOG("failed to parse XML file, error row %d col %d\n", doc.ErrorRow(), doc.ErrorCol());
-				LOG("error: %s\n", doc.ErrorDesc());
-			}
-			else {
-				try {
-					GameState *new_gamestate = loadStateParseXMLNode(&doc);
-					// we create a new gamestate if playing a game
-					if( new_gamestate != NULL ) {
-						LOG("loaded PlayingGameState\n");
-						int c_page = static_cast<PlayingGameState *>(new_gamestate)->getGamePanel()->getPage();
-						setGameStateID(GAMESTATEID_PLAYING, new_gamestate);
-						static_cast<PlayingGameState *>(new_gamestate)->getGamePanel()->setPage(c_page);
-					}
-					else {
-						LOG("loaded PlaceMenGameState\n");
-						setGameStateID(GAMESTATEID_PLACEMEN);
-					}
-					ok = true;
-				}
-				catch(const std::runtime_error &error) {
-					LOG("caught error loading state: %s\n", error.what());
-				}
-			}
+			ok = loadStateFromBuffer(buffer, size);
 			if( !ok ) {
 				LOG("rename bad save file\n");
 				const char *save_bad_fullfilename = getApplicationFilename(autosave_bad_filename, autosave_survive_uninstall);
@@ -4121,6 +4706,8 @@ void Game::mouseClick(int m_x, int m_y, bool m_left, bool m_middle, bool m_right
 }
 
 void Game::updateGame() {
+	updateNetwork();
+
 	if( !paused && screen != NULL ) { // screen can be NULL according to Google Play crash reports
 		int m_x = 0, m_y = 0;
 		bool m_left = false, m_middle = false, m_right = false;
@@ -4138,21 +4725,14 @@ void Game::updateGame() {
 	// update
 	if( !paused ) {
 		if( gameStateID == GAMESTATEID_PLAYING ) {
-			for(int i=0;i<n_players_c;i++) {
-				if( i != human_player && players[i] != NULL )
-					players[i]->doAIUpdate(human_player, static_cast<PlayingGameState *>(gamestate));
+			if( this->isSimulationThreaded() ) {
+				// AI and sectors are updated by the simulation thread
+				gamestate->update();
 			}
-			//players[ enemy_player ]->doAIUpdate();
-			gamestate->update();
-			for(int y=0;y<map_height_c;y++) {
-				for(int x=0;x<map_width_c;x++) {
-					/*if( map->sectors[x][y] != NULL )
-					map->sectors[x][y]->update();*/
-					Sector *sector = map->getSector(x, y);
-					if( sector != NULL ) {
-						sector->update(human_player);
-					}
-				}
+			else {
+				updateSimulation();
+				gamestate->update();
+				updateSectors();
 			}
 		}
 	}
@@ -4199,11 +4779,387 @@ void Game::updateGame() {
 	}
 }
 
+void Game::updateSimulation() {
+	// should only be called when playing
+	PlayingGameState *playingGameState = static_cast<PlayingGameState *>(gamestate);
+	playingGameState->processCommands();
+	if( gameMode == GAMEMODE_MULTIPLAYER_CLIENT ) {
+		// the AI is run by the server
+		return;
+	}
+	for(int i=0;i<n_players_c;i++) {
+		if( i != human_player && players[i] != NULL && !players[i]->isHuman() )
+			players[i]->doAIUpdate(human_player, playingGameState);
+	}
+	//players[ enemy_player ]->doAIUpdate();
+	updatePeriodicAutosave();
+}
+
+void Game::updatePeriodicAutosave() {
+	// called from the simulation step, so decides when a periodic autosave is due
+	if( is_testing || state_changed ) {
+		return;
+	}
+	if( gameMode == GAMEMODE_MULTIPLAYER_CLIENT ) {
+		return; // the game belongs to the server
+	}
+	if( last_periodic_autosave_time == -1 || game_time < last_periodic_autosave_time ) {
+		// new game or loaded game
+		last_periodic_autosave_time = game_time;
+		return;
+	}
+	if( game_time - last_periodic_autosave_time < periodic_autosave_interval_c ) {
+		return;
+	}
+	last_periodic_autosave_time = game_time;
+	if( this->isSimulationThreaded() ) {
+		// we're on the simulation thread, so the main thread carries on showing frames whilst this step serialises
+		writePeriodicAutosave();
+	}
+	else {
+		// serialise once the current frame has been presented, rather than part way through it
+		periodic_autosave_pending = true;
+	}
+}
+
+void Game::writePendingAutosave() {
+	// called by the main loop after presenting a frame, when not using the simulation thread, so the
+	// serialising uses the time the loop would otherwise spend waiting for the next frame
+	if( periodic_autosave_pending ) {
+		periodic_autosave_pending = false;
+		if( gameStateID == GAMESTATEID_PLAYING && !state_changed ) {
+			writePeriodicAutosave();
+		}
+	}
+}
+
+void Game::writePeriodicAutosave() {
+	// only the serialising to memory happens here, the file is written by BackgroundSaver
+	MemorySaveSink sink;
+	BinarySaveWriter writer(&sink);
+	writeState(writer);
+	if( !writer.isOk() ) {
+		LOG("failed to write periodic autosave\n");
+		return;
+	}
+	if( background_saver == NULL ) {
+		background_saver = new BackgroundSaver();
+	}
+	stringstream filename;
+	filename << autosave_periodic_filename << periodic_autosave_index << ".sav";
+	const char *save_fullfilename = getApplicationFilename(filename.str().c_str(), autosave_survive_uninstall);
+	LOG("periodic autosave: %s (%d bytes)\n", save_fullfilename, static_cast<int>(sink.getData().size()));
+	background_saver->submit(sink.getData(), save_fullfilename);
+	delete [] save_fullfilename;
+	periodic_autosave_index = (periodic_autosave_index + 1) % n_periodic_autosaves_c;
+}
+
+void Game::updateSectors() {
+	for(int y=0;y<map_height_c;y++) {
+		for(int x=0;x<map_width_c;x++) {
+			/*if( map->sectors[x][y] != NULL )
+			map->sectors[x][y]->update();*/
+			Sector *sector = map->getSector(x, y);
+			if( sector != NULL ) {
+				sector->update(human_player);
+			}
+		}
+	}
+}
+
+bool Game::startNetwork(const string &address) {
+	if( gameMode == GAMEMODE_MULTIPLAYER_SERVER ) {
+		net_server = new NetServer();
+		if( net_server->open(address) ) {
+			return true;
+		}
+		delete net_server;
+		net_server = NULL;
+	}
+	else if( gameMode == GAMEMODE_MULTIPLAYER_CLIENT ) {
+		net_client = new NetClient();
+		if( net_client->connect(address) ) {
+			return true;
+		}
+		delete net_client;
+		net_client = NULL;
+	}
+	LOG("failed to start network, running as a single player game\n");
+	gameMode = GAMEMODE_SINGLEPLAYER;
+	return false;
+}
+
+void Game::updateNetwork() {
+	if( net_server != NULL ) {
+		net_server->update();
+	}
+	else if( net_client != NULL ) {
+		net_client->update();
+		if( net_client->isFinished() && gameStateID != GAMESTATEID_PLAYING ) {
+			// the game is over and we've left it, so carry on as a normal single player game
+			LOG("network game finished\n");
+			delete net_client;
+			net_client = NULL;
+			gameMode = GAMEMODE_SINGLEPLAYER;
+		}
+	}
+}
+
+int Game::addNetworkPlayer() {
+	// called on the server, when a client joins a game being played; returns the client's player, or -1 if there's no room
+	ASSERT( gameStateID == GAMESTATEID_PLAYING );
+	int player = -1;
+	for(int i=0;i<n_players_c && player == -1;i++) {
+		if( players[i] == NULL ) {
+			player = i;
+		}
+	}
+	if( player == -1 ) {
+		return -1;
+	}
+	vector<Sector *> free_sectors;
+	for(int y=0;y<map_height_c;y++) {
+		for(int x=0;x<map_width_c;x++) {
+			if( !map->isSectorAt(x, y) || map->isReserved(x, y) ) {
+				continue;
+			}
+			Sector *sector = map->getSector(x, y);
+			bool empty = sector->getPlayer() == PLAYER_NONE && !sector->isNuked();
+			for(int i=0;i<n_players_c && empty;i++) {
+				if( sector->getArmy(i)->any(true) ) {
+					empty = false;
+				}
+			}
+			if( empty ) {
+				free_sectors.push_back(sector);
+			}
+		}
+	}
+	if( free_sectors.size() == 0 ) {
+		return -1;
+	}
+	Sector *sector = free_sectors.at( rand() % free_sectors.size() );
+	players[player] = new Player(true, player);
+	// same as the AI players get, see PlayingGameState::createSectors()
+	players[player]->setNMenForThisIsland( start_epoch == end_epoch_c ? 100 : 20 + 5*start_epoch );
+	sector->createTower(player, players[player]->getNMenForThisIsland());
+	LOG("network player %d created at %d , %d\n", player, sector->getXPos(), sector->getYPos());
+	return player;
+}
+
+bool Game::submitNetworkCommand(const Command &command) {
+	// called on the server, for a command from a client
+	// returns false if the command is malformed, in which case the client should be dropped
+	if( gameStateID != GAMESTATEID_PLAYING ) {
+		return true; // game is ending, so just ignore the command
+	}
+	PlayingGameState *playingGameState = static_cast<PlayingGameState *>(gamestate);
+	bool malformed = false;
+	if( !playingGameState->validateCommand(command, &malformed) ) {
+		if( malformed ) {
+			return false;
+		}
+		// the client sent it for a state that's since changed - it's checked again when executed, as the world may also change before then
+		LOG("ignoring command %s from player %d, not valid for the current state\n", Command::getName(command.type), command.player);
+		return true;
+	}
+	playingGameState->submitCommand(command);
+	return true;
+}
+
+bool Game::sendNetworkCommand(const Command &command) {
+	// called on a client, for commands to be executed by the server
+	return net_client != NULL && net_client->sendCommand(command);
+}
+
+bool Game::loadNetworkSnapshot(const char *buffer, size_t length) {
+	// called on a client, when joining a game
+	if( !loadStateFromBuffer(buffer, length) ) {
+		return false;
+	}
+	if( gameStateID != GAMESTATEID_PLAYING ) {
+		LOG("snapshot isn't of a game being played\n");
+		return false;
+	}
+	// the snapshot was viewing the server's sector
+	for(int y=0;y<map_height_c;y++) {
+		for(int x=0;x<map_width_c;x++) {
+			if( map->isSectorAt(x, y) && map->getSector(x, y)->getPlayer() == human_player ) {
+				static_cast<PlayingGameState *>(gamestate)->moveTo(x, y);
+				return true;
+			}
+		}
+	}
+	return true;
+}
+
+void Game::endNetworkGame(GameResult result) {
+	// called on a client, when the server ends the game
+	if( gameStateID != GAMESTATEID_PLAYING || state_changed ) {
+		return;
+	}
+	state_changed = true;
+	gameResult = result;
+	if( result == GAMERESULT_WON ) {
+		playSample(s_won);
+	}
+	else if( result == GAMERESULT_LOST ) {
+		playSample(s_itis_all_over);
+	}
+	fadeMusic(SHORT_DELAY + 1000);
+	gamestate->fadeScreen(true, SHORT_DELAY, endIsland_g);
+}
+
+void Game::netFields(NetFields &fields) {
+	// the replicated fields of the game world, see NetFields
+	PlayingGameState *playingGameState = static_cast<PlayingGameState *>(gamestate);
+	fields.beginObject(); // the game time and players, then each Sector is an object
+	fields.field(game_time);
+	for(int i=0;i<n_players_c;i++) {
+		int player_state = players[i] == NULL ? 0 : players[i]->isDead() ? 2 : 1;
+		fields.field(player_state);
+		if( fields.isWriting() && player_state != 0 ) {
+			if( players[i] == NULL ) {
+				// e.g., another client has joined
+				players[i] = new Player(false, i);
+			}
+			if( player_state == 2 && !players[i]->isDead() ) {
+				players[i]->kill(playingGameState);
+			}
+		}
+		if( players[i] != NULL ) {
+			int n_births = players[i]->getNBirths();
+			int n_deaths = players[i]->getNDeaths();
+			fields.field(n_births);
+			fields.field(n_deaths);
+			players[i]->registerBirths(n_births - players[i]->getNBirths());
+			players[i]->setNDeaths(n_deaths);
+		}
+		else {
+			fields.skip(2);
+		}
+	}
+	for(int y=0;y<map_height_c;y++) {
+		for(int x=0;x<map_width_c;x++) {
+			if( map->isSectorAt(x, y) ) {
+				map->getSector(x, y)->netFields(fields, human_player);
+				if( !fields.isOk() ) {
+					return; // the remaining fields are no longer in step
+				}
+			}
+		}
+	}
+}
+
 void Game::drawGame() const {
 	// we now redraw even when paused, to display paused message
 	gamestate->draw();
 }
 
+#if SDL_MAJOR_VERSION == 1
+#else
+const unsigned int simulation_tick_c = 16; // ms per simulation step
+
+static int simulationThreadFunction(void *data) {
+	Game *game = static_cast<Game *>(data);
+	game->runSimulationThread();
+	return 0;
+}
+#endif
+
+bool Game::startSimulationThread() {
+#if SDL_MAJOR_VERSION == 1
+	LOG("simulation thread not supported with SDL 1\n");
+	return false;
+#else
+	if( simulation_thread != NULL ) {
+		return true;
+	}
+	world_mutex = SDL_CreateMutex();
+	if( world_mutex == NULL ) {
+		LOG("failed to create world mutex: %s\n", SDL_GetError());
+		return false;
+	}
+	SDL_AtomicSet(&simulation_thread_quit, 0);
+	simulation_thread = SDL_CreateThread(simulationThreadFunction, "simulation", this);
+	if( simulation_thread == NULL ) {
+		LOG("failed to create simulation thread: %s\n", SDL_GetError());
+		SDL_DestroyMutex(world_mutex);
+		world_mutex = NULL;
+		return false;
+	}
+	LOG("started simulation thread\n");
+	return true;
+#endif
+}
+
+void Game::stopSimulationThread() {
+#if SDL_MAJOR_VERSION == 1
+#else
+	if( simulation_thread != NULL ) {
+		LOG("stopping simulation thread\n");
+		SDL_AtomicSet(&simulation_thread_quit, 1);
+		SDL_WaitThread(simulation_thread, NULL);
+		simulation_thread = NULL;
+	}
+	if( world_mutex != NULL ) {
+		SDL_DestroyMutex(world_mutex);
+		world_mutex = NULL;
+	}
+#endif
+}
+
+void Game::runSimulationThread() {
+	// Steps the game world at a fixed rate. The world lock is only held for the duration of a step, so
+	// the main thread can render and handle input in between; it never waits on a step (see lockWorld()).
+	// Game time is also owned by this thread whilst it runs, so that a step always sees a consistent time.
+#if SDL_MAJOR_VERSION == 1
+#else
+	unsigned int elapsed_time = application->getTicks();
+	while( SDL_AtomicGet(&simulation_thread_quit) == 0 ) {
+		unsigned int start_time = application->getTicks();
+		SDL_mutexP(world_mutex);
+		unsigned int new_time = application->getTicks();
+		updateTime(paused ? 0 : new_time - elapsed_time);
+		elapsed_time = new_time;
+		if( !paused && gameStateID == GAMESTATEID_PLAYING && !state_changed ) {
+			updateSimulation();
+			updateSectors();
+		}
+		SDL_mutexV(world_mutex);
+
+		unsigned int time_taken = application->getTicks() - start_time;
+		if( time_taken < simulation_tick_c ) {
+			SDL_Delay(simulation_tick_c - time_taken);
+		}
+	}
+#endif
+}
+
+bool Game::lockWorld(bool wait) {
+	// returns false if wait is false and the simulation thread currently holds the lock
+	if( world_mutex == NULL ) {
+		// not threaded
+		return true;
+	}
+#if SDL_MAJOR_VERSION == 1
+	SDL_mutexP(world_mutex);
+	return true;
+#else
+	if( wait ) {
+		SDL_mutexP(world_mutex);
+		return true;
+	}
+	return SDL_TryLockMutex(world_mutex) == 0;
+#endif
+}
+
+void Game::unlockWorld() {
+	if( world_mutex != NULL ) {
+		SDL_mutexV(world_mutex);
+	}
+}
+
 const char prefs_filename[] = "prefs";
 const bool prefs_survive_uninstall = false; // no need for prefs file to save uninstall, and seems better to allow resetting to initial condition (especially on Android where this is typical behaviour)
 const char onemousebutton_key[] = "onemousebutton";
@@ -4221,50 +5177,35 @@ bool Game::createApplication() {
 
 void Game::loadPrefs() {
 	const char *prefs_fullfilename = getApplicationFilename(prefs_filename, prefs_survive_uninstall);
-	SDL_RWops *prefs_file = SDL_RWFromFile(prefs_fullfilename, "rb");
-	if( prefs_file != NULL ) {
+	TextReader prefs_file;
+	if( prefs_file.open(prefs_fullfilename) ) {
 		// reset
 		pref_sound_on = false;
 		pref_music_on = false;
 		pref_disallow_nukes = false;
 		onemousebutton = false;
 
-		const int MAX_LINE = 4096;
-		char line[MAX_LINE+1] = "";
-		char buffer[MAX_LINE+1] = "";
-		int buffer_offset = 0;
-		bool reached_end = false;
-		int newline_index = 0;
-		bool ok = true;
-		while( ok ) {
-			bool done = readLineFromRWOps(ok, prefs_file, buffer, line, MAX_LINE, buffer_offset, newline_index, reached_end);
-			if( !ok )  {
-				LOG("failed to read line for: %s\n", prefs_fullfilename);
-			}
-			else if( done ) {
-				break;
+		TextToken line;
+		while( prefs_file.readLine(&line) ) {
+			LOG("read prefs line: %s\n", line.toString().c_str());
+			if( line.startsWith(onemousebutton_key) ) {
+				LOG("enable onemousebutton from prefs\n");
+				onemousebutton = true;
 			}
-			else {
-				LOG("read prefs line: %s", line);
-				if( strncmp(line, onemousebutton_key, strlen(onemousebutton_key)) == 0 ) {
-					LOG("enable onemousebutton from prefs\n");
-					onemousebutton = true;
-				}
-				else if( strncmp(line, sound_on_key, strlen(sound_on_key)) == 0 ) {
-					LOG("enable pref_sound_on from prefs\n");
-					pref_sound_on = true;
-				}
-				else if( strncmp(line, music_on_key, strlen(music_on_key)) == 0 ) {
-					LOG("enable pref_music_on from prefs\n");
-					pref_music_on = true;
-				}
-				else if( strncmp(line, disallow_nukes_key, strlen(disallow_nukes_key)) == 0 ) {
-					LOG("enable pref_disallow_nukes from prefs\n");
-					pref_disallow_nukes = true;
-				}
+			else if( line.startsWith(sound_on_key) ) {
+				LOG("enable pref_sound_on from prefs\n");
+				pref_sound_on = true;
+			}
+			else if( line.startsWith(music_on_key) ) {
+				LOG("enable pref_music_on from prefs\n");
+				pref_music_on = true;
+			}
+			else if( line.startsWith(disallow_nukes_key) ) {
+				LOG("enable pref_disallow_nukes from prefs\n");
+				pref_disallow_nukes = true;
 			}
 		}
-		prefs_file->close(prefs_file);
+		prefs_file.close();
 
 #if defined(__ANDROID__)
 		// force onemousebutton mode, just to be safe
@@ -4329,8 +5270,467 @@ bool Game::testFindSoldiersBuildingNewTower(const Sector *sector, int *total, in
 	return found;
 }
 
+static int countSoldiers(const Map *map) {
+	int n_soldiers = 0;
+	for(int y=0;y<map_height_c;y++) {
+		for(int x=0;x<map_width_c;x++) {
+			if( map->isSectorAt(x, y) ) {
+				for(int i=0;i<n_players_c;i++) {
+					n_soldiers += map->getSector(x, y)->getArmy(i)->getTotal();
+				}
+			}
+		}
+	}
+	return n_soldiers;
+}
+
+void Game::runNetworkBenchmark() {
+	// logs the size of the state updates that a server would send (see network.h), while every occupied sector is under attack
+	LOG("Game::runNetworkBenchmark()\n");
+	this->setTesting(true);
+	human_player = 0;
+	start_epoch = 5;
+	selected_island = 0;
+	map = maps[start_epoch][selected_island];
+	setGameStateID(GAMESTATEID_PLACEMEN);
+	newGame();
+	setupPlayers();
+	int sx = 0, sy = 0;
+	map->findRandomSector(&sx, &sy);
+	PlaceMenGameState *placeMenGameState = static_cast<PlaceMenGameState *>(gamestate);
+	placeMenGameState->getChooseMenPanel()->setNMen(10);
+	placeMenGameState->setStartMapPos(sx, sy); // will automatically switch to playing gamestate
+	updateGame(); // needed to dispose the gamestate
+	if( gameStateID != GAMESTATEID_PLAYING ) {
+		LOG("failed to start game\n");
+		return;
+	}
+
+	for(int y=0;y<map_height_c;y++) {
+		for(int x=0;x<map_width_c;x++) {
+			Sector *sector = map->isSectorAt(x, y) ? map->getSector(x, y) : NULL;
+			if( sector == NULL || sector->getPlayer() == PLAYER_NONE ) {
+				continue;
+			}
+			for(int i=0;i<n_players_c;i++) {
+				if( i != sector->getPlayer() && players[i] != NULL ) {
+					sector->getArmy(i)->add(start_epoch, 20);
+					sector->getArmy(i)->add(n_epochs_c, 20);
+				}
+			}
+		}
+	}
+	int n_soldiers = countSoldiers(map);
+
+	vector<int> values;
+	vector<size_t> objects;
+	{
+		NetFields fields(true, &values, &objects);
+		netFields(fields);
+	}
+	MemorySaveSink sink;
+	BinarySaveWriter writer(&sink);
+	writeState(writer, human_player);
+	NetBuffer keyframe;
+	writeNetDelta(&keyframe, values, NULL, objects);
+	LOG("%d replicated fields in %d objects: snapshot is %d bytes, keyframe is %d bytes\n", static_cast<int>(values.size()), static_cast<int>(objects.size()), static_cast<int>(sink.getData().size()), static_cast<int>(keyframe.size()));
+
+	// deltas against the previous tick, as when acknowledgements arrive promptly, and against an older tick, as with a slow connection
+	const int tick_time_c = 50; // as NetServer sends an update every 50ms
+	const int n_ticks_c = 200;
+	const size_t ack_lag_c = 4;
+	const char *names[] = {"acked each tick", "acked 200ms late"};
+	size_t total_bytes[2] = {0, 0};
+	size_t max_bytes[2] = {0, 0};
+	double gather_time = 0.0, encode_time = 0.0; // gathering walks the whole world every tick, however little has changed, so is reported separately
+	vector< vector<int> > states;
+	states.push_back(values);
+	int n_ticks = 0;
+	for(;n_ticks<n_ticks_c && gameStateID == GAMESTATEID_PLAYING && !state_changed;n_ticks++) {
+		updateTime(tick_time_c);
+		updateGame();
+		double time_s = game_g->getApplication()->getPreciseTicks(); // a tick's work can take well under a millisecond
+		NetFields fields(true, &values, &objects);
+		netFields(fields);
+		double time_gathered = game_g->getApplication()->getPreciseTicks();
+		gather_time += time_gathered - time_s;
+		for(int j=0;j<2;j++) {
+			const vector<int> &baseline = j == 0 ? states.back() : states.front();
+			NetBuffer payload;
+			writeNetDelta(&payload, values, &baseline, objects);
+			total_bytes[j] += payload.size();
+			if( payload.size() > max_bytes[j] ) {
+				max_bytes[j] = payload.size();
+			}
+		}
+		encode_time += game_g->getApplication()->getPreciseTicks() - time_gathered;
+		states.push_back(values);
+		if( states.size() > ack_lag_c ) {
+			states.erase(states.begin());
+		}
+	}
+	if( n_ticks == 0 ) {
+		LOG("game ended immediately\n");
+		return;
+	}
+	LOG("%d ticks of %dms, soldiers went from %d to %d\n", n_ticks, tick_time_c, n_soldiers, countSoldiers(map));
+	for(int j=0;j<2;j++) {
+		LOG("    %s: %.1f bytes per tick on average, %d at most\n", names[j], total_bytes[j]/(float)n_ticks, static_cast<int>(max_bytes[j]));
+	}
+	LOG("    time to gather: %.2fms per tick\n", gather_time/n_ticks);
+	LOG("    time to encode both deltas: %.2fms per tick\n", encode_time/n_ticks);
+}
+
+static bool islandSpritesLoaded(const Game *game) {
+	vector<int> epochs;
+	game->getIslandSpriteEpochs(&epochs);
+	for(vector<int>::const_iterator iter = epochs.begin(); iter != epochs.end(); ++iter) {
+		if( game->fortress[*iter] == NULL ) {
+			LOG("sprites for epoch %d not loaded\n", *iter);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void testNetDeltas() {
+	// three objects (see NetFields), the middle one of which doesn't change
+	vector<size_t> objects;
+	objects.push_back(0);
+	objects.push_back(3);
+	objects.push_back(5);
+	const int baseline_c[] = {5, -3, 0, 7, 7, 100, INT_MIN, INT_MAX, 0};
+	const int values_c[] = {4, -3, -20, 7, 7, 100, INT_MAX, INT_MIN, -1};
+	const size_t n_fields = sizeof(values_c)/sizeof(values_c[0]);
+	vector<int> baseline(baseline_c, baseline_c + n_fields);
+	vector<int> values(values_c, values_c + n_fields);
+	for(int i=0;i<3;i++) {
+		// a keyframe, a delta with changes of each sign and the largest possible changes, and a delta with no changes
+		const vector<int> &expected = i == 2 ? baseline : values;
+		const vector<int> *base = i == 0 ? NULL : &baseline;
+		NetBuffer payload;
+		writeNetDelta(&payload, expected, base, objects);
+		vector<int> result;
+		if( !readNetDelta(&payload, base, objects, n_fields, &result) ) {
+			throw string("failed to read net delta");
+		}
+		else if( result != expected ) {
+			throw string("net delta didn't round trip");
+		}
+		else if( !payload.atEnd() ) {
+			throw string("net delta not fully read");
+		}
+		else if( i == 2 && payload.size() != 3 ) {
+			// the number of fields, the length of the bits, and a byte for no objects
+			LOG("delta with no changes is %d bytes\n", static_cast<int>(payload.size()));
+			throw string("unchanged objects should cost nothing");
+		}
+		if( i == 1 ) {
+			for(size_t length=0;length<payload.size();length++) {
+				NetBuffer truncated;
+				truncated.getData().assign(payload.getData().begin(), payload.getData().begin() + length);
+				if( readNetDelta(&truncated, base, objects, n_fields, &result) ) {
+					LOG("truncated to %d bytes\n", static_cast<int>(length));
+					throw string("accepted truncated net delta");
+				}
+			}
+			payload.clear();
+			writeNetDelta(&payload, expected, base, objects);
+			if( readNetDelta(&payload, NULL, objects, n_fields-1, &result) ) {
+				throw string("accepted net delta with the wrong number of fields");
+			}
+		}
+	}
+	{
+		// an object that doesn't exist
+		NetBitWriter bits;
+		bits.writeGamma(1);
+		bits.writeGamma(static_cast<unsigned int>(objects.size()));
+		bits.writeGamma(0);
+		bits.writeGamma(0);
+		bits.writeGamma(0);
+		NetBuffer payload;
+		payload.writeVarint(static_cast<unsigned int>(n_fields));
+		payload.writeBytes(&bits.getData()[0], bits.getData().size());
+		vector<int> result;
+		if( readNetDelta(&payload, &baseline, objects, n_fields, &result) ) {
+			throw string("accepted net delta with an invalid object");
+		}
+	}
+	{
+		// a field past the end of its object
+		NetBitWriter bits;
+		bits.writeGamma(1);
+		bits.writeGamma(1);
+		bits.writeGamma(0);
+		bits.writeGamma(2);
+		bits.writeGamma(0);
+		NetBuffer payload;
+		payload.writeVarint(static_cast<unsigned int>(n_fields));
+		payload.writeBytes(&bits.getData()[0], bits.getData().size());
+		vector<int> result;
+		if( readNetDelta(&payload, &baseline, objects, n_fields, &result) ) {
+			throw string("accepted net delta with an invalid field");
+		}
+	}
+	{
+		// too many zero bits for a gamma code
+		const unsigned char zeroes[5] = {0, 0, 0, 0, 0};
+		NetBuffer payload;
+		payload.writeVarint(static_cast<unsigned int>(n_fields));
+		payload.writeBytes(zeroes, sizeof(zeroes));
+		vector<int> result;
+		if( readNetDelta(&payload, &baseline, objects, n_fields, &result) ) {
+			throw string("accepted net delta with an invalid gamma code");
+		}
+	}
+}
+
+static void testNetCommands() {
+	for(int i=0;i<Command::N_COMMAND_TYPES;i++) {
+		Command command(static_cast<Command::CommandType>(i), i % n_players_c, i, map_height_c-1);
+		command.args[0] = -1;
+		command.args[1] = i;
+		command.args[2] = INT_MIN;
+		command.args[3] = INT_MAX;
+		NetBuffer payload;
+		writeNetCommand(&payload, command);
+		Command result;
+		if( !readNetCommand(&payload, &result) || !payload.atEnd() ) {
+			throw string("failed to read net command");
+		}
+		else if( result.type != command.type || result.player != command.player || result.sector_x != command.sector_x || result.sector_y != command.sector_y ) {
+			throw string("net command didn't round trip");
+		}
+		for(int j=0;j<Command::n_args_c;j++) {
+			if( result.args[j] != command.args[j] ) {
+				throw string("net command args didn't round trip");
+			}
+		}
+		for(size_t length=0;length<payload.size();length++) {
+			NetBuffer truncated;
+			truncated.getData().assign(payload.getData().begin(), payload.getData().begin() + length);
+			if( readNetCommand(&truncated, &result) ) {
+				throw string("accepted truncated net command");
+			}
+		}
+	}
+	const int invalid_types[] = {Command::COMMAND_NONE, Command::N_COMMAND_TYPES};
+	for(int i=0;i<2;i++) {
+		Command command(static_cast<Command::CommandType>(invalid_types[i]), 0, 0, 0);
+		NetBuffer payload;
+		writeNetCommand(&payload, command);
+		Command result;
+		if( readNetCommand(&payload, &result) ) {
+			throw string("accepted net command of invalid type");
+		}
+	}
+}
+
+#ifdef NETWORK_SOCKETS
+static bool receiveNetMessage(NetConnection *connection, NetServer *server, NetClient *client, NetMessageType expected_type, NetBuffer *payload) {
+	// for the scripted end of a loopback connection: gives the other end a few updates to send the next message
+	for(int i=0;i<100;i++) {
+		NetMessageType type;
+		if( connection->receive(&type, payload) ) {
+			if( type != expected_type ) {
+				LOG("received network message %d, expected %d\n", type, expected_type);
+				return false;
+			}
+			return true;
+		}
+		else if( !connection->isOpen() ) {
+			return false;
+		}
+		if( server != NULL ) {
+			server->update();
+		}
+		if( client != NULL ) {
+			client->update();
+		}
+	}
+	LOG("timed out waiting for network message %d\n", expected_type);
+	return false;
+}
+
+static bool receiveNetState(NetConnection *connection, NetServer *server, const vector<size_t> &objects, size_t n_fields, unsigned int acked_seq, const vector<int> &acked_values, unsigned int *seq, unsigned int *base_seq, vector<int> *values) {
+	NetBuffer payload;
+	if( !receiveNetMessage(connection, server, NULL, NETMESSAGE_STATE, &payload) ) {
+		return false;
+	}
+	*seq = payload.readVarint();
+	*base_seq = payload.readVarint();
+	if( !payload.isOk() || ( *base_seq != 0 && *base_seq != acked_seq ) ) {
+		LOG("received state %d against %d, but only acknowledged %d\n", *seq, *base_seq, acked_seq);
+		return false;
+	}
+	return readNetDelta(&payload, *base_seq == 0 ? NULL : &acked_values, objects, n_fields, values) && payload.atEnd();
+}
+
+static void sendNetAck(NetConnection *connection, unsigned int seq) {
+	NetBuffer payload;
+	payload.writeVarint(seq);
+	connection->send(NETMESSAGE_ACK, payload);
+}
+
+void Game::testNetworkLoopback() {
+	// a scripted client talks to a NetServer, then a scripted server to a NetClient, over a Unix domain socket; n.b., both ends share this game world
+	LOG("test network loopback\n");
+	const string address = "unix:_test_network";
+	const int saved_game_time = game_time;
+	const int saved_real_time = real_time;
+	vector<int> current;
+	vector<size_t> objects;
+	{
+		NetFields layout(true, &current, &objects);
+		netFields(layout);
+	}
+	const size_t n_fields = current.size();
+
+	{
+		NetServer server;
+		if( !server.open(address) ) {
+			throw string("failed to open network server");
+		}
+		NetConnection *connection = NetConnection::connect(address);
+		if( connection == NULL ) {
+			throw string("failed to connect to network server");
+		}
+		NetBuffer payload;
+		payload.writeInt(network_version_c);
+		connection->send(NETMESSAGE_HELLO, payload);
+		if( !receiveNetMessage(connection, &server, NULL, NETMESSAGE_WELCOME, &payload) ) {
+			throw string("network client wasn't welcomed");
+		}
+		int player = payload.readInt();
+		if( !payload.isOk() || player < 0 || player >= n_players_c || player == human_player || players[player] == NULL ) {
+			throw string("network client didn't join as a new player");
+		}
+		vector<char> snapshot;
+		if( !receiveNetMessage(connection, &server, NULL, NETMESSAGE_SNAPSHOT, &payload) || !payload.readBytes(&snapshot, payload.readVarint()) || snapshot.size() == 0 || !isBinarySaveState(&snapshot[0], snapshot.size()) ) {
+			throw string("network client didn't receive a snapshot");
+		}
+
+		// the first state is a keyframe
+		unsigned int seq = 0, base_seq = 0, acked_seq = 0;
+		vector<int> values, acked_values;
+		if( !receiveNetState(connection, &server, objects, n_fields, acked_seq, acked_values, &seq, &base_seq, &values) ) {
+			throw string("network client didn't receive the first state");
+		}
+		{
+			NetFields fields(true, &current);
+			netFields(fields);
+		}
+		if( base_seq != 0 ) {
+			throw string("first network state isn't a keyframe");
+		}
+		else if( values != current ) {
+			throw string("network keyframe doesn't match the world");
+		}
+		acked_seq = seq;
+		acked_values = values;
+		sendNetAck(connection, seq);
+
+		// then the server sends deltas against the acknowledged state, until it's no longer in the history, when it has to send a keyframe
+		for(unsigned int i=0;base_seq!=0 || i==0;i++) {
+			if( i > 2*max_net_history_c ) {
+				throw string("network server never sent a keyframe");
+			}
+			game_time++; // so there's a new state to send
+			real_time += 1000;
+			if( !receiveNetState(connection, &server, objects, n_fields, acked_seq, acked_values, &seq, &base_seq, &values) ) {
+				throw string("network client didn't receive a state");
+			}
+			NetFields fields(true, &current);
+			netFields(fields);
+			if( values != current ) {
+				throw string("network state doesn't match the world");
+			}
+			unsigned int expected_base_seq = seq >= acked_seq + max_net_history_c ? 0 : acked_seq;
+			if( base_seq != expected_base_seq ) {
+				LOG("state %d is against %d, expected %d\n", seq, base_seq, expected_base_seq);
+				throw string("network state against unexpected base");
+			}
+		}
+		acked_seq = seq;
+		acked_values = values;
+		sendNetAck(connection, seq);
+		game_time++;
+		real_time += 1000;
+		if( !receiveNetState(connection, &server, objects, n_fields, acked_seq, acked_values, &seq, &base_seq, &values) ) {
+			throw string("network client didn't receive a state after acknowledging the keyframe");
+		}
+		else if( base_seq != acked_seq ) {
+			throw string("network state isn't against the acknowledged keyframe");
+		}
+
+		// a command that the GUI would never send gets the client dropped
+		Command command(Command::COMMAND_SET_N_DESIGNERS, player, 0, 0);
+		command.args[0] = -1;
+		payload.clear();
+		writeNetCommand(&payload, command);
+		connection->send(NETMESSAGE_COMMAND, payload);
+		if( !receiveNetMessage(connection, &server, NULL, NETMESSAGE_BYE, &payload) ) {
+			throw string("network client wasn't dropped for an invalid command");
+		}
+		delete connection;
+	}
+
+	// now the other way round
+	NetListener listener;
+	if( !listener.open(address) ) {
+		throw string("failed to listen for network client");
+	}
+	NetClient client;
+	if( !client.connect(address) ) {
+		throw string("network client failed to connect");
+	}
+	NetConnection *connection = NULL;
+	NetBuffer payload;
+	for(int i=0;i<100 && connection == NULL;i++) {
+		connection = listener.accept();
+	}
+	if( connection == NULL ) {
+		throw string("network client didn't connect");
+	}
+	if( !receiveNetMessage(connection, NULL, &client, NETMESSAGE_HELLO, &payload) || payload.readInt() != network_version_c ) {
+		throw string("network client didn't say hello");
+	}
+	payload.clear();
+	payload.writeInt(human_player);
+	connection->send(NETMESSAGE_WELCOME, payload);
+	MemorySaveSink sink;
+	BinarySaveWriter writer(&sink);
+	writeState(writer, human_player);
+	payload.clear();
+	payload.writeBytes(&sink.getData()[0], sink.getData().size());
+	connection->send(NETMESSAGE_SNAPSHOT, payload);
+	{
+		NetFields fields(true, &current);
+		netFields(fields);
+	}
+	payload.clear();
+	payload.writeVarint(1);
+	payload.writeVarint(0);
+	writeNetDelta(&payload, current, NULL, objects);
+	connection->send(NETMESSAGE_STATE, payload);
+	if( !receiveNetMessage(connection, NULL, &client, NETMESSAGE_ACK, &payload) || payload.readVarint() != 1 ) {
+		throw string("network client didn't acknowledge the state");
+	}
+	else if( client.isFinished() || gameStateID != GAMESTATEID_PLAYING ) {
+		throw string("network client didn't join the game");
+	}
+	delete connection;
+
+	game_time = saved_game_time;
+	real_time = saved_real_time;
+}
+#endif
+
 void Game::runTests() {
 	game_g->setTesting(true);
+	testNetDeltas();
+	testNetCommands();
 
 	human_player = rand() % 4;
 	//human_player = 0;
@@ -4397,6 +5797,9 @@ void Game::runTests() {
 		}
 		placeMenGameState->setStartMapPos(sx, sy); // will automatically switch to playing gamestate
 		updateGame(); // needed to dispose the gamestate
+		if( gameStateID != GAMESTATEID_PLAYING ) {
+			throw string("failed to start island");
+		}
 
 		int ex = -1, ey = -1;
 		for(int y=0;y<map_height_c && ex==-1;y++) {
@@ -4438,6 +5841,9 @@ void Game::runTests() {
 		else if( tutorial != NULL ) {
 			throw string("didn't expect tutorial when loading state");
 		}
+		else if( !islandSpritesLoaded(this) ) {
+			throw string("sprites for island's epochs not loaded when loading state");
+		}
 #if defined(_WIN32) || defined(__linux) || (defined(__APPLE__) && defined(__MACH__))
 		// ensure on a platform where access() is defined (it isn't available on AROS etc - we could write platform specific code, but not really worth it for now)
 		else if( access(getApplicationFilename(autosave_filename, autosave_survive_uninstall), 0) == 0 ) {
@@ -4445,6 +5851,73 @@ void Game::runTests() {
 		}
 #endif
 
+		// test the XML export loads back in the same way as the binary autosave
+		{
+			const char *save_fullfilename = getApplicationFilename(autosave_filename, autosave_survive_uninstall);
+			bool exported = exportStateXML(save_fullfilename);
+			delete [] save_fullfilename;
+			if( !exported ) {
+				throw string("failed to export state as XML");
+			}
+		}
+		delete gamestate;
+		gamestate = NULL;
+		if( !loadState() ) {
+			throw string("failed to load exported XML state");
+		}
+		else if( gamestate == NULL ) {
+			throw string("failed to create new gamestate when loading exported XML state");
+		}
+		else if( gameStateID != GAMESTATEID_PLAYING ) {
+			throw string("expected playinggamestate when loading exported XML state");
+		}
+
+		if( start_epoch == 0 && selected_island == 0 ) {
+			// test periodic autosaves are only due once the interval has passed, and are then written
+			int saved_game_time = game_time;
+			setTesting(false); // periodic autosaves are otherwise disabled when testing
+			last_periodic_autosave_time = -1;
+			updatePeriodicAutosave(); // starts the interval
+			game_time += periodic_autosave_interval_c - 1;
+			updatePeriodicAutosave();
+			bool early = periodic_autosave_pending;
+			game_time++;
+			updatePeriodicAutosave();
+			bool due = periodic_autosave_pending;
+			int index = periodic_autosave_index;
+			writePendingAutosave();
+			setTesting(true);
+			game_time = saved_game_time;
+			last_periodic_autosave_time = -1;
+			delete background_saver; // waits for the file to be written
+			background_saver = NULL;
+			if( early ) {
+				throw string("periodic autosave due before the interval");
+			}
+			else if( !due ) {
+				throw string("periodic autosave not due after the interval");
+			}
+			else if( periodic_autosave_pending ) {
+				throw string("periodic autosave still pending after writing");
+			}
+			else if( periodic_autosave_index != (index + 1) % n_periodic_autosaves_c ) {
+				throw string("periodic autosave index not advanced");
+			}
+			stringstream filename;
+			filename << autosave_periodic_filename << index << ".sav";
+			const char *periodic_fullfilename = getApplicationFilename(filename.str().c_str(), autosave_survive_uninstall);
+#if defined(_WIN32) || defined(__linux) || (defined(__APPLE__) && defined(__MACH__))
+			bool written = access(periodic_fullfilename, 0) == 0;
+#else
+			bool written = true;
+#endif
+			remove(periodic_fullfilename);
+			delete [] periodic_fullfilename;
+			if( !written ) {
+				throw string("periodic autosave file not created");
+			}
+		}
+
 		PlayingGameState *playingGameState = static_cast<PlayingGameState *>(gamestate);
 		// island specific testing
 		if( start_epoch == 0 && selected_island == 0 ) {
@@ -4462,7 +5935,17 @@ void Game::runTests() {
 			else if( !design->isErgonomicallyTerrific() ) {
 				throw string("rock weapon isn't ergonomically terrific");
 			}
+			// when deferred, requests should only be applied once the simulation processes the command queue
+			playingGameState->setDeferCommands(true);
 			playingGameState->setCurrentDesign(sx, sy, design);
+			if( start_sector->getCurrentDesign() == design ) {
+				throw string("deferred command applied before being processed");
+			}
+			playingGameState->processCommands();
+			playingGameState->setDeferCommands(false);
+			if( start_sector->getCurrentDesign() != design ) {
+				throw string("deferred command not applied");
+			}
 			start_sector->invent(human_player);
 			if( !start_sector->canBuildDesign(design) ) {
 				throw string("can't build rock weapon");
@@ -5077,6 +6560,12 @@ void Game::runTests() {
 			}
 			playingGameState->shutdown(sx, sy);
 		}
+#ifdef NETWORK_SOCKETS
+		if( start_epoch == 0 && selected_island == 0 ) {
+			// n.b., adds a player, and reloads the game world
+			testNetworkLoopback();
+		}
+#endif
 
 		endIsland();
 		updateGame(); // needed to dispose the gamestate
@@ -5244,6 +6733,9 @@ void playGame(int n_args, char *args[]) {
 #endif
 
 	bool fullscreen = false;
+	bool run_benchmarks = false;
+	bool run_network_benchmark = false;
+	string network_address; // defaults to localhost on default_network_port_c
 #if defined(__amigaos4__) || defined(AROS) || defined(__MORPHOS__)
 	fullscreen = false; // run in windowed mode due to reported performance problems in fullscreen mode on AmigaOS 4; also randomly hangs on AROS in fullscreen mode; also included MorphOS just to be safe
 #endif
@@ -5270,6 +6762,14 @@ void playGame(int n_args, char *args[]) {
 			game_g->setGameMode(GAMEMODE_MULTIPLAYER_SERVER);
 		else if( strcmp(args[i], "client") == 0 )
 			game_g->setGameMode(GAMEMODE_MULTIPLAYER_CLIENT);
+		else if( strncmp(args[i], "netaddress=", 11) == 0 )
+			network_address = args[i] + 11; // e.g., "netaddress=:27182", "netaddress=unix:/tmp/gigalomania"
+		else if( strcmp(args[i], "simthread") == 0 )
+			game_g->setUseSimulationThread(true);
+		else if( strcmp(args[i], "benchmark") == 0 )
+			run_benchmarks = true;
+		else if( strcmp(args[i], "netbenchmark") == 0 )
+			run_network_benchmark = true;
 	}
 #endif
 
@@ -5292,6 +6792,7 @@ void playGame(int n_args, char *args[]) {
 	LOG("set random seed to %d\n", seed);
 	srand( seed );
 
+
 	//bool run_tests = true;
 	bool run_tests = false;
 
@@ -5324,6 +6825,13 @@ void playGame(int n_args, char *args[]) {
 
 	LOG("successfully opened libraries\n");
 
+	if( run_benchmarks ) {
+		Gigalomania::Image::runBenchmarks();
+		delete game_g;
+		game_g = NULL;
+		return;
+	}
+
 	bool ok = true;
 	if( !game_g->openScreen(fullscreen) ) {
 		LOG("failed to open screen\n");
@@ -5382,20 +6890,20 @@ void playGame(int n_args, char *args[]) {
 	}
 	game_g->drawProgress(95);
 
-	for(size_t i=0;i<TrackedObject::getNumTags();i++) {
-		TrackedObject *to = TrackedObject::getTag(i);
-		if( to != NULL && strcmp( to->getClass(), "CLASS_IMAGE" ) == 0 ) {
-			Gigalomania::Image *image = (Gigalomania::Image *)to;
-			if( !image->convertToDisplayFormat() ) {
-				LOG("failed to convertToDisplayFormat\n");
-				LOG("delete game %d\n", game_g);
-				delete game_g;
-				game_g = NULL;
+	{
+		vector<Gigalomania::Image *> images;
+		for(size_t i=0;i<TrackedObject::getNumObjects(TrackedObject::TRACKED_IMAGE);i++) {
+			images.push_back( static_cast<Gigalomania::Image *>(TrackedObject::getObject(TrackedObject::TRACKED_IMAGE, i)) );
+		}
+		if( !Gigalomania::Image::convertToDisplayFormat(images) ) {
+			LOG("failed to convertToDisplayFormat\n");
+			LOG("delete game %d\n", game_g);
+			delete game_g;
+			game_g = NULL;
 #ifdef _WIN32
-				MessageBoxA(NULL, "Failed to create texture images", "Error", MB_OK|MB_ICONEXCLAMATION);
+			MessageBoxA(NULL, "Failed to create texture images", "Error", MB_OK|MB_ICONEXCLAMATION);
 #endif
-				return;
-			}
+			return;
 		}
 	}
 
@@ -5412,14 +6920,25 @@ void playGame(int n_args, char *args[]) {
 	if( run_tests ) {
 		game_g->runTests();
 	}
+	else if( run_network_benchmark ) {
+		game_g->runNetworkBenchmark();
+	}
 	else {
-		if( !game_g->loadState() ) {
+		// a client waits at the menu for the server's snapshot, rather than resuming its own game
+		if( game_g->getGameMode() == GAMEMODE_MULTIPLAYER_CLIENT || !game_g->loadState() ) {
 			game_g->setCurrentMap();
 			game_g->setGameStateID(GAMESTATEID_CHOOSEGAMETYPE);
 			//setGameStateID(GAMESTATEID_CHOOSEPLAYER);
 		}
+		if( game_g->getGameMode() != GAMEMODE_SINGLEPLAYER ) {
+			game_g->startNetwork(network_address);
+		}
 
+		if( game_g->isUseSimulationThread() ) {
+			game_g->startSimulationThread();
+		}
 		game_g->getApplication()->runMainLoop();
+		game_g->stopSimulationThread();
 	}
 
 	LOG("delete game %d\n", game_g);
@@ -26,7 +26,17 @@ class Player;
 class Application;
 class TextEffect;
 class Map;
+class SaveWriter;
+class SaveNode;
+class SaveAttribute;
+class BackgroundSaver;
+class ImagePack;
 class Tutorial;
+class TextToken;
+class Command;
+class NetServer;
+class NetClient;
+class NetFields;
 
 #include "common.h"
 #include "image.h"
@@ -151,22 +161,58 @@ class Game {
 	int n_men_store;
 	int n_player_suspended;
 
+	bool use_simulation_thread;
+	SDL_Thread *simulation_thread;
+	SDL_mutex *world_mutex; // held whilst the game world is being read or modified, when the simulation thread is running
+#if SDL_MAJOR_VERSION == 1
+#else
+	SDL_atomic_t simulation_thread_quit;
+#endif
+
+	BackgroundSaver *background_saver;
+	int last_periodic_autosave_time;
+	int periodic_autosave_index;
+	bool periodic_autosave_pending; // due, but waiting for the main loop to serialise it (see writePendingAutosave())
+
+	NetServer *net_server; // when GAMEMODE_MULTIPLAYER_SERVER
+	NetClient *net_client; // when GAMEMODE_MULTIPLAYER_CLIENT
+
+	ImagePack *image_pack; // if the images were loaded from the image pack, this must be kept until they're deleted
+
+	string epoch_sprites_gfx_dir;
+	bool epoch_sprites_loaded[n_epochs_c];
+	vector<int> epoch_sprites_lru; // most recently used first
+
 	void calculateScale(const Gigalomania::Image *image);
 	void convertToHiColor(Gigalomania::Image *image) const;
 	void processImage(Gigalomania::Image *image, bool old_smooth = true) const;
+	void createPlayerImages(Gigalomania::Image *player_images[n_players_c], Gigalomania::Image *image) const;
+	static void deletePlayerImages(Gigalomania::Image *player_images[n_players_c]);
 	bool loadAttackersWalkingImages(const string &gfx_dir, int epoch);
+	Gigalomania::Image *loadBuildingImage(const char *name, int epoch, int x, int y, int w, int h) const;
+	bool loadEpochSprites(int epoch);
+	void freeEpochSprites(int epoch);
+	void getImageSlots(vector<Gigalomania::Image **> *slots);
+	void getImagePackValues(vector<int> *values) const;
+	bool setImagePackValues(const vector<int> &values);
+	unsigned int getImagePackKey() const;
+	bool loadImagePack();
+	bool loadImagesFromSources(const string &gfx_dir, const string &background_filename);
+	void saveImagePack(const vector<string> &sources);
 	bool loadOldImages();
 	void getDesktopResolution(int *user_width, int *user_height) const;
 
 	const char *getFilename(int slot) const;
-	bool readMapProcessLine(int *epoch, int *index, Map **l_map, char *line, const int MAX_LINE, const char *filename);
+	bool readMapProcessLine(int *epoch, int *index, Map **l_map, int *sec_x, int *sec_y, TextToken line, const char *filename);
 	bool readMap(const char *filename);
 	bool loadGameInfo(DifficultyLevel *difficulty, int *player, int *n_men, int suspended[n_players_c], int *epoch, bool completed[max_islands_per_epoch_c], const char *filename) const;
 	bool loadGame(const char *filename);
-	GameState *loadStateParseXMLNode(const TiXmlNode *parent);
+	GameState *loadStateParseXMLNode(SaveNode *parent);
+	bool loadStateFromBuffer(const char *buffer, size_t length);
 	void copyFile(const char *src, const char *dst) const;
 
 	bool testFindSoldiersBuildingNewTower(const Sector *sector, int *total, int *squares) const;
+	void testNetworkLoopback();
 
 	void disposeGameState();
 
@@ -174,6 +220,11 @@ class Game {
 	void updatedEpoch();
 	void setEpoch(int epoch);
 	void cleanupPlayers();
+	void updateSimulation();
+	void updateSectors();
+	void updatePeriodicAutosave();
+	void writePeriodicAutosave();
+	void updateNetwork();
 public:
 	Gigalomania::Image *background;
 	Gigalomania::Image *background_stars;
@@ -340,6 +391,8 @@ public:
 	bool isUsingOldGfx() const {
 		return this->using_old_gfx;
 	}
+	void getIslandSpriteEpochs(vector<int> *epochs) const;
+	bool requireEpochSprites();
 	void setTesting(bool is_testing) {
 		this->is_testing = is_testing;
 	}
@@ -362,6 +415,7 @@ public:
 		return this->screen;
 	}
 	bool isPaused() const;
+	bool isIdle() const;
 
 	void cycleTimeRate() {
 		time_rate++;
@@ -411,7 +465,7 @@ public:
 	DifficultyLevel getDifficultyLevel() const {
 		return this->difficulty_level;
 	}
-	void setGameStateID(GameStateID state, GameState *new_gamestate = NULL);
+	bool setGameStateID(GameStateID state, GameState *new_gamestate = NULL);
 	GameStateID getGameStateID() const {
 		return this->gameStateID;
 	}
@@ -428,6 +482,7 @@ public:
 		return this->gameResult;
 	}
 	void setupTutorial(const string &id);
+	void cancelTutorial();
 	const Tutorial *getTutorial() const {
 		return this->tutorial;
 	}
@@ -480,6 +535,9 @@ public:
 
 	void deleteState() const;
 	void saveState() const;
+	void writeState(SaveWriter &writer) const;
+	void writeState(SaveWriter &writer, int client_player) const; // as seen by client_player
+	bool exportStateXML(const char *filename) const;
 	bool loadState();
 
 	int getMenAvailable() const;
@@ -502,10 +560,36 @@ public:
 	void mouseClick(int m_x, int m_y, bool m_left, bool m_middle, bool m_right, bool click);
 	void updateGame();
 	void drawGame() const;
+
+	// the simulation (AI and sectors) can optionally be run on its own thread, at a fixed rate
+	void setUseSimulationThread(bool use_simulation_thread) {
+		this->use_simulation_thread = use_simulation_thread;
+	}
+	bool isUseSimulationThread() const {
+		return this->use_simulation_thread;
+	}
+	bool isSimulationThreaded() const {
+		return this->simulation_thread != NULL;
+	}
+	bool startSimulationThread();
+	void stopSimulationThread();
+	void runSimulationThread();
+	bool lockWorld(bool wait);
+	void unlockWorld();
+	void writePendingAutosave();
+
+	// multiplayer (see network.h); the server runs the game as normal, and clients replicate it
+	bool startNetwork(const string &address);
+	int addNetworkPlayer();
+	bool submitNetworkCommand(const Command &command);
+	bool sendNetworkCommand(const Command &command);
+	bool loadNetworkSnapshot(const char *buffer, size_t length);
+	void endNetworkGame(GameResult result);
+	void netFields(NetFields &fields);
+
 	void addTextEffect(TextEffect *effect);
 	void drawProgress(int percentage) const;
 
-	bool readLineFromRWOps(bool &ok, SDL_RWops *file, char *buffer, char *line, int MAX_LINE, int &buffer_offset, int &newline_index, bool &reached_end);
 	bool loadGameInfo(DifficultyLevel *difficulty, int *player, int *n_men, int suspended[n_players_c], int *epoch, bool completed[max_islands_per_epoch_c], int slot);
 	bool loadGame(int slot);
 	void saveGame(int slot) const;
@@ -520,6 +604,7 @@ public:
 	bool playerAlive(int player) const;
 
 	void runTests();
+	void runNetworkBenchmark(); // logs the bytes per tick of the state updates sent to clients, during a large battle
 };
 
 extern Game *game_g;
@@ -553,6 +638,7 @@ class Map {
 	Sector *sectors[map_width_c][map_height_c];
 	bool sector_at[map_width_c][map_height_c];
 	bool reserved[map_width_c][map_height_c]; // if true, don't use for starting players - used for testing
+	int elements[map_width_c][map_height_c][N_ID]; // starting amounts, read along with the rest of the map at startup
 
 public:
 
@@ -570,7 +656,9 @@ public:
 	bool isSectorAt(int x, int y) const;
 
 	void newSquareAt(int x,int y);
+	void setElements(int x, int y, Id id, int n_elements);
 	void createSectors(PlayingGameState *gamestate, int epoch);
+	void setupSectorElements();
 #if 0
 	void checkSectors() const;
 #endif
@@ -596,7 +684,7 @@ public:
 	void canMoveTo(bool temp[map_width_c][map_height_c], int sx,int sy,int player) const;
 	void calculateStats() const;
 
-	void saveStateSectors(stringstream &stream) const;
+	void saveStateSectors(SaveWriter &writer) const;
 };
 
 void playGame(int n_args, char *args[]);
@@ -19,6 +19,7 @@
 #include "screen.h"
 #include "image.h"
 #include "sound.h"
+#include "savestate.h"
 
 //---------------------------------------------------------------------------
 
@@ -253,6 +254,7 @@ GameState::GameState(int client_player) : client_player(client_player) {
     this->confirm_button_1 = NULL;
     this->confirm_button_2 = NULL;
     this->confirm_button_3 = NULL;
+	this->static_layer = NULL;
 }
 
 GameState::~GameState() {
@@ -263,6 +265,8 @@ GameState::~GameState() {
 	}
 	if( whitefade != NULL )
 		delete whitefade;
+	if( static_layer != NULL )
+		delete static_layer;
 
 	if( this->screen_page )
 		delete screen_page;
@@ -331,15 +335,61 @@ void GameState::draw() {
 			str << fps;
 			Gigalomania::Image::writeMixedCase(4, default_height_c - 16, game_g->letters_large, game_g->letters_small, game_g->numbers_white, str.str().c_str(), Gigalomania::Image::JUSTIFY_LEFT);
 		}
+#if SDL_MAJOR_VERSION == 1
+#else
+		stringstream draw_calls_str;
+		draw_calls_str << "draw calls " << Gigalomania::SpriteBatch::getNDrawCallsLastFrame();
+		Gigalomania::Image::writeMixedCase(4, default_height_c - 32, game_g->letters_large, game_g->letters_small, game_g->numbers_white, draw_calls_str.str().c_str(), Gigalomania::Image::JUSTIFY_LEFT);
+#endif
+		stringstream frame_time_str;
+		frame_time_str << "frame ms p50 " << (int)game_g->getApplication()->getFrameTimePercentile(50.0f) << " p99 " << (int)game_g->getApplication()->getFrameTimePercentile(99.0f);
+		Gigalomania::Image::writeMixedCase(4, default_height_c - 48, game_g->letters_large, game_g->letters_small, game_g->numbers_white, frame_time_str.str().c_str(), Gigalomania::Image::JUSTIFY_LEFT);
 	}
 
 	game_g->getScreen()->refresh();
 }
 
 void GameState::mouseClick(int m_x,int m_y,bool m_left,bool m_middle,bool m_right,bool click) {
+	// the click may change any of the panels
+	this->invalidateStaticLayer();
 	this->screen_page->input(m_x, m_y, m_left, m_middle, m_right, click);
 }
 
+/* Returns true if the static layer needs redrawing, in which case the caller should draw its content, then call endStaticLayer().
+*  Popups are skipped, as they depend on the mouse position and time; instead, call drawDeferredPopups() on the panels every frame.
+*/
+bool GameState::beginStaticLayer() {
+	if( static_layer == NULL ) {
+		static_layer = new Gigalomania::RenderLayer(game_g->getScreen());
+	}
+	if( !static_layer->beginUpdate() ) {
+		return false;
+	}
+	PanelPage::setDeferPopups(true);
+	return true;
+}
+
+void GameState::endStaticLayer() {
+	PanelPage::setDeferPopups(false);
+	static_layer->endUpdate();
+}
+
+void GameState::invalidateStaticLayer() {
+	if( static_layer != NULL ) {
+		static_layer->invalidate();
+	}
+}
+
+/* Returns true if the display only changes with input: either the game is paused, or this state draws everything
+*  other than popups and the mouse pointer in its static layer; and no fade is in progress.
+*/
+bool GameState::isIdle() const {
+	if( fade != NULL || whitefade != NULL ) {
+		return false;
+	}
+	return game_g->isPaused() || static_layer != NULL;
+}
+
 void GameState::requestQuit(bool force_quit) {
 	game_g->getApplication()->setQuit();
 }
@@ -400,16 +450,22 @@ void ChooseGameTypeGameState::reset() {
 		this->choosegametypePanel = NULL;
 	}
 	this->choosegametypePanel = new ChooseGameTypePanel();
+	this->invalidateStaticLayer();
 }
 
 void ChooseGameTypeGameState::draw() {
 	game_g->getScreen()->clear(); // SDL on Android and OS X at least require screen to be cleared (otherwise we get corrupt regions outside of the main area)
-	game_g->background->draw(0, 0);
+	if( this->beginStaticLayer() ) {
+		game_g->background->draw(0, 0);
 
-	this->choosegametypePanel->draw();
+		this->choosegametypePanel->draw();
 
-	this->screen_page->draw();
-	//this->screen_page->drawPopups();
+		this->screen_page->draw();
+		this->endStaticLayer();
+	}
+	this->static_layer->draw();
+	this->choosegametypePanel->drawDeferredPopups();
+	this->screen_page->drawDeferredPopups();
 
 	GameState::setDefaultMouseImage();
 	GameState::draw();
@@ -445,15 +501,22 @@ void ChooseDifficultyGameState::reset() {
 		this->choosedifficultyPanel = NULL;
 	}
 	this->choosedifficultyPanel = new ChooseDifficultyPanel();
+	this->invalidateStaticLayer();
 }
 
 void ChooseDifficultyGameState::draw() {
 	game_g->getScreen()->clear(); // SDL on Android and OS X at least require screen to be cleared (otherwise we get corrupt regions outside of the main area)
-	game_g->background->draw(0, 0);
+	if( this->beginStaticLayer() ) {
+		game_g->background->draw(0, 0);
 
-	this->choosedifficultyPanel->draw();
+		this->choosedifficultyPanel->draw();
 
-	this->screen_page->draw();
+		this->screen_page->draw();
+		this->endStaticLayer();
+	}
+	this->static_layer->draw();
+	this->choosedifficultyPanel->drawDeferredPopups();
+	this->screen_page->drawDeferredPopups();
 
 	GameState::setDefaultMouseImage();
 	GameState::draw();
@@ -507,25 +570,31 @@ void ChoosePlayerGameState::reset() {
 	screen_page->add(new Button(xpos+xindent, ypos+ylargediff+ysmalldiff, "BUILDINGS STRONGER AGAINST ATTACK", game_g->letters_small));
 	ypos += ydiff;
 	screen_page->add(button_blue);
+	this->invalidateStaticLayer();
 }
 
 void ChoosePlayerGameState::draw() {
 	game_g->getScreen()->clear(); // SDL on Android and OS X at least require screen to be cleared (otherwise we get corrupt regions outside of the main area)
-	//player_select->draw(0, 0, false);
-	game_g->background->draw(0, 0);
-    Gigalomania::Image::writeMixedCase(160, 16, game_g->letters_large, game_g->letters_small, NULL, "Select a Player", Gigalomania::Image::JUSTIFY_CENTRE);
-
-	const int y_offset = 2; // must be even, otherwise we have graphical problems when running at 1280x1024 mode
-	if( game_g->player_heads_select[0] != NULL )
-		game_g->player_heads_select[0]->draw(button_red->getLeft(), button_red->getTop()+y_offset);
-	if( game_g->player_heads_select[1] != NULL )
-		game_g->player_heads_select[1]->draw(button_green->getLeft(), button_green->getTop()+y_offset);
-	if( game_g->player_heads_select[2] != NULL )
-		game_g->player_heads_select[2]->draw(button_yellow->getLeft(), button_yellow->getTop()+y_offset);
-	if( game_g->player_heads_select[3] != NULL )
-		game_g->player_heads_select[3]->draw(button_blue->getLeft(), button_blue->getTop()+y_offset);
-
-	this->screen_page->draw();
+	if( this->beginStaticLayer() ) {
+		//player_select->draw(0, 0, false);
+		game_g->background->draw(0, 0);
+		Gigalomania::Image::writeMixedCase(160, 16, game_g->letters_large, game_g->letters_small, NULL, "Select a Player", Gigalomania::Image::JUSTIFY_CENTRE);
+
+		const int y_offset = 2; // must be even, otherwise we have graphical problems when running at 1280x1024 mode
+		if( game_g->player_heads_select[0] != NULL )
+			game_g->player_heads_select[0]->draw(button_red->getLeft(), button_red->getTop()+y_offset);
+		if( game_g->player_heads_select[1] != NULL )
+			game_g->player_heads_select[1]->draw(button_green->getLeft(), button_green->getTop()+y_offset);
+		if( game_g->player_heads_select[2] != NULL )
+			game_g->player_heads_select[2]->draw(button_yellow->getLeft(), button_yellow->getTop()+y_offset);
+		if( game_g->player_heads_select[3] != NULL )
+			game_g->player_heads_select[3]->draw(button_blue->getLeft(), button_blue->getTop()+y_offset);
+
+		this->screen_page->draw();
+		this->endStaticLayer();
+	}
+	this->static_layer->draw();
+	this->screen_page->drawDeferredPopups();
 
 	GameState::setDefaultMouseImage();
 	GameState::draw();
@@ -579,14 +648,20 @@ void ChooseTutorialGameState::reset() {
 		screen_page->add(button);
 		buttons.push_back(button);
 	}
+	this->invalidateStaticLayer();
 }
 
 void ChooseTutorialGameState::draw() {
 	game_g->getScreen()->clear(); // SDL on Android and OS X at least require screen to be cleared (otherwise we get corrupt regions outside of the main area)
-	game_g->background->draw(0, 0);
-    Gigalomania::Image::writeMixedCase(160, 16, game_g->letters_large, game_g->letters_small, NULL, "Select a Tutorial", Gigalomania::Image::JUSTIFY_CENTRE);
+	if( this->beginStaticLayer() ) {
+		game_g->background->draw(0, 0);
+		Gigalomania::Image::writeMixedCase(160, 16, game_g->letters_large, game_g->letters_small, NULL, "Select a Tutorial", Gigalomania::Image::JUSTIFY_CENTRE);
 
-	this->screen_page->draw();
+		this->screen_page->draw();
+		this->endStaticLayer();
+	}
+	this->static_layer->draw();
+	this->screen_page->drawDeferredPopups();
 
 	GameState::setDefaultMouseImage();
 	GameState::draw();
@@ -601,7 +676,10 @@ void ChooseTutorialGameState::mouseClick(int m_x,int m_y,bool m_left,bool m_midd
 			game_g->setupTutorial(button->getId());
 			game_g->setCurrentIsand(game_g->getTutorial()->getStartEpoch(), game_g->getTutorial()->getIsland());
 			game_g->setupPlayers();
-			game_g->setGameStateID(GAMESTATEID_PLAYING);
+			if( !game_g->setGameStateID(GAMESTATEID_PLAYING) ) {
+				game_g->cancelTutorial();
+				game_g->addTextEffect(new TextEffect("failed to load the tutorial", default_width_c/2, default_height_c/2, 3000));
+			}
 			break;
 		}
 	}
@@ -913,6 +991,9 @@ PlayingGameState::PlayingGameState(int client_player) : GameState(client_player)
 	}
 	alliance_yes = NULL;
 	alliance_no = NULL;
+	this->defer_commands = false;
+	this->background_layer = NULL;
+	this->background_layer_map = false;
 
 	game_g->setTimeRate(client_player == PLAYER_DEMO ? 5 : 1);
 }
@@ -938,6 +1019,8 @@ PlayingGameState::~PlayingGameState() {
 	}
 	if( this->gamePanel )
 		delete gamePanel;
+	if( this->background_layer )
+		delete background_layer;
 	LOG("~PlayingGameState() done\n");
 }
 
@@ -964,151 +1047,6 @@ void PlayingGameState::createQuitWindow() {
 	}
 }
 
-bool PlayingGameState::readSectorsProcessLine(Map *map, char *line, bool *done_header, int *sec_x, int *sec_y) {
-	bool ok = true;
-	line[ strlen(line) - 1 ] = '\0'; // trim new line
-	line[ strlen(line) - 1 ] = '\0'; // trim carriage return
-	if( !(*done_header) ) {
-		if( line[0] != '#' ) {
-			LOG("expected first character to be '#'\n");
-			ok = false;
-			return ok;
-		}
-		// ignore rest of header
-		*done_header = true;
-	}
-	else {
-		char *line_ptr = line;
-		while( *line_ptr == ' ' || *line_ptr == '\t' ) // avoid initial whitespace
-			line_ptr++;
-		char *comment = strchr(line_ptr, '#');
-		if( comment != NULL ) { // trim comments
-			*comment = '\0';
-		}
-		char *ptr = strtok(line_ptr, " ");
-		if( ptr == NULL ) {
-			// this line may be a comment
-		}
-		else if( strcmp(ptr, "SECTOR") == 0 ) {
-			ptr = strtok(NULL, " ");
-			if( ptr == NULL ) {
-				LOG("can't find sec_x\n");
-				ok = false;
-				return ok;
-			}
-			*sec_x = atoi(ptr);
-			if( *sec_x < 0 || *sec_x >= map_width_c ) {
-				LOG("invalid map x %d\n", *sec_x);
-				ok = false;
-				return ok;
-			}
-
-			ptr = strtok(NULL, " ");
-			if( ptr == NULL ) {
-				LOG("can't find sec_y\n");
-				ok = false;
-				return ok;
-			}
-			*sec_y = atoi(ptr);
-			if( *sec_y < 0 || *sec_y >= map_height_c ) {
-				LOG("invalid map y %d\n", *sec_y);
-				ok = false;
-				return ok;
-			}
-		}
-		else if( strcmp(ptr, "ELEMENT") == 0 ) {
-			if( *sec_x == -1 || *sec_y == -1 ) {
-				LOG("sector not defined\n");
-				ok = false;
-				return ok;
-			}
-			ptr = strtok(NULL, " ");
-			if( ptr == NULL ) {
-				LOG("can't find element name\n");
-				ok = false;
-				return ok;
-			}
-			/*char elementname[MAX_LINE+1] = "";
-			strcpy(elementname, ptr);*/
-			string elementname = ptr;
-
-			ptr = strtok(NULL, " ");
-			if( ptr == NULL ) {
-				LOG("can't find n_elements\n");
-				ok = false;
-				return ok;
-			}
-			int n_elements = atoi(ptr);
-
-			Id element = UNDEFINED;
-			for(int i=0;i<N_ID;i++) {
-				if( strcmp( game_g->elements[i]->getName(), elementname.c_str() ) == 0 ) {
-					element = (Id)i;
-				}
-			}
-			if( element == UNDEFINED ) {
-				LOG("unknown element: %s\n", elementname.c_str());
-				ok = false;
-				return ok;
-			}
-
-			game_g->getMap()->getSector(*sec_x, *sec_y)->setElements(element, n_elements);
-		}
-		else {
-			LOG("unknown word: %s\n", ptr);
-			ok = false;
-			return ok;
-		}
-	}
-	return ok;
-}
-
-bool PlayingGameState::readSectors(Map *map) {
-	bool ok = true;
-	const int MAX_LINE = 4096;
-	char line[MAX_LINE+1] = "";
-	int sec_x = -1, sec_y = -1;
-	bool done_header = false;
-
-    char fullname[4096] = "";
-	sprintf(fullname, "%s/%s", maps_dirname.c_str(), game_g->getMap()->getFilename());
-	// open in binary mode, so that we parse files in an OS-independent manner
-	// (otherwise, Windows will parse "\r\n" as being "\n", but Linux will still read it as "\n")
-	//FILE *file = fopen(fullname, "rb");
-	SDL_RWops *file = SDL_RWFromFile(fullname, "rb");
-#ifdef DATADIR
-	if( file == NULL ) {
-		LOG("searching in /usr/share/gigalomania/ for islands folder\n");
-		sprintf(fullname, "%s/%s", alt_maps_dirname.c_str(), game_g->getMap()->getFilename());
-		file = SDL_RWFromFile(fullname, "rb");
-	}
-#endif
-	if( file == NULL ) {
-		LOG("failed to open file: %s\n", fullname);
-		//perror("perror returns: ");
-		return false;
-	}
-	char buffer[MAX_LINE+1] = "";
-	int buffer_offset = 0;
-	bool reached_end = false;
-	int newline_index = 0;
-	while( ok ) {
-		bool done = game_g->readLineFromRWOps(ok, file, buffer, line, MAX_LINE, buffer_offset, newline_index, reached_end);
-		if( !ok )  {
-			LOG("failed to read line\n");
-		}
-		else if( done ) {
-			break;
-		}
-		else {
-			ok = readSectorsProcessLine(map, line, &done_header, &sec_x, &sec_y);
-		}
-	}
-	file->close(file);
-
-	return ok;
-}
-
 void PlayingGameState::createSectors(int x, int y, int n_men) {
 	LOG("PlayingGameState::createSectors(%d, %d, %d)\n", x, y, n_men);
 
@@ -1153,10 +1091,7 @@ void PlayingGameState::createSectors(int x, int y, int n_men) {
 		//enemy_sector->createTower(enemy_player, 200);
 	}
 
-	if( !readSectors(game_g->getMap()) ) {
-		LOG("failed to read map sector info!\n");
-		ASSERT(false);
-	}
+	game_g->getMap()->setupSectorElements();
 }
 
 GamePanel *PlayingGameState::getGamePanel() {
@@ -1467,7 +1402,6 @@ void PlayingGameState::getFlagOffset(int *offset_x, int *offset_y, int epoch) co
 
 void PlayingGameState::draw() {
 	game_g->getScreen()->clear(); // SDL on Android and OS X at least require screen to be cleared (otherwise we get corrupt regions outside of the main area)
-	game_g->background_stars->draw(0, 0);
 
 	bool no_armies = true;
 	for(int i=0;i<n_players_c && no_armies;i++) {
@@ -1481,6 +1415,24 @@ void PlayingGameState::draw() {
 		this->reset();
 	}
 
+	// the stars and map don't change during play, so are cached, and only redrawn if we switch to or from the map
+	bool show_map = this->player_asking_alliance == -1 && this->map_display == MAPDISPLAY_MAP;
+	if( this->background_layer == NULL ) {
+		this->background_layer = new Gigalomania::RenderLayer(game_g->getScreen());
+	}
+	else if( this->background_layer_map != show_map ) {
+		this->background_layer->invalidate();
+	}
+	this->background_layer_map = show_map;
+	if( this->background_layer->beginUpdate() ) {
+		game_g->background_stars->draw(0, 0);
+		if( show_map ) {
+			game_g->getMap()->draw(offset_map_x_c, offset_map_y_c);
+		}
+		this->background_layer->endUpdate();
+	}
+	this->background_layer->draw();
+
 	if( this->player_asking_alliance != -1 ) {
 		// ask alliance
 		if( game_g->player_heads_alliance[player_asking_alliance] != NULL ) {
@@ -1495,9 +1447,7 @@ void PlayingGameState::draw() {
 		Gigalomania::Image::write(offset_map_x_c + 8, offset_map_y_c + 16, game_g->letters_small, str.str().c_str(), Gigalomania::Image::JUSTIFY_LEFT);
 	}
 	else if( this->map_display == MAPDISPLAY_MAP ) {
-		// map
-
-		game_g->getMap()->draw(offset_map_x_c, offset_map_y_c);
+		// map (the map itself is drawn in the background layer)
 		for(int y=0;y<map_height_c;y++) {
 			for(int x=0;x<map_width_c;x++) {
 				if( game_g->getMap()->getSector(x, y) != NULL ) {
@@ -2947,261 +2897,440 @@ void PlayingGameState::refreshShieldNumberPanels() {
 }
 
 void PlayingGameState::setNDesigners(int sector_x, int sector_y, int n_designers) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		if( sector->getCurrentDesign() != NULL ) {
-			sector->setDesigners(n_designers);
-		}
-	}
+	Command command(Command::COMMAND_SET_N_DESIGNERS, client_player, sector_x, sector_y);
+	command.args[0] = n_designers;
+	submitCommand(command);
 }
 
 void PlayingGameState::setNWorkers(int sector_x, int sector_y, int n_workers) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		if( sector->getCurrentManufacture() != NULL ) {
-			sector->setWorkers(n_workers);
-		}
-	}
+	Command command(Command::COMMAND_SET_N_WORKERS, client_player, sector_x, sector_y);
+	command.args[0] = n_workers;
+	submitCommand(command);
 }
 
 void PlayingGameState::setFAmount(int sector_x, int sector_y, int n_famount) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		if( sector->getCurrentManufacture() != NULL ) {
-			sector->setFAmount(n_famount);
-		}
-	}
+	Command command(Command::COMMAND_SET_F_AMOUNT, client_player, sector_x, sector_y);
+	command.args[0] = n_famount;
+	submitCommand(command);
 }
 
 void PlayingGameState::setNMiners(int sector_x, int sector_y, Id element, int n_miners) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		if( sector->canMine(element) ) {
-			sector->setMiners(element, n_miners);
-		}
-	}
+	Command command(Command::COMMAND_SET_N_MINERS, client_player, sector_x, sector_y);
+	command.args[0] = element;
+	command.args[1] = n_miners;
+	submitCommand(command);
 }
 
 void PlayingGameState::setNBuilders(int sector_x, int sector_y, Type type, int n_builders) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		if( sector->canBuild(type) ) {
-			sector->setBuilders(type, n_builders);
-		}
-	}
+	Command command(Command::COMMAND_SET_N_BUILDERS, client_player, sector_x, sector_y);
+	command.args[0] = type;
+	command.args[1] = n_builders;
+	submitCommand(command);
 }
 
 void PlayingGameState::setCurrentDesign(int sector_x, int sector_y, Design *design) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		sector->setCurrentDesign(design);
-	}
+	Command command(Command::COMMAND_SET_CURRENT_DESIGN, client_player, sector_x, sector_y);
+	command.setDesignArgs(design);
+	submitCommand(command);
 }
 
 void PlayingGameState::setCurrentManufacture(int sector_x, int sector_y, Design *design) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		sector->setCurrentManufacture(design);
-	}
+	Command command(Command::COMMAND_SET_CURRENT_MANUFACTURE, client_player, sector_x, sector_y);
+	command.setDesignArgs(design);
+	submitCommand(command);
 }
 
 void PlayingGameState::assembledArmyEmpty(int sector_x, int sector_y) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		sector->getAssembledArmy()->empty();
-	}
+	Command command(Command::COMMAND_ASSEMBLED_ARMY_EMPTY, client_player, sector_x, sector_y);
+	submitCommand(command);
 }
 
 bool PlayingGameState::assembleArmyUnarmed(int sector_x, int sector_y, int n) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		int n_spare = sector->getAvailablePopulation();
-		if( n_spare >= n ) {
-			int n_population = sector->getPopulation();
-			sector->getAssembledArmy()->add(n_epochs_c, n);
-			sector->setPopulation(n_population - n);
-			return true;
-		}
-	}
-	return false;
+	Command command(Command::COMMAND_ASSEMBLE_ARMY_UNARMED, client_player, sector_x, sector_y);
+	command.args[0] = n;
+	return submitCommand(command);
 }
 
 bool PlayingGameState::assembleArmy(int sector_x, int sector_y, int epoch, int n) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		if( sector->assembleArmy(epoch, n) ) {
-			return true;
-		}
-	}
-	return false;
+	Command command(Command::COMMAND_ASSEMBLE_ARMY, client_player, sector_x, sector_y);
+	command.args[0] = epoch;
+	command.args[1] = n;
+	return submitCommand(command);
 }
 
 bool PlayingGameState::assembleAll(int sector_x, int sector_y, bool include_unarmed) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		sector->assembleAll(include_unarmed);
-	}
+	Command command(Command::COMMAND_ASSEMBLE_ALL, client_player, sector_x, sector_y);
+	command.args[0] = include_unarmed ? 1 : 0;
+	submitCommand(command);
 	return false;
 }
 
 void PlayingGameState::returnAssembledArmy(int sector_x, int sector_y) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		sector->returnAssembledArmy();
-	}
+	Command command(Command::COMMAND_RETURN_ASSEMBLED_ARMY, client_player, sector_x, sector_y);
+	submitCommand(command);
 }
 
 bool PlayingGameState::returnArmy(int sector_x, int sector_y, int src_x, int src_y) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		Sector *src = game_g->getMap()->getSector(src_x, src_y);
-		Army *army = src->getArmy(client_player);
-		return sector->returnArmy(army);
-	}
-	return false;
+	Command command(Command::COMMAND_RETURN_ARMY, client_player, sector_x, sector_y);
+	command.args[0] = src_x;
+	command.args[1] = src_y;
+	return submitCommand(command);
 }
 
 bool PlayingGameState::moveArmyTo(int src_x, int src_y, int target_x, int target_y) {
-	Sector *src = game_g->getMap()->getSector(src_x, src_y);
-	Sector *target = game_g->getMap()->getSector(target_x, target_y);
-	ASSERT(src != NULL);
-	ASSERT(target != NULL);
-	Army *army = src->getArmy(client_player);
-	return target->moveArmy(army);
+	Command command(Command::COMMAND_MOVE_ARMY_TO, client_player, src_x, src_y);
+	command.args[0] = target_x;
+	command.args[1] = target_y;
+	return submitCommand(command);
 }
 
 bool PlayingGameState::moveAssembledArmyTo(int src_x, int src_y, int target_x, int target_y) {
-	Sector *src = game_g->getMap()->getSector(src_x, src_y);
-	ASSERT(src != NULL);
-	if( src->getActivePlayer() == client_player ) {
-		Army *army = src->getAssembledArmy();
-		Sector *target = game_g->getMap()->getSector(target_x, target_y);
-		ASSERT(target != NULL);
-		return target->moveArmy(army);
-	}
-	return false;
+	Command command(Command::COMMAND_MOVE_ASSEMBLED_ARMY_TO, client_player, src_x, src_y);
+	command.args[0] = target_x;
+	command.args[1] = target_y;
+	return submitCommand(command);
 }
 
 bool PlayingGameState::nukeSector(int src_x, int src_y, int target_x, int target_y) {
-	Sector *src = game_g->getMap()->getSector(src_x, src_y);
-	Sector *target = game_g->getMap()->getSector(target_x, target_y);
-	ASSERT(src != NULL);
-	ASSERT(target != NULL);
-	if( src->getActivePlayer() == client_player ) {
-		if( target->nukeSector(src) ) {
-			this->assembledArmyEmpty(src_x, src_y);
-			return true;
-		}
-	}
-	return false;
+	Command command(Command::COMMAND_NUKE_SECTOR, client_player, src_x, src_y);
+	command.args[0] = target_x;
+	command.args[1] = target_y;
+	return submitCommand(command);
 }
 
 void PlayingGameState::deployDefender(int sector_x, int sector_y, Type type, int turret, int epoch) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		Building *building = sector->getBuilding(type);
-		if( building != NULL ) {
-			sector->deployDefender(building, turret, epoch);
-		}
-	}
+	Command command(Command::COMMAND_DEPLOY_DEFENDER, client_player, sector_x, sector_y);
+	command.args[0] = type;
+	command.args[1] = turret;
+	command.args[2] = epoch;
+	submitCommand(command);
 }
 
 void PlayingGameState::returnDefender(int sector_x, int sector_y, Type type, int turret) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		Building *building = sector->getBuilding(type);
-		if( building != NULL ) {
-			sector->returnDefender(building, turret);
-		}
-	}
+	Command command(Command::COMMAND_RETURN_DEFENDER, client_player, sector_x, sector_y);
+	command.args[0] = type;
+	command.args[1] = turret;
+	submitCommand(command);
 }
 
 void PlayingGameState::useShield(int sector_x, int sector_y, Type type, int shield) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		Building *building = sector->getBuilding(type);
-		if( building != NULL ) {
-			sector->useShield(building, shield);
+	Command command(Command::COMMAND_USE_SHIELD, client_player, sector_x, sector_y);
+	command.args[0] = type;
+	command.args[1] = shield;
+	submitCommand(command);
+}
+
+void PlayingGameState::trashDesign(int sector_x, int sector_y, Invention *invention) {
+	Command command(Command::COMMAND_TRASH_DESIGN, client_player, sector_x, sector_y);
+	command.setInventionArgs(invention);
+	submitCommand(command);
+}
+
+void PlayingGameState::shutdown(int sector_x, int sector_y) {
+	Command command(Command::COMMAND_SHUTDOWN, client_player, sector_x, sector_y);
+	submitCommand(command);
+}
+
+bool PlayingGameState::submitCommand(const Command &command) {
+	if( !command_queue.push(command) ) {
+		LOG("command queue full, dropping command: %s\n", Command::getName(command.type));
+		return false;
+	}
+	if( !defer_commands && !game_g->isSimulationThreaded() ) {
+		// simulation runs on this thread, so apply now
+		return this->processCommands();
+	}
+	// otherwise the simulation will apply the command at the start of its next step (see Game::updateSimulation())
+	return true;
+}
+
+bool PlayingGameState::processCommands() {
+	bool result = false;
+	Command command;
+	while( command_queue.pop(&command) ) {
+		if( game_g->getGameMode() == GAMEMODE_MULTIPLAYER_CLIENT ) {
+			// executed by the server, and we'll see the results in the state it sends back
+			game_g->sendNetworkCommand(command);
+		}
+		else {
+			result = this->executeCommand(command);
 		}
 	}
+	return result;
 }
 
-void PlayingGameState::trashDesign(int sector_x, int sector_y, Invention *invention) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		sector->trashDesign(invention);
+static Sector *getCommandSector(int x, int y) {
+	// n.b., commands may have come from elsewhere (e.g., loaded), so validate rather than assert on the positions
+	if( x < 0 || x >= map_width_c || y < 0 || y >= map_height_c ) {
+		return NULL;
 	}
+	return game_g->getMap()->getSector(x, y);
 }
 
-void PlayingGameState::shutdown(int sector_x, int sector_y) {
-	Sector *sector = game_g->getMap()->getSector(sector_x, sector_y);
-	ASSERT(sector != NULL);
-	if( sector->getActivePlayer() == client_player ) {
-		sector->shutdown(client_player);
+static bool validCount(int n, int current, int available) {
+	// the GUI only ever lowers a count, or raises it by at most the available population
+	return n >= 0 && ( n <= current || n - current <= available );
+}
+
+static bool wellFormedCommand(const Command &command) {
+	// checks that don't depend on the state of the world
+	if( command.player < 0 || command.player >= n_players_c || getCommandSector(command.sector_x, command.sector_y) == NULL ) {
+		return false;
+	}
+	switch( command.type ) {
+		case Command::COMMAND_SET_N_DESIGNERS:
+		case Command::COMMAND_SET_N_WORKERS:
+		case Command::COMMAND_ASSEMBLE_ARMY_UNARMED:
+			return command.args[0] >= 0;
+		case Command::COMMAND_SET_F_AMOUNT:
+			return command.args[0] >= 1 && command.args[0] <= infinity_c;
+		case Command::COMMAND_SET_N_MINERS:
+			return command.args[0] >= 0 && command.args[0] < N_ID && game_g->elements[command.args[0]]->getType() != Element::GATHERABLE && command.args[1] >= 0;
+		case Command::COMMAND_SET_N_BUILDERS:
+			return command.args[0] >= 0 && command.args[0] < N_BUILDINGS && command.args[1] >= 0;
+		case Command::COMMAND_SET_CURRENT_DESIGN:
+		case Command::COMMAND_SET_CURRENT_MANUFACTURE:
+			return ( command.args[0] == -1 && command.args[1] == -1 && command.args[2] == -1 ) || command.getInventionArg() != NULL;
+		case Command::COMMAND_ASSEMBLE_ARMY:
+			return command.args[0] >= 0 && command.args[0] < n_epochs_c && command.args[1] >= 0;
+		case Command::COMMAND_RETURN_ARMY:
+		case Command::COMMAND_MOVE_ARMY_TO:
+		case Command::COMMAND_MOVE_ASSEMBLED_ARMY_TO:
+		case Command::COMMAND_NUKE_SECTOR:
+			return getCommandSector(command.args[0], command.args[1]) != NULL;
+		case Command::COMMAND_DEPLOY_DEFENDER:
+			return command.args[0] >= 0 && command.args[0] < N_BUILDINGS && command.args[1] >= 0 && command.args[1] < max_building_turrets_c && command.args[2] >= 0 && command.args[2] < n_epochs_c;
+		case Command::COMMAND_RETURN_DEFENDER:
+			return command.args[0] >= 0 && command.args[0] < N_BUILDINGS && command.args[1] >= 0 && command.args[1] < max_building_turrets_c;
+		case Command::COMMAND_USE_SHIELD:
+			return command.args[0] >= 0 && command.args[0] < N_BUILDINGS && command.args[1] >= 0 && command.args[1] < n_shields_c;
+		case Command::COMMAND_TRASH_DESIGN:
+			return command.getInventionArg() != NULL;
+		case Command::COMMAND_ASSEMBLED_ARMY_EMPTY:
+		case Command::COMMAND_ASSEMBLE_ALL:
+		case Command::COMMAND_RETURN_ASSEMBLED_ARMY:
+		case Command::COMMAND_SHUTDOWN:
+			return true;
+		default:
+			break;
+	}
+	return false;
+}
+
+bool PlayingGameState::validateCommand(const Command &command, bool *malformed) const {
+	// n.b., the Sector methods that commands call only assert on their arguments, and commands may have come from a network client or a saved game, so check them against the real state of the sector here
+	if( malformed != NULL ) {
+		*malformed = false;
+	}
+	if( !wellFormedCommand(command) ) {
+		LOG("malformed command %s for player %d at %d, %d\n", Command::getName(command.type), command.player, command.sector_x, command.sector_y);
+		if( malformed != NULL ) {
+			*malformed = true;
+		}
+		return false;
+	}
+	// otherwise the command was valid for some state of the world, but may not be for this one (e.g., a network client may not have seen the latest state yet)
+	const Sector *sector = getCommandSector(command.sector_x, command.sector_y);
+	const int player = command.player;
+	if( command.type != Command::COMMAND_MOVE_ARMY_TO && sector->getActivePlayer() != player ) {
+		// all other commands are for a sector that the player owns
+		return false;
+	}
+	switch( command.type ) {
+		case Command::COMMAND_SET_N_DESIGNERS:
+			return sector->getCurrentDesign() != NULL && validCount(command.args[0], sector->getDesigners(), sector->getAvailablePopulation());
+		case Command::COMMAND_SET_N_WORKERS:
+			return sector->getCurrentManufacture() != NULL && validCount(command.args[0], sector->getWorkers(), sector->getAvailablePopulation());
+		case Command::COMMAND_SET_F_AMOUNT:
+			return sector->getCurrentManufacture() != NULL;
+		case Command::COMMAND_SET_N_MINERS:
+			{
+				Id element = static_cast<Id>(command.args[0]);
+				return sector->canMine(element) && validCount(command.args[1], sector->getMiners(element), sector->getAvailablePopulation());
+			}
+		case Command::COMMAND_SET_N_BUILDERS:
+			{
+				Type type = static_cast<Type>(command.args[0]);
+				return sector->canBuild(type) && validCount(command.args[1], sector->getBuilders(type), sector->getAvailablePopulation());
+			}
+		case Command::COMMAND_ASSEMBLE_ARMY_UNARMED:
+			return command.args[0] <= sector->getAvailablePopulation();
+		case Command::COMMAND_DEPLOY_DEFENDER:
+		case Command::COMMAND_RETURN_DEFENDER:
+		case Command::COMMAND_USE_SHIELD:
+			{
+				const Building *building = sector->getBuilding(static_cast<Type>(command.args[0]));
+				if( building == NULL ) {
+					return false;
+				}
+				else if( command.type == Command::COMMAND_DEPLOY_DEFENDER ) {
+					return command.args[1] < building->getNTurrets();
+				}
+				else if( command.type == Command::COMMAND_RETURN_DEFENDER ) {
+					return command.args[1] < building->getNTurrets() && building->getTurretMan(command.args[1]) != -1;
+				}
+			}
+			return true;
+		default:
+			break;
+	}
+	return true;
+}
+
+bool PlayingGameState::executeCommand(const Command &command) {
+	// the state may have changed since the command was submitted (e.g., if the simulation is threaded), so always check it again
+	if( !this->validateCommand(command, NULL) ) {
+		LOG("ignoring command %s from player %d, not valid for the current state\n", Command::getName(command.type), command.player);
+		return false;
+	}
+	Sector *sector = getCommandSector(command.sector_x, command.sector_y);
+	const int player = command.player;
+	switch( command.type ) {
+		case Command::COMMAND_SET_N_DESIGNERS:
+			sector->setDesigners(command.args[0]);
+			return true;
+		case Command::COMMAND_SET_N_WORKERS:
+			sector->setWorkers(command.args[0]);
+			return true;
+		case Command::COMMAND_SET_F_AMOUNT:
+			sector->setFAmount(command.args[0]);
+			return true;
+		case Command::COMMAND_SET_N_MINERS:
+			sector->setMiners(static_cast<Id>(command.args[0]), command.args[1]);
+			return true;
+		case Command::COMMAND_SET_N_BUILDERS:
+			sector->setBuilders(static_cast<Type>(command.args[0]), command.args[1]);
+			return true;
+		case Command::COMMAND_SET_CURRENT_DESIGN:
+			sector->setCurrentDesign(command.getDesignArg());
+			return true;
+		case Command::COMMAND_SET_CURRENT_MANUFACTURE:
+			sector->setCurrentManufacture(command.getDesignArg());
+			return true;
+		case Command::COMMAND_ASSEMBLED_ARMY_EMPTY:
+			sector->getAssembledArmy()->empty();
+			return true;
+		case Command::COMMAND_ASSEMBLE_ARMY_UNARMED:
+			{
+				int n = command.args[0];
+				int n_population = sector->getPopulation();
+				sector->getAssembledArmy()->add(n_epochs_c, n);
+				sector->setPopulation(n_population - n);
+				return true;
+			}
+		case Command::COMMAND_ASSEMBLE_ARMY:
+			return sector->assembleArmy(command.args[0], command.args[1]);
+		case Command::COMMAND_ASSEMBLE_ALL:
+			sector->assembleAll(command.args[0] != 0);
+			break;
+		case Command::COMMAND_RETURN_ASSEMBLED_ARMY:
+			sector->returnAssembledArmy();
+			return true;
+		case Command::COMMAND_RETURN_ARMY:
+			{
+				Sector *src = getCommandSector(command.args[0], command.args[1]);
+				Army *army = src->getArmy(player);
+				return sector->returnArmy(army);
+			}
+		case Command::COMMAND_MOVE_ARMY_TO:
+			{
+				Sector *target = getCommandSector(command.args[0], command.args[1]);
+				Army *army = sector->getArmy(player);
+				return target->moveArmy(army);
+			}
+		case Command::COMMAND_MOVE_ASSEMBLED_ARMY_TO:
+			{
+				Sector *target = getCommandSector(command.args[0], command.args[1]);
+				Army *army = sector->getAssembledArmy();
+				return target->moveArmy(army);
+			}
+		case Command::COMMAND_NUKE_SECTOR:
+			{
+				Sector *target = getCommandSector(command.args[0], command.args[1]);
+				if( target->nukeSector(sector) ) {
+					sector->getAssembledArmy()->empty();
+					return true;
+				}
+			}
+			break;
+		case Command::COMMAND_DEPLOY_DEFENDER:
+			sector->deployDefender(sector->getBuilding(static_cast<Type>(command.args[0])), command.args[1], command.args[2]);
+			return true;
+		case Command::COMMAND_RETURN_DEFENDER:
+			sector->returnDefender(sector->getBuilding(static_cast<Type>(command.args[0])), command.args[1]);
+			return true;
+		case Command::COMMAND_USE_SHIELD:
+			sector->useShield(sector->getBuilding(static_cast<Type>(command.args[0])), command.args[1]);
+			return true;
+		case Command::COMMAND_TRASH_DESIGN:
+			sector->trashDesign(command.getInventionArg());
+			return true;
+		case Command::COMMAND_SHUTDOWN:
+			sector->shutdown(player);
+			return true;
+		default:
+			LOG("unknown command type: %d\n", command.type);
+			ASSERT(false);
+			break;
 	}
+	return false;
 }
 
-void PlayingGameState::saveState(stringstream &stream) const {
-	stream << "<playing_gamestate>\n";
+void PlayingGameState::saveState(SaveWriter &writer) const {
+	writer.startElement("playing_gamestate");
 	if( game_g->getGameType() == GAMETYPE_TUTORIAL ) {
-		stream << "<tutorial ";
-		stream << "name=\"" << game_g->getTutorial()->getId().c_str() << "\" ";
+		writer.startElement("tutorial");
+		writer.addAttribute("name", game_g->getTutorial()->getId().c_str());
 		if( game_g->getTutorial()->getCard() != NULL ) {
-			stream << "current_card_name=\"" << game_g->getTutorial()->getCard()->getId().c_str() << "\" ";
+			writer.addAttribute("current_card_name", game_g->getTutorial()->getCard()->getId().c_str());
 		}
-		stream << "/>\n";
+		writer.endElement();
 	}
-	stream << "<current_sector x=\"" << current_sector->getXPos() << "\" y=\"" << current_sector->getYPos() << "\" />\n";
-	stream << "<game_panel page=\"" << this->gamePanel->getPage() << "\" />\n";
-	stream << "<player_asking_alliance player_id=\"" << player_asking_alliance << "\" />\n";
+	writer.startElement("current_sector");
+	writer.addAttribute("x", current_sector->getXPos());
+	writer.addAttribute("y", current_sector->getYPos());
+	writer.endElement();
+	writer.startElement("game_panel");
+	writer.addAttribute("page", this->gamePanel->getPage());
+	writer.endElement();
+	writer.startElement("player_asking_alliance");
+	writer.addAttribute("player_id", player_asking_alliance);
+	writer.endElement();
 
 	for(int i=0;i<n_players_c;i++) {
 		if( game_g->players[i] != NULL ) {
-			game_g->players[i]->saveState(stream);
+			game_g->players[i]->saveState(writer);
 		}
 	}
-	Player::saveStateAlliances(stream);
+	Player::saveStateAlliances(writer);
 	for(int i=0;i<n_players_c;i++) {
 		for(int j=0;j<n_epochs_c+1;j++) {
-			stream << "<n_deaths player_id=\"" << i << "\" epoch=\"" << j << "\" n=\"" << n_deaths[i][j] << "\" />\n";
+			writer.startElement("n_deaths");
+			writer.addAttribute("player_id", i);
+			writer.addAttribute("epoch", j);
+			writer.addAttribute("n", n_deaths[i][j]);
+			writer.endElement();
 		}
 	}
-	game_g->getMap()->saveStateSectors(stream);
-	stream << "</playing_gamestate>\n";
+	game_g->getMap()->saveStateSectors(writer);
+	writer.endElement();
 }
 
-void PlayingGameState::loadStateParseXMLMapXY(int *map_x, int *map_y, const TiXmlAttribute *attribute) {
+void PlayingGameState::loadStateParseXMLMapXY(int *map_x, int *map_y, const SaveAttribute *attribute) {
 	*map_x = -1;
 	*map_y = -1;
 	while( attribute != NULL ) {
-		const char *attribute_name = attribute->Name();
+		const char *attribute_name = attribute->getName();
 		if( strcmp(attribute_name, "x") == 0 ) {
-			*map_x = atoi(attribute->Value());
+			*map_x = attribute->getIntValue();
 		}
 		else if( strcmp(attribute_name, "y") == 0 ) {
-			*map_y = atoi(attribute->Value());
+			*map_y = attribute->getIntValue();
 		}
 		else {
 			// skip the other sector attributes, only interested in x/y in this subfunction
 		}
-		attribute = attribute->Next();
+		attribute = attribute->next();
 	}
 	if( *map_x < 0 || *map_x >= map_width_c || *map_y < 0 || *map_y >= map_height_c ) {
 		throw std::runtime_error("current_sector invalid map reference");
@@ -3211,21 +3340,20 @@ void PlayingGameState::loadStateParseXMLMapXY(int *map_x, int *map_y, const TiXm
 	}
 }
 
-void PlayingGameState::loadStateParseXMLNode(const TiXmlNode *parent) {
+void PlayingGameState::loadStateParseXMLNode(SaveNode *parent) {
 	if( parent == NULL ) {
 		return;
 	}
 	bool read_children = true;
 	//throw std::runtime_error("blah"); // test failing to load state
 
-	switch( parent->Type() ) {
-		case TiXmlNode::TINYXML_DOCUMENT:
+	switch( parent->getType() ) {
+		case SaveNode::SAVENODE_DOCUMENT:
 			break;
-		case TiXmlNode::TINYXML_ELEMENT:
+		case SaveNode::SAVENODE_ELEMENT:
 			{
-				const char *element_name = parent->Value();
-				const TiXmlElement *element = parent->ToElement();
-				const TiXmlAttribute *attribute = element->FirstAttribute();
+				const char *element_name = parent->getName();
+				const SaveAttribute *attribute = parent->getFirstAttribute();
 				if( strcmp(element_name, "playing_gamestate") == 0 ) {
 					// handled entirely by caller
 				}
@@ -3236,21 +3364,21 @@ void PlayingGameState::loadStateParseXMLNode(const TiXmlNode *parent) {
 					bool has_card_name = false;
 					string card_name;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "name") == 0 ) {
-							string name = attribute->Value();
+							string name = attribute->getValue();
 							game_g->setupTutorial(name);
 						}
 						else if( strcmp(attribute_name, "current_card_name") == 0 ) {
 							has_card_name = true;
-							card_name = attribute->Value();
+							card_name = attribute->getValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown playinggamestate/tutorial attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( game_g->getTutorial() == NULL ) {
 						throw std::runtime_error("unknown tutorial name");
@@ -3266,16 +3394,16 @@ void PlayingGameState::loadStateParseXMLNode(const TiXmlNode *parent) {
 				}
 				else if( strcmp(element_name, "player_asking_alliance") == 0 ) {
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "player_id") == 0 ) {
-							player_asking_alliance = atoi(attribute->Value());
+							player_asking_alliance = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown playinggamestate/player_asking_alliance attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 				}
 				else if( strcmp(element_name, "n_deaths") == 0 ) {
@@ -3283,22 +3411,22 @@ void PlayingGameState::loadStateParseXMLNode(const TiXmlNode *parent) {
 					int epoch = -1;
 					int n = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "player_id") == 0 ) {
-							player_id = atoi(attribute->Value());
+							player_id = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "epoch") == 0 ) {
-							epoch = atoi(attribute->Value());
+							epoch = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "n") == 0 ) {
-							n = atoi(attribute->Value());
+							n = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown playinggamestate/n_deaths attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( player_id == -1 || epoch == -1 || n == -1 ) {
 						throw std::runtime_error("n_deaths missing attributes");
@@ -3318,9 +3446,9 @@ void PlayingGameState::loadStateParseXMLNode(const TiXmlNode *parent) {
 				}
 				else if( strcmp(element_name, "game_panel") == 0 ) {
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "page") == 0 ) {
-							int page = atoi(attribute->Value());
+							int page = attribute->getIntValue();
 							if( page < 0 || page > GamePanel::N_STATES ) {
 								throw std::runtime_error("game_panel invalid page");
 							}
@@ -3331,7 +3459,7 @@ void PlayingGameState::loadStateParseXMLNode(const TiXmlNode *parent) {
 							LOG("unknown playinggamestate/game_panel attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 				}
 				else if( strcmp(element_name, "sector") == 0 ) {
@@ -3343,14 +3471,14 @@ void PlayingGameState::loadStateParseXMLNode(const TiXmlNode *parent) {
 				else if( strcmp(element_name, "player") == 0 ) {
 					int player_id = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "player_id") == 0 ) {
-							player_id = atoi(attribute->Value());
+							player_id = attribute->getIntValue();
 						}
 						else {
 							// everything else parsed by Player::loadStateParseXMLNode()
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( player_id < 0 || player_id >= n_players_c ) {
 						throw std::runtime_error("player invalid player_id");
@@ -3365,33 +3493,14 @@ void PlayingGameState::loadStateParseXMLNode(const TiXmlNode *parent) {
 				}
 				else {
 					// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
-					LOG("unknown playinggamestate tag at line %d col %d: %s\n", parent->Row(), parent->Column(), element_name);
+					LOG("unknown playinggamestate tag: %s\n", element_name);
 					ASSERT(false);
 				}
 			}
 			break;
-		case TiXmlNode::TINYXML_COMMENT:
-			break;
-		case TiXmlNode::TINYXML_UNKNOWN:
-			break;
-		case TiXmlNode::TINYXML_TEXT:
-			{
-				/*
-				// add to the existing node, not a child
-				vi_tree->setData( parent->Value() );
-				*/
-				/*VI_XMLTreeNode *vi_child = new VI_XMLTreeNode();
-				vi_child->setData( parent->Value() );
-				// add to the tree
-				vi_tree->addChild(vi_child);
-				vi_tree = vi_child;*/
-			}
-			break;
-		case TiXmlNode::TINYXML_DECLARATION:
-			break;
 	}
 
-	for(const TiXmlNode *child=parent->FirstChild();child!=NULL && read_children;child=child->NextSibling())  {
+	for(SaveNode *child=read_children ? parent->nextChild() : NULL;child!=NULL;child=parent->nextChild()) {
 		loadStateParseXMLNode(child);
 	}
 }
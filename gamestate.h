@@ -11,12 +11,14 @@ using std::stringstream;
 
 //#include "game.h"
 #include "common.h"
+#include "command.h"
 
 namespace Gigalomania {
 	class Image;
 	class ImageButton;
 	class Button;
 	class PanelPage;
+	class RenderLayer;
 }
 
 using Gigalomania::Button;
@@ -24,6 +26,9 @@ using Gigalomania::ImageButton;
 using Gigalomania::PanelPage;
 
 class PlayingGameState;
+class SaveWriter;
+class SaveNode;
+class SaveAttribute;
 class ChooseGameTypePanel;
 class ChooseDifficultyPanel;
 class ChooseMenPanel;
@@ -64,6 +69,9 @@ protected:
 	int xpos, ypos;
 	bool at_front;
 public:
+	// allocated from island_arena
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
 	Feature(Gigalomania::Image *image[],int n_frames,int xpos,int ypos) {
 		this->image = image;
 		this->n_frames = n_frames;
@@ -201,9 +209,12 @@ protected:
     Button *confirm_button_1;
     Button *confirm_button_2;
     Button *confirm_button_3;
+	Gigalomania::RenderLayer *static_layer; // for states whose display only changes with input: the background and panels, without popups
 
 	void setDefaultMouseImage();
     virtual void createQuitWindow();
+	bool beginStaticLayer();
+	void endStaticLayer();
 
 public:
 	GameState(int client_player);
@@ -225,6 +236,8 @@ public:
     virtual void requestQuit(bool force_quit);
 	virtual void requestConfirm() {
 	}
+	void invalidateStaticLayer();
+	bool isIdle() const;
 
 	void fadeScreen(bool out, int delay, void (*func_finish)());
 	void whiteFlash();
@@ -236,7 +249,7 @@ public:
         return confirm_window != NULL;
     }
 
-	virtual void saveState(stringstream &stream) const {
+	virtual void saveState(SaveWriter &writer) const {
 	}
 };
 
@@ -362,19 +375,21 @@ class PlayingGameState : public GameState {
 	Button *alliance_yes;
 	Button *alliance_no;
 	int n_deaths[n_players_c][n_epochs_c+1]; // saved
+	CommandQueue command_queue;
+	bool defer_commands;
+	Gigalomania::RenderLayer *background_layer; // the stars and (if displayed) map
+	bool background_layer_map; // whether background_layer includes the map
 
 	void getFlagOffset(int *offset_x, int *offset_y, int epoch) const;
 	bool openPitMine();
 	bool validSoldierLocation(int epoch,int xpos,int ypos);
 	bool buildingMouseClick(int s_m_x,int s_m_y,bool m_left,bool m_right,Building *building);
-	void moveTo(int map_x,int map_y);
 	void blueEffect(int xpos,int ypos,bool dir);
 	void refreshShieldNumberPanels();
 	void setupMapGUI();
-	bool readSectorsProcessLine(Map *map, char *line, bool *done_header, int *sec_x, int *sec_y);
-	bool readSectors(Map *map);
-	void loadStateParseXMLMapXY(int *map_x, int *map_y, const TiXmlAttribute *attribute);
+	void loadStateParseXMLMapXY(int *map_x, int *map_y, const SaveAttribute *attribute);
     virtual void createQuitWindow();
+	bool executeCommand(const Command &command);
 
 	//static void buttonSpeedClick(void *data, int arg, bool m_left, bool m_middle, bool m_right);
 public:
@@ -392,6 +407,7 @@ public:
 	virtual void requestConfirm();
 
 	GamePanel *getGamePanel();
+	void moveTo(int map_x,int map_y);
 	//Sector *getCurrentSector();
 	const Sector *getCurrentSector() const;
 	bool viewingActiveClientSector() const;
@@ -428,7 +444,9 @@ public:
 	void refreshTimeRate();
 
 	// functions for requesting a modification to the game world based on client user input
-	// for now, these functions make the modification themselves directly - later on, we can go via a server class
+	// these are turned into Commands and placed on the command queue, which is drained by the simulation (see processCommands())
+	// whilst commands aren't deferred, the queue is drained straight away, so the returned values reflect whether the request succeeded;
+	// when deferred, the return value only says whether the request was queued
 	void setNDesigners(int sector_x, int sector_y, int n_designers);
 	void setNWorkers(int sector_x, int sector_y, int n_workers);
 	void setFAmount(int sector_x, int sector_y, int n_famount);
@@ -457,8 +475,18 @@ public:
 	void shutdown(int sector_x, int sector_y);
 	//current_sector->shutdown();
 
-	virtual void saveState(stringstream &stream) const;
-	void loadStateParseXMLNode(const TiXmlNode *parent);
+	bool submitCommand(const Command &command);
+	bool validateCommand(const Command &command, bool *malformed) const; // whether command is allowed by the current state of the world; malformed (if not NULL) is set if it never could be
+	bool processCommands(); // returns the result of the last command processed, or false if there were none
+	void setDeferCommands(bool defer_commands) {
+		this->defer_commands = defer_commands;
+	}
+	bool isDeferCommands() const {
+		return this->defer_commands;
+	}
+
+	virtual void saveState(SaveWriter &writer) const;
+	void loadStateParseXMLNode(SaveNode *parent);
 };
 
 class EndIslandGameState : public GameState {
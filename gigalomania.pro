@@ -5,7 +5,7 @@ CONFIG -= qt
 
 DEFINES -= UNICODE
 
-SOURCES += game.cpp gamestate.cpp gui.cpp image.cpp main.cpp panel.cpp player.cpp resources.cpp screen.cpp sector.cpp sound.cpp tutorial.cpp utils.cpp TinyXML/tinyxml.cpp TinyXML/tinyxmlerror.cpp TinyXML/tinyxmlparser.cpp
+SOURCES += command.cpp game.cpp gamestate.cpp gui.cpp image.cpp imagepack.cpp main.cpp network.cpp panel.cpp player.cpp resources.cpp savestate.cpp screen.cpp sector.cpp sound.cpp tutorial.cpp utils.cpp TinyXML/tinyxml.cpp TinyXML/tinyxmlerror.cpp TinyXML/tinyxmlparser.cpp
 
 win32 {
     # update this to match where SDL2 includes are installed on your system
@@ -60,6 +60,7 @@ OneMouseButtonPanel::OneMouseButtonPanel(ClickFunc *clickFunc, void *data, int a
 	this->button_right = new ImageButton(32 + caller_button->getWidth(), 0, game_g->arrow_right);
     //this->button_right->setAlpha(true, 160);
     this->add(this->button_right);
+	this->input_mode = INPUT_ALL; // also closes when clicking outside
 }
 
 void OneMouseButtonPanel::input(int m_x,int m_y,bool m_left,bool m_middle,bool m_right,bool click) {
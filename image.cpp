@@ -14,8 +14,17 @@
 using std::min;
 using std::max;
 
+#include <map>
+using std::map;
+
 #include "image.h"
 #include "utils.h"
+
+#if defined(USE_SSE2)
+#include <emmintrin.h>
+#elif defined(USE_NEON)
+#include <arm_neon.h>
+#endif
 //---------------------------------------------------------------------------
 
 inline void CreateMask( Uint32& rmask, Uint32& gmask, Uint32& bmask, Uint32& amask) {
@@ -45,19 +54,48 @@ inline void CreateMask( Uint32& rmask, Uint32& gmask, Uint32& bmask, Uint32& ama
 extern const bool DEBUG;
 extern const int DEBUGLEVEL;
 
+vector<string> *Gigalomania::Image::loaded_filenames = NULL;
+
 #if SDL_MAJOR_VERSION == 1
 SDL_Surface *Gigalomania::Image::dest_surf = NULL;
 #else
 SDL_Renderer *Gigalomania::Image::sdlRenderer = NULL;
+vector<SDL_Texture *> Gigalomania::Image::atlas_textures;
+
+SDL_Renderer *Gigalomania::SpriteBatch::sdlRenderer = NULL;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+bool Gigalomania::SpriteBatch::enabled = true;
+SDL_Texture *Gigalomania::SpriteBatch::texture = NULL;
+int Gigalomania::SpriteBatch::texture_w = 0;
+int Gigalomania::SpriteBatch::texture_h = 0;
+vector<SDL_Vertex> Gigalomania::SpriteBatch::vertices;
+vector<int> Gigalomania::SpriteBatch::indices;
+#else
+bool Gigalomania::SpriteBatch::enabled = false; // requires SDL_RenderGeometry
+#endif
+int Gigalomania::SpriteBatch::n_draw_calls = 0;
+int Gigalomania::SpriteBatch::n_draw_calls_last_frame = 0;
 #endif
 
-Gigalomania::Image::Image() {
+const int atlas_max_size_c = 2048; // maximum width/height of an atlas texture
+const int atlas_max_image_size_c = 256; // larger images (e.g., backgrounds) keep their own texture
+const int atlas_padding_c = 1; // gap between images, so that filtering when drawing scaled doesn't pick up neighbouring images
+
+Gigalomania::Image::Image() : TrackedObject(TRACKED_IMAGE) {
 	this->data = NULL;
 	this->need_to_free_data = false;
 	this->surface = NULL;
 #if SDL_MAJOR_VERSION == 1
 #else
 	this->texture = NULL;
+	this->owns_texture = false;
+	this->atlas_x = 0;
+	this->atlas_y = 0;
+	this->tint_base = NULL;
+	this->tint_mask = NULL;
+	this->tint_r = 255;
+	this->tint_g = 255;
+	this->tint_b = 255;
 #endif
 	this->scale_x = 1;
 	this->scale_y = 1;
@@ -77,8 +115,11 @@ void Gigalomania::Image::free() {
 #if SDL_MAJOR_VERSION == 1
 #else
 	if( this->texture != NULL ) {
-		SDL_DestroyTexture(this->texture);
+		if( this->owns_texture ) {
+			SDL_DestroyTexture(this->texture);
+		}
 		this->texture = NULL;
+		this->owns_texture = false;
 	}
 #endif
 	if( need_to_free_data && this->data != NULL ) {
@@ -105,12 +146,17 @@ void Gigalomania::Image::draw(int x, int y) const {
 	dstrect.h = 0;
 	SDL_BlitSurface(surface, &srcrect, dest_surf, &dstrect);
 #else
+	SDL_Rect srcrect;
+	srcrect.x = 0;
+	srcrect.y = 0;
+	srcrect.w = this->getWidth();
+	srcrect.h = this->getHeight();
 	SDL_Rect dstrect;
 	dstrect.x = (short)x;
 	dstrect.y = (short)y;
 	dstrect.w = (short)this->getWidth();
 	dstrect.h = (short)this->getHeight();
-	SDL_RenderCopy(sdlRenderer, texture, NULL, &dstrect);
+	addQuad(srcrect, dstrect, 255, 255, 255, 255);
 #endif
 }
 
@@ -144,7 +190,7 @@ void Gigalomania::Image::draw(int x, int y, int sw, int sh) const {
 	dstrect.y = (short)y;
 	dstrect.w = sw;
 	dstrect.h = sh;
-	SDL_RenderCopy(sdlRenderer, texture, &srcrect, &dstrect);
+	addQuad(srcrect, dstrect, 255, 255, 255, 255);
 #endif
 }
 
@@ -167,12 +213,17 @@ void Gigalomania::Image::draw(int x, int y, float scale_w, float scale_h) const
 	SDL_BlitSurface(surface, &srcrect, dest_surf, &dstrect);
 	}
 #else
+	SDL_Rect srcrect;
+	srcrect.x = 0;
+	srcrect.y = 0;
+	srcrect.w = this->getWidth();
+	srcrect.h = this->getHeight();
 	SDL_Rect dstrect;
 	dstrect.x = (short)x;
 	dstrect.y = (short)y;
 	dstrect.w = (short)(this->getWidth()*scale_w);
 	dstrect.h = (short)(this->getHeight()*scale_h);
-	SDL_RenderCopy(sdlRenderer, texture, NULL, &dstrect);
+	addQuad(srcrect, dstrect, 255, 255, 255, 255);
 #endif
 }
 
@@ -180,17 +231,61 @@ void Gigalomania::Image::drawWithAlpha(int x, int y, unsigned char alpha) const
 	// n.b., only works if the image doesn't have per-pixel alpha channel
 #if SDL_MAJOR_VERSION == 1
 	SDL_SetAlpha(this->surface, SDL_SRCALPHA|SDL_RLEACCEL, alpha);
+	this->draw(x, y);
 #else
-	SDL_SetTextureAlphaMod(texture, alpha);
+	x += offset_x;
+	y += offset_y;
+	x = (int)(x * scale_x);
+	y = (int)(y * scale_y);
+	SDL_Rect srcrect;
+	srcrect.x = 0;
+	srcrect.y = 0;
+	srcrect.w = this->getWidth();
+	srcrect.h = this->getHeight();
+	SDL_Rect dstrect;
+	dstrect.x = (short)x;
+	dstrect.y = (short)y;
+	dstrect.w = (short)this->getWidth();
+	dstrect.h = (short)this->getHeight();
+	addQuad(srcrect, dstrect, 255, 255, 255, alpha);
 #endif
-	this->draw(x, y);
 }
 
+#if SDL_MAJOR_VERSION == 1
+#else
+// srcrect is relative to the image
+void Gigalomania::Image::addQuad(const SDL_Rect &srcrect, const SDL_Rect &dstrect, unsigned char r, unsigned char g, unsigned char b, unsigned char alpha) const {
+	if( tint_base != NULL ) {
+		tint_base->addQuad(srcrect, dstrect, r, g, b, alpha);
+		if( tint_mask != NULL ) {
+			tint_mask->addQuad(srcrect, dstrect, (unsigned char)((r*tint_r)/255), (unsigned char)((g*tint_g)/255), (unsigned char)((b*tint_b)/255), alpha);
+		}
+		return;
+	}
+	SDL_Rect texture_srcrect = srcrect;
+	texture_srcrect.x += atlas_x;
+	texture_srcrect.y += atlas_y;
+	SpriteBatch::add(texture, texture_srcrect, dstrect, r, g, b, alpha);
+}
+#endif
+
 int Gigalomania::Image::getWidth() const {
+#if SDL_MAJOR_VERSION == 1
+#else
+	if( tint_base != NULL ) {
+		return tint_base->getWidth();
+	}
+#endif
 	return this->surface->w;
 }
 
 int Gigalomania::Image::getHeight() const {
+#if SDL_MAJOR_VERSION == 1
+#else
+	if( tint_base != NULL ) {
+		return tint_base->getHeight();
+	}
+#endif
 	return this->surface->h;
 }
 
@@ -306,6 +401,229 @@ void putpixel(SDL_Surface *surface, int x, int y, Uint32 pixel) {
 	}
 }
 
+/* Row kernels for the pixel processing functions.
+* Each works on a whole row of 32 bit pixels (or bytes, for smoothing), with SSE2 or NEON versions where available; the scalar
+* versions give identical results, and are used for the leftover pixels at the end of each row, or if SIMD is disabled.
+*/
+
+bool Gigalomania::Image::simd_enabled = true;
+
+void Gigalomania::Image::setSIMDEnabled(bool simd_enabled) {
+	Image::simd_enabled = simd_enabled;
+}
+
+const char *Gigalomania::Image::getSIMDName() {
+#if defined(USE_SSE2)
+	return "SSE2";
+#elif defined(USE_NEON)
+	return "NEON";
+#else
+	return "none";
+#endif
+}
+
+static bool useSIMD() {
+#if defined(USE_SSE2) || defined(USE_NEON)
+	return Gigalomania::Image::isSIMDEnabled();
+#else
+	return false;
+#endif
+}
+
+/* Returns the shift of a colour channel mask, or -1 if the channel isn't a single whole byte.
+*/
+static int byteChannelShift(Uint32 mask) {
+	for(int shift=0;shift<32;shift+=8) {
+		if( mask == ((Uint32)0xff << shift) )
+			return shift;
+	}
+	return -1;
+}
+
+/* Returns true if the surface is 32 bit with 8 bits per RGB channel, and either no alpha or an 8 bit alpha channel.
+*/
+static bool isByteChannel32(const SDL_Surface *surface) {
+	const SDL_PixelFormat *format = surface->format;
+	if( format->BytesPerPixel != 4 )
+		return false;
+	if( byteChannelShift(format->Rmask) == -1 || byteChannelShift(format->Gmask) == -1 || byteChannelShift(format->Bmask) == -1 )
+		return false;
+	if( format->Amask != 0 && byteChannelShift(format->Amask) == -1 )
+		return false;
+	return true;
+}
+
+/* Pixels whose RGB bits equal key have them replaced by replacement; all other bits are kept.
+*/
+static void remapRow(Uint32 *row, int n, Uint32 rgb_mask, Uint32 key, Uint32 replacement) {
+	int i = 0;
+	if( useSIMD() ) {
+#if defined(USE_SSE2)
+		const __m128i v_mask = _mm_set1_epi32((int)rgb_mask);
+		const __m128i v_key = _mm_set1_epi32((int)key);
+		const __m128i v_replacement = _mm_set1_epi32((int)replacement);
+		for(;i+4<=n;i+=4) {
+			__m128i p = _mm_loadu_si128((const __m128i *)&row[i]);
+			__m128i eq = _mm_cmpeq_epi32(_mm_and_si128(p, v_mask), v_key);
+			__m128i replaced = _mm_or_si128(_mm_andnot_si128(v_mask, p), v_replacement);
+			p = _mm_or_si128(_mm_and_si128(eq, replaced), _mm_andnot_si128(eq, p));
+			_mm_storeu_si128((__m128i *)&row[i], p);
+		}
+#elif defined(USE_NEON)
+		const uint32x4_t v_mask = vdupq_n_u32(rgb_mask);
+		const uint32x4_t v_key = vdupq_n_u32(key);
+		const uint32x4_t v_replacement = vdupq_n_u32(replacement);
+		for(;i+4<=n;i+=4) {
+			uint32x4_t p = vld1q_u32(&row[i]);
+			uint32x4_t eq = vceqq_u32(vandq_u32(p, v_mask), v_key);
+			uint32x4_t replaced = vorrq_u32(vbicq_u32(p, v_mask), v_replacement);
+			vst1q_u32(&row[i], vbslq_u32(eq, replaced, p));
+		}
+#endif
+	}
+	for(;i<n;i++) {
+		if( (row[i] & rgb_mask) == key ) {
+			row[i] = (row[i] & ~rgb_mask) | replacement;
+		}
+	}
+}
+
+/* Returns value*scale clamped to [0, 255], truncated as a cast would.
+*/
+static Uint8 scaleChannel(Uint8 value, float scale) {
+	float col = value * scale;
+	if( col < 0 )
+		col = 0;
+	else if( col > 255 )
+		col = 255;
+	return (Uint8)col;
+}
+
+/* Scales the 8 bit channels at the given shifts by the corresponding scale; n_channels is at most 3.
+*/
+static void scaleChannelsRow(Uint32 *row, int n, int n_channels, const int shift[3], const float scale[3]) {
+	Uint32 channel_mask = 0;
+	for(int j=0;j<n_channels;j++) {
+		channel_mask |= (Uint32)0xff << shift[j];
+	}
+	int i = 0;
+	if( useSIMD() ) {
+#if defined(USE_SSE2)
+		const __m128i v_byte = _mm_set1_epi32(0xff);
+		const __m128i v_keep = _mm_set1_epi32((int)~channel_mask);
+		const __m128 v_zero = _mm_setzero_ps();
+		const __m128 v_max = _mm_set1_ps(255.0f);
+		for(;i+4<=n;i+=4) {
+			__m128i p = _mm_loadu_si128((const __m128i *)&row[i]);
+			__m128i result = _mm_and_si128(p, v_keep);
+			for(int j=0;j<n_channels;j++) {
+				__m128i v_shift = _mm_cvtsi32_si128(shift[j]);
+				__m128i channel = _mm_and_si128(_mm_srl_epi32(p, v_shift), v_byte);
+				__m128 col = _mm_mul_ps(_mm_cvtepi32_ps(channel), _mm_set1_ps(scale[j]));
+				col = _mm_min_ps(_mm_max_ps(col, v_zero), v_max);
+				channel = _mm_cvttps_epi32(col);
+				result = _mm_or_si128(result, _mm_sll_epi32(channel, v_shift));
+			}
+			_mm_storeu_si128((__m128i *)&row[i], result);
+		}
+#elif defined(USE_NEON)
+		const uint32x4_t v_byte = vdupq_n_u32(0xff);
+		const uint32x4_t v_mask = vdupq_n_u32(channel_mask);
+		const float32x4_t v_zero = vdupq_n_f32(0.0f);
+		const float32x4_t v_max = vdupq_n_f32(255.0f);
+		for(;i+4<=n;i+=4) {
+			uint32x4_t p = vld1q_u32(&row[i]);
+			uint32x4_t result = vbicq_u32(p, v_mask);
+			for(int j=0;j<n_channels;j++) {
+				uint32x4_t channel = vandq_u32(vshlq_u32(p, vdupq_n_s32(-shift[j])), v_byte);
+				float32x4_t col = vmulq_f32(vcvtq_f32_u32(channel), vdupq_n_f32(scale[j]));
+				col = vminq_f32(vmaxq_f32(col, v_zero), v_max);
+				channel = vcvtq_u32_f32(col);
+				result = vorrq_u32(result, vshlq_u32(channel, vdupq_n_s32(shift[j])));
+			}
+			vst1q_u32(&row[i], result);
+		}
+#endif
+	}
+	for(;i<n;i++) {
+		Uint32 result = row[i] & ~channel_mask;
+		for(int j=0;j<n_channels;j++) {
+			Uint8 channel = (Uint8)(row[i] >> shift[j]);
+			result |= (Uint32)scaleChannel(channel, scale[j]) << shift[j];
+		}
+		row[i] = result;
+	}
+}
+
+/* Applies the [1 2 1; 2 4 2; 1 2 1]/16 kernel to bytes [bytesperpixel, n_bytes-bytesperpixel) of row, writing them to dst.
+* Each byte is filtered with the same byte of its neighbouring pixels, so this works for any byte ordering of the channels.
+*/
+static void smoothRow(unsigned char *dst, const unsigned char *above, const unsigned char *row, const unsigned char *below, int n_bytes, int bytesperpixel) {
+	int i = bytesperpixel;
+	int end = n_bytes - bytesperpixel;
+	const int l = - bytesperpixel;
+	const int r = bytesperpixel;
+	if( useSIMD() ) {
+#if defined(USE_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+		for(;i+16<=end;i+=16) {
+			__m128i sum[2];
+			for(int half=0;half<2;half++) {
+				__m128i h[3];
+				const unsigned char *rows[3] = {above, row, below};
+				for(int k=0;k<3;k++) {
+					__m128i p0 = _mm_loadu_si128((const __m128i *)&rows[k][i+l]);
+					__m128i p1 = _mm_loadu_si128((const __m128i *)&rows[k][i]);
+					__m128i p2 = _mm_loadu_si128((const __m128i *)&rows[k][i+r]);
+					if( half == 0 ) {
+						p0 = _mm_unpacklo_epi8(p0, zero);
+						p1 = _mm_unpacklo_epi8(p1, zero);
+						p2 = _mm_unpacklo_epi8(p2, zero);
+					}
+					else {
+						p0 = _mm_unpackhi_epi8(p0, zero);
+						p1 = _mm_unpackhi_epi8(p1, zero);
+						p2 = _mm_unpackhi_epi8(p2, zero);
+					}
+					h[k] = _mm_add_epi16(_mm_add_epi16(p0, p2), _mm_slli_epi16(p1, 1));
+				}
+				sum[half] = _mm_add_epi16(_mm_add_epi16(h[0], h[2]), _mm_slli_epi16(h[1], 1));
+				sum[half] = _mm_srli_epi16(sum[half], 4);
+			}
+			_mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(sum[0], sum[1]));
+		}
+#elif defined(USE_NEON)
+		for(;i+16<=end;i+=16) {
+			uint16x8_t sum[2];
+			const unsigned char *rows[3] = {above, row, below};
+			uint8x16_t p[3][3];
+			for(int k=0;k<3;k++) {
+				p[k][0] = vld1q_u8(&rows[k][i+l]);
+				p[k][1] = vld1q_u8(&rows[k][i]);
+				p[k][2] = vld1q_u8(&rows[k][i+r]);
+			}
+			for(int half=0;half<2;half++) {
+				uint16x8_t h[3];
+				for(int k=0;k<3;k++) {
+					uint8x8_t p0 = half == 0 ? vget_low_u8(p[k][0]) : vget_high_u8(p[k][0]);
+					uint8x8_t p1 = half == 0 ? vget_low_u8(p[k][1]) : vget_high_u8(p[k][1]);
+					uint8x8_t p2 = half == 0 ? vget_low_u8(p[k][2]) : vget_high_u8(p[k][2]);
+					h[k] = vaddq_u16(vaddl_u8(p0, p2), vshll_n_u8(p1, 1));
+				}
+				sum[half] = vaddq_u16(vaddq_u16(h[0], h[2]), vshlq_n_u16(h[1], 1));
+			}
+			vst1q_u8(&dst[i], vcombine_u8(vshrn_n_u16(sum[0], 4), vshrn_n_u16(sum[1], 4)));
+		}
+#endif
+	}
+	for(;i<end;i++) {
+		Uint32 h0 = above[i+l] + 2 * above[i] + above[i+r];
+		Uint32 h1 = row[i+l] + 2 * row[i] + row[i+r];
+		Uint32 h2 = below[i+l] + 2 * below[i] + below[i+r];
+		dst[i] = (unsigned char)( ( h0 + 2 * h1 + h2 ) / 16 );
+	}
+}
+
 // Creates an alpha from the mask; also adds in shadow effect based on supplied ar/ag/ab colour
 bool Gigalomania::Image::createAlphaForColor(bool mask, unsigned char mr, unsigned char mg, unsigned char mb, unsigned char ar, unsigned char ag, unsigned char ab, unsigned char alpha) {
 	int w = this->getWidth();
@@ -366,16 +684,28 @@ void Gigalomania::Image::scaleAlpha(float scale) {
 	int w = this->getWidth();
 	int h = this->getHeight();
 	SDL_LockSurface(this->surface);
-	// faster to read in x direction! (caching?)
-	for(int cy=0;cy<h;cy++) {
-		for(int cx=0;cx<w;cx++) {
-			Uint32 pixel = getpixel(this->surface, cx, cy);
-			Uint8 r = 0, g = 0, b = 0, a = 0;
-			SDL_GetRGBA(pixel, this->surface->format, &r, &g, &b, &a);
-			//a *= scale;
-			a = (Uint8)(a*scale);
-			pixel = SDL_MapRGBA(this->surface->format, r, g, b, a);
-			putpixel(this->surface, cx, cy, pixel);
+	if( isByteChannel32(this->surface) ) {
+		if( this->surface->format->Amask != 0 ) {
+			const int shift[3] = {byteChannelShift(this->surface->format->Amask), 0, 0};
+			const float scales[3] = {scale, 0.0f, 0.0f};
+			for(int cy=0;cy<h;cy++) {
+				Uint32 *row = (Uint32 *)((Uint8 *)this->surface->pixels + cy * this->surface->pitch);
+				scaleChannelsRow(row, w, 1, shift, scales);
+			}
+		}
+	}
+	else {
+		// faster to read in x direction! (caching?)
+		for(int cy=0;cy<h;cy++) {
+			for(int cx=0;cx<w;cx++) {
+				Uint32 pixel = getpixel(this->surface, cx, cy);
+				Uint8 r = 0, g = 0, b = 0, a = 0;
+				SDL_GetRGBA(pixel, this->surface->format, &r, &g, &b, &a);
+				//a *= scale;
+				a = scaleChannel(a, scale);
+				pixel = SDL_MapRGBA(this->surface->format, r, g, b, a);
+				putpixel(this->surface, cx, cy, pixel);
+			}
 		}
 	}
 	SDL_UnlockSurface(this->surface);
@@ -427,11 +757,24 @@ bool Gigalomania::Image::convertToDisplayFormat() {
 	SDL_FreeSurface(this->surface);
 	this->surface = new_surf;
 #else
+	if( tint_base != NULL ) {
+		// nothing of our own to convert, but the base and mask may not have been converted yet
+		if( tint_base->texture == NULL && !tint_base->convertToDisplayFormat() ) {
+			return false;
+		}
+		if( tint_mask != NULL && tint_mask->texture == NULL && !tint_mask->convertToDisplayFormat() ) {
+			return false;
+		}
+		return true;
+	}
 	texture = SDL_CreateTextureFromSurface(sdlRenderer, surface);
 	if( texture == NULL ) {
 		LOG("SDL_CreateTextureFromSurface failed\n");
 		return false;
 	}
+	owns_texture = true;
+	atlas_x = 0;
+	atlas_y = 0;
 	/*{
 		SDL_BlendMode blendMode = SDL_BLENDMODE_NONE;
 		SDL_GetTextureBlendMode(texture, &blendMode);
@@ -442,6 +785,164 @@ bool Gigalomania::Image::convertToDisplayFormat() {
 	return true;
 }
 
+#if SDL_MAJOR_VERSION == 1
+#else
+static bool imageHeightGreater(const Gigalomania::Image *a, const Gigalomania::Image *b) {
+	return a->getHeight() > b->getHeight();
+}
+
+/* Packs the images into a single atlas texture, in rows ("shelves") of
+*  decreasing height, no wider than max_size. The caller must ensure the
+*  images fit.
+*/
+bool Gigalomania::Image::packAtlas(const vector<Image *> &images, int max_size) {
+	int atlas_w = 0, atlas_h = 0;
+	{
+		int x = 0, y = 0, row_h = 0;
+		for(vector<Image *>::const_iterator iter = images.begin(); iter != images.end(); ++iter) {
+			const Image *image = *iter;
+			if( x + image->getWidth() > max_size ) {
+				x = 0;
+				y += row_h + atlas_padding_c;
+				row_h = 0;
+			}
+			x += image->getWidth() + atlas_padding_c;
+			row_h = max(row_h, image->getHeight());
+			atlas_w = max(atlas_w, x);
+			atlas_h = max(atlas_h, y + row_h);
+		}
+	}
+
+	Uint32 rmask, gmask, bmask, amask;
+	CreateMask(rmask, gmask, bmask, amask);
+	SDL_Surface *atlas_surface = SDL_CreateRGBSurface(0, atlas_w, atlas_h, 32, rmask, gmask, bmask, amask);
+	if( atlas_surface == NULL ) {
+		LOG("failed to create atlas surface %d x %d\n", atlas_w, atlas_h);
+		return false;
+	}
+	// surface starts as fully transparent
+	int x = 0, y = 0, row_h = 0;
+	for(vector<Image *>::const_iterator iter = images.begin(); iter != images.end(); ++iter) {
+		Image *image = *iter;
+		if( x + image->getWidth() > max_size ) {
+			x = 0;
+			y += row_h + atlas_padding_c;
+			row_h = 0;
+		}
+		SDL_Rect dstrect;
+		dstrect.x = x;
+		dstrect.y = y;
+		dstrect.w = image->getWidth();
+		dstrect.h = image->getHeight();
+		// copy the pixels including alpha, rather than blending (colour keyed pixels are still skipped, so remain transparent)
+		SDL_BlendMode blend_mode = SDL_BLENDMODE_NONE;
+		SDL_GetSurfaceBlendMode(image->surface, &blend_mode);
+		SDL_SetSurfaceBlendMode(image->surface, SDL_BLENDMODE_NONE);
+		SDL_BlitSurface(image->surface, NULL, atlas_surface, &dstrect);
+		SDL_SetSurfaceBlendMode(image->surface, blend_mode);
+		image->atlas_x = x;
+		image->atlas_y = y;
+		x += image->getWidth() + atlas_padding_c;
+		row_h = max(row_h, image->getHeight());
+	}
+
+	SDL_Texture *atlas_texture = SDL_CreateTextureFromSurface(sdlRenderer, atlas_surface);
+	SDL_FreeSurface(atlas_surface);
+	if( atlas_texture == NULL ) {
+		LOG("SDL_CreateTextureFromSurface failed for atlas\n");
+		return false;
+	}
+	SDL_SetTextureBlendMode(atlas_texture, SDL_BLENDMODE_BLEND);
+	atlas_textures.push_back(atlas_texture);
+	for(vector<Image *>::const_iterator iter = images.begin(); iter != images.end(); ++iter) {
+		Image *image = *iter;
+		image->texture = atlas_texture;
+		image->owns_texture = false;
+	}
+	LOG("packed %d images into %d x %d atlas\n", static_cast<int>(images.size()), atlas_w, atlas_h);
+	return true;
+}
+#endif
+
+/* Creates the textures for a set of images. With SDL 2, small images are
+*  packed together into a few large atlas textures, so that drawing many
+*  different images (soldiers, font glyphs, icons) needs far fewer texture
+*  switches. The images shouldn't be modified afterwards.
+*/
+bool Gigalomania::Image::convertToDisplayFormat(const vector<Image *> &images) {
+#if SDL_MAJOR_VERSION == 1
+	for(vector<Image *>::const_iterator iter = images.begin(); iter != images.end(); ++iter) {
+		if( !(*iter)->convertToDisplayFormat() ) {
+			return false;
+		}
+	}
+#else
+	int max_size = atlas_max_size_c;
+	SDL_RendererInfo info;
+	if( SDL_GetRendererInfo(sdlRenderer, &info) == 0 && info.max_texture_width > 0 && info.max_texture_height > 0 ) {
+		max_size = min(max_size, min(info.max_texture_width, info.max_texture_height));
+	}
+	vector<Image *> atlas_images;
+	for(vector<Image *>::const_iterator iter = images.begin(); iter != images.end(); ++iter) {
+		Image *image = *iter;
+		if( image->texture != NULL ) {
+			// already converted
+		}
+		else if( image->tint_base != NULL ) {
+			// drawn with its base and mask images, which are converted in their own right
+		}
+		else if( max_size < atlas_max_image_size_c || image->getWidth() > atlas_max_image_size_c || image->getHeight() > atlas_max_image_size_c ) {
+			if( !image->convertToDisplayFormat() ) {
+				return false;
+			}
+		}
+		else {
+			atlas_images.push_back(image);
+		}
+	}
+	std::stable_sort(atlas_images.begin(), atlas_images.end(), imageHeightGreater);
+
+	// split into atlases, using the same shelf layout as packAtlas()
+	vector<Image *> current;
+	int x = 0, y = 0, row_h = 0;
+	for(vector<Image *>::const_iterator iter = atlas_images.begin(); iter != atlas_images.end(); ++iter) {
+		Image *image = *iter;
+		if( x + image->getWidth() > max_size ) {
+			x = 0;
+			y += row_h + atlas_padding_c;
+			row_h = 0;
+		}
+		if( y + image->getHeight() > max_size ) {
+			// atlas is full
+			if( !packAtlas(current, max_size) ) {
+				return false;
+			}
+			current.clear();
+			x = 0;
+			y = 0;
+			row_h = 0;
+		}
+		current.push_back(image);
+		x += image->getWidth() + atlas_padding_c;
+		row_h = max(row_h, image->getHeight());
+	}
+	if( current.size() > 0 && !packAtlas(current, max_size) ) {
+		return false;
+	}
+#endif
+	return true;
+}
+
+void Gigalomania::Image::freeAtlases() {
+#if SDL_MAJOR_VERSION == 1
+#else
+	for(vector<SDL_Texture *>::iterator iter = atlas_textures.begin(); iter != atlas_textures.end(); ++iter) {
+		SDL_DestroyTexture(*iter);
+	}
+	atlas_textures.clear();
+#endif
+}
+
 bool Gigalomania::Image::copyPalette(const Gigalomania::Image *image) {
 	if( this->surface->format->palette == NULL || image->surface->format->palette == NULL )
 		return false;
@@ -457,6 +958,116 @@ bool Gigalomania::Image::copyPalette(const Gigalomania::Image *image) {
 	return true;
 }
 
+/* Scalers for exact integer factors, specialised on the factor and bytes per pixel so that the inner loops unroll.
+* These give the same results as the general code in Image::scale(): nearest neighbour when enlarging, and when reducing the
+* average of each factor x factor block (or for paletted images, the last pixel of the block).
+*/
+
+typedef void (*IntegerScaler)(unsigned char *dst, int dst_pitch, const unsigned char *src, int src_pitch, int dst_w, int dst_h, bool paletted);
+
+template<int factor, int bytesperpixel>
+static void enlargeInteger(unsigned char *dst, int dst_pitch, const unsigned char *src, int src_pitch, int dst_w, int dst_h, bool) {
+	const int src_w = dst_w / factor;
+	const int src_h = dst_h / factor;
+	for(int cy=0;cy<src_h;cy++) {
+		const unsigned char *src_row = &src[cy * src_pitch];
+		unsigned char *dst_row = &dst[cy * factor * dst_pitch];
+		unsigned char *d = dst_row;
+		for(int cx=0;cx<src_w;cx++, src_row += bytesperpixel) {
+			for(int x=0;x<factor;x++) {
+				for(int i=0;i<bytesperpixel;i++) {
+					*d++ = src_row[i];
+				}
+			}
+		}
+		// the other rows of this block are copies of the first
+		for(int y=1;y<factor;y++) {
+			memcpy(&dst_row[y * dst_pitch], dst_row, dst_w * bytesperpixel);
+		}
+	}
+}
+
+template<int factor, int bytesperpixel>
+static void reduceInteger(unsigned char *dst, int dst_pitch, const unsigned char *src, int src_pitch, int dst_w, int dst_h, bool paletted) {
+	for(int dy=0;dy<dst_h;dy++) {
+		const unsigned char *src_block = &src[dy * factor * src_pitch];
+		unsigned char *d = &dst[dy * dst_pitch];
+		for(int dx=0;dx<dst_w;dx++, src_block += factor * bytesperpixel) {
+			if( paletted ) {
+				// the last pixel of the block wins
+				const unsigned char *s = &src_block[(factor-1) * src_pitch + (factor-1) * bytesperpixel];
+				for(int i=0;i<bytesperpixel;i++) {
+					*d++ = s[i];
+				}
+				continue;
+			}
+			int sum[bytesperpixel];
+			for(int i=0;i<bytesperpixel;i++) {
+				sum[i] = 0;
+			}
+			for(int y=0;y<factor;y++) {
+				const unsigned char *s = &src_block[y * src_pitch];
+				for(int x=0;x<factor;x++) {
+					for(int i=0;i<bytesperpixel;i++) {
+						sum[i] += *s++;
+					}
+				}
+			}
+			for(int i=0;i<bytesperpixel;i++) {
+				*d++ = (unsigned char)(sum[i] / (factor * factor));
+			}
+		}
+	}
+}
+
+template<int factor>
+static IntegerScaler getIntegerScaler(bool enlarging, int bytesperpixel) {
+	switch( bytesperpixel ) {
+	case 1:
+		return enlarging ? &enlargeInteger<factor, 1> : &reduceInteger<factor, 1>;
+	case 2:
+		return enlarging ? &enlargeInteger<factor, 2> : &reduceInteger<factor, 2>;
+	case 3:
+		return enlarging ? &enlargeInteger<factor, 3> : &reduceInteger<factor, 3>;
+	case 4:
+		return enlarging ? &enlargeInteger<factor, 4> : &reduceInteger<factor, 4>;
+	}
+	return NULL;
+}
+
+bool Gigalomania::Image::integer_scalers_enabled = true;
+
+void Gigalomania::Image::setIntegerScalersEnabled(bool integer_scalers_enabled) {
+	Image::integer_scalers_enabled = integer_scalers_enabled;
+}
+
+/* Returns the specialised scaler if sx and sy are both exactly 2, 3 or 4 (or 1/2, 1/3 or 1/4), and the new size is an exact
+* multiple (or fraction) of the old size; otherwise returns NULL, and the general code should be used.
+*/
+static IntegerScaler getIntegerScaler(float sx, float sy, bool enlarging, int w, int h, int new_width, int new_height, int bytesperpixel) {
+	if( sx != sy ) {
+		return NULL;
+	}
+	int factor = enlarging ? (int)sx : (int)(1.0f/sx + 0.5f);
+	if( enlarging ) {
+		if( sx != (float)factor || new_width != w * factor || new_height != h * factor )
+			return NULL;
+	}
+	else {
+		if( factor < 1 || sx != 1.0f/(float)factor || new_width != w / factor || new_height != h / factor )
+			return NULL;
+	}
+	switch( factor ) {
+	case 2:
+		return getIntegerScaler<2>(enlarging, bytesperpixel);
+	case 3:
+		return getIntegerScaler<3>(enlarging, bytesperpixel);
+	case 4:
+		return getIntegerScaler<4>(enlarging, bytesperpixel);
+	}
+	return NULL;
+}
+
 // side-effect: also converts images with < 256 colours to have 256 colours, unless scaling is 1.0
 void Gigalomania::Image::scale(float sx,float sy) {
 	if( sx == 1.0f && sy == 1.0f ) {
@@ -484,10 +1095,11 @@ void Gigalomania::Image::scale(float sx,float sy) {
 	int new_height = (int)(h * sy);
 	int new_size = (int)(new_width * new_height * bytesperpixel);
 	bool is_paletted = this->isPaletted();
+	IntegerScaler integer_scaler = integer_scalers_enabled ? getIntegerScaler(sx, sy, enlarging, w, h, new_width, new_height, bytesperpixel) : NULL;
 	unsigned char *new_data = NULL;
 	int *new_data_nonpaletted = NULL;
 	int *count = NULL;
-	if( is_paletted || enlarging ) {
+	if( integer_scaler != NULL || is_paletted || enlarging ) {
 		new_data = new unsigned char[new_size];
 	}
 	else {
@@ -498,8 +1110,11 @@ void Gigalomania::Image::scale(float sx,float sy) {
 			count[i] = 0;
 		}
 	}
+	if( integer_scaler != NULL ) {
+		integer_scaler(new_data, new_width * bytesperpixel, src_data, this->surface->pitch, new_width, new_height, is_paletted);
+	}
 	// faster to read in x direction! (caching?)
-	if( enlarging ) {
+	else if( enlarging ) {
 		for(int cy=0;cy<h;cy++) {
 			int src_indx = cy * this->surface->pitch;
 			for(int cx=0;cx<w;cx++) {
@@ -561,7 +1176,7 @@ void Gigalomania::Image::scale(float sx,float sy) {
 		Uint32 gmask = this->surface->format->Gmask;
 		Uint32 bmask = this->surface->format->Bmask;
 		Uint32 amask = this->surface->format->Amask;
-		if( !(is_paletted || enlarging) ) {
+		if( new_data_nonpaletted != NULL ) {
 			new_data = new unsigned char[new_size];
 			for(int i=0;i<new_size;i++) {
 				new_data[i] = (unsigned char)(new_data_nonpaletted[i] / count[i]);
@@ -622,33 +1237,48 @@ void Gigalomania::Image::remap(unsigned char sr,unsigned char sg,unsigned char s
 	int irg = (int)rg;
 	int irb = (int)rb;
 	int mag_r = (int)sqrt( (float)(irr*irr + irg*irg + irb*irb) ); // *255*/
-	// faster to read in x direction! (caching?)
-	for(int y=0;y<h;y++) {
-		for(int x=0;x<w;x++) {
-			Uint32 pixel = getpixel(this->surface, x, y);
-			Uint8 r = 0, g = 0, b = 0, a = 0;
-			SDL_GetRGBA(pixel, this->surface->format, &r, &g, &b, &a);
-			if( r == sr && g == sg && b == sb ) {
-				pixel = SDL_MapRGBA(surface->format, rr, rg, rb, a);
-				putpixel(this->surface, x, y, pixel);
-			}
-			/*if( r == 0 && g == 0 && b == 0 ) {
-				continue;
+	if( isByteChannel32(this->surface) ) {
+		const SDL_PixelFormat *format = this->surface->format;
+		int r_shift = byteChannelShift(format->Rmask);
+		int g_shift = byteChannelShift(format->Gmask);
+		int b_shift = byteChannelShift(format->Bmask);
+		Uint32 rgb_mask = format->Rmask | format->Gmask | format->Bmask;
+		Uint32 key = ((Uint32)sr << r_shift) | ((Uint32)sg << g_shift) | ((Uint32)sb << b_shift);
+		Uint32 replacement = ((Uint32)rr << r_shift) | ((Uint32)rg << g_shift) | ((Uint32)rb << b_shift);
+		for(int y=0;y<h;y++) {
+			Uint32 *row = (Uint32 *)((Uint8 *)this->surface->pixels + y * this->surface->pitch);
+			remapRow(row, w, rgb_mask, key, replacement);
+		}
+	}
+	else {
+		// faster to read in x direction! (caching?)
+		for(int y=0;y<h;y++) {
+			for(int x=0;x<w;x++) {
+				Uint32 pixel = getpixel(this->surface, x, y);
+				Uint8 r = 0, g = 0, b = 0, a = 0;
+				SDL_GetRGBA(pixel, this->surface->format, &r, &g, &b, &a);
+				if( r == sr && g == sg && b == sb ) {
+					pixel = SDL_MapRGBA(surface->format, rr, rg, rb, a);
+					putpixel(this->surface, x, y, pixel);
+				}
+				/*if( r == 0 && g == 0 && b == 0 ) {
+					continue;
+				}
+				int ir = (int)r;
+				int ig = (int)g;
+				int ib = (int)b;
+				int mag = (int)sqrt( (float)(ir*ir + ig*ig + ib*ib) ); // *255
+				int dot = ( sr*ir + sg*ig + sb*ib ); // *255*255
+				if( dot >= threshold*mag ) {
+					float cos_angle = ((float)dot) / (float)( mag_s * mag ); // *1
+					int proj_mag = mag * cos_angle; // *255
+					ir = proj_mag * rr / mag_r;
+					ig = proj_mag * rg / mag_r;
+					ib = proj_mag * rb / mag_r;
+					pixel = SDL_MapRGBA(surface->format, ir, ig, ib, a);
+					putpixel(this->surface, x, y, pixel);
+				}*/
 			}
-			int ir = (int)r;
-			int ig = (int)g;
-			int ib = (int)b;
-			int mag = (int)sqrt( (float)(ir*ir + ig*ig + ib*ib) ); // *255
-			int dot = ( sr*ir + sg*ig + sb*ib ); // *255*255
-			if( dot >= threshold*mag ) {
-				float cos_angle = ((float)dot) / (float)( mag_s * mag ); // *1
-				int proj_mag = mag * cos_angle; // *255
-				ir = proj_mag * rr / mag_r;
-				ig = proj_mag * rg / mag_r;
-				ib = proj_mag * rb / mag_r;
-				pixel = SDL_MapRGBA(surface->format, ir, ig, ib, a);
-				putpixel(this->surface, x, y, pixel);
-			}*/
 		}
 	}
 
@@ -715,23 +1345,27 @@ void Gigalomania::Image::brighten(float sr, float sg, float sb) {
 	SDL_LockSurface(this->surface);
 	int w = getWidth();
 	int h = getHeight();
-	// faster to read in x direction! (caching?)
-	for(int y=0;y<h;y++) {
-		for(int x=0;x<w;x++) {
-			Uint32 pixel = getpixel(this->surface, x, y);
-			Uint8 rgba[] = {0, 0, 0, 0};
-			SDL_GetRGBA(pixel, this->surface->format, &rgba[0], &rgba[1], &rgba[2], &rgba[3]);
-			for(int j=0;j<3;j++) {
-				float col = (float)rgba[j];
-				col *= scale[j];
-				if( col < 0 )
-					col = 0;
-				else if( col > 255 )
-					col = 255;
-				rgba[j] = (unsigned char)col;
+	if( isByteChannel32(this->surface) ) {
+		const SDL_PixelFormat *format = this->surface->format;
+		const int shift[3] = {byteChannelShift(format->Rmask), byteChannelShift(format->Gmask), byteChannelShift(format->Bmask)};
+		for(int y=0;y<h;y++) {
+			Uint32 *row = (Uint32 *)((Uint8 *)this->surface->pixels + y * this->surface->pitch);
+			scaleChannelsRow(row, w, 3, shift, scale);
+		}
+	}
+	else {
+		// faster to read in x direction! (caching?)
+		for(int y=0;y<h;y++) {
+			for(int x=0;x<w;x++) {
+				Uint32 pixel = getpixel(this->surface, x, y);
+				Uint8 rgba[] = {0, 0, 0, 0};
+				SDL_GetRGBA(pixel, this->surface->format, &rgba[0], &rgba[1], &rgba[2], &rgba[3]);
+				for(int j=0;j<3;j++) {
+					rgba[j] = scaleChannel(rgba[j], scale[j]);
+				}
+				pixel = SDL_MapRGBA(surface->format, rgba[0], rgba[1], rgba[2], rgba[3]);
+				putpixel(this->surface, x, y, pixel);
 			}
-			pixel = SDL_MapRGBA(surface->format, rgba[0], rgba[1], rgba[2], rgba[3]);
-			putpixel(this->surface, x, y, pixel);
 		}
 	}
 	SDL_UnlockSurface(this->surface);
@@ -877,23 +1511,208 @@ Gigalomania::Image *Gigalomania::Image::copy(int x, int y, int w, int h) const {
 	return copy_image;
 }
 
-Gigalomania::Image *Gigalomania::Image::loadImage(const char *filename) {
-#ifdef TIMING
-	int time_s = clock();
+#if SDL_MAJOR_VERSION == 1
+#else
+/* Images can be decoded ahead of time on a pool of worker threads, so that
+*  loading (which is otherwise all on the main thread) scales with the number
+*  of cores. loadImage() then takes the decoded surface, decoding it itself
+*  if no worker has started on it yet, or waiting if one is part way through.
+*/
+enum PrefetchState {
+	PREFETCH_PENDING = 0,
+	PREFETCH_DECODING,
+	PREFETCH_DONE,
+	PREFETCH_TAKEN
+};
+
+struct PrefetchEntry {
+	string filename;
+	PrefetchState state;
+	SDL_Surface *surface;
+};
+
+static SDL_mutex *prefetch_mutex = NULL;
+static SDL_cond *prefetch_cond = NULL;
+static vector<PrefetchEntry> prefetch_entries;
+static map<string, size_t> prefetch_indices;
+static size_t prefetch_next = 0; // next entry for a worker to decode
+static vector<SDL_Thread *> prefetch_threads;
 #endif
-	//LOG("Image::loadImage(\"%s\")\n",filename); // disabled logging to improve performance on startup
+
+static SDL_Surface *decodeImage(const char *filename) {
 	SDL_RWops *src = SDL_RWFromFile(filename, "rb");
 	if( src == NULL ) {
 		LOG("SDL_RWFromFile failed: %s\n", SDL_GetError());
 		return NULL;
 	}
-	Gigalomania::Image *image = new Image();
-	image->surface = IMG_Load_RW(src, 1);
-	if( image->surface == NULL ) {
+	SDL_Surface *surface = IMG_Load_RW(src, 1);
+	if( surface == NULL ) {
 		LOG("IMG_Load_RW failed: %s\n", IMG_GetError());
-		delete image;
-		image = NULL;
 	}
+	return surface;
+}
+
+#if SDL_MAJOR_VERSION == 1
+#else
+static int prefetchThreadFunction(void *) {
+	SDL_mutexP(prefetch_mutex);
+	while( prefetch_next < prefetch_entries.size() ) {
+		size_t indx = prefetch_next++;
+		if( prefetch_entries[indx].state != PREFETCH_PENDING ) {
+			// already being decoded by loadImage()
+			continue;
+		}
+		prefetch_entries[indx].state = PREFETCH_DECODING;
+		string filename = prefetch_entries[indx].filename;
+		SDL_mutexV(prefetch_mutex);
+
+		SDL_Surface *surface = decodeImage(filename.c_str());
+
+		SDL_mutexP(prefetch_mutex);
+		prefetch_entries[indx].surface = surface;
+		prefetch_entries[indx].state = PREFETCH_DONE;
+		SDL_CondBroadcast(prefetch_cond);
+	}
+	SDL_mutexV(prefetch_mutex);
+	return 0;
+}
+
+// returns true if the filename was prefetched, in which case *surface is the decoded surface (may be NULL if decoding failed)
+static bool takePrefetchedImage(SDL_Surface **surface, const char *filename) {
+	if( prefetch_mutex == NULL ) {
+		return false;
+	}
+	SDL_mutexP(prefetch_mutex);
+	map<string, size_t>::const_iterator iter = prefetch_indices.find(filename);
+	if( iter == prefetch_indices.end() || prefetch_entries[iter->second].state == PREFETCH_TAKEN ) {
+		SDL_mutexV(prefetch_mutex);
+		return false;
+	}
+	PrefetchEntry &entry = prefetch_entries[iter->second];
+	if( entry.state == PREFETCH_PENDING ) {
+		// no worker has got to this yet, so quicker to decode it ourselves than wait
+		entry.state = PREFETCH_DECODING;
+		SDL_mutexV(prefetch_mutex);
+		SDL_Surface *decoded = decodeImage(filename);
+		SDL_mutexP(prefetch_mutex);
+		entry.surface = decoded;
+		entry.state = PREFETCH_DONE;
+	}
+	while( entry.state == PREFETCH_DECODING ) {
+		SDL_CondWait(prefetch_cond, prefetch_mutex);
+	}
+	*surface = entry.surface;
+	entry.surface = NULL;
+	entry.state = PREFETCH_TAKEN;
+	SDL_mutexV(prefetch_mutex);
+	return true;
+}
+#endif
+
+void Gigalomania::Image::prefetchImages(const vector<string> &filenames) {
+#if SDL_MAJOR_VERSION == 1
+	// not supported, images are decoded when loaded
+#else
+	endPrefetch();
+	int n_threads = SDL_GetCPUCount() - 1; // the main thread also decodes, if it gets ahead of the workers
+	if( n_threads <= 0 || filenames.size() == 0 ) {
+		return;
+	}
+	n_threads = min(n_threads, (int)filenames.size());
+	// IMG_Load() otherwise initialises the decoder for a format the first time it sees it, which isn't thread safe
+	int img_flags = 0;
+	for(vector<string>::const_iterator iter = filenames.begin(); iter != filenames.end(); ++iter) {
+		string extension = iter->length() >= 4 ? iter->substr(iter->length() - 4) : "";
+		if( extension == ".png" )
+			img_flags |= IMG_INIT_PNG;
+		else if( extension == ".jpg" )
+			img_flags |= IMG_INIT_JPG;
+	}
+	if( (IMG_Init(img_flags) & img_flags) != img_flags ) {
+		LOG("IMG_Init failed, so not decoding images on other threads: %s\n", IMG_GetError());
+		return;
+	}
+	prefetch_mutex = SDL_CreateMutex();
+	prefetch_cond = SDL_CreateCond();
+	if( prefetch_mutex == NULL || prefetch_cond == NULL ) {
+		endPrefetch();
+		return;
+	}
+	for(vector<string>::const_iterator iter = filenames.begin(); iter != filenames.end(); ++iter) {
+		if( prefetch_indices.find(*iter) != prefetch_indices.end() ) {
+			continue;
+		}
+		PrefetchEntry entry;
+		entry.filename = *iter;
+		entry.state = PREFETCH_PENDING;
+		entry.surface = NULL;
+		prefetch_indices[*iter] = prefetch_entries.size();
+		prefetch_entries.push_back(entry);
+	}
+	prefetch_next = 0;
+	for(int i=0;i<n_threads;i++) {
+		SDL_Thread *thread = SDL_CreateThread(prefetchThreadFunction, "image decode", NULL);
+		if( thread == NULL ) {
+			LOG("failed to create image decode thread: %s\n", SDL_GetError());
+			break;
+		}
+		prefetch_threads.push_back(thread);
+	}
+	LOG("decoding %d images on %d threads\n", (int)prefetch_entries.size(), (int)prefetch_threads.size());
+#endif
+}
+
+void Gigalomania::Image::endPrefetch() {
+#if SDL_MAJOR_VERSION == 1
+#else
+	if( prefetch_mutex != NULL ) {
+		// stop the workers starting any more
+		SDL_mutexP(prefetch_mutex);
+		prefetch_next = prefetch_entries.size();
+		SDL_mutexV(prefetch_mutex);
+	}
+	for(vector<SDL_Thread *>::iterator iter = prefetch_threads.begin(); iter != prefetch_threads.end(); ++iter) {
+		SDL_WaitThread(*iter, NULL);
+	}
+	prefetch_threads.clear();
+	for(vector<PrefetchEntry>::iterator iter = prefetch_entries.begin(); iter != prefetch_entries.end(); ++iter) {
+		if( iter->surface != NULL ) {
+			// decoded but never used
+			SDL_FreeSurface(iter->surface);
+		}
+	}
+	prefetch_entries.clear();
+	prefetch_indices.clear();
+	prefetch_next = 0;
+	if( prefetch_cond != NULL ) {
+		SDL_DestroyCond(prefetch_cond);
+		prefetch_cond = NULL;
+	}
+	if( prefetch_mutex != NULL ) {
+		SDL_DestroyMutex(prefetch_mutex);
+		prefetch_mutex = NULL;
+	}
+#endif
+}
+
+Gigalomania::Image *Gigalomania::Image::loadImage(const char *filename) {
+#ifdef TIMING
+	int time_s = clock();
+#endif
+	//LOG("Image::loadImage(\"%s\")\n",filename); // disabled logging to improve performance on startup
+	SDL_Surface *surface = NULL;
+#if SDL_MAJOR_VERSION == 1
+	surface = decodeImage(filename);
+#else
+	if( !takePrefetchedImage(&surface, filename) ) {
+		surface = decodeImage(filename);
+	}
+#endif
+	if( surface == NULL ) {
+		return NULL;
+	}
+	Gigalomania::Image *image = new Image();
+	image->surface = surface;
 #ifdef TIMING
 	int time_taken = clock() - time_s;
 	LOG("    image load time %d\n", time_taken);
@@ -913,8 +1732,94 @@ Gigalomania::Image *Gigalomania::Image::loadImage(const char *filename) {
 	}
 #endif
 
+	if( image != NULL && loaded_filenames != NULL ) {
+		loaded_filenames->push_back(filename);
+	}
+	return image;
+}
+
+Gigalomania::Image *Gigalomania::Image::createFromPixels(unsigned char *pixels, int width, int height, int bpp, int pitch, Uint32 rmask, Uint32 gmask, Uint32 bmask, Uint32 amask) {
+	SDL_Surface *surface = SDL_CreateRGBSurfaceFrom(pixels, width, height, bpp, pitch, rmask, gmask, bmask, amask);
+	if( surface == NULL ) {
+		LOG("SDL_CreateRGBSurfaceFrom failed: %s\n", SDL_GetError());
+		return NULL;
+	}
+	Gigalomania::Image *image = new Image();
+	image->surface = surface;
+	return image;
+}
+
+#if SDL_MAJOR_VERSION == 1
+#else
+/* Moves the pixels of colour (sr, sg, sb) out of this image, into a mask
+*  image that is white with their alpha, and transparent elsewhere. Drawing
+*  the mask with a tint on top of this image matches remap()ing the colour
+*  to the tint, so several players can share the one image (see
+*  createTinted()). As with remap(), this should be done before the image
+*  is scaled, and the mask then scaled in the same way. Returns false if
+*  this image doesn't have an alpha channel; otherwise *mask is NULL if
+*  there were no such pixels.
+*/
+bool Gigalomania::Image::extractTintMask(Image **mask, unsigned char sr, unsigned char sg, unsigned char sb) {
+	*mask = NULL;
+	const SDL_PixelFormat *format = this->surface->format;
+	if( format->BitsPerPixel != 32 || format->Amask == 0 ) {
+		return false;
+	}
+	const Uint32 rgb_mask = format->Rmask | format->Gmask | format->Bmask;
+	const Uint32 key = SDL_MapRGBA(format, sr, sg, sb, 0) & rgb_mask;
+	int w = getWidth();
+	int h = getHeight();
+	SDL_Surface *mask_surface = NULL;
+	SDL_LockSurface(this->surface);
+	for(int y=0;y<h;y++) {
+		Uint32 *row = (Uint32 *)((Uint8 *)this->surface->pixels + y * this->surface->pitch);
+		for(int x=0;x<w;x++) {
+			Uint32 pixel = row[x];
+			if( (pixel & rgb_mask) != key || (pixel & format->Amask) == 0 ) {
+				continue;
+			}
+			if( mask_surface == NULL ) {
+				mask_surface = SDL_CreateRGBSurface(0, w, h, 32, format->Rmask, format->Gmask, format->Bmask, format->Amask);
+				if( mask_surface == NULL ) {
+					LOG("failed to create tint mask: %s\n", SDL_GetError());
+					SDL_UnlockSurface(this->surface);
+					return false;
+				}
+			}
+			Uint32 *mask_row = (Uint32 *)((Uint8 *)mask_surface->pixels + y * mask_surface->pitch);
+			mask_row[x] = rgb_mask | (pixel & format->Amask);
+			row[x] = pixel & ~format->Amask;
+		}
+	}
+	SDL_UnlockSurface(this->surface);
+	if( mask_surface != NULL ) {
+		Image *image = new Image();
+		image->surface = mask_surface;
+		image->scale_x = this->scale_x;
+		image->scale_y = this->scale_y;
+		image->offset_x = this->offset_x;
+		image->offset_y = this->offset_y;
+		*mask = image;
+	}
+	return true;
+}
+
+Gigalomania::Image *Gigalomania::Image::createTinted(Image *base, Image *mask, unsigned char r, unsigned char g, unsigned char b) {
+	ASSERT( base->tint_base == NULL );
+	Image *image = new Image();
+	image->tint_base = base;
+	image->tint_mask = mask;
+	image->tint_r = r;
+	image->tint_g = g;
+	image->tint_b = b;
+	image->scale_x = base->scale_x;
+	image->scale_y = base->scale_y;
+	image->offset_x = base->offset_x;
+	image->offset_y = base->offset_y;
 	return image;
 }
+#endif
 
 Gigalomania::Image *Gigalomania::Image::createBlankImage(int width,int height, int bpp) {
 	Uint32 rmask, gmask, bmask, amask;
@@ -930,32 +1835,67 @@ Gigalomania::Image *Gigalomania::Image::createBlankImage(int width,int height, i
 	return image;
 }
 
-Gigalomania::Image *Gigalomania::Image::createNoise(int w,int h,float scale_u,float scale_v,const unsigned char filter_max[3],const unsigned char filter_min[3],NOISEMODE_t noisemode,int n_iterations) {
-	Gigalomania::Image *image = Gigalomania::Image::createBlankImage(w, h, 32);
-	SDL_LockSurface(image->surface);
-	float fvec[2] = {0.0f, 0.0f};
-	for(int y=0;y<h;y++) {
-		fvec[0] = scale_v * ((float)y) / ((float)h - 1.0f);
+/* Parameters for generating rows of a noise image, possibly shared between threads.
+*/
+struct NoiseJob {
+	SDL_Surface *surface;
+	float scale_u, scale_v;
+	const unsigned char *filter_max;
+	const unsigned char *filter_min;
+	Gigalomania::Image::NOISEMODE_t noisemode;
+	int n_iterations;
+	bool simd;
+	int y0, y1; // the rows to generate
+};
+
+static void createNoiseRows(const NoiseJob *job) {
+	SDL_Surface *surface = job->surface;
+	const int w = surface->w;
+	const int r_shift = byteChannelShift(surface->format->Rmask);
+	const int g_shift = byteChannelShift(surface->format->Gmask);
+	const int b_shift = byteChannelShift(surface->format->Bmask);
+	const Uint32 amask = surface->format->Amask;
+	float *fvec1 = new float[w];
+	float *this_fvec1 = new float[w];
+	float *this_h = new float[w];
+	float *row_h = new float[w];
+	for(int x=0;x<w;x++) {
+		fvec1[x] = job->scale_u * ((float)x) / ((float)w - 1.0f);
+	}
+	float max_val = 0.0f;
+	{
+		float mult = 1.0f;
+		for(int j=0;j<job->n_iterations;j++,mult*=2.0f) {
+			max_val += 1.0f / mult;
+		}
+	}
+	for(int y=job->y0;y<job->y1;y++) {
+		float fvec0 = job->scale_v * ((float)y) / ((float)surface->h - 1.0f);
 		for(int x=0;x<w;x++) {
-			fvec[1] = scale_u * ((float)x) / ((float)w - 1.0f);
-			float h = 0.0f;
-			float max_val = 0.0f;
-			float mult = 1.0f;
-			for(int j=0;j<n_iterations;j++,mult*=2.0f) {
-				float this_fvec[2];
-				this_fvec[0] = fvec[0] * mult;
-				this_fvec[1] = fvec[1] * mult;
-				float this_h = perlin_noise2(this_fvec) / mult;
-				if( noisemode == NOISEMODE_PATCHY || noisemode == NOISEMODE_MARBLE )
-					this_h = abs(this_h);
-				h += this_h;
-				max_val += 1.0f / mult;
+			row_h[x] = 0.0f;
+		}
+		float mult = 1.0f;
+		for(int j=0;j<job->n_iterations;j++,mult*=2.0f) {
+			for(int x=0;x<w;x++) {
+				this_fvec1[x] = fvec1[x] * mult;
+			}
+			perlin_noise2_row(this_h, fvec0 * mult, this_fvec1, w, job->simd);
+			for(int x=0;x<w;x++) {
+				float value = this_h[x] / mult;
+				if( job->noisemode == Gigalomania::Image::NOISEMODE_PATCHY || job->noisemode == Gigalomania::Image::NOISEMODE_MARBLE )
+					value = abs(value);
+				row_h[x] += value;
 			}
-			if( noisemode == NOISEMODE_PATCHY ) {
+		}
+
+		Uint32 *row = (Uint32 *)((Uint8 *)surface->pixels + y * surface->pitch);
+		for(int x=0;x<w;x++) {
+			float h = row_h[x];
+			if( job->noisemode == Gigalomania::Image::NOISEMODE_PATCHY ) {
 				h /= max_val;
 			}
-			else if( noisemode == NOISEMODE_MARBLE ) {
-				h = sin(scale_u * ((float)x) / ((float)w - 1.0f) + h);
+			else if( job->noisemode == Gigalomania::Image::NOISEMODE_MARBLE ) {
+				h = sin(fvec1[x] + h);
 				h = 0.5f + 0.5f * h;
 			}
 			else {
@@ -963,7 +1903,7 @@ Gigalomania::Image *Gigalomania::Image::createNoise(int w,int h,float scale_u,fl
 				h = 0.5f + 0.5f * h;
 			}
 
-			if( noisemode == NOISEMODE_CLOUDS ) {
+			if( job->noisemode == Gigalomania::Image::NOISEMODE_CLOUDS ) {
 				//const float offset = 0.4f;
 				//const float offset = 0.3f;
 				const float offset = 0.2f;
@@ -976,18 +1916,83 @@ Gigalomania::Image *Gigalomania::Image::createNoise(int w,int h,float scale_u,fl
 				LOG("h value is out of bounds\n");
 				ASSERT(false);
 			}
-			if( noisemode == NOISEMODE_WOOD ) {
+			if( job->noisemode == Gigalomania::Image::NOISEMODE_WOOD ) {
 				h = 20 * h;
 				h = h - floor(h);
 			}
-			Uint8 r = (Uint8)((filter_max[0] - filter_min[0]) * h + filter_min[0]);
-			Uint8 g = (Uint8)((filter_max[1] - filter_min[1]) * h + filter_min[1]);
-			Uint8 b = (Uint8)((filter_max[2] - filter_min[2]) * h + filter_min[2]);
-			Uint8 a = 255;
-			Uint32 pixel = SDL_MapRGBA(image->surface->format, r, g, b, a);
-			putpixel(image->surface, x, y, pixel);
+			Uint8 r = (Uint8)((job->filter_max[0] - job->filter_min[0]) * h + job->filter_min[0]);
+			Uint8 g = (Uint8)((job->filter_max[1] - job->filter_min[1]) * h + job->filter_min[1]);
+			Uint8 b = (Uint8)((job->filter_max[2] - job->filter_min[2]) * h + job->filter_min[2]);
+			row[x] = ((Uint32)r << r_shift) | ((Uint32)g << g_shift) | ((Uint32)b << b_shift) | amask;
+		}
+	}
+	delete [] fvec1;
+	delete [] this_fvec1;
+	delete [] this_h;
+	delete [] row_h;
+}
+
+static int createNoiseThreadFunction(void *data) {
+	createNoiseRows((const NoiseJob *)data);
+	return 0;
+}
+
+bool Gigalomania::Image::multithreaded = true;
+
+void Gigalomania::Image::setMultithreaded(bool multithreaded) {
+	Image::multithreaded = multithreaded;
+}
+
+Gigalomania::Image *Gigalomania::Image::createNoise(int w,int h,float scale_u,float scale_v,const unsigned char filter_max[3],const unsigned char filter_min[3],NOISEMODE_t noisemode,int n_iterations) {
+	Gigalomania::Image *image = Gigalomania::Image::createBlankImage(w, h, 32);
+	SDL_LockSurface(image->surface);
+	ASSERT( isByteChannel32(image->surface) );
+	perlin_noise2_init(); // must be done before starting any threads
+
+	NoiseJob job;
+	job.surface = image->surface;
+	job.scale_u = scale_u;
+	job.scale_v = scale_v;
+	job.filter_max = filter_max;
+	job.filter_min = filter_min;
+	job.noisemode = noisemode;
+	job.n_iterations = n_iterations;
+	job.simd = useSIMD();
+	job.y0 = 0;
+	job.y1 = h;
+
+	// split the rows into bands, one per thread, with the calling thread doing the first band; not worth it for small images
+	const int min_rows_per_thread_c = 32;
+	int n_threads = 1;
+#if SDL_MAJOR_VERSION != 1
+	if( multithreaded ) {
+		n_threads = min(SDL_GetCPUCount(), h / min_rows_per_thread_c);
+		n_threads = max(n_threads, 1);
+	}
+#endif
+	vector<NoiseJob> jobs(n_threads, job);
+	vector<SDL_Thread *> threads;
+	for(int i=0;i<n_threads;i++) {
+		jobs[i].y0 = (h * i) / n_threads;
+		jobs[i].y1 = (h * (i+1)) / n_threads;
+	}
+#if SDL_MAJOR_VERSION != 1
+	for(int i=1;i<n_threads;i++) {
+		SDL_Thread *thread = SDL_CreateThread(createNoiseThreadFunction, "noise", &jobs[i]);
+		if( thread == NULL ) {
+			LOG("failed to create noise thread: %s\n", SDL_GetError());
+			// do this band on the calling thread instead
+			createNoiseRows(&jobs[i]);
+		}
+		else {
+			threads.push_back(thread);
 		}
 	}
+#endif
+	createNoiseRows(&jobs[0]);
+	for(vector<SDL_Thread *>::iterator iter = threads.begin(); iter != threads.end(); ++iter) {
+		SDL_WaitThread(*iter, NULL);
+	}
 	SDL_UnlockSurface(image->surface);
 
 	return image;
@@ -1027,11 +2032,110 @@ void Gigalomania::Image::setGraphicsOutput(SDL_Surface *dest_surf) {
 	Gigalomania::Image::dest_surf = dest_surf;
 }
 #else
+void Gigalomania::SpriteBatch::setRenderer(SDL_Renderer *sdlRenderer) {
+	flush();
+	SpriteBatch::sdlRenderer = sdlRenderer;
+}
+
+void Gigalomania::SpriteBatch::setEnabled(bool enabled) {
+	flush();
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	SpriteBatch::enabled = enabled;
+#endif
+}
+
+void Gigalomania::SpriteBatch::add(SDL_Texture *texture, const SDL_Rect &srcrect, const SDL_Rect &dstrect, unsigned char r, unsigned char g, unsigned char b, unsigned char alpha) {
+	if( !enabled ) {
+		// n.b., the texture may be a shared atlas, so reset any modulation afterwards
+		if( alpha != 255 ) {
+			SDL_SetTextureAlphaMod(texture, alpha);
+		}
+		if( r != 255 || g != 255 || b != 255 ) {
+			SDL_SetTextureColorMod(texture, r, g, b);
+		}
+		SDL_RenderCopy(sdlRenderer, texture, &srcrect, &dstrect);
+		n_draw_calls++;
+		if( alpha != 255 ) {
+			SDL_SetTextureAlphaMod(texture, 255);
+		}
+		if( r != 255 || g != 255 || b != 255 ) {
+			SDL_SetTextureColorMod(texture, 255, 255, 255);
+		}
+		return;
+	}
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	if( texture != SpriteBatch::texture ) {
+		flush();
+		SpriteBatch::texture = texture;
+		SDL_QueryTexture(texture, NULL, NULL, &texture_w, &texture_h);
+	}
+	float u0 = ((float)srcrect.x) / (float)texture_w;
+	float v0 = ((float)srcrect.y) / (float)texture_h;
+	float u1 = ((float)(srcrect.x + srcrect.w)) / (float)texture_w;
+	float v1 = ((float)(srcrect.y + srcrect.h)) / (float)texture_h;
+	float x0 = (float)dstrect.x;
+	float y0 = (float)dstrect.y;
+	float x1 = (float)(dstrect.x + dstrect.w);
+	float y1 = (float)(dstrect.y + dstrect.h);
+
+	int index = (int)vertices.size();
+	SDL_Vertex vertex;
+	vertex.color.r = r;
+	vertex.color.g = g;
+	vertex.color.b = b;
+	vertex.color.a = alpha;
+	vertex.position.x = x0;
+	vertex.position.y = y0;
+	vertex.tex_coord.x = u0;
+	vertex.tex_coord.y = v0;
+	vertices.push_back(vertex);
+	vertex.position.x = x1;
+	vertex.tex_coord.x = u1;
+	vertices.push_back(vertex);
+	vertex.position.y = y1;
+	vertex.tex_coord.y = v1;
+	vertices.push_back(vertex);
+	vertex.position.x = x0;
+	vertex.tex_coord.x = u0;
+	vertices.push_back(vertex);
+
+	indices.push_back(index);
+	indices.push_back(index+1);
+	indices.push_back(index+2);
+	indices.push_back(index);
+	indices.push_back(index+2);
+	indices.push_back(index+3);
+#endif
+}
+
+void Gigalomania::SpriteBatch::flush() {
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+	if( indices.size() > 0 ) {
+		SDL_RenderGeometry(sdlRenderer, texture, &vertices[0], (int)vertices.size(), &indices[0], (int)indices.size());
+		n_draw_calls++;
+		vertices.clear();
+		indices.clear();
+	}
+	texture = NULL;
+#endif
+}
+
+void Gigalomania::SpriteBatch::endFrame() {
+	n_draw_calls_last_frame = n_draw_calls;
+	n_draw_calls = 0;
+}
+
 void Gigalomania::Image::setGraphicsOutput(SDL_Renderer *sdlRenderer) {
 	Gigalomania::Image::sdlRenderer = sdlRenderer;
+	SpriteBatch::setRenderer(sdlRenderer);
 }
 #endif
 
+/* Text is laid out and drawn glyph by glyph each time. The glyphs are packed into the shared atlases, so SpriteBatch draws
+* them in the same call as the panels and buttons around them; caching strings in their own textures would add a texture switch
+* (and so a draw call) for each string.
+*/
+
 void Gigalomania::Image::writeNumbers(int x,int y,Gigalomania::Image *images[10],int number,Justify justify) {
 	char buffer[16] = "";
 	sprintf(buffer,"%d",number);
@@ -1152,40 +2256,192 @@ void Gigalomania::Image::smooth() {
 	}
 	int w = getWidth();
 	int h = getHeight();
-	unsigned char *src_data = (unsigned char *)this->surface->pixels;
+	if( w < 3 || h < 3 ) {
+		// no interior pixels
+		return;
+	}
+#ifdef TIMING
+	int time_s = clock();
+#endif
 	int bytesperpixel = this->surface->format->BytesPerPixel;
 	int pitch = this->surface->pitch;
-	unsigned char *new_data = new unsigned char[w * h * bytesperpixel];
+	int n_bytes = w * bytesperpixel;
+	// smooth in place, keeping copies of the unsmoothed current and previous rows; the border pixels are left as they are
+	unsigned char *prev_row = new unsigned char[n_bytes];
+	unsigned char *this_row = new unsigned char[n_bytes];
 
 	SDL_LockSurface(this->surface);
-	for(int y=0;y<h;y++) {
-		for(int x=0;x<w;x++) {
-			for(int i=0;i<bytesperpixel;i++) {
-				Uint32 col = 0;
-				if(	x > 0 && x < w-1 && y > 0 && y < h-1 ) {
-						Uint32 sq[9];
-						int indx = 0;
-						for(int sx=x-1;sx<=x+1;sx++) {
-							for(int sy=y-1;sy<=y+1;sy++) {
-								sq[indx++] = src_data[ sy * pitch + sx * bytesperpixel + i ];
-							}
-						}
-						col = ( sq[0] + 2 * sq[1] + sq[2] + 2 * sq[3] + 4 * sq[4] + 2 * sq[5] + sq[6] + 2 * sq[7] + sq[8] ) / 16;
-						//col = ( sq[1] + sq[3] + sq[5] + sq[7] + 12 * sq[4] ) / 16;
+	unsigned char *src_data = (unsigned char *)this->surface->pixels;
+	memcpy(prev_row, src_data, n_bytes);
+	for(int y=1;y<h-1;y++) {
+		unsigned char *dst = &src_data[y * pitch];
+		memcpy(this_row, dst, n_bytes);
+		smoothRow(dst, prev_row, this_row, &src_data[(y+1) * pitch], n_bytes, bytesperpixel);
+		std::swap(prev_row, this_row);
+	}
+	SDL_UnlockSurface(this->surface);
+	delete [] prev_row;
+	delete [] this_row;
+#ifdef TIMING
+	int time_taken = clock() - time_s;
+	LOG("    image smooth time %d\n", time_taken);
+	static int total = 0;
+	total += time_taken;
+	LOG("    image smooth total %d\n", total);
+#endif
+}
+
+/* Fills the surface with repeatable pseudo random pixels, a mix of pure red, pure green and random colours, with random alpha.
+*/
+static void fillBenchmarkSurface(const SDL_Surface *surface) {
+	Uint32 seed = 12345;
+	for(int y=0;y<surface->h;y++) {
+		for(int x=0;x<surface->w;x++) {
+			seed = seed * 1103515245 + 12345;
+			Uint8 r = (Uint8)(seed >> 8), g = (Uint8)(seed >> 16), b = (Uint8)(seed >> 24), a = (Uint8)(seed >> 4);
+			int choice = seed >> 30;
+			if( choice == 0 ) {
+				r = 255; g = 0; b = 0;
+			}
+			else if( choice == 1 ) {
+				r = 0; g = 255; b = 0;
+			}
+			putpixel((SDL_Surface *)surface, x, y, SDL_MapRGBA(surface->format, r, g, b, a));
+		}
+	}
+}
+
+void Gigalomania::Image::runBenchmarks() {
+	LOG("Image::runBenchmarks(): SIMD: %s\n", getSIMDName());
+	const int size = 512;
+	const int n_iterations = 20;
+	const char *names[] = {"remap", "brighten", "scaleAlpha", "smooth"};
+	const int n_kernels = sizeof(names)/sizeof(names[0]);
+	bool old_simd_enabled = simd_enabled;
+	for(int k=0;k<n_kernels;k++) {
+		Image *images[2] = {NULL, NULL};
+		int times[2] = {0, 0};
+		for(int pass=0;pass<2;pass++) {
+			// first pass is scalar, second pass uses SIMD if available
+			setSIMDEnabled(pass == 1);
+			Image *image = createBlankImage(size, size, 32);
+			images[pass] = image;
+			fillBenchmarkSurface(image->surface);
+			Uint32 time_s = SDL_GetTicks();
+			for(int i=0;i<n_iterations;i++) {
+				if( k == 0 ) {
+					// swap the colours back and forth, so that every iteration has pixels to remap
+					if( i % 2 == 0 )
+						image->remap(255, 0, 0, 0, 255, 0);
+					else
+						image->remap(0, 255, 0, 255, 0, 0);
 				}
+				else if( k == 1 )
+					image->brighten(0.9f, 1.1f, 0.95f);
+				else if( k == 2 )
+					image->scaleAlpha(0.95f);
 				else
-					col = src_data[ y * pitch + x * bytesperpixel + i ];
-				new_data[ y * w * bytesperpixel + x * bytesperpixel + i] = (unsigned char)col;
+					image->smooth();
 			}
+			times[pass] = (int)( SDL_GetTicks() - time_s );
 		}
+		bool match = true;
+		const SDL_Surface *surface0 = images[0]->surface;
+		const SDL_Surface *surface1 = images[1]->surface;
+		for(int y=0;y<size && match;y++) {
+			const Uint8 *row0 = (const Uint8 *)surface0->pixels + y * surface0->pitch;
+			const Uint8 *row1 = (const Uint8 *)surface1->pixels + y * surface1->pitch;
+			if( memcmp(row0, row1, size * surface0->format->BytesPerPixel) != 0 )
+				match = false;
+		}
+		LOG("    %s x %d: scalar %d ms, SIMD %d ms, %s\n", names[k], n_iterations, times[0], times[1], match ? "results match" : "RESULTS DIFFER");
+		delete images[0];
+		delete images[1];
 	}
-	for(int y=0;y<h;y++) {
-		for(int x=0;x<w;x++) {
-			for(int i=0;i<bytesperpixel;i++) {
-				src_data[ y * pitch + x * bytesperpixel + i ] = new_data[ y * w * bytesperpixel + x * bytesperpixel + i];
+
+	// scale(), by 2, 3 and 4 and their inverses, with the general code and then with the integer scalers
+	bool old_integer_scalers_enabled = integer_scalers_enabled;
+	const int scale_size = 240; // a multiple of 2, 3 and 4
+	for(int enlarge=0;enlarge<2;enlarge++) {
+		for(int factor=2;factor<=4;factor++) {
+			float scale_factor = enlarge ? (float)factor : 1.0f/(float)factor;
+			Image *images[2][n_iterations];
+			int times[2] = {0, 0};
+			for(int pass=0;pass<2;pass++) {
+				setIntegerScalersEnabled(pass == 1);
+				// scale() works in place, so create the images first, and only time the scaling
+				for(int i=0;i<n_iterations;i++) {
+					images[pass][i] = createBlankImage(scale_size, scale_size, 32);
+					fillBenchmarkSurface(images[pass][i]->surface);
+				}
+				Uint32 time_s = SDL_GetTicks();
+				for(int i=0;i<n_iterations;i++) {
+					images[pass][i]->scale(scale_factor, scale_factor);
+				}
+				times[pass] = (int)( SDL_GetTicks() - time_s );
+			}
+			bool match = images[0][0]->getWidth() == images[1][0]->getWidth() && images[0][0]->getHeight() == images[1][0]->getHeight();
+			const SDL_Surface *surface0 = images[0][0]->surface;
+			const SDL_Surface *surface1 = images[1][0]->surface;
+			for(int y=0;y<surface0->h && match;y++) {
+				const Uint8 *row0 = (const Uint8 *)surface0->pixels + y * surface0->pitch;
+				const Uint8 *row1 = (const Uint8 *)surface1->pixels + y * surface1->pitch;
+				if( memcmp(row0, row1, surface0->w * surface0->format->BytesPerPixel) != 0 )
+					match = false;
+			}
+			LOG("    scale %s%d x %d: general %d ms, integer %d ms, %s\n", enlarge ? "" : "1/", factor, n_iterations, times[0], times[1], match ? "results match" : "RESULTS DIFFER");
+			for(int pass=0;pass<2;pass++) {
+				for(int i=0;i<n_iterations;i++) {
+					delete images[pass][i];
+				}
 			}
 		}
 	}
-	delete [] new_data;
-	SDL_UnlockSurface(this->surface);
+	setIntegerScalersEnabled(old_integer_scalers_enabled);
+
+	// createNoise(), for the map squares and for a screen sized image, at 1x and 2x resolution; the first configuration calls perlin_noise2() per pixel, as the original code did
+	bool old_multithreaded = multithreaded;
+	const unsigned char filter_max[3] = {255, 192, 84};
+	const unsigned char filter_min[3] = {120, 0, 0};
+	const char *config_names[] = {"scalar, 1 thread", "SIMD, 1 thread", "SIMD, multithreaded"};
+	const int n_configs = sizeof(config_names)/sizeof(config_names[0]);
+	for(int res=1;res<=2;res++) {
+		for(int test=0;test<2;test++) {
+			int w = test == 0 ? 16 * res : 320 * res;
+			int h = test == 0 ? 16 * res : 240 * res;
+			int n_images = test == 0 ? 15 * n_iterations : 1;
+			Image *reference = NULL;
+			for(int config=0;config<n_configs;config++) {
+				setSIMDEnabled(config >= 1);
+				setMultithreaded(config == 2);
+				Image *image = NULL;
+				Uint32 time_s = SDL_GetTicks();
+				for(int i=0;i<n_images;i++) {
+					delete image;
+					image = createNoise(w, h, 4.0f, 4.0f, filter_max, filter_min, NOISEMODE_PERLIN, 4);
+				}
+				int time = (int)( SDL_GetTicks() - time_s );
+				// the SIMD code does the same operations, but compilers that fuse multiply-adds in the scalar code can give slightly different results
+				int max_diff = 0;
+				if( reference == NULL ) {
+					reference = image;
+					image = NULL;
+				}
+				else {
+					for(int y=0;y<h;y++) {
+						const Uint8 *row0 = (const Uint8 *)reference->surface->pixels + y * reference->surface->pitch;
+						const Uint8 *row1 = (const Uint8 *)image->surface->pixels + y * image->surface->pitch;
+						for(int i=0;i<w*4;i++) {
+							max_diff = max(max_diff, abs(row0[i] - row1[i]));
+						}
+					}
+				}
+				LOG("    createNoise %d x %d x %d (%s): %d ms, max difference %d\n", w, h, n_images, config_names[config], time, max_diff);
+				delete image;
+			}
+			delete reference;
+		}
+	}
+	setMultithreaded(old_multithreaded);
+	setSIMDEnabled(old_simd_enabled);
 }
@@ -26,6 +26,42 @@ const int font_index_dash_c = 31;
 const int n_font_chars_c = 32;
 
 namespace Gigalomania {
+#if SDL_MAJOR_VERSION == 1
+#else
+	/* Collects textured quads during a frame, and draws consecutive quads
+	*  that use the same texture (e.g., the same atlas) with a single
+	*  SDL_RenderGeometry call. Alpha is per quad (via the vertex colours),
+	*  so doesn't need any texture state changes. Anything else drawn to the
+	*  renderer must call flush() first, to keep the drawing order.
+	*  If SDL_RenderGeometry isn't available, or batching is disabled, quads
+	*  are drawn immediately with SDL_RenderCopy.
+	*/
+	class SpriteBatch {
+		static SDL_Renderer *sdlRenderer;
+		static bool enabled;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+		static SDL_Texture *texture;
+		static int texture_w, texture_h;
+		static vector<SDL_Vertex> vertices;
+		static vector<int> indices;
+#endif
+		static int n_draw_calls;
+		static int n_draw_calls_last_frame;
+	public:
+		static void setRenderer(SDL_Renderer *sdlRenderer);
+		static void setEnabled(bool enabled);
+		static bool isEnabled() {
+			return enabled;
+		}
+		static void add(SDL_Texture *texture, const SDL_Rect &srcrect, const SDL_Rect &dstrect, unsigned char r, unsigned char g, unsigned char b, unsigned char alpha);
+		static void flush();
+		static void endFrame(); // call once per frame, after the final flush()
+		static int getNDrawCallsLastFrame() {
+			return n_draw_calls_last_frame;
+		}
+	};
+
+#endif
 	class Image : public TrackedObject {
 		unsigned char *data;
 		bool need_to_free_data;
@@ -34,11 +70,26 @@ namespace Gigalomania {
 		static SDL_Surface *dest_surf;
 #else
 		SDL_Texture *texture;
+		bool owns_texture; // false if texture is a shared atlas
+		int atlas_x, atlas_y; // position within the texture
 		static SDL_Renderer *sdlRenderer;
+		static vector<SDL_Texture *> atlas_textures;
+		// if tint_base is non-NULL, this image has no pixels of its own, and is drawn as tint_base, with tint_mask (if non-NULL) on top modulated by the tint colour
+		Image *tint_base;
+		Image *tint_mask;
+		unsigned char tint_r, tint_g, tint_b;
+
+		static bool packAtlas(const vector<Image *> &images, int max_size);
+		void addQuad(const SDL_Rect &srcrect, const SDL_Rect &dstrect, unsigned char r, unsigned char g, unsigned char b, unsigned char alpha) const;
 #endif
 		float scale_x, scale_y;
 		int offset_x, offset_y;
 
+		static vector<string> *loaded_filenames;
+		static bool simd_enabled;
+		static bool integer_scalers_enabled;
+		static bool multithreaded;
+
 		Image();
 
 		void free();
@@ -60,6 +111,8 @@ namespace Gigalomania {
 			return (int)(this->getHeight() / scale_y);
 		}
 		bool convertToDisplayFormat();
+		static bool convertToDisplayFormat(const vector<Image *> &images);
+		static void freeAtlases();
 		bool copyPalette(const Image *image);
 		float getScaleX() const {
 			return scale_x;
@@ -74,6 +127,38 @@ namespace Gigalomania {
 			this->offset_x = offset_x;
 			this->offset_y = offset_y;
 		}
+		int getOffsetX() const {
+			return this->offset_x;
+		}
+		int getOffsetY() const {
+			return this->offset_y;
+		}
+		const SDL_Surface *getSurface() const {
+			return this->surface;
+		}
+#if SDL_MAJOR_VERSION == 1
+		Image *getTintBase() const {
+			return NULL;
+		}
+		Image *getTintMask() const {
+			return NULL;
+		}
+#else
+		Image *getTintBase() const {
+			return this->tint_base;
+		}
+		Image *getTintMask() const {
+			return this->tint_mask;
+		}
+		void getTint(unsigned char *r, unsigned char *g, unsigned char *b) const {
+			*r = this->tint_r;
+			*g = this->tint_g;
+			*b = this->tint_b;
+		}
+		bool extractTintMask(Image **mask, unsigned char sr, unsigned char sg, unsigned char sb);
+		// tinted images can only be drawn (and converted to display format); base and mask must outlive them
+		static Image * createTinted(Image *base, Image *mask, unsigned char r, unsigned char g, unsigned char b);
+#endif
 		void remap(unsigned char sr,unsigned char sg,unsigned char sb,unsigned char rr,unsigned char rg,unsigned char rb);
 		void reshadeRGB(int from, bool to_r, bool to_g, bool to_b);
 		void brighten(float sr, float sg, float sb);
@@ -99,10 +184,18 @@ namespace Gigalomania {
 		void smooth();
 
 		static Image * loadImage(const char *filename);
+		// decodes the images on worker threads, ready for loadImage(); call endPrefetch() once done loading
+		static void prefetchImages(const vector<string> &filenames);
+		static void endPrefetch();
 		static Image * loadImage(string filename) {
 			return loadImage(filename.c_str());
 		}
 		static Image * createBlankImage(int width,int height, int bpp);
+		static Image * createFromPixels(unsigned char *pixels, int width, int height, int bpp, int pitch, Uint32 rmask, Uint32 gmask, Uint32 bmask, Uint32 amask); // pixels aren't copied, so must outlive the image
+		static void setLoadedFilenames(vector<string> *loaded_filenames) {
+			// if non-NULL, the filename of each image successfully loaded by loadImage() is added
+			Image::loaded_filenames = loaded_filenames;
+		}
 		enum NOISEMODE_t {
 			NOISEMODE_PERLIN = 0,
 			NOISEMODE_SMOKE = 1,
@@ -124,6 +217,22 @@ namespace Gigalomania {
 		static void write(int x,int y,Image *images[n_font_chars_c],const char *text,Justify justify);
 		static void writeMixedCase(int x,int y,Image *large[n_font_chars_c],Image *little[n_font_chars_c],Image *numbers[10],const char *text,Justify justify);
 
+		// the pixel processing functions (remap, brighten, scaleAlpha, smooth, createNoise) use SSE2 or NEON where available
+		static void setSIMDEnabled(bool simd_enabled); // if false, the scalar versions are used, which give identical results
+		static bool isSIMDEnabled() {
+			return simd_enabled;
+		}
+		static const char *getSIMDName();
+		static void setIntegerScalersEnabled(bool integer_scalers_enabled); // if false, scale() always uses the general code, which gives identical results
+		static bool isIntegerScalersEnabled() {
+			return integer_scalers_enabled;
+		}
+		static void setMultithreaded(bool multithreaded); // if false, createNoise() only uses the calling thread
+		static bool isMultithreaded() {
+			return multithreaded;
+		}
+		static void runBenchmarks(); // logs the time taken by the pixel processing functions and createNoise(), with and without SIMD, and by scale(), with and without the integer scalers
+
 		// SDL specific
 #if SDL_MAJOR_VERSION == 1
 		static void setGraphicsOutput(SDL_Surface *dest_surf);
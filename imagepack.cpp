@@ -0,0 +1,432 @@
+//---------------------------------------------------------------------------
+#include "stdafx.h"
+
+#include <cassert>
+#include <cstring>
+
+#include <map>
+using std::map;
+
+#if defined(_WIN32) || defined(__amigaos4__) || defined(AROS) || defined(__MORPHOS__)
+// no mmap, so the pack is read into memory instead
+#else
+#define IMAGEPACK_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "imagepack.h"
+#include "image.h"
+#include "savestate.h"
+#include "utils.h"
+
+//---------------------------------------------------------------------------
+
+/* Layout of the file, all as native endian ints (there's a check value in
+*  the header, so a pack from a different endianness is rejected rather than
+*  misread - it's just a cache, so will be rebuilt):
+*  header: magic, version, endian check, key, n_sources, n_values, n_slots, n_images
+*  sources: for each, the length then the characters, padded to 4 bytes
+*  values: n_values ints
+*  slots: n_slots ints, each an image index, or -1 for empty
+*  images: n_images entries of image_entry_size_c ints (see IMAGE_ENTRY_*)
+*  pixel data, each image starting on a 16 byte boundary
+*  A tinted image (see Image::createTinted()) has no pixels, and refers to
+*  its base and mask images, which always come earlier in the list.
+*/
+const int image_pack_magic_c = 0x50474947; // "GIGP"
+const int image_pack_version_c = 2; // increment if the file layout changes
+const int image_pack_endian_check_c = 0x01020304;
+const int image_pack_header_size_c = 8;
+
+enum {
+	IMAGE_ENTRY_WIDTH = 0,
+	IMAGE_ENTRY_HEIGHT,
+	IMAGE_ENTRY_BPP,
+	IMAGE_ENTRY_PITCH,
+	IMAGE_ENTRY_RMASK,
+	IMAGE_ENTRY_GMASK,
+	IMAGE_ENTRY_BMASK,
+	IMAGE_ENTRY_AMASK,
+	IMAGE_ENTRY_OFFSET_X,
+	IMAGE_ENTRY_OFFSET_Y,
+	IMAGE_ENTRY_SCALE_X, // float, stored as its bits
+	IMAGE_ENTRY_SCALE_Y, // float, stored as its bits
+	IMAGE_ENTRY_DATA, // offset of the pixels from the start of the file
+	IMAGE_ENTRY_TINT_BASE, // index of the base image if tinted, else -1
+	IMAGE_ENTRY_TINT_MASK, // index of the mask image, or -1
+	IMAGE_ENTRY_TINT_COLOUR, // 0xRRGGBB
+	image_entry_size_c
+};
+
+static int floatToBits(float value) {
+	int bits = 0;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static float bitsToFloat(int bits) {
+	float value = 0.0f;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+ImagePack::ImagePack() : data(NULL), size(0), mapped(false), key(0), slots(NULL), n_slots(0), image_entries(NULL), n_images(0) {
+}
+
+ImagePack::~ImagePack() {
+	close();
+}
+
+void ImagePack::close() {
+	if( data != NULL ) {
+#ifdef IMAGEPACK_USE_MMAP
+		if( mapped ) {
+			munmap(data, size);
+		}
+		else
+#endif
+		{
+			delete [] data;
+		}
+		data = NULL;
+	}
+	size = 0;
+	mapped = false;
+	sources.clear();
+	values.clear();
+	slots = NULL;
+	n_slots = 0;
+	image_entries = NULL;
+	n_images = 0;
+}
+
+bool ImagePack::open(const char *filename) {
+	close();
+#ifdef IMAGEPACK_USE_MMAP
+	int fd = ::open(filename, O_RDONLY);
+	if( fd == -1 ) {
+		return false;
+	}
+	struct stat file_stat;
+	if( fstat(fd, &file_stat) == 0 && file_stat.st_size > 0 ) {
+		// private and writable, so that images created from the pack can still be modified (copy on write)
+		void *ptr = mmap(NULL, file_stat.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if( ptr != MAP_FAILED ) {
+			data = static_cast<unsigned char *>(ptr);
+			size = file_stat.st_size;
+			mapped = true;
+		}
+	}
+	::close(fd);
+#else
+	FILE *file = fopen(filename, "rb");
+	if( file == NULL ) {
+		return false;
+	}
+	if( fseek(file, 0, SEEK_END) == 0 ) {
+		long length = ftell(file);
+		if( length > 0 && fseek(file, 0, SEEK_SET) == 0 ) {
+			data = new unsigned char[length];
+			size = length;
+			if( fread(data, 1, size, file) != size ) {
+				delete [] data;
+				data = NULL;
+				size = 0;
+			}
+		}
+	}
+	fclose(file);
+#endif
+	if( data == NULL ) {
+		LOG("failed to read image pack: %s\n", filename);
+		return false;
+	}
+	if( !parse() ) {
+		LOG("image pack is invalid or out of date: %s\n", filename);
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool ImagePack::parse() {
+	if( size < image_pack_header_size_c * sizeof(int) ) {
+		return false;
+	}
+	const int *ints = reinterpret_cast<const int *>(data);
+	const int *end = reinterpret_cast<const int *>(data + (size & ~(sizeof(int)-1)));
+	if( ints[0] != image_pack_magic_c || ints[1] != image_pack_version_c || ints[2] != image_pack_endian_check_c ) {
+		return false;
+	}
+	key = static_cast<unsigned int>(ints[3]);
+	int n_sources = ints[4];
+	int n_values = ints[5];
+	n_slots = ints[6];
+	n_images = ints[7];
+	if( n_sources < 0 || n_values < 0 || n_slots < 0 || n_images < 0 ) {
+		return false;
+	}
+	const int *ptr = ints + image_pack_header_size_c;
+	for(int i=0;i<n_sources;i++) {
+		if( ptr >= end ) {
+			return false;
+		}
+		int length = *ptr++;
+		int n_ints = (length + sizeof(int) - 1) / sizeof(int);
+		if( length < 0 || n_ints > end - ptr ) {
+			return false;
+		}
+		sources.push_back(string(reinterpret_cast<const char *>(ptr), length));
+		ptr += n_ints;
+	}
+	if( n_values > end - ptr ) {
+		return false;
+	}
+	values.assign(ptr, ptr + n_values);
+	ptr += n_values;
+	if( n_slots > end - ptr ) {
+		return false;
+	}
+	slots = ptr;
+	ptr += n_slots;
+	if( n_images > (end - ptr) / image_entry_size_c ) {
+		return false;
+	}
+	image_entries = ptr;
+
+	for(int i=0;i<n_slots;i++) {
+		if( slots[i] < -1 || slots[i] >= n_images ) {
+			return false;
+		}
+	}
+	for(int i=0;i<n_images;i++) {
+		const int *entry = &image_entries[i * image_entry_size_c];
+		int tint_base = entry[IMAGE_ENTRY_TINT_BASE];
+		if( tint_base != -1 ) {
+			int tint_mask = entry[IMAGE_ENTRY_TINT_MASK];
+			if( tint_base < 0 || tint_base >= i || image_entries[tint_base * image_entry_size_c + IMAGE_ENTRY_TINT_BASE] != -1 ) {
+				return false;
+			}
+			if( tint_mask < -1 || tint_mask >= i || ( tint_mask != -1 && image_entries[tint_mask * image_entry_size_c + IMAGE_ENTRY_TINT_BASE] != -1 ) ) {
+				return false;
+			}
+			continue;
+		}
+		int w = entry[IMAGE_ENTRY_WIDTH];
+		int h = entry[IMAGE_ENTRY_HEIGHT];
+		int bpp = entry[IMAGE_ENTRY_BPP];
+		int pitch = entry[IMAGE_ENTRY_PITCH];
+		int offset = entry[IMAGE_ENTRY_DATA];
+		if( w <= 0 || h <= 0 || pitch <= 0 || offset < 0 ) {
+			return false;
+		}
+		// as written by addPackImage(); the pixels are used in place, so each row must hold the whole width
+		if( ( bpp != 24 && bpp != 32 ) || (size_t)pitch < (size_t)w * (size_t)(bpp/8) ) {
+			return false;
+		}
+		if( (size_t)offset > size || (size_t)h * (size_t)pitch > size - offset ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ImagePack::createImages(vector<Gigalomania::Image *> *slot_images) const {
+	vector<Gigalomania::Image *> images(n_images, (Gigalomania::Image *)NULL);
+	for(int i=0;i<n_images;i++) {
+		const int *entry = &image_entries[i * image_entry_size_c];
+		if( entry[IMAGE_ENTRY_TINT_BASE] != -1 ) {
+#if SDL_MAJOR_VERSION == 1
+			images[i] = NULL; // not supported
+#else
+			int colour = entry[IMAGE_ENTRY_TINT_COLOUR];
+			Gigalomania::Image *mask = entry[IMAGE_ENTRY_TINT_MASK] == -1 ? NULL : images[ entry[IMAGE_ENTRY_TINT_MASK] ];
+			images[i] = Gigalomania::Image::createTinted(images[ entry[IMAGE_ENTRY_TINT_BASE] ], mask, (unsigned char)((colour >> 16) & 255), (unsigned char)((colour >> 8) & 255), (unsigned char)(colour & 255));
+#endif
+		}
+		else {
+			images[i] = Gigalomania::Image::createFromPixels(data + entry[IMAGE_ENTRY_DATA], entry[IMAGE_ENTRY_WIDTH], entry[IMAGE_ENTRY_HEIGHT], entry[IMAGE_ENTRY_BPP], entry[IMAGE_ENTRY_PITCH],
+				entry[IMAGE_ENTRY_RMASK], entry[IMAGE_ENTRY_GMASK], entry[IMAGE_ENTRY_BMASK], entry[IMAGE_ENTRY_AMASK]);
+		}
+		if( images[i] == NULL ) {
+			for(int j=0;j<i;j++) {
+				delete images[j];
+			}
+			return false;
+		}
+		images[i]->setOffset(entry[IMAGE_ENTRY_OFFSET_X], entry[IMAGE_ENTRY_OFFSET_Y]);
+		images[i]->setScale(bitsToFloat(entry[IMAGE_ENTRY_SCALE_X]), bitsToFloat(entry[IMAGE_ENTRY_SCALE_Y]));
+	}
+	slot_images->clear();
+	for(int i=0;i<n_slots;i++) {
+		slot_images->push_back( slots[i] == -1 ? NULL : images[ slots[i] ] );
+	}
+	return true;
+}
+
+bool ImagePack::hashSources(unsigned int *key, const vector<string> &sources) {
+	// FNV-1a, over the filenames and contents
+	unsigned int hash = *key ^ 2166136261u;
+	unsigned char buffer[4096];
+	for(vector<string>::const_iterator iter = sources.begin(); iter != sources.end(); ++iter) {
+		const string &source = *iter;
+		for(size_t i=0;i<source.length();i++) {
+			hash = ( hash ^ (unsigned char)source[i] ) * 16777619u;
+		}
+		SDL_RWops *src = SDL_RWFromFile(source.c_str(), "rb");
+		if( src == NULL ) {
+			LOG("failed to open image pack source: %s\n", source.c_str());
+			return false;
+		}
+		for(;;) {
+			int n_read = (int)SDL_RWread(src, buffer, 1, sizeof(buffer));
+			if( n_read <= 0 ) {
+				break;
+			}
+			for(int i=0;i<n_read;i++) {
+				hash = ( hash ^ buffer[i] ) * 16777619u;
+			}
+		}
+		SDL_RWclose(src);
+	}
+	*key = hash;
+	return true;
+}
+
+// returns the index of the image in images, adding it (and the images it's tinted from) if necessary, or -1 if it can't be written
+static int addPackImage(vector<const Gigalomania::Image *> *images, map<const Gigalomania::Image *, int> *image_indices, const Gigalomania::Image *image) {
+	map<const Gigalomania::Image *, int>::iterator image_iter = image_indices->find(image);
+	if( image_iter != image_indices->end() ) {
+		return image_iter->second;
+	}
+	if( image->getTintBase() != NULL ) {
+		if( addPackImage(images, image_indices, image->getTintBase()) == -1 ) {
+			return -1;
+		}
+		if( image->getTintMask() != NULL && addPackImage(images, image_indices, image->getTintMask()) == -1 ) {
+			return -1;
+		}
+	}
+	else {
+		int bpp = image->getSurface()->format->BitsPerPixel;
+		if( bpp != 24 && bpp != 32 ) {
+			LOG("can't write %d bit image to image pack\n", bpp);
+			return -1;
+		}
+	}
+	int index = (int)images->size();
+	(*image_indices)[image] = index;
+	images->push_back(image);
+	return index;
+}
+
+bool ImagePack::write(const char *filename, unsigned int key, const vector<string> &sources, const vector<int> &values, const vector<Gigalomania::Image *> &slot_images) {
+	// find the distinct images
+	vector<const Gigalomania::Image *> images;
+	map<const Gigalomania::Image *, int> image_indices;
+	vector<int> slots;
+	for(vector<Gigalomania::Image *>::const_iterator iter = slot_images.begin(); iter != slot_images.end(); ++iter) {
+		const Gigalomania::Image *image = *iter;
+		if( image == NULL ) {
+			slots.push_back(-1);
+			continue;
+		}
+		int index = addPackImage(&images, &image_indices, image);
+		if( index == -1 ) {
+			return false;
+		}
+		slots.push_back(index);
+	}
+
+	vector<int> header;
+	header.push_back(image_pack_magic_c);
+	header.push_back(image_pack_version_c);
+	header.push_back(image_pack_endian_check_c);
+	header.push_back(static_cast<int>(key));
+	header.push_back((int)sources.size());
+	header.push_back((int)values.size());
+	header.push_back((int)slots.size());
+	header.push_back((int)images.size());
+	for(vector<string>::const_iterator iter = sources.begin(); iter != sources.end(); ++iter) {
+		int length = (int)iter->length();
+		header.push_back(length);
+		size_t pos = header.size();
+		header.resize(pos + (length + sizeof(int) - 1) / sizeof(int), 0);
+		memcpy(&header[pos], iter->c_str(), length);
+	}
+	header.insert(header.end(), values.begin(), values.end());
+	header.insert(header.end(), slots.begin(), slots.end());
+
+	size_t offset = ( header.size() + images.size() * image_entry_size_c ) * sizeof(int);
+	for(vector<const Gigalomania::Image *>::const_iterator iter = images.begin(); iter != images.end(); ++iter) {
+		const Gigalomania::Image *image = *iter;
+		if( image->getTintBase() != NULL ) {
+			for(int i=0;i<IMAGE_ENTRY_OFFSET_X;i++) {
+				header.push_back(0);
+			}
+			header.push_back(image->getOffsetX());
+			header.push_back(image->getOffsetY());
+			header.push_back(floatToBits(image->getScaleX()));
+			header.push_back(floatToBits(image->getScaleY()));
+			header.push_back(0);
+#if SDL_MAJOR_VERSION == 1
+#else
+			unsigned char r = 0, g = 0, b = 0;
+			image->getTint(&r, &g, &b);
+			header.push_back(image_indices[image->getTintBase()]);
+			header.push_back(image->getTintMask() == NULL ? -1 : image_indices[image->getTintMask()]);
+			header.push_back((r << 16) | (g << 8) | b);
+#endif
+			continue;
+		}
+		const SDL_Surface *surface = image->getSurface();
+		offset = (offset + 15) & ~(size_t)15;
+		header.push_back(surface->w);
+		header.push_back(surface->h);
+		header.push_back(surface->format->BitsPerPixel);
+		header.push_back(surface->pitch);
+		header.push_back(static_cast<int>(surface->format->Rmask));
+		header.push_back(static_cast<int>(surface->format->Gmask));
+		header.push_back(static_cast<int>(surface->format->Bmask));
+		header.push_back(static_cast<int>(surface->format->Amask));
+		header.push_back(image->getOffsetX());
+		header.push_back(image->getOffsetY());
+		header.push_back(floatToBits(image->getScaleX()));
+		header.push_back(floatToBits(image->getScaleY()));
+		header.push_back((int)offset);
+		header.push_back(-1);
+		header.push_back(-1);
+		header.push_back(0);
+		offset += surface->h * surface->pitch;
+	}
+
+	FileSaveSink sink(filename);
+	if( !sink.isOpen() ) {
+		return false;
+	}
+	bool ok = sink.write(&header[0], header.size() * sizeof(int));
+	size_t pos = header.size() * sizeof(int);
+	const unsigned char padding[16] = {0};
+	for(vector<const Gigalomania::Image *>::const_iterator iter = images.begin(); iter != images.end() && ok; ++iter) {
+		if( (*iter)->getTintBase() != NULL ) {
+			continue;
+		}
+		const SDL_Surface *surface = (*iter)->getSurface();
+		size_t aligned_pos = (pos + 15) & ~(size_t)15;
+		if( aligned_pos != pos ) {
+			ok = sink.write(padding, aligned_pos - pos);
+			pos = aligned_pos;
+		}
+		size_t length = surface->h * surface->pitch;
+		ok = ok && sink.write(surface->pixels, length);
+		pos += length;
+	}
+	if( !ok ) {
+		LOG("failed to write image pack: %s\n", filename);
+		return false;
+	}
+	return sink.commit();
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+/** A cache of images after all of the loading and processing done at startup,
+*   stored uncompressed so that it can be memory mapped and the pixels used
+*   directly, without decoding or processing the source images again.
+*   The pack stores the images for a list of "slots" (so the same image may
+*   appear in several slots), and some integer values for any other state the
+*   caller needs to restore.
+*/
+
+#include <string>
+using std::string;
+
+#include <vector>
+using std::vector;
+
+namespace Gigalomania {
+	class Image;
+}
+
+class ImagePack {
+	unsigned char *data;
+	size_t size;
+	bool mapped; // if false, data was allocated with new []
+
+	unsigned int key;
+	vector<string> sources;
+	vector<int> values;
+	const int *slots;
+	int n_slots;
+	const int *image_entries;
+	int n_images;
+
+	ImagePack(const ImagePack &); // not copyable
+	ImagePack &operator=(const ImagePack &);
+
+	void close();
+	bool parse();
+public:
+	ImagePack();
+	~ImagePack(); // any images created from the pack must be deleted first, as they refer to its memory
+
+	bool open(const char *filename);
+	unsigned int getKey() const {
+		return this->key;
+	}
+	const vector<string> &getSources() const {
+		return this->sources;
+	}
+	const vector<int> &getValues() const {
+		return this->values;
+	}
+	int getNSlots() const {
+		return this->n_slots;
+	}
+	// creates an image for each slot (NULL for empty slots), with images that were shared when written still shared
+	bool createImages(vector<Gigalomania::Image *> *slot_images) const;
+
+	// hashes the contents of the source files, so that the pack is rebuilt if any of them change; returns false if any can't be read
+	static bool hashSources(unsigned int *key, const vector<string> &sources);
+	// only 24 and 32 bit images are supported (which all images are, after processing)
+	static bool write(const char *filename, unsigned int key, const vector<string> &sources, const vector<int> &values, const vector<Gigalomania::Image *> &slot_images);
+};
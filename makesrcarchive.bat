@@ -63,14 +63,18 @@ REM General:
 
 copy %src%\gpl.txt %dst%
 
+copy %src%\command.cpp %dst%
 copy %src%\game.cpp %dst%
 copy %src%\gamestate.cpp %dst%
 copy %src%\gui.cpp %dst%
 copy %src%\image.cpp %dst%
+copy %src%\imagepack.cpp %dst%
 copy %src%\main.cpp %dst%
+copy %src%\network.cpp %dst%
 copy %src%\panel.cpp %dst%
 copy %src%\player.cpp %dst%
 copy %src%\resources.cpp %dst%
+copy %src%\savestate.cpp %dst%
 copy %src%\screen.cpp %dst%
 copy %src%\sector.cpp %dst%
 copy %src%\sound.cpp %dst%
@@ -78,13 +82,17 @@ copy %src%\tutorial.cpp %dst%
 copy %src%\utils.cpp %dst%
 copy %src%\stdafx.cpp %dst%
 
+copy %src%\command.h %dst%
 copy %src%\game.h %dst%
 copy %src%\gamestate.h %dst%
 copy %src%\gui.h %dst%
 copy %src%\image.h %dst%
+copy %src%\imagepack.h %dst%
+copy %src%\network.h %dst%
 copy %src%\panel.h %dst%
 copy %src%\player.h %dst%
 copy %src%\resources.h %dst%
+copy %src%\savestate.h %dst%
 copy %src%\screen.h %dst%
 copy %src%\sector.h %dst%
 copy %src%\sound.h %dst%
@@ -0,0 +1,1070 @@
+//---------------------------------------------------------------------------
+#include "stdafx.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <sstream>
+
+#include "network.h"
+#include "game.h"
+#include "player.h"
+#include "savestate.h"
+#include "utils.h"
+
+#ifdef NETWORK_SOCKETS
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+//---------------------------------------------------------------------------
+
+const size_t max_net_message_c = 16*1024*1024; // larger messages are treated as a broken stream
+const size_t max_net_pending_c = 4*1024*1024; // if a peer stops reading, drop it rather than buffering forever
+const int net_send_interval_c = 50; // ms between state updates sent to the clients
+
+void NetBuffer::writeVarint(unsigned int value) {
+	while( value >= 0x80 ) {
+		data.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	data.push_back((unsigned char)value);
+}
+
+void NetBuffer::writeInt(int value) {
+	writeVarint( ((unsigned int)value << 1) ^ (unsigned int)(value >> 31) );
+}
+
+void NetBuffer::writeBytes(const void *bytes, size_t length) {
+	writeVarint((unsigned int)length);
+	const unsigned char *ptr = static_cast<const unsigned char *>(bytes);
+	data.insert(data.end(), ptr, ptr + length);
+}
+
+unsigned int NetBuffer::readVarint() {
+	unsigned int value = 0;
+	for(int shift=0;shift<35;shift+=7) {
+		if( read_pos >= data.size() ) {
+			break;
+		}
+		unsigned char byte = data[read_pos++];
+		value |= (unsigned int)(byte & 0x7f) << shift;
+		if( (byte & 0x80) == 0 ) {
+			return value;
+		}
+	}
+	ok = false;
+	return 0;
+}
+
+int NetBuffer::readInt() {
+	unsigned int raw = readVarint();
+	return (int)(raw >> 1) ^ -(int)(raw & 1);
+}
+
+bool NetBuffer::readBytes(vector<char> *bytes, size_t length) {
+	if( !ok || length > getRemaining() ) {
+		ok = false;
+		return false;
+	}
+	bytes->assign(data.begin() + read_pos, data.begin() + read_pos + length);
+	read_pos += length;
+	return true;
+}
+
+void NetFields::field(int &value) {
+	if( reading ) {
+		values->push_back(value);
+	}
+	else {
+		if( index < values->size() ) {
+			value = (*values)[index];
+		}
+		index++;
+	}
+}
+
+void NetFields::field(bool &value) {
+	int v = value ? 1 : 0;
+	field(v);
+	value = v != 0;
+}
+
+int NetFields::peek() const {
+	ASSERT( !reading );
+	return index < values->size() ? (*values)[index] : 0;
+}
+
+void NetFields::skip(int n) {
+	if( reading ) {
+		values->insert(values->end(), n, 0);
+	}
+	else {
+		index += n;
+	}
+}
+
+void NetFields::beginObject() {
+	if( reading && objects != NULL && objects->back() != values->size() ) {
+		objects->push_back(values->size());
+	}
+}
+
+void NetBitWriter::writeBits(unsigned int value, int n) {
+	for(int i=n-1;i>=0;i--) {
+		if( n_bits == 8 ) {
+			data.push_back(0);
+			n_bits = 0;
+		}
+		if( (value >> i) & 1 ) {
+			data.back() |= (unsigned char)(0x80 >> n_bits);
+		}
+		n_bits++;
+	}
+}
+
+void NetBitWriter::writeGamma(unsigned int value) {
+	// n zero bits, then the n+1 bits of value+1
+	ASSERT( value != 0xffffffff );
+	value++;
+	int n = 0;
+	while( n < 31 && ( value >> (n+1) ) != 0 ) {
+		n++;
+	}
+	writeBits(0, n);
+	writeBits(value, n+1);
+}
+
+unsigned int NetBitReader::readBits(int n) {
+	unsigned int value = 0;
+	for(int i=0;i<n;i++) {
+		if( bit_pos >= 8*data.size() ) {
+			ok = false;
+			return 0;
+		}
+		unsigned char byte = (unsigned char)data[bit_pos/8];
+		value = ( value << 1 ) | ( ( byte >> (7 - bit_pos%8) ) & 1 );
+		bit_pos++;
+	}
+	return value;
+}
+
+unsigned int NetBitReader::readGamma() {
+	int n = 0;
+	while( readBits(1) == 0 ) {
+		if( !ok || ++n > 31 ) {
+			ok = false;
+			return 0;
+		}
+	}
+	unsigned int value = ( 1u << n ) | readBits(n);
+	return ok ? value - 1 : 0;
+}
+
+static size_t netObjectEnd(const vector<size_t> &objects, size_t object, size_t n_fields) {
+	return object+1 < objects.size() ? objects[object+1] : n_fields;
+}
+
+/* After the number of fields, a delta is a bit packed list of the objects
+*  (see NetFields) that differ from the baseline, and for each of those, the
+*  fields that differ. Objects and fields are given as gaps from the previous
+*  one, and each change as the zigzag of the difference from the baseline, so
+*  from one tick to the next, unchanged objects cost nothing, and a soldier
+*  killed in an Army costs around a byte.
+*/
+void writeNetDelta(NetBuffer *buffer, const vector<int> &values, const vector<int> *baseline, const vector<size_t> &objects) {
+	ASSERT( baseline == NULL || baseline->size() == values.size() );
+	ASSERT( objects.size() > 0 && objects[0] == 0 );
+	buffer->writeVarint((unsigned int)values.size());
+	NetBitWriter bits;
+	// the objects that have changed since the baseline
+	vector<size_t> dirty;
+	for(size_t i=0;i<objects.size();i++) {
+		size_t end = netObjectEnd(objects, i, values.size());
+		for(size_t j=objects[i];j<end;j++) {
+			if( values[j] != ( baseline == NULL ? 0 : (*baseline)[j] ) ) {
+				dirty.push_back(i);
+				break;
+			}
+		}
+	}
+	bits.writeGamma((unsigned int)dirty.size());
+	size_t next_object = 0;
+	for(size_t i=0;i<dirty.size();i++) {
+		size_t object = dirty[i];
+		size_t end = netObjectEnd(objects, object, values.size());
+		bits.writeGamma((unsigned int)(object - next_object));
+		next_object = object + 1;
+		unsigned int n_changed = 0;
+		for(size_t j=objects[object];j<end;j++) {
+			if( values[j] != ( baseline == NULL ? 0 : (*baseline)[j] ) ) {
+				n_changed++;
+			}
+		}
+		bits.writeGamma(n_changed - 1);
+		size_t next = objects[object];
+		for(size_t j=objects[object];j<end;j++) {
+			int base = baseline == NULL ? 0 : (*baseline)[j];
+			if( values[j] != base ) {
+				int change = (int)((unsigned int)values[j] - (unsigned int)base);
+				unsigned int zigzag = ((unsigned int)change << 1) ^ (unsigned int)(change >> 31);
+				bits.writeGamma((unsigned int)(j - next));
+				bits.writeGamma(zigzag - 1); // never 0, as the field has changed
+				next = j + 1;
+			}
+		}
+	}
+	const vector<unsigned char> &data = bits.getData();
+	buffer->writeBytes(data.empty() ? NULL : &data[0], data.size());
+}
+
+bool readNetDelta(NetBuffer *buffer, const vector<int> *baseline, const vector<size_t> &objects, size_t n_fields, vector<int> *values) {
+	ASSERT( baseline == NULL || baseline->size() == n_fields );
+	unsigned int n_sent_fields = buffer->readVarint();
+	if( !buffer->isOk() || n_sent_fields != n_fields ) {
+		LOG("net delta has %d fields, expected %d\n", static_cast<int>(n_sent_fields), static_cast<int>(n_fields));
+		return false;
+	}
+	vector<char> data;
+	if( !buffer->readBytes(&data, buffer->readVarint()) ) {
+		return false;
+	}
+	if( baseline == NULL ) {
+		values->assign(n_fields, 0);
+	}
+	else {
+		*values = *baseline;
+	}
+	NetBitReader bits(data);
+	unsigned int n_dirty = bits.readGamma();
+	if( !bits.isOk() || n_dirty > objects.size() ) {
+		return false;
+	}
+	size_t next_object = 0;
+	for(unsigned int i=0;i<n_dirty;i++) {
+		size_t object = next_object + bits.readGamma();
+		if( !bits.isOk() || object >= objects.size() ) {
+			LOG("net delta object out of range: %d\n", static_cast<int>(object));
+			return false;
+		}
+		next_object = object + 1;
+		size_t end = netObjectEnd(objects, object, n_fields);
+		size_t n_changed = (size_t)bits.readGamma() + 1;
+		if( !bits.isOk() || n_changed > end - objects[object] ) {
+			return false;
+		}
+		size_t next = objects[object];
+		for(size_t j=0;j<n_changed;j++) {
+			size_t index = next + bits.readGamma();
+			unsigned int zigzag = bits.readGamma() + 1;
+			if( !bits.isOk() || index >= end ) {
+				LOG("net delta field out of range: %d\n", static_cast<int>(index));
+				return false;
+			}
+			int change = (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+			(*values)[index] = (int)((unsigned int)(*values)[index] + (unsigned int)change);
+			next = index + 1;
+		}
+	}
+	return true;
+}
+
+void writeNetCommand(NetBuffer *buffer, const Command &command) {
+	buffer->writeInt(command.type);
+	buffer->writeInt(command.player);
+	buffer->writeInt(command.sector_x);
+	buffer->writeInt(command.sector_y);
+	for(int i=0;i<Command::n_args_c;i++) {
+		buffer->writeInt(command.args[i]);
+	}
+}
+
+bool readNetCommand(NetBuffer *buffer, Command *command) {
+	int type = buffer->readInt();
+	if( type <= Command::COMMAND_NONE || type >= Command::N_COMMAND_TYPES ) {
+		return false;
+	}
+	command->type = static_cast<Command::CommandType>(type);
+	command->player = buffer->readInt();
+	command->sector_x = buffer->readInt();
+	command->sector_y = buffer->readInt();
+	for(int i=0;i<Command::n_args_c;i++) {
+		command->args[i] = buffer->readInt();
+	}
+	return buffer->isOk();
+}
+
+#ifdef NETWORK_SOCKETS
+static bool setNonBlocking(int socket_fd) {
+	int flags = fcntl(socket_fd, F_GETFL, 0);
+	return flags != -1 && fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static bool parseNetAddress(const string &address, bool *is_unix, string *host, string *port) {
+	const string unix_prefix = "unix:";
+	if( address.compare(0, unix_prefix.length(), unix_prefix) == 0 ) {
+		*is_unix = true;
+		*host = address.substr(unix_prefix.length());
+		return host->length() > 0 && host->length() < sizeof(((sockaddr_un *)NULL)->sun_path);
+	}
+	*is_unix = false;
+	size_t colon = address.rfind(':');
+	*host = address.substr(0, colon);
+	if( colon == string::npos || colon+1 == address.length() ) {
+		stringstream str;
+		str << default_network_port_c;
+		*port = str.str();
+	}
+	else {
+		*port = address.substr(colon+1);
+	}
+	if( host->length() == 0 ) {
+		*host = "127.0.0.1";
+	}
+	return true;
+}
+
+/* Returns a socket bound (if listening) or connected to address, or -1.
+*  Sockets that aren't listening are non-blocking, and connecting is set if
+*  the connection is still being made.
+*/
+static int openNetSocket(const string &address, bool listening, bool *connecting) {
+	*connecting = false;
+	bool is_unix = false;
+	string host, port;
+	if( !parseNetAddress(address, &is_unix, &host, &port) ) {
+		LOG("invalid network address: %s\n", address.c_str());
+		return -1;
+	}
+	if( is_unix ) {
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, host.c_str());
+		int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if( socket_fd == -1 ) {
+			return -1;
+		}
+		if( listening ) {
+			unlink(host.c_str()); // in case left behind by a previous server
+		}
+		else if( !setNonBlocking(socket_fd) ) {
+			::close(socket_fd);
+			return -1;
+		}
+		int result = listening ? bind(socket_fd, (sockaddr *)&addr, sizeof(addr)) : ::connect(socket_fd, (sockaddr *)&addr, sizeof(addr));
+		if( result != 0 && !listening && errno == EINPROGRESS ) {
+			*connecting = true;
+		}
+		else if( result != 0 ) {
+			LOG("failed to %s %s: %s\n", listening ? "bind" : "connect to", address.c_str(), strerror(errno));
+			::close(socket_fd);
+			return -1;
+		}
+		return socket_fd;
+	}
+
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listening ? AI_PASSIVE : 0;
+	addrinfo *info = NULL;
+	if( getaddrinfo(host.c_str(), port.c_str(), &hints, &info) != 0 ) {
+		LOG("failed to resolve network address: %s\n", address.c_str());
+		return -1;
+	}
+	int socket_fd = -1;
+	for(addrinfo *ai=info;ai!=NULL && socket_fd==-1;ai=ai->ai_next) {
+		socket_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if( socket_fd == -1 ) {
+			continue;
+		}
+		int result = 0;
+		if( listening ) {
+			int reuse = 1;
+			setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+			result = bind(socket_fd, ai->ai_addr, ai->ai_addrlen);
+		}
+		else if( !setNonBlocking(socket_fd) ) {
+			result = -1;
+		}
+		else {
+			result = ::connect(socket_fd, ai->ai_addr, ai->ai_addrlen);
+			if( result != 0 && errno == EINPROGRESS ) {
+				// n.b., if this fails, we find out too late to try any other addresses
+				*connecting = true;
+				result = 0;
+			}
+		}
+		if( result != 0 ) {
+			::close(socket_fd);
+			socket_fd = -1;
+		}
+	}
+	freeaddrinfo(info);
+	if( socket_fd == -1 ) {
+		LOG("failed to %s %s\n", listening ? "bind" : "connect to", address.c_str());
+		return -1;
+	}
+	int nodelay = 1; // the messages are small and latency matters more than throughput
+	setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	return socket_fd;
+}
+#endif
+
+NetConnection::NetConnection(int socket_fd, bool connecting) : socket_fd(socket_fd), bytes_sent(0), bytes_received(0), connecting(connecting) {
+#ifdef NETWORK_SOCKETS
+#ifdef SO_NOSIGPIPE
+	int nosigpipe = 1;
+	setsockopt(socket_fd, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof(nosigpipe));
+#endif
+	setNonBlocking(socket_fd);
+#endif
+}
+
+NetConnection::~NetConnection() {
+	close();
+}
+
+NetConnection *NetConnection::connect(const string &address) {
+#ifdef NETWORK_SOCKETS
+	bool connecting = false;
+	int socket_fd = openNetSocket(address, false, &connecting);
+	if( socket_fd == -1 ) {
+		return NULL;
+	}
+	LOG("%s %s\n", connecting ? "connecting to" : "connected to", address.c_str());
+	// anything sent is queued until the connection has been made
+	return new NetConnection(socket_fd, connecting);
+#else
+	LOG("networking not supported on this platform\n");
+	return NULL;
+#endif
+}
+
+void NetConnection::close() {
+#ifdef NETWORK_SOCKETS
+	if( socket_fd != -1 ) {
+		if( out_data.size() > 0 ) {
+			// hand anything still queued (e.g., a BYE message) to the OS, which carries on sending it after we close; but don't wait for room if the peer isn't reading
+			flush();
+		}
+		if( socket_fd != -1 ) {
+			::close(socket_fd);
+			socket_fd = -1;
+		}
+	}
+#endif
+	out_data.clear();
+}
+
+bool NetConnection::updateConnecting() {
+	// returns whether the connection has been made
+#ifdef NETWORK_SOCKETS
+	if( !connecting ) {
+		return socket_fd != -1;
+	}
+	pollfd poll_fd;
+	poll_fd.fd = socket_fd;
+	poll_fd.events = POLLOUT;
+	poll_fd.revents = 0;
+	int n = poll(&poll_fd, 1, 0);
+	if( n == 0 || ( n < 0 && errno == EINTR ) ) {
+		return false; // still connecting
+	}
+	int error = 0;
+	socklen_t error_length = sizeof(error);
+	if( n < 0 || getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &error, &error_length) != 0 || error != 0 ) {
+		LOG("failed to connect: %s\n", strerror(n < 0 || error == 0 ? errno : error));
+		::close(socket_fd);
+		socket_fd = -1;
+		out_data.clear();
+		return false;
+	}
+	connecting = false;
+	LOG("connection made\n");
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool NetConnection::flush() {
+#ifdef NETWORK_SOCKETS
+	if( !updateConnecting() ) {
+		return socket_fd != -1; // keep it queued until we're connected
+	}
+#ifdef MSG_NOSIGNAL
+	const int flags = MSG_NOSIGNAL;
+#else
+	const int flags = 0;
+#endif
+	size_t done = 0;
+	while( done < out_data.size() ) {
+		ssize_t n = ::send(socket_fd, &out_data[done], out_data.size() - done, flags);
+		if( n > 0 ) {
+			done += n;
+		}
+		else if( n < 0 && errno == EINTR ) {
+			continue;
+		}
+		else if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+			break;
+		}
+		else {
+			LOG("network send failed: %s\n", strerror(errno));
+			::close(socket_fd);
+			socket_fd = -1;
+			out_data.clear();
+			return false;
+		}
+	}
+	bytes_sent += done;
+	out_data.erase(out_data.begin(), out_data.begin() + done);
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool NetConnection::send(NetMessageType type, const NetBuffer &payload) {
+	if( !isOpen() ) {
+		return false;
+	}
+	NetBuffer header;
+	header.writeVarint((unsigned int)payload.size() + 1);
+	out_data.insert(out_data.end(), header.getData().begin(), header.getData().end());
+	out_data.push_back((unsigned char)type);
+	out_data.insert(out_data.end(), payload.getData().begin(), payload.getData().end());
+	if( !flush() ) {
+		return false;
+	}
+	if( out_data.size() > max_net_pending_c ) {
+		LOG("network peer isn't reading, dropping connection\n");
+		close();
+		return false;
+	}
+	return true;
+}
+
+bool NetConnection::receive(NetMessageType *type, NetBuffer *payload) {
+#ifdef NETWORK_SOCKETS
+	if( out_data.size() > 0 ) {
+		// send anything left over from earlier (or queued while connecting)
+		flush();
+	}
+	while( socket_fd != -1 && !connecting ) {
+		unsigned char buffer[4096];
+		ssize_t n = ::recv(socket_fd, buffer, sizeof(buffer), 0);
+		if( n > 0 ) {
+			in_data.insert(in_data.end(), buffer, buffer + n);
+			bytes_received += n;
+		}
+		else if( n < 0 && errno == EINTR ) {
+			continue;
+		}
+		else if( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+			break;
+		}
+		else {
+			// closed by the peer (or failed) - but still hand over any complete messages we've already received
+			::close(socket_fd);
+			socket_fd = -1;
+			out_data.clear();
+		}
+	}
+#endif
+	// parse the length
+	unsigned int length = 0;
+	size_t pos = 0;
+	for(int shift=0;;shift+=7) {
+		if( pos >= in_data.size() ) {
+			return false;
+		}
+		else if( shift >= 35 ) {
+			in_data.clear();
+			close();
+			return false;
+		}
+		unsigned char byte = in_data[pos++];
+		length |= (unsigned int)(byte & 0x7f) << shift;
+		if( (byte & 0x80) == 0 ) {
+			break;
+		}
+	}
+	if( length == 0 || length > max_net_message_c ) {
+		LOG("invalid network message length %d\n", length);
+		in_data.clear();
+		close();
+		return false;
+	}
+	if( in_data.size() - pos < length ) {
+		return false;
+	}
+	*type = static_cast<NetMessageType>(in_data[pos]);
+	payload->clear();
+	payload->getData().assign(in_data.begin() + pos + 1, in_data.begin() + pos + length);
+	in_data.erase(in_data.begin(), in_data.begin() + pos + length);
+	return true;
+}
+
+NetListener::NetListener() : socket_fd(-1) {
+}
+
+NetListener::~NetListener() {
+	close();
+}
+
+bool NetListener::open(const string &address) {
+	close();
+#ifdef NETWORK_SOCKETS
+	bool connecting = false;
+	socket_fd = openNetSocket(address, true, &connecting);
+	if( socket_fd == -1 ) {
+		return false;
+	}
+	if( listen(socket_fd, 4) != 0 || !setNonBlocking(socket_fd) ) {
+		LOG("failed to listen on %s\n", address.c_str());
+		close();
+		return false;
+	}
+	const string unix_prefix = "unix:";
+	if( address.compare(0, unix_prefix.length(), unix_prefix) == 0 ) {
+		unix_path = address.substr(unix_prefix.length());
+	}
+	LOG("listening on %s\n", address.c_str());
+	return true;
+#else
+	LOG("networking not supported on this platform\n");
+	return false;
+#endif
+}
+
+void NetListener::close() {
+#ifdef NETWORK_SOCKETS
+	if( socket_fd != -1 ) {
+		::close(socket_fd);
+		socket_fd = -1;
+	}
+	if( unix_path.length() > 0 ) {
+		unlink(unix_path.c_str());
+		unix_path.clear();
+	}
+#endif
+}
+
+NetConnection *NetListener::accept() {
+#ifdef NETWORK_SOCKETS
+	if( socket_fd == -1 ) {
+		return NULL;
+	}
+	int connection_fd = ::accept(socket_fd, NULL, NULL);
+	if( connection_fd == -1 ) {
+		return NULL;
+	}
+	if( unix_path.length() == 0 ) {
+		int nodelay = 1;
+		setsockopt(connection_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	}
+	return new NetConnection(connection_fd);
+#else
+	return NULL;
+#endif
+}
+
+NetServer::NetServer() : last_seq(0), last_send_time(-1) {
+}
+
+NetServer::~NetServer() {
+	for(size_t i=0;i<peers.size();i++) {
+		Peer *peer = peers[i];
+		if( peer->connection->isOpen() ) {
+			sendBye(peer, GAMERESULT_QUIT);
+		}
+		delete peer->connection;
+		delete peer;
+	}
+	for(size_t i=0;i<history.size();i++) {
+		delete history[i];
+	}
+}
+
+bool NetServer::open(const string &address) {
+	return listener.open(address);
+}
+
+void NetServer::sendBye(Peer *peer, int result) {
+	NetBuffer payload;
+	payload.writeInt(result);
+	peer->connection->send(NETMESSAGE_BYE, payload);
+	peer->connection->close();
+}
+
+bool NetServer::join(Peer *peer) {
+	if( game_g->getGameStateID() != GAMESTATEID_PLAYING || game_g->isStateChanged() ) {
+		return true; // wait until a game is being played
+	}
+	int player = game_g->addNetworkPlayer();
+	if( player == -1 ) {
+		LOG("no room for another player\n");
+		sendBye(peer, GAMERESULT_QUIT);
+		return false;
+	}
+	peer->player = player;
+	peer->sent = 0;
+	peer->acked = 0; // so the first state update is a keyframe
+	LOG("client joined as player %d\n", player);
+
+	NetBuffer welcome;
+	welcome.writeInt(player);
+	peer->connection->send(NETMESSAGE_WELCOME, welcome);
+
+	MemorySaveSink sink;
+	BinarySaveWriter writer(&sink);
+	game_g->writeState(writer, player);
+	if( !writer.isOk() ) {
+		LOG("failed to write snapshot\n");
+		sendBye(peer, GAMERESULT_QUIT);
+		return false;
+	}
+	NetBuffer snapshot;
+	snapshot.writeBytes(&sink.getData()[0], sink.getData().size());
+	return peer->connection->send(NETMESSAGE_SNAPSHOT, snapshot);
+}
+
+bool NetServer::processMessage(Peer *peer, NetMessageType type, NetBuffer *payload) {
+	if( type == NETMESSAGE_HELLO ) {
+		int version = payload->readInt();
+		if( version != network_version_c ) {
+			LOG("client has network version %d, expected %d\n", version, network_version_c);
+			sendBye(peer, GAMERESULT_QUIT);
+			return false;
+		}
+		peer->greeted = true;
+		return true;
+	}
+	else if( type == NETMESSAGE_COMMAND ) {
+		Command command;
+		if( !readNetCommand(payload, &command) ) {
+			LOG("received invalid command\n");
+			return false;
+		}
+		if( peer->player == -1 ) {
+			LOG("ignoring command %s from client that hasn't joined\n", Command::getName(command.type));
+		}
+		else if( command.player != peer->player || !game_g->submitNetworkCommand(command) ) {
+			// the GUI never sends these, so the client isn't playing fair
+			LOG("received invalid command %s from player %d for player %d\n", Command::getName(command.type), peer->player, command.player);
+			sendBye(peer, GAMERESULT_QUIT);
+			return false;
+		}
+		return true;
+	}
+	else if( type == NETMESSAGE_ACK ) {
+		unsigned int seq = payload->readVarint();
+		if( !payload->isOk() || seq > peer->sent ) {
+			LOG("received invalid acknowledgement\n");
+			return false;
+		}
+		if( seq > peer->acked ) {
+			peer->acked = seq;
+		}
+		return true;
+	}
+	else if( type == NETMESSAGE_BYE ) {
+		LOG("player %d has left\n", peer->player);
+		peer->connection->close();
+		return false;
+	}
+	LOG("unexpected network message type %d\n", type);
+	return false;
+}
+
+const NetSnapshot *NetServer::findSnapshot(unsigned int seq) const {
+	for(size_t i=0;i<history.size();i++) {
+		if( history[i]->seq == seq ) {
+			return history[i];
+		}
+	}
+	return NULL;
+}
+
+bool NetServer::gatherState() {
+	// returns whether there's a new snapshot
+	NetFields fields(true, &values, &objects);
+	game_g->netFields(fields);
+	if( history.size() > 0 && history.back()->values == values ) {
+		return false;
+	}
+	if( history.size() >= max_net_history_c ) {
+		delete history[0];
+		history.erase(history.begin());
+	}
+	history.push_back(new NetSnapshot(++last_seq, values));
+	return true;
+}
+
+void NetServer::update() {
+	for(;;) {
+		NetConnection *connection = listener.accept();
+		if( connection == NULL ) {
+			break;
+		}
+		LOG("accepted network connection\n");
+		peers.push_back(new Peer(connection));
+	}
+
+	for(size_t i=0;i<peers.size();) {
+		Peer *peer = peers[i];
+		bool ok = true;
+		NetMessageType type;
+		NetBuffer payload;
+		while( ok && peer->connection->receive(&type, &payload) ) {
+			ok = processMessage(peer, type, &payload);
+		}
+		if( ok && peer->greeted && peer->player == -1 ) {
+			ok = join(peer);
+		}
+		if( ok && peer->player != -1 && ( game_g->players[peer->player] == NULL || game_g->players[peer->player]->isDead() ) ) {
+			sendBye(peer, GAMERESULT_LOST);
+			ok = false;
+		}
+		if( !ok || !peer->connection->isOpen() ) {
+			LOG("network client for player %d disconnected\n", peer->player);
+			delete peer->connection;
+			delete peer;
+			peers.erase(peers.begin() + i);
+		}
+		else {
+			i++;
+		}
+	}
+
+	if( game_g->getGameStateID() != GAMESTATEID_PLAYING || game_g->isStateChanged() ) {
+		endGame();
+		return;
+	}
+
+	int time = game_g->getRealTime();
+	if( last_send_time != -1 && time >= last_send_time && time - last_send_time < net_send_interval_c ) {
+		return;
+	}
+	last_send_time = time;
+	bool gathered = false;
+	for(size_t i=0;i<peers.size();i++) {
+		Peer *peer = peers[i];
+		if( peer->player == -1 ) {
+			continue;
+		}
+		if( !gathered ) {
+			gatherState();
+			gathered = true;
+		}
+		const NetSnapshot *latest = history.back();
+		if( peer->sent == latest->seq ) {
+			continue; // nothing changed
+		}
+		// if the acknowledged state is too old to still be kept, send a keyframe
+		const NetSnapshot *base = findSnapshot(peer->acked);
+		NetBuffer payload;
+		payload.writeVarint(latest->seq);
+		payload.writeVarint(base == NULL ? 0 : base->seq);
+		writeNetDelta(&payload, latest->values, base == NULL ? NULL : &base->values, objects);
+		peer->connection->send(NETMESSAGE_STATE, payload);
+		peer->sent = latest->seq;
+	}
+}
+
+void NetServer::endGame() {
+	for(size_t i=0;i<peers.size();) {
+		Peer *peer = peers[i];
+		if( peer->player == -1 ) {
+			i++;
+			continue;
+		}
+		int result = GAMERESULT_QUIT;
+		if( game_g->getGameResult() != GAMERESULT_QUIT ) {
+			result = game_g->playerAlive(peer->player) ? GAMERESULT_WON : GAMERESULT_LOST;
+		}
+		sendBye(peer, result);
+		delete peer->connection;
+		delete peer;
+		peers.erase(peers.begin() + i);
+	}
+}
+
+NetClient::NetClient() : connection(NULL), player(-1), joined(false), finished(false), n_fields(0) {
+}
+
+NetClient::~NetClient() {
+	if( connection != NULL ) {
+		if( connection->isOpen() ) {
+			NetBuffer payload;
+			payload.writeInt(GAMERESULT_QUIT);
+			connection->send(NETMESSAGE_BYE, payload);
+		}
+		delete connection;
+	}
+	clearReceived();
+}
+
+void NetClient::clearReceived() {
+	for(size_t i=0;i<received.size();i++) {
+		delete received[i];
+	}
+	received.clear();
+}
+
+bool NetClient::connect(const string &address) {
+	connection = NetConnection::connect(address);
+	if( connection == NULL ) {
+		finished = true;
+		return false;
+	}
+	NetBuffer hello;
+	hello.writeInt(network_version_c);
+	return connection->send(NETMESSAGE_HELLO, hello);
+}
+
+void NetClient::finish(int result) {
+	finished = true;
+	if( connection != NULL ) {
+		connection->close();
+	}
+	if( joined ) {
+		game_g->endNetworkGame(static_cast<GameResult>(result));
+	}
+}
+
+bool NetClient::processMessage(NetMessageType type, NetBuffer *payload) {
+	if( type == NETMESSAGE_WELCOME ) {
+		player = payload->readInt();
+		LOG("joined server as player %d\n", player);
+		return payload->isOk() && player >= 0 && player < n_players_c;
+	}
+	else if( type == NETMESSAGE_SNAPSHOT ) {
+		vector<char> bytes;
+		if( player == -1 || !payload->readBytes(&bytes, payload->readVarint()) ) {
+			LOG("received invalid snapshot\n");
+			return false;
+		}
+		LOG("received snapshot of %d bytes\n", static_cast<int>(bytes.size()));
+		bytes.push_back('\0'); // in case it's XML
+		if( !game_g->loadNetworkSnapshot(&bytes[0], bytes.size()-1) ) {
+			LOG("failed to load snapshot\n");
+			return false;
+		}
+		joined = true;
+		clearReceived();
+		// the layout of the fields doesn't depend on the state of the world, so we can find it from our copy
+		vector<int> values;
+		NetFields layout(true, &values, &objects);
+		game_g->netFields(layout);
+		n_fields = values.size();
+		return true;
+	}
+	else if( type == NETMESSAGE_STATE ) {
+		if( !joined ) {
+			return true;
+		}
+		if( !processState(payload) ) {
+			LOG("received invalid state\n");
+			return false;
+		}
+		return true;
+	}
+	else if( type == NETMESSAGE_BYE ) {
+		int result = payload->readInt();
+		LOG("server has ended the game: %d\n", result);
+		finish(result);
+		return true;
+	}
+	LOG("unexpected network message type %d\n", type);
+	return false;
+}
+
+bool NetClient::processState(NetBuffer *payload) {
+	unsigned int seq = payload->readVarint();
+	unsigned int base_seq = payload->readVarint();
+	if( !payload->isOk() || seq <= base_seq || ( received.size() > 0 && seq <= received.back()->seq ) ) {
+		return false;
+	}
+	const NetSnapshot *base = NULL;
+	for(size_t i=0;i<received.size() && base == NULL;i++) {
+		if( received[i]->seq == base_seq ) {
+			base = received[i];
+		}
+	}
+	if( base == NULL && base_seq != 0 ) {
+		LOG("don't have state %d to apply delta to\n", base_seq);
+		return false;
+	}
+	NetSnapshot *snapshot = new NetSnapshot(seq, vector<int>());
+	if( !readNetDelta(payload, base == NULL ? NULL : &base->values, objects, n_fields, &snapshot->values) ) {
+		delete snapshot;
+		return false;
+	}
+	received.push_back(snapshot);
+	// the server only sends deltas against states at least as new as the ones we've acknowledged, and that it still keeps
+	while( received.size() > 0 && ( received[0]->seq < base_seq || received[0]->seq + max_net_history_c <= seq ) ) {
+		delete received[0];
+		received.erase(received.begin());
+	}
+
+	NetFields fields(false, &snapshot->values);
+	game_g->netFields(fields);
+	if( !fields.isOk() ) {
+		return false;
+	}
+
+	NetBuffer ack;
+	ack.writeVarint(seq);
+	return connection->send(NETMESSAGE_ACK, ack);
+}
+
+void NetClient::update() {
+	if( finished ) {
+		return;
+	}
+	if( joined && ( game_g->getGameStateID() != GAMESTATEID_PLAYING || game_g->isStateChanged() ) ) {
+		// we've quit
+		NetBuffer payload;
+		payload.writeInt(GAMERESULT_QUIT);
+		connection->send(NETMESSAGE_BYE, payload);
+		joined = false;
+		finish(GAMERESULT_QUIT);
+		return;
+	}
+	NetMessageType type;
+	NetBuffer payload;
+	while( !finished && connection->receive(&type, &payload) ) {
+		if( !processMessage(type, &payload) ) {
+			finish(GAMERESULT_QUIT);
+		}
+	}
+	if( !finished && !connection->isOpen() ) {
+		LOG("lost connection to server\n");
+		finish(GAMERESULT_QUIT);
+	}
+}
+
+bool NetClient::sendCommand(const Command &command) {
+	if( !joined || finished ) {
+		return false;
+	}
+	NetBuffer payload;
+	writeNetCommand(&payload, command);
+	return connection->send(NETMESSAGE_COMMAND, payload);
+}
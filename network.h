@@ -0,0 +1,313 @@
+#pragma once
+
+/** Client/server multiplayer. The server runs the simulation as normal; each
+*   client receives a full snapshot of the game when it joins, then a stream
+*   of compact deltas of the replicated fields of the game world, and sends
+*   its Commands up to the server to be executed there.
+*   Each state update is numbered, and the client acknowledges the ones it
+*   has applied; the server sends each update as a delta against the last
+*   state that the client acknowledged, so a client (or a spectator tool)
+*   that falls behind still only needs the latest update to catch up.
+*/
+
+#include <vector>
+using std::vector;
+
+#include <string>
+using std::string;
+
+#include "command.h"
+
+// sockets are only implemented for POSIX platforms for now
+#if defined(__linux) || (defined(__APPLE__) && defined(__MACH__))
+#define NETWORK_SOCKETS
+#endif
+
+const int network_version_c = 2;
+const int default_network_port_c = 27182;
+
+enum NetMessageType {
+	NETMESSAGE_HELLO = 1, // client to server: network_version_c
+	NETMESSAGE_WELCOME = 2, // server to client: the client's player
+	NETMESSAGE_SNAPSHOT = 3, // server to client: a binary saved state
+	NETMESSAGE_STATE = 4, // server to client: the state's sequence number, the sequence number of the state it's a delta against, then the delta
+	NETMESSAGE_COMMAND = 5, // client to server: a Command
+	NETMESSAGE_BYE = 6, // either way: the GameResult for the receiver, then the connection is closed
+	NETMESSAGE_ACK = 7 // client to server: the sequence number of the last state applied
+};
+
+/* Bytes of a message, with varint encoding for integers (zigzag for signed
+*  values, so small negative numbers stay small).
+*/
+class NetBuffer {
+	vector<unsigned char> data;
+	size_t read_pos;
+	bool ok; // false if a read ran past the end
+public:
+	NetBuffer() : read_pos(0), ok(true) {
+	}
+
+	void clear() {
+		data.clear();
+		read_pos = 0;
+		ok = true;
+	}
+	const vector<unsigned char> &getData() const {
+		return this->data;
+	}
+	vector<unsigned char> &getData() {
+		return this->data;
+	}
+	size_t size() const {
+		return this->data.size();
+	}
+	bool isOk() const {
+		return this->ok;
+	}
+	bool atEnd() const {
+		return this->read_pos >= this->data.size();
+	}
+
+	void writeVarint(unsigned int value);
+	void writeInt(int value);
+	void writeBytes(const void *bytes, size_t length);
+	unsigned int readVarint();
+	int readInt();
+	bool readBytes(vector<char> *bytes, size_t length);
+	size_t getRemaining() const {
+		return this->data.size() - this->read_pos;
+	}
+};
+
+/* Bits of a message, most significant bit first. Unsigned values that are
+*  usually small are written with an Elias gamma code, so 0 takes one bit, 1
+*  and 2 take three bits, 3 to 6 take five bits, and so on.
+*/
+class NetBitWriter {
+	vector<unsigned char> data;
+	int n_bits; // number of bits used in the last byte
+public:
+	NetBitWriter() : n_bits(8) {
+	}
+
+	const vector<unsigned char> &getData() const {
+		return this->data;
+	}
+	void writeBits(unsigned int value, int n);
+	void writeGamma(unsigned int value); // value must be less than 0xffffffff
+};
+
+class NetBitReader {
+	const vector<char> &data;
+	size_t bit_pos;
+	bool ok; // false if a read ran past the end, or a gamma code was invalid
+public:
+	NetBitReader(const vector<char> &data) : data(data), bit_pos(0), ok(true) {
+	}
+
+	bool isOk() const {
+		return this->ok;
+	}
+	unsigned int readBits(int n);
+	unsigned int readGamma();
+};
+
+/* Walks the replicated fields of the game world in a fixed order, so the same
+*  code both gathers the fields on the server (reading from the world) and
+*  applies them on the client (writing to the world). Objects that don't
+*  currently exist must still skip() their fields, so that each field keeps
+*  the same index, and the deltas stay small.
+*  The fields of each Sector, Army and Building are marked as an object with
+*  beginObject(), so that a delta can skip over unchanged objects as a
+*  whole; when reading, the index of each object's first field is recorded
+*  in objects, if given.
+*/
+class NetFields {
+	bool reading;
+	vector<int> *values;
+	vector<size_t> *objects;
+	size_t index;
+	bool ok; // false if a value that can't be applied was found
+public:
+	NetFields(bool reading, vector<int> *values, vector<size_t> *objects = NULL) : reading(reading), values(values), objects(objects), index(0), ok(true) {
+		if( reading ) {
+			values->clear();
+			if( objects != NULL ) {
+				objects->clear();
+				objects->push_back(0);
+			}
+		}
+	}
+
+	bool isReading() const {
+		return this->reading;
+	}
+	bool isWriting() const {
+		return !this->reading;
+	}
+	bool isOk() const {
+		return this->ok;
+	}
+	void reject() {
+		// called when writing, if a value is invalid; the rest of the fields are then not applied
+		this->ok = false;
+	}
+	void field(int &value);
+	void field(bool &value);
+	int peek() const; // when writing, the value that the next field will be set to
+	void skip(int n);
+	void beginObject();
+	void skipObject(int n) {
+		beginObject();
+		skip(n);
+	}
+};
+
+/* A numbered state of the replicated fields, kept by the server until it's
+*  too old to be acknowledged, and by the client while the server might still
+*  send deltas against it.
+*/
+class NetSnapshot {
+public:
+	unsigned int seq;
+	vector<int> values;
+
+	NetSnapshot(unsigned int seq, const vector<int> &values) : seq(seq), values(values) {
+	}
+};
+
+const unsigned int max_net_history_c = 64; // number of snapshots kept to be acknowledged
+
+// a NULL baseline is all zeroes, so the delta is a keyframe
+void writeNetDelta(NetBuffer *buffer, const vector<int> &values, const vector<int> *baseline, const vector<size_t> &objects);
+bool readNetDelta(NetBuffer *buffer, const vector<int> *baseline, const vector<size_t> &objects, size_t n_fields, vector<int> *values);
+
+void writeNetCommand(NetBuffer *buffer, const Command &command);
+bool readNetCommand(NetBuffer *buffer, Command *command);
+
+/* A framed, non-blocking stream connection. Each message is a varint length,
+*  then the NetMessageType byte, then the payload.
+*/
+class NetConnection {
+	int socket_fd;
+	vector<unsigned char> in_data;
+	vector<unsigned char> out_data;
+	size_t bytes_sent;
+	size_t bytes_received;
+	bool connecting; // a non-blocking connect that hasn't completed yet
+
+	NetConnection(const NetConnection &); // not copyable
+	NetConnection &operator=(const NetConnection &);
+
+	bool updateConnecting();
+	bool flush();
+public:
+	NetConnection(int socket_fd, bool connecting = false);
+	~NetConnection();
+
+	static NetConnection *connect(const string &address); // doesn't wait for the connection to be made; returns NULL on failure
+
+	bool isOpen() const {
+		return this->socket_fd != -1;
+	}
+	void close();
+	bool send(NetMessageType type, const NetBuffer &payload);
+	bool receive(NetMessageType *type, NetBuffer *payload); // returns false if no complete message is waiting
+	size_t getBytesSent() const {
+		return this->bytes_sent;
+	}
+	size_t getBytesReceived() const {
+		return this->bytes_received;
+	}
+};
+
+/* Accepts connections on a TCP ("host:port", or just ":port") or Unix domain
+*  socket ("unix:path") address.
+*/
+class NetListener {
+	int socket_fd;
+	string unix_path;
+
+	NetListener(const NetListener &); // not copyable
+	NetListener &operator=(const NetListener &);
+public:
+	NetListener();
+	~NetListener();
+
+	bool open(const string &address);
+	bool isOpen() const {
+		return this->socket_fd != -1;
+	}
+	void close();
+	NetConnection *accept(); // returns NULL if there are no pending connections
+};
+
+/* The server side, owned by the Game when running as GAMEMODE_MULTIPLAYER_SERVER.
+*/
+class NetServer {
+	class Peer {
+	public:
+		NetConnection *connection;
+		bool greeted; // whether the client has said hello, so can join once a game is being played
+		int player; // -1 until the client has joined the game
+		unsigned int sent; // sequence number of the last state sent to this client, 0 for none
+		unsigned int acked; // sequence number of the last state the client acknowledged, 0 for none
+
+		Peer(NetConnection *connection) : connection(connection), greeted(false), player(-1), sent(0), acked(0) {
+		}
+	};
+
+	NetListener listener;
+	vector<Peer *> peers;
+	vector<int> values;
+	vector<size_t> objects;
+	vector<NetSnapshot *> history; // the most recent states, oldest first
+	unsigned int last_seq;
+	int last_send_time;
+
+	NetServer(const NetServer &); // not copyable
+	NetServer &operator=(const NetServer &);
+
+	bool processMessage(Peer *peer, NetMessageType type, NetBuffer *payload);
+	bool join(Peer *peer);
+	void sendBye(Peer *peer, int result);
+	bool gatherState();
+	const NetSnapshot *findSnapshot(unsigned int seq) const;
+public:
+	NetServer();
+	~NetServer();
+
+	bool open(const string &address);
+	void update();
+	void endGame(); // tells the clients the result, when the game on the server ends
+};
+
+/* The client side, owned by the Game when running as GAMEMODE_MULTIPLAYER_CLIENT.
+*/
+class NetClient {
+	NetConnection *connection;
+	int player; // -1 until welcomed
+	bool joined; // whether the snapshot has been loaded
+	bool finished; // the server has ended the game, or the connection was lost
+	vector<size_t> objects; // layout of the replicated fields, see NetFields
+	size_t n_fields;
+	vector<NetSnapshot *> received; // states that the server may send deltas against, oldest first
+
+	NetClient(const NetClient &); // not copyable
+	NetClient &operator=(const NetClient &);
+
+	bool processMessage(NetMessageType type, NetBuffer *payload);
+	bool processState(NetBuffer *payload);
+	void clearReceived();
+	void finish(int result);
+public:
+	NetClient();
+	~NetClient();
+
+	bool connect(const string &address);
+	void update();
+	bool sendCommand(const Command &command);
+	bool isFinished() const {
+		return this->finished;
+	}
+};
@@ -2,6 +2,11 @@
 #include "stdafx.h"
 
 #include <cassert>
+#include <cmath>
+
+#include <algorithm>
+using std::min;
+using std::max;
 
 #include "panel.h"
 #include "game.h"
@@ -18,6 +23,64 @@ using Gigalomania::MultiPanel;
 
 //---------------------------------------------------------------------------
 
+namespace Gigalomania {
+	/* Flat index of the panels that a PanelPage dispatches input to, with a grid over the screen so that the panels that
+	* only act when the mouse is over them can be found without testing every one.
+	*/
+	class PanelInputIndex {
+	public:
+		static const int n_cells_x_c = 16;
+		static const int n_cells_y_c = 12;
+
+		vector<PanelPage *> panels; // in the order that input was previously dispatched to them
+		vector<int> all_panels; // indices into panels, for those that need all input
+		vector<int> cells[n_cells_y_c][n_cells_x_c]; // indices into panels, for those that overlap each cell
+		float scale_w, scale_h;
+
+		PanelInputIndex(float scale_w, float scale_h) : scale_w(scale_w), scale_h(scale_h) {
+		}
+
+		void addAll(PanelPage *panel) {
+			all_panels.push_back(panels.size());
+			panels.push_back(panel);
+		}
+		void addInside(PanelPage *panel, int left, int top, int w, int h, int tolerance) {
+			// same area as PanelPage::mouseOver()
+			int cx0 = getCellX( (left - tolerance) * scale_w );
+			int cx1 = getCellX( (left + w + tolerance) * scale_w );
+			int cy0 = getCellY( (top - tolerance) * scale_h );
+			int cy1 = getCellY( (top + h + tolerance) * scale_h );
+			for(int cy=cy0;cy<=cy1;cy++) {
+				for(int cx=cx0;cx<=cx1;cx++) {
+					cells[cy][cx].push_back(panels.size());
+				}
+			}
+			panels.push_back(panel);
+		}
+		int getCellX(float x) const {
+			int cx = (int)floor( x * n_cells_x_c / ( default_width_c * scale_w ) );
+			return max(0, min(cx, n_cells_x_c-1));
+		}
+		int getCellY(float y) const {
+			int cy = (int)floor( y * n_cells_y_c / ( default_height_c * scale_h ) );
+			return max(0, min(cy, n_cells_y_c-1));
+		}
+		// the panels to dispatch input at this position to, in order
+		void find(vector<PanelPage *> *found, int m_x, int m_y) const {
+			const vector<int> &cell = cells[getCellY((float)m_y)][getCellX((float)m_x)];
+			vector<int> indices;
+			indices.reserve(all_panels.size() + cell.size());
+			indices.insert(indices.end(), all_panels.begin(), all_panels.end());
+			indices.insert(indices.end(), cell.begin(), cell.end());
+			std::sort(indices.begin(), indices.end());
+			found->clear();
+			for(vector<int>::const_iterator iter = indices.begin(); iter != indices.end(); ++iter) {
+				found->push_back(panels.at(*iter));
+			}
+		}
+	};
+}
+
 void registerClick() {
 	//LOG("registerClick()\n");
 	// call for gui items to be registered as a mouse click, rather than continuous press
@@ -25,20 +88,22 @@ void registerClick() {
     game_g->s_guiclick->setVolume(0.125f);
 }
 
-PanelPage::PanelPage(int offset_x,int offset_y) {
+bool PanelPage::defer_popups = false;
+
+PanelPage::PanelPage(int offset_x,int offset_y) : TrackedObject(TRACKED_PANELPAGE) {
 	init_panelpage();
 	this->offset_x = offset_x;
 	this->offset_y = offset_y;
 }
 
-PanelPage::PanelPage(int offset_x,int offset_y,const char *infoLMB) {
+PanelPage::PanelPage(int offset_x,int offset_y,const char *infoLMB) : TrackedObject(TRACKED_PANELPAGE) {
 	init_panelpage();
 	this->offset_x = offset_x;
 	this->offset_y = offset_y;
 	this->setInfoLMB(infoLMB);
 }
 
-PanelPage::PanelPage(int offset_x,int offset_y,int w,int h) {
+PanelPage::PanelPage(int offset_x,int offset_y,int w,int h) : TrackedObject(TRACKED_PANELPAGE) {
 	init_panelpage();
 	this->offset_x = offset_x;
 	this->offset_y = offset_y;
@@ -51,9 +116,15 @@ PanelPage::~PanelPage() {
 		owner->remove(this);
 	free(true);
 	delete children;
+	delete input_index;
 }
 
 void PanelPage::init_panelpage() {
+	this->input_index = NULL;
+	this->input_mode = INPUT_NONE;
+	this->layout_valid = false;
+	this->layout_left = 0;
+	this->layout_top = 0;
 	this->owner = NULL;
 	this->modal_child = NULL;
 	this->offset_x = 0;
@@ -79,39 +150,96 @@ void PanelPage::init_panelpage() {
 void PanelPage::add(PanelPage *panel) {
 	this->children->push_back(panel);
 	panel->owner = this;
+	panel->invalidateLayout();
+	this->invalidateInputIndex();
 }
 
 void PanelPage::remove(PanelPage *panel) {
 	if( panel == this->modal_child )
 		this->modal_child = NULL;
 	panel->owner = NULL;
+	panel->invalidateLayout();
 	remove_vec(this->children, panel);
+	this->invalidateInputIndex();
+}
+
+/* Must be called whenever the panels that input is dispatched to might change: the input index of this panel and its
+* owners all include this panel's descendants.
+*/
+void PanelPage::invalidateInputIndex() {
+	for(PanelPage *panel = this; panel != NULL; panel = panel->owner) {
+		delete panel->input_index;
+		panel->input_index = NULL;
+	}
+}
+
+/* Adds this panel, or if it doesn't handle input itself, its descendants that do.
+*/
+void PanelPage::addToInputIndex(PanelInputIndex *index, int parent_left, int parent_top) {
+	int left = parent_left + offset_x;
+	int top = parent_top + offset_y;
+	if( this->input_mode == INPUT_ALL || this->modal_child != NULL ) {
+		// if there's a modal child, our input() only passes input to that
+		index->addAll(this);
+	}
+	else if( this->input_mode == INPUT_INSIDE ) {
+		if( children->size() > 0 ) {
+			// our input() also passes input on to our children
+			index->addAll(this);
+		}
+		else {
+			index->addInside(this, left, top, w, h, tolerance);
+		}
+	}
+	else {
+		for(unsigned int i=0;i<children->size();i++) {
+			children->at(i)->addToInputIndex(index, left, top);
+		}
+	}
+}
+
+/* Must be called when the owner of this panel changes, as that changes the absolute position of it and all its descendants
+* (offsets are only set on construction).
+*/
+void PanelPage::invalidateLayout() {
+	this->layout_valid = false;
+	for(unsigned int i=0;i<children->size();i++) {
+		children->at(i)->invalidateLayout();
+	}
+}
+
+void PanelPage::updateLayout() const {
+	this->layout_left = ( owner != NULL ? owner->getLeft() : 0 ) + offset_x;
+	this->layout_top = ( owner != NULL ? owner->getTop() : 0 ) + offset_y;
+	this->layout_valid = true;
 }
 
 int PanelPage::getLeft() const {
-	int parent_left = owner != NULL ? owner->getLeft() : 0;
-	return parent_left + offset_x;
+	if( !layout_valid )
+		updateLayout();
+	return layout_left;
 }
 
 int PanelPage::getTop() const {
-	int parent_top = owner != NULL ? owner->getTop() : 0;
-	return parent_top + offset_y;
+	if( !layout_valid )
+		updateLayout();
+	return layout_top;
 }
 
 int PanelPage::getRight() const {
-	return owner->getLeft() + offset_x + w;
+	return getLeft() + w;
 }
 
 int PanelPage::getXCentre() const {
-	return owner->getLeft() + offset_x + w/2;
+	return getLeft() + w/2;
 }
 
 int PanelPage::getYCentre() const {
-	return owner->getTop() + offset_y + h/2;
+	return getTop() + h/2;
 }
 
 int PanelPage::getBottom() const {
-	return owner->getTop() + offset_y + h;
+	return getTop() + h;
 }
 
 PanelPage *PanelPage::findById(const string &id) {
@@ -173,6 +301,7 @@ const char *PanelPage::getInfoRMB() const {
 }*/
 
 void PanelPage::free(bool free_this) {
+	this->invalidateInputIndex();
 	for(unsigned int i=0;i<children->size();i++) {
 		PanelPage *panel = children->at(i);
 		// panel should be non-NULL, but to satisfy VS Code Analysis...
@@ -194,6 +323,9 @@ void PanelPage::free(bool free_this) {
 }
 
 void PanelPage::drawPopups() {
+	if( defer_popups ) {
+		return;
+	}
 	bool touch_mode = game_g->isMobileUI() || game_g->getApplication()->isBlankMouse();
 	if( touch_mode ) {
 		return;
@@ -372,6 +504,17 @@ void PanelPage::draw() {
 	this->drawForeground();
 }
 
+/* Draws the popups skipped by a draw() with setDeferPopups(true), calling drawPopups() in the same order as draw() would.
+*/
+void PanelPage::drawDeferredPopups() {
+	for(unsigned int i=0;i<children->size();i++) {
+		PanelPage *panel = children->at(i);
+		panel->drawDeferredPopups();
+	}
+
+	this->drawPopups();
+}
+
 bool PanelPage::mouseOver(int m_x,int m_y) const {
 	if( visible && enabled &&
         m_x >= ( this->getLeft() - tolerance ) * game_g->getScaleWidth() &&
@@ -392,9 +535,37 @@ void PanelPage::input(int m_x,int m_y,bool m_left,bool m_middle,bool m_right,boo
 		this->modal_child->input(m_x, m_y, m_left, m_middle, m_right, click);
         return;
 	}
-	for(unsigned int i=0;i<children->size();i++) {
-		PanelPage *panel = children->at(i);
-		panel->input(m_x, m_y, m_left, m_middle, m_right, click);
+	// rather than passing the input down the whole tree, only dispatch to the descendants that handle it
+	vector<PanelPage *> panels;
+	vector<PanelPage *> done;
+	for(;;) {
+		if( this->input_index != NULL && ( this->input_index->scale_w != game_g->getScaleWidth() || this->input_index->scale_h != game_g->getScaleHeight() ) ) {
+			this->invalidateInputIndex();
+		}
+		if( this->input_index == NULL ) {
+			this->input_index = new PanelInputIndex(game_g->getScaleWidth(), game_g->getScaleHeight());
+			int left = this->getLeft();
+			int top = this->getTop();
+			for(unsigned int i=0;i<children->size();i++) {
+				children->at(i)->addToInputIndex(this->input_index, left, top);
+			}
+		}
+		const PanelInputIndex *index = this->input_index;
+		index->find(&panels, m_x, m_y);
+		bool changed = false;
+		for(vector<PanelPage *>::const_iterator iter = panels.begin(); iter != panels.end() && !changed; ++iter) {
+			PanelPage *panel = *iter;
+			if( std::find(done.begin(), done.end(), panel) != done.end() ) {
+				continue;
+			}
+			done.push_back(panel);
+			panel->input(m_x, m_y, m_left, m_middle, m_right, click);
+			// if the panels changed (e.g., a panel deleted itself), the remaining pointers may be invalid, so find them again
+			changed = this->input_index != index;
+		}
+		if( !changed ) {
+			break;
+		}
 	}
 }
 
@@ -550,6 +721,7 @@ CycleButton::CycleButton(int x,int y,const char *texts[],int n_texts,Gigalomania
 	this->w = font[0]->getScaledWidth() * max_len + 2;
 	this->h = font[0]->getScaledHeight() + 2;
 	this->active = 0;
+	this->input_mode = INPUT_INSIDE;
 	if( game_g->isMobileUI() ) {
 		this->tolerance += 4;
 		//this->h += 8; // useful for Android, where touches often seem to register lower than I seem to expect
@@ -603,7 +775,7 @@ MultiPanel::MultiPanel(int n_pages, int x, int y) : PanelPage(x, y) {
 		//this->get(i)->owner = this;
 	}
 	this->c_page = 0;
-
+	this->input_mode = INPUT_ALL; // passes input on to the current page
 }
 
 MultiPanel::~MultiPanel() {
@@ -630,6 +802,10 @@ void MultiPanel::draw() {
 	this->get(this->c_page)->draw();
 }
 
+void MultiPanel::drawDeferredPopups() {
+	this->get(this->c_page)->drawDeferredPopups();
+}
+
 void MultiPanel::input(int m_x,int m_y,bool m_left,bool m_middle,bool m_right,bool click) {
 	//this->pages[this->c_page]->input(m_x, m_y, m_b);
 	this->get(this->c_page)->input(m_x, m_y, m_left, m_middle, m_right, click);
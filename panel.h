@@ -16,9 +16,30 @@ using std::vector;
 using std::string;
 
 namespace Gigalomania {
+	class PanelInputIndex;
+
 	class PanelPage : public TrackedObject {
+	public:
+		// what a panel's input() does, so that input can be dispatched only to the panels that need it
+		enum InputMode {
+			INPUT_NONE = 0, // only passes the input on to the children
+			INPUT_INSIDE = 1, // only acts when the mouse is over the panel
+			INPUT_ALL = 2 // needs all input, wherever the mouse is
+		};
 	private:
+		// the descendants to dispatch input to, with their bounds; NULL if it needs rebuilding
+		PanelInputIndex *input_index;
+		// cached absolute position, as returned by getLeft()/getTop(); only valid if layout_valid is true
+		mutable bool layout_valid;
+		mutable int layout_left, layout_top;
+		// if true, draw() skips the popups, so they can be drawn afterwards with drawDeferredPopups()
+		static bool defer_popups;
+
 		void init_panelpage();
+		void invalidateLayout();
+		void updateLayout() const;
+		void invalidateInputIndex();
+		void addToInputIndex(PanelInputIndex *index, int parent_left, int parent_top);
 	protected:
 		string id;
 		bool visible;
@@ -46,6 +67,8 @@ namespace Gigalomania {
 		bool survive_owner;
 
 		PanelPage *modal_child;
+
+		InputMode input_mode; // subclasses that override input() must set this
 		
 		virtual void drawPopups();
 		virtual void drawBackground();
@@ -85,6 +108,7 @@ namespace Gigalomania {
 		void setModal() {
 			// must already be owned!
 			this->owner->modal_child = this;
+			this->owner->invalidateInputIndex();
 		}
 		virtual bool hasModal() const {
 			return this->modal_child != NULL;
@@ -127,7 +151,7 @@ namespace Gigalomania {
 		int getOffsetY() const {
 			return this->offset_y;
 		}
-		// gets the abolute position (taking into account parents)
+		// gets the abolute position (taking into account parents); these are cached, so are cheap to call
 		virtual int getLeft() const;
 		virtual int getTop() const;
 		virtual int getRight() const;
@@ -146,6 +170,10 @@ namespace Gigalomania {
 
 		virtual void free(bool free_this);
 		virtual void draw();
+		virtual void drawDeferredPopups();
+		static void setDeferPopups(bool defer_popups) {
+			PanelPage::defer_popups = defer_popups;
+		}
 		virtual bool mouseOver(int m_x,int m_y) const;
 		virtual void input(int m_x,int m_y,bool m_left,bool m_middle,bool m_right,bool click);
 	};
@@ -219,6 +247,7 @@ namespace Gigalomania {
 
 		//virtual void drawPopups();
 		virtual void draw();
+		virtual void drawDeferredPopups();
 		virtual void input(int m_x,int m_y,bool m_left,bool m_middle,bool m_right,bool click);
 		virtual void setPage(int page) {
 			this->c_page = page;
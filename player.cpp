@@ -15,6 +15,7 @@
 #include "utils.h"
 #include "sector.h"
 #include "tutorial.h"
+#include "savestate.h"
 //---------------------------------------------------------------------------
 
 bool Player::alliances[n_players_c][n_players_c];
@@ -76,63 +77,61 @@ index(index), dead(false), n_births(0), n_deaths(0), n_men_for_this_island(0), n
 Player::~Player() {
 }
 
-void Player::saveState(stringstream &stream) const {
-	stream << "<player ";
-	stream << "player_id=\"" << index << "\" ";
-	stream << "dead=\"" << (dead?1:0) << "\" ";
-	stream << "n_births=\"" << n_births << "\" ";
-	stream << "n_deaths=\"" << n_deaths << "\" ";
-	stream << "n_men_for_this_island=\"" << n_men_for_this_island << "\" ";
-	stream << "n_suspended=\"" << n_suspended << "\" ";
-	stream << "alliance_last_asked_human=\"" << alliance_last_asked_human << "\" ";
-	stream << ">\n";
-	stream << "</player>\n";
+void Player::saveState(SaveWriter &writer) const {
+	writer.startElement("player");
+	writer.addAttribute("player_id", index);
+	writer.addAttribute("dead", dead?1:0);
+	writer.addAttribute("n_births", n_births);
+	writer.addAttribute("n_deaths", n_deaths);
+	writer.addAttribute("n_men_for_this_island", n_men_for_this_island);
+	writer.addAttribute("n_suspended", n_suspended);
+	writer.addAttribute("alliance_last_asked_human", alliance_last_asked_human);
+	writer.endElement();
 }
 
-void Player::loadStateParseXMLNode(const TiXmlNode *parent) {
+void Player::loadStateParseXMLNode(SaveNode *parent) {
 	if( parent == NULL ) {
 		return;
 	}
 	bool read_children = true;
 
-	switch( parent->Type() ) {
-		case TiXmlNode::TINYXML_DOCUMENT:
+	switch( parent->getType() ) {
+		case SaveNode::SAVENODE_DOCUMENT:
 			break;
-		case TiXmlNode::TINYXML_ELEMENT:
+		case SaveNode::SAVENODE_ELEMENT:
 			{
-				const char *element_name = parent->Value();
-				const TiXmlElement *element = parent->ToElement();
-				const TiXmlAttribute *attribute = element->FirstAttribute();
+				const char *element_name = parent->getName();
+				const SaveAttribute *attribute = parent->getFirstAttribute();
 				if( strcmp(element_name, "player") == 0 ) {
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "player_id") == 0 ) {
 							// handled by caller
 						}
 						else if( strcmp(attribute_name, "dead") == 0 ) {
-							dead = atoi(attribute->Value())==1;
+							dead = attribute->getIntValue()==1;
 						}
 						else if( strcmp(attribute_name, "n_births") == 0 ) {
-							n_births = atoi(attribute->Value());
+							n_births = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "n_deaths") == 0 ) {
-							n_deaths = atoi(attribute->Value());
+							n_deaths = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "n_men_for_this_island") == 0 ) {
-							n_men_for_this_island = atoi(attribute->Value());
+							n_men_for_this_island = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "n_suspended") == 0 ) {
-							n_suspended = atoi(attribute->Value());
+							n_suspended = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "alliance_last_asked_human") == 0 ) {
-							alliance_last_asked_human = atoi(attribute->Value());
+							alliance_last_asked_human = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown player/player attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 				}
 				else {
@@ -142,52 +141,41 @@ void Player::loadStateParseXMLNode(const TiXmlNode *parent) {
 				}
 			}
 			break;
-		case TiXmlNode::TINYXML_COMMENT:
-			break;
-		case TiXmlNode::TINYXML_UNKNOWN:
-			break;
-		case TiXmlNode::TINYXML_TEXT:
-			{
-			}
-			break;
-		case TiXmlNode::TINYXML_DECLARATION:
-			break;
 	}
 
-	for(const TiXmlNode *child=parent->FirstChild();child!=NULL && read_children;child=child->NextSibling())  {
+	for(SaveNode *child=read_children ? parent->nextChild() : NULL;child!=NULL;child=parent->nextChild()) {
 		loadStateParseXMLNode(child);
 	}
 }
 
-void Player::saveStateAlliances(stringstream &stream) {
-	stream << "<player_alliances>\n";
+void Player::saveStateAlliances(SaveWriter &writer) {
+	writer.startElement("player_alliances");
 	for(int i=0;i<n_players_c;i++) {
 		for(int j=i+1;j<n_players_c;j++) {
-			stream << "<player_alliance ";
-			stream << "player_id_i=\"" << i << "\" ";
-			stream << "player_id_j=\"" << j << "\" ";
-			stream << "alliances=\"" << (alliances[i][j] ? 1 : 0) << "\" ";
-			stream << "alliance_last_asked=\"" << alliance_last_asked[i][j] << "\" ";
-			stream << "/>\n";
+			writer.startElement("player_alliance");
+			writer.addAttribute("player_id_i", i);
+			writer.addAttribute("player_id_j", j);
+			writer.addAttribute("alliances", alliances[i][j] ? 1 : 0);
+			writer.addAttribute("alliance_last_asked", alliance_last_asked[i][j]);
+			writer.endElement();
 		}
 	}
-	stream << "</player_alliances>\n";
+	writer.endElement();
 }
 
-void Player::loadStateParseXMLNodeAlliances(const TiXmlNode *parent) {
+void Player::loadStateParseXMLNodeAlliances(SaveNode *parent) {
 	if( parent == NULL ) {
 		return;
 	}
 	bool read_children = true;
 
-	switch( parent->Type() ) {
-		case TiXmlNode::TINYXML_DOCUMENT:
+	switch( parent->getType() ) {
+		case SaveNode::SAVENODE_DOCUMENT:
 			break;
-		case TiXmlNode::TINYXML_ELEMENT:
+		case SaveNode::SAVENODE_ELEMENT:
 			{
-				const char *element_name = parent->Value();
-				const TiXmlElement *element = parent->ToElement();
-				const TiXmlAttribute *attribute = element->FirstAttribute();
+				const char *element_name = parent->getName();
+				const SaveAttribute *attribute = parent->getFirstAttribute();
 				if( strcmp(element_name, "player_alliances") == 0 ) {
 					// handled entirely by caller
 				}
@@ -197,25 +185,25 @@ void Player::loadStateParseXMLNodeAlliances(const TiXmlNode *parent) {
 					bool alliance = false;
 					int last_asked = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "player_id_i") == 0 ) {
-							player_id_i = atoi(attribute->Value());
+							player_id_i = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "player_id_j") == 0 ) {
-							player_id_j = atoi(attribute->Value());
+							player_id_j = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "alliances") == 0 ) {
-							alliance = atoi(attribute->Value())==1;
+							alliance = attribute->getIntValue()==1;
 						}
 						else if( strcmp(attribute_name, "alliance_last_asked") == 0 ) {
-							last_asked = atoi(attribute->Value());
+							last_asked = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown player_alliances/player_alliance attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( player_id_i < 0 || player_id_i >= n_players_c ) {
 						throw std::runtime_error("player_alliance invalid player_id_i");
@@ -233,19 +221,9 @@ void Player::loadStateParseXMLNodeAlliances(const TiXmlNode *parent) {
 				}
 			}
 			break;
-		case TiXmlNode::TINYXML_COMMENT:
-			break;
-		case TiXmlNode::TINYXML_UNKNOWN:
-			break;
-		case TiXmlNode::TINYXML_TEXT:
-			{
-			}
-			break;
-		case TiXmlNode::TINYXML_DECLARATION:
-			break;
 	}
 
-	for(const TiXmlNode *child=parent->FirstChild();child!=NULL && read_children;child=child->NextSibling())  {
+	for(SaveNode *child=read_children ? parent->nextChild() : NULL;child!=NULL;child=parent->nextChild()) {
 		loadStateParseXMLNodeAlliances(child);
 	}
 }
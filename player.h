@@ -9,6 +9,9 @@
 
 class Sector;
 class PlayingGameState;
+class SaveWriter;
+class SaveNode;
+class SaveAttribute;
 
 using std::stringstream;
 
@@ -98,10 +101,10 @@ public:
 		this->n_suspended += n;
 	}
 
-	void saveState(stringstream &stream) const;
-	void loadStateParseXMLNode(const TiXmlNode *parent);
-	static void saveStateAlliances(stringstream &stream);
-	static void loadStateParseXMLNodeAlliances(const TiXmlNode *parent);
+	void saveState(SaveWriter &writer) const;
+	void loadStateParseXMLNode(SaveNode *parent);
+	static void saveStateAlliances(SaveWriter &writer);
+	static void loadStateParseXMLNodeAlliances(SaveNode *parent);
 
 	static void setAlliance(int a, int b, bool alliance);
 	static bool isAlliance(int a, int b);
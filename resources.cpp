@@ -5,6 +5,9 @@
 #include "utils.h"
 
 #include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <new>
 
 using Gigalomania::TrackedObject;
 
@@ -13,43 +16,76 @@ using Gigalomania::TrackedObject;
 #define NULL 0
 #endif
 
-vector<TrackedObject *> TrackedObject::tags;
+// a tag is the slot index+1 in the low bits (so 0 is never a valid tag), and the slot's generation in the remaining bits
+const size_t tag_index_bits_c = 20;
+const size_t tag_index_mask_c = ((size_t)1 << tag_index_bits_c) - 1;
+const size_t tag_generation_mask_c = ((size_t)-1) >> tag_index_bits_c;
+
+vector<TrackedObject::Slot> TrackedObject::slots;
+size_t TrackedObject::first_free = 0;
+vector<TrackedObject *> TrackedObject::objects[TrackedObject::N_TRACKED_TYPES];
 
 TrackedObject::TrackedObject() {
+	init_trackedobject(TRACKED_OTHER);
+}
+
+TrackedObject::TrackedObject(TrackedType type) {
+	init_trackedobject(type);
+}
+
+void TrackedObject::init_trackedobject(TrackedType type) {
 	this->tag = TrackedObject::addTag(this);
 	//LOG("New Tracked Object, tag = %d\n", this->tag);
 	this->deleteLevel = 0;
+	this->tracked_type = type;
+	this->tracked_index = objects[type].size();
+	objects[type].push_back(this);
 }
 
 TrackedObject::~TrackedObject() {
 	//LOG("Deleting Tracked Object, tag = %d\n", this->tag);
 	removeTag(this->tag);
+	vector<TrackedObject *> &list = objects[this->tracked_type];
+	if( this->tracked_index < list.size() && list[this->tracked_index] == this ) {
+		// swap with the last, to remove in constant time
+		TrackedObject *last = list.back();
+		list[this->tracked_index] = last;
+		last->tracked_index = this->tracked_index;
+		list.pop_back();
+	}
 }
 
 void TrackedObject::initialise() {
 	// important for Android, where static/globals aren't cleared when native app is restarted
-	tags.clear();
+	slots.clear();
+	first_free = 0;
+	for(int i=0;i<N_TRACKED_TYPES;i++) {
+		objects[i].clear();
+	}
 }
 
 void TrackedObject::flushAll() {
 	LOG("TrackedObject::flushAll()\n");
-	for(size_t i=0;i<tags.size();i++) {
-		TrackedObject *vo = tags.at(i);
-		if(vo != NULL) {
-			delete vo;
-			tags[i] = NULL;
-		}
-	}
-	tags.clear();
+	flush(INT_MIN);
+	initialise();
 }
 
 void TrackedObject::flush(int deleteLevel) {
 	LOG("TrackedObject::flush(%d)\n", deleteLevel);
-	for(size_t i=0;i<tags.size();i++) {
-		TrackedObject *vo = tags.at(i);
-		if(vo != NULL && vo->deleteLevel >= deleteLevel) {
+	// deleting an object may delete others (e.g., a PanelPage deletes its children), so collect the tags first, and skip any that have since been deleted
+	vector<size_t> delete_tags;
+	for(int i=0;i<N_TRACKED_TYPES;i++) {
+		for(size_t j=0;j<objects[i].size();j++) {
+			TrackedObject *vo = objects[i][j];
+			if( vo->deleteLevel >= deleteLevel ) {
+				delete_tags.push_back(vo->tag);
+			}
+		}
+	}
+	for(size_t i=0;i<delete_tags.size();i++) {
+		TrackedObject *vo = ptrFromTag(delete_tags[i]);
+		if( vo != NULL ) {
 			delete vo;
-			tags[i] = NULL;
 		}
 	}
 }
@@ -67,35 +103,59 @@ void TrackedObject::cleanup() {
 }
 
 size_t TrackedObject::addTag(TrackedObject *ptr) {
-	size_t tag = tags.size() + 1;
-	tags.push_back(ptr);
-	return tag;
+	size_t index = 0;
+	if( first_free != 0 ) {
+		index = first_free - 1;
+		first_free = slots[index].next_free;
+	}
+	else if( slots.size() < tag_index_mask_c ) {
+		index = slots.size();
+		Slot slot;
+		slot.generation = 0;
+		slots.push_back(slot);
+	}
+	else {
+		LOG("TrackedObject: out of tags\n");
+		return 0;
+	}
+	Slot &slot = slots[index];
+	slot.ptr = ptr;
+	slot.next_free = 0;
+	return ( slot.generation << tag_index_bits_c ) | ( index + 1 );
 }
 
 TrackedObject *TrackedObject::ptrFromTag(size_t tag) {
-	TrackedObject *ptr = NULL;
-	if( tag == 0 ||tag > tags.size() ) {
+	size_t index = tag & tag_index_mask_c;
+	if( index == 0 || index > slots.size() ) {
 		// error
-		ptr = NULL;
+		return NULL;
 	}
-	else {
-		ptr = tags.at(tag-1);
+	const Slot &slot = slots[index-1];
+	if( slot.ptr == NULL || slot.generation != ( tag >> tag_index_bits_c ) ) {
+		// deleted
+		return NULL;
 	}
-	return ptr;
+	return slot.ptr;
 }
 
 void TrackedObject::removeTag(size_t tag) {
-	//tags.getData()[tag - 1] = NULL;
-	tags[tag-1] = NULL;
+	if( ptrFromTag(tag) == NULL ) {
+		return;
+	}
+	size_t index = ( tag & tag_index_mask_c ) - 1;
+	Slot &slot = slots[index];
+	slot.ptr = NULL;
+	slot.generation = ( slot.generation + 1 ) & tag_generation_mask_c;
+	slot.next_free = first_free;
+	first_free = index + 1;
 }
 
-size_t TrackedObject::getNumTags() {
-	return tags.size();
+size_t TrackedObject::getNumObjects(TrackedType type) {
+	return objects[type].size();
 }
 
-TrackedObject *TrackedObject::getTag(size_t index) {
-	//return (TrackedObject *)tags.elementAt(index);
-	return tags.at(index);
+TrackedObject *TrackedObject::getObject(TrackedType type, size_t index) {
+	return objects[type].at(index);
 }
 
 /*VisionException *Vision::getError() {
@@ -113,3 +173,100 @@ bool TrackedObject::isClass(const char *classname) const {
 	return ( strcmp( this->getClass(), classname ) == 0 );
 }
 
+using Gigalomania::Arena;
+
+const size_t arena_alignment_c = 16;
+const size_t arena_chunk_size_c = 64 * 1024;
+const size_t arena_min_blocks_per_chunk_c = 16;
+
+Arena::Arena(const char *name) : name(name) {
+}
+
+Arena::~Arena() {
+	freeChunks();
+}
+
+Arena::Pool *Arena::getPool(size_t size) {
+	size_t block_size = ( ( size + arena_alignment_c - 1 ) / arena_alignment_c ) * arena_alignment_c;
+	for(size_t i=0;i<pools.size();i++) {
+		if( pools[i].block_size == block_size ) {
+			return &pools[i];
+		}
+	}
+	Pool pool;
+	pool.block_size = block_size;
+	pool.free_list = NULL;
+	pool.chunk_size = block_size * arena_min_blocks_per_chunk_c;
+	if( pool.chunk_size < arena_chunk_size_c )
+		pool.chunk_size = arena_chunk_size_c;
+	pool.chunk_used = 0;
+	pool.n_live = 0;
+	pools.push_back(pool);
+	return &pools.back();
+}
+
+void *Arena::allocate(size_t size) {
+	Pool *pool = getPool(size);
+	void *ptr = NULL;
+	if( pool->free_list != NULL ) {
+		ptr = pool->free_list;
+		pool->free_list = *(void **)ptr;
+	}
+	else {
+		if( pool->chunks.size() == 0 || pool->chunk_used + pool->block_size > pool->chunk_size ) {
+			// malloc's alignment is enough for anything we allocate
+			char *chunk = (char *)malloc(pool->chunk_size);
+			if( chunk == NULL ) {
+				throw std::bad_alloc();
+			}
+			pool->chunks.push_back(chunk);
+			pool->chunk_used = 0;
+		}
+		ptr = pool->chunks.back() + pool->chunk_used;
+		pool->chunk_used += pool->block_size;
+	}
+	pool->n_live++;
+	return ptr;
+}
+
+void Arena::deallocate(void *ptr, size_t size) {
+	if( ptr == NULL ) {
+		return;
+	}
+	Pool *pool = getPool(size);
+	ASSERT( pool->n_live > 0 );
+	*(void **)ptr = pool->free_list;
+	pool->free_list = ptr;
+	pool->n_live--;
+}
+
+/* Frees all the memory at once, so long as every object has been deleted. Otherwise the memory is kept, as it's still in
+*  use, and false is returned.
+*/
+bool Arena::releaseAll() {
+	size_t n_live = getNLive();
+	if( n_live > 0 ) {
+		LOG("Arena %s: can't release, %d objects still allocated\n", name, (int)n_live);
+		return false;
+	}
+	freeChunks();
+	return true;
+}
+
+void Arena::freeChunks() {
+	for(size_t i=0;i<pools.size();i++) {
+		for(size_t j=0;j<pools[i].chunks.size();j++) {
+			free(pools[i].chunks[j]);
+		}
+	}
+	pools.clear();
+}
+
+size_t Arena::getNLive() const {
+	size_t n_live = 0;
+	for(size_t i=0;i<pools.size();i++) {
+		n_live += pools[i].n_live;
+	}
+	return n_live;
+}
+
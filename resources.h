@@ -8,24 +8,85 @@ using std::vector;
 
 namespace Gigalomania {
 	class TrackedObject {
-		static vector<TrackedObject *> tags;
+	public:
+		// types that can be iterated over with getNumObjects()/getObject(); set by the subclass constructor
+		enum TrackedType {
+			TRACKED_OTHER = 0,
+			TRACKED_IMAGE = 1,
+			TRACKED_SAMPLE = 2,
+			TRACKED_PANELPAGE = 3,
+			N_TRACKED_TYPES = 4
+		};
+
+	private:
+		/* Objects are looked up by tag, which is an index into slots, along with the slot's generation. Freed slots are
+		*  reused, and their generation incremented, so that tags of deleted objects are detected.
+		*/
+		struct Slot {
+			TrackedObject *ptr; // NULL if free
+			size_t generation;
+			size_t next_free; // for free slots, the index+1 of the next free slot, or 0
+		};
+		static vector<Slot> slots;
+		static size_t first_free; // index+1 of the first free slot, or 0
+		static vector<TrackedObject *> objects[N_TRACKED_TYPES]; // the live objects of each type, in no particular order
+
 		size_t tag;
+		TrackedType tracked_type;
+		size_t tracked_index; // position in objects[tracked_type]
 		int deleteLevel;
 
+		void init_trackedobject(TrackedType type);
+		static size_t addTag(TrackedObject *ptr);
+		static void removeTag(size_t tag);
+
 	public:
 		TrackedObject();
+		explicit TrackedObject(TrackedType type);
 		virtual ~TrackedObject();
 
 		static void initialise();
 		static void flushAll();
 		static void flush(int deleteLevel);
 		static void cleanup();
-		static size_t addTag(TrackedObject *ptr);
-		static void removeTag(size_t tag);
-		static size_t getNumTags();
-		static TrackedObject *getTag(size_t index);
 		static TrackedObject *ptrFromTag(size_t tag);
+		static size_t getNumObjects(TrackedType type);
+		static TrackedObject *getObject(TrackedType type, size_t index);
+		size_t getTag() const {
+			return this->tag;
+		}
+		TrackedType getTrackedType() const {
+			return this->tracked_type;
+		}
 		virtual const char *getClass() const=0;
 		bool isClass(const char *classname) const;
 	};
+
+	/** Memory for objects that share a lifetime, allocated contiguously from large chunks. There's a pool
+	*   for each object size (so in practice one per class), and freed blocks are reused by the same pool.
+	*   Classes opt in by defining operator new and operator delete to call allocate() and deallocate().
+	*/
+	class Arena {
+		struct Pool {
+			size_t block_size;
+			void *free_list; // freed blocks, each holding a pointer to the next
+			vector<char *> chunks;
+			size_t chunk_size;
+			size_t chunk_used; // bytes used in the last chunk
+			size_t n_live;
+		};
+		const char *name;
+		vector<Pool> pools;
+
+		Pool *getPool(size_t size);
+		void freeChunks();
+	public:
+		Arena(const char *name);
+		~Arena();
+
+		void *allocate(size_t size);
+		void deallocate(void *ptr, size_t size);
+		bool releaseAll();
+		size_t getNLive() const;
+	};
 }
@@ -0,0 +1,589 @@
+//---------------------------------------------------------------------------
+#include "stdafx.h"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <stdexcept>
+
+#include <string>
+using std::string;
+
+#include "savestate.h"
+#include "utils.h"
+
+#if defined(_WIN32)
+#include <io.h> // for _commit
+#include <windows.h> // for MoveFileEx
+#elif defined(__linux) || defined(__ANDROID__) || (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h> // for fsync
+#endif
+
+//---------------------------------------------------------------------------
+
+const char binary_save_magic_c[] = "GIGS";
+const int binary_save_magic_length_c = 4;
+const unsigned char binary_save_version_c = 1;
+
+enum BinarySaveOpcode {
+	BINARYSAVE_START_ELEMENT = 1,
+	BINARYSAVE_INT_ATTRIBUTE = 2,
+	BINARYSAVE_STRING_ATTRIBUTE = 3,
+	BINARYSAVE_END_ELEMENT = 4,
+	BINARYSAVE_END = 5
+};
+
+FileSaveSink::FileSaveSink(const char *filename) : buffer(NULL), buffer_used(0), file(NULL), filename(filename), ok(true) {
+	temp_filename = this->filename + ".tmp";
+	file = fopen(temp_filename.c_str(), "wb");
+	if( file == NULL ) {
+		LOG("failed to open: %s\n", temp_filename.c_str());
+		ok = false;
+	}
+	else {
+		buffer = new char[buffer_size_c];
+	}
+}
+
+FileSaveSink::~FileSaveSink() {
+	if( file != NULL ) {
+		// not committed
+		fclose(file);
+		remove(temp_filename.c_str());
+	}
+	delete [] buffer;
+}
+
+bool FileSaveSink::flushBuffer() {
+	if( buffer_used > 0 ) {
+		if( fwrite(buffer, 1, buffer_used, file) != buffer_used ) {
+			LOG("failed to write to: %s\n", temp_filename.c_str());
+			ok = false;
+		}
+		buffer_used = 0;
+	}
+	return ok;
+}
+
+bool FileSaveSink::write(const void *data, size_t length) {
+	if( !ok ) {
+		return false;
+	}
+	if( buffer_used + length > buffer_size_c ) {
+		if( !flushBuffer() ) {
+			return false;
+		}
+		if( length > buffer_size_c ) {
+			// too big to be worth buffering
+			if( fwrite(data, 1, length, file) != length ) {
+				LOG("failed to write to: %s\n", temp_filename.c_str());
+				ok = false;
+			}
+			return ok;
+		}
+	}
+	memcpy(&buffer[buffer_used], data, length);
+	buffer_used += length;
+	return true;
+}
+
+bool FileSaveSink::commit() {
+	if( file == NULL ) {
+		return false;
+	}
+	flushBuffer();
+	if( fflush(file) != 0 ) {
+		ok = false;
+	}
+	if( ok ) {
+		// make sure the data is actually on disk before we rename, otherwise a power cut could leave us with an empty file
+#if defined(_WIN32)
+		_commit(_fileno(file));
+#elif defined(__linux) || defined(__ANDROID__) || (defined(__APPLE__) && defined(__MACH__))
+		fsync(fileno(file));
+#endif
+	}
+	if( fclose(file) != 0 ) {
+		ok = false;
+	}
+	file = NULL;
+	if( !ok ) {
+		LOG("failed to save: %s\n", filename.c_str());
+		remove(temp_filename.c_str());
+		return false;
+	}
+	// replace the existing file in a single step, so that there's always either the old or the new file
+#if defined(_WIN32)
+	bool renamed = MoveFileExA(temp_filename.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+#if defined(__amigaos4__) || defined(AROS) || defined(__MORPHOS__)
+	remove(filename.c_str()); // rename doesn't replace an existing file, and there's no atomic alternative
+#endif
+	bool renamed = rename(temp_filename.c_str(), filename.c_str()) == 0;
+#endif
+	if( !renamed ) {
+		LOG("failed to rename %s to %s\n", temp_filename.c_str(), filename.c_str());
+		remove(temp_filename.c_str());
+		return false;
+	}
+	return true;
+}
+
+MemorySaveSink::MemorySaveSink() {
+	data.reserve(65536); // enough for a typical save, to avoid reallocating
+}
+
+bool MemorySaveSink::write(const void *data, size_t length) {
+	const char *ptr = static_cast<const char *>(data);
+	this->data.insert(this->data.end(), ptr, ptr + length);
+	return true;
+}
+
+BackgroundSaver::BackgroundSaver() : thread(NULL), mutex(NULL), cond(NULL), quit(false), has_pending(false) {
+	mutex = SDL_CreateMutex();
+	cond = SDL_CreateCond();
+	if( mutex != NULL && cond != NULL ) {
+#if SDL_MAJOR_VERSION == 1
+		thread = SDL_CreateThread(threadFunction, this);
+#else
+		thread = SDL_CreateThread(threadFunction, "save", this);
+#endif
+	}
+	if( thread == NULL ) {
+		LOG("failed to create save thread, will save synchronously: %s\n", SDL_GetError());
+	}
+}
+
+BackgroundSaver::~BackgroundSaver() {
+	if( thread != NULL ) {
+		SDL_mutexP(mutex);
+		quit = true;
+		SDL_CondSignal(cond);
+		SDL_mutexV(mutex);
+		SDL_WaitThread(thread, NULL);
+	}
+	if( cond != NULL ) {
+		SDL_DestroyCond(cond);
+	}
+	if( mutex != NULL ) {
+		SDL_DestroyMutex(mutex);
+	}
+}
+
+int BackgroundSaver::threadFunction(void *data) {
+	BackgroundSaver *saver = static_cast<BackgroundSaver *>(data);
+	saver->run();
+	return 0;
+}
+
+void BackgroundSaver::run() {
+	vector<char> data;
+	string filename;
+	SDL_mutexP(mutex);
+	for(;;) {
+		while( !has_pending && !quit ) {
+			SDL_CondWait(cond, mutex);
+		}
+		if( !has_pending ) {
+			// quit, with nothing left to write
+			break;
+		}
+		data.swap(pending_data);
+		filename = pending_filename;
+		has_pending = false;
+		SDL_mutexV(mutex);
+
+		writeFile(data, filename.c_str());
+		data.clear();
+
+		SDL_mutexP(mutex);
+	}
+	SDL_mutexV(mutex);
+}
+
+void BackgroundSaver::submit(vector<char> &data, const char *filename) {
+	if( thread == NULL ) {
+		writeFile(data, filename);
+		return;
+	}
+	SDL_mutexP(mutex);
+	if( has_pending ) {
+		LOG("previous save still pending, replacing: %s\n", pending_filename.c_str());
+	}
+	pending_data.swap(data);
+	pending_filename = filename;
+	has_pending = true;
+	SDL_CondSignal(cond);
+	SDL_mutexV(mutex);
+}
+
+bool BackgroundSaver::writeFile(const vector<char> &data, const char *filename) {
+	FileSaveSink sink(filename);
+	if( !sink.isOpen() ) {
+		return false;
+	}
+	if( !data.empty() ) {
+		sink.write(&data[0], data.size());
+	}
+	return sink.commit();
+}
+
+XMLSaveWriter::XMLSaveWriter(SaveSink *sink) : SaveWriter(sink), depth(0), tag_open(false) {
+	const char header[] = "<?xml version=\"1.0\" ?>\n";
+	write(header, sizeof(header)-1);
+}
+
+void XMLSaveWriter::startElement(const char *name) {
+	ASSERT( depth < max_depth_c );
+	if( tag_open ) {
+		write(">\n", 2);
+	}
+	write("<", 1);
+	write(name, strlen(name));
+	open_elements[depth++] = name;
+	tag_open = true;
+}
+
+void XMLSaveWriter::addAttribute(const char *name, int value) {
+	ASSERT( tag_open );
+	char buffer[32] = "";
+	int length = sprintf(buffer, "%d", value);
+	write(" ", 1);
+	write(name, strlen(name));
+	write("=\"", 2);
+	write(buffer, length);
+	write("\"", 1);
+}
+
+void XMLSaveWriter::addAttribute(const char *name, const char *value) {
+	ASSERT( tag_open );
+	write(" ", 1);
+	write(name, strlen(name));
+	write("=\"", 2);
+	for(const char *ptr = value; *ptr != '\0'; ptr++) {
+		if( *ptr == '&' )
+			write("&amp;", 5);
+		else if( *ptr == '<' )
+			write("&lt;", 4);
+		else if( *ptr == '>' )
+			write("&gt;", 4);
+		else if( *ptr == '\"' )
+			write("&quot;", 6);
+		else
+			write(ptr, 1);
+	}
+	write("\"", 1);
+}
+
+void XMLSaveWriter::endElement() {
+	ASSERT( depth > 0 );
+	depth--;
+	if( tag_open ) {
+		write(" />\n", 4);
+		tag_open = false;
+	}
+	else {
+		const char *name = open_elements[depth];
+		write("</", 2);
+		write(name, strlen(name));
+		write(">\n", 2);
+	}
+}
+
+void XMLSaveWriter::finish() {
+	ASSERT( depth == 0 );
+}
+
+BinarySaveWriter::BinarySaveWriter(SaveSink *sink) : SaveWriter(sink), depth(0) {
+	write(binary_save_magic_c, binary_save_magic_length_c);
+	writeByte(binary_save_version_c);
+}
+
+void BinarySaveWriter::writeByte(unsigned char value) {
+	write(&value, 1);
+}
+
+void BinarySaveWriter::writeVarint(unsigned int value) {
+	unsigned char buffer[5];
+	int length = 0;
+	while( value >= 0x80 ) {
+		buffer[length++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	buffer[length++] = (unsigned char)value;
+	write(buffer, length);
+}
+
+void BinarySaveWriter::writeName(const char *name) {
+	// the same literal is nearly always used for a given name, so check the pointers first
+	for(size_t i=0;i<names.size();i++) {
+		if( names[i] == name ) {
+			writeVarint((unsigned int)i);
+			return;
+		}
+	}
+	for(size_t i=0;i<names.size();i++) {
+		if( strcmp(names[i], name) == 0 ) {
+			writeVarint((unsigned int)i);
+			return;
+		}
+	}
+	// first use, so define it
+	writeVarint((unsigned int)names.size());
+	names.push_back(name);
+	size_t length = strlen(name);
+	writeVarint((unsigned int)length);
+	write(name, length);
+}
+
+void BinarySaveWriter::startElement(const char *name) {
+	writeByte(BINARYSAVE_START_ELEMENT);
+	writeName(name);
+	depth++;
+}
+
+void BinarySaveWriter::addAttribute(const char *name, int value) {
+	writeByte(BINARYSAVE_INT_ATTRIBUTE);
+	writeName(name);
+	// zigzag, so small negative numbers (e.g., -1 for "none") stay small
+	writeVarint( ((unsigned int)value << 1) ^ (unsigned int)(value >> 31) );
+}
+
+void BinarySaveWriter::addAttribute(const char *name, const char *value) {
+	writeByte(BINARYSAVE_STRING_ATTRIBUTE);
+	writeName(name);
+	size_t length = strlen(value);
+	writeVarint((unsigned int)length);
+	write(value, length);
+}
+
+void BinarySaveWriter::endElement() {
+	ASSERT( depth > 0 );
+	writeByte(BINARYSAVE_END_ELEMENT);
+	depth--;
+}
+
+void BinarySaveWriter::finish() {
+	ASSERT( depth == 0 );
+	writeByte(BINARYSAVE_END);
+}
+
+bool isBinarySaveState(const char *buffer, size_t length) {
+	return length >= binary_save_magic_length_c+1 && memcmp(buffer, binary_save_magic_c, binary_save_magic_length_c) == 0;
+}
+
+const char *SaveAttribute::getValue() const {
+	if( value == NULL ) {
+		sprintf(int_text, "%d", int_value);
+		return int_text;
+	}
+	return value;
+}
+
+int SaveAttribute::getIntValue() const {
+	return value == NULL ? int_value : atoi(value);
+}
+
+void SaveNode::endAttributes() {
+	if( attributes.size() > 0 ) {
+		attributes.back().is_last = true;
+	}
+}
+
+void XMLSaveNode::set(const TiXmlNode *node) {
+	const TiXmlElement *element = node->ToElement();
+	name = element == NULL ? NULL : element->Value();
+	attributes.clear();
+	if( element != NULL ) {
+		for(const TiXmlAttribute *attribute=element->FirstAttribute();attribute!=NULL;attribute=attribute->Next()) {
+			attributes.push_back(SaveAttribute(attribute->Name(), attribute->Value()));
+		}
+	}
+	endAttributes();
+	next_child = node->FirstChild();
+}
+
+SaveNode *XMLSaveNode::nextChild() {
+	while( next_child != NULL && next_child->Type() != TiXmlNode::TINYXML_ELEMENT ) {
+		next_child = next_child->NextSibling();
+	}
+	if( next_child == NULL ) {
+		return NULL;
+	}
+	if( child == NULL ) {
+		child = new XMLSaveNode();
+	}
+	child->set(next_child);
+	next_child = next_child->NextSibling();
+	return child;
+}
+
+class BinarySaveNode : public SaveNode {
+	friend class BinarySaveReader;
+
+	BinarySaveReader *reader;
+	int depth;
+	bool finished; // the end of the element has been read
+	vector<char> text; // the values of the string attributes
+public:
+	BinarySaveNode(BinarySaveReader *reader, int depth) : reader(reader), depth(depth), finished(false) {
+	}
+
+	virtual SaveNode *nextChild();
+};
+
+SaveNode *BinarySaveNode::nextChild() {
+	if( finished ) {
+		return NULL;
+	}
+	// skip anything left of the previous child
+	reader->closeTo(depth);
+	unsigned char opcode = reader->readByte();
+	if( opcode == BINARYSAVE_START_ELEMENT ) {
+		return reader->readElement(depth+1);
+	}
+	else if( opcode == BINARYSAVE_END_ELEMENT && depth > 0 ) {
+		finished = true;
+		reader->depth--;
+		return NULL;
+	}
+	else if( opcode == BINARYSAVE_END && depth == 0 ) {
+		finished = true;
+		return NULL;
+	}
+	else if( opcode == BINARYSAVE_INT_ATTRIBUTE || opcode == BINARYSAVE_STRING_ATTRIBUTE ) {
+		throw std::runtime_error("binary save state: attribute after a child element");
+	}
+	LOG("binary save state: unexpected opcode %d at depth %d\n", opcode, depth);
+	throw std::runtime_error("binary save state: unexpected opcode");
+}
+
+BinarySaveReader::BinarySaveReader(const char *buffer, size_t length) : ptr((const unsigned char *)buffer), end((const unsigned char *)buffer + length), depth(0), valid(false) {
+	if( !isBinarySaveState(buffer, length) ) {
+		LOG("not a binary save state\n");
+		return;
+	}
+	ptr += binary_save_magic_length_c;
+	unsigned char version = *ptr++;
+	if( version > binary_save_version_c ) {
+		LOG("binary save state version %d is newer than supported version %d\n", version, binary_save_version_c);
+		return;
+	}
+	nodes.push_back(new BinarySaveNode(this, 0));
+	valid = true;
+}
+
+BinarySaveReader::~BinarySaveReader() {
+	for(size_t i=0;i<names.size();i++) {
+		delete [] names[i];
+	}
+	for(size_t i=0;i<nodes.size();i++) {
+		delete nodes[i];
+	}
+}
+
+SaveNode *BinarySaveReader::getDocument() {
+	return valid ? nodes[0] : NULL;
+}
+
+unsigned char BinarySaveReader::readByte() {
+	if( ptr >= end ) {
+		throw std::runtime_error("binary save state is truncated");
+	}
+	return *ptr++;
+}
+
+unsigned int BinarySaveReader::readVarint() {
+	unsigned int value = 0;
+	for(int shift=0;shift<35;shift+=7) {
+		unsigned char byte = readByte();
+		value |= (unsigned int)(byte & 0x7f) << shift;
+		if( (byte & 0x80) == 0 ) {
+			return value;
+		}
+	}
+	throw std::runtime_error("binary save state: invalid varint");
+}
+
+const char *BinarySaveReader::readName() {
+	// names are kept for the whole load, as the same name is written by index afterwards
+	unsigned int index = readVarint();
+	if( index < names.size() ) {
+		return names[index];
+	}
+	else if( index != names.size() ) {
+		LOG("binary save state: unknown name index %d\n", index);
+		throw std::runtime_error("binary save state: unknown name index");
+	}
+	unsigned int length = readVarint();
+	if( length > (unsigned int)(end - ptr) ) {
+		throw std::runtime_error("binary save state is truncated");
+	}
+	char *name = new char[length+1];
+	memcpy(name, ptr, length);
+	name[length] = '\0';
+	ptr += length;
+	names.push_back(name);
+	return name;
+}
+
+/* Reads the name and attributes of an element whose start has just been read.
+*/
+BinarySaveNode *BinarySaveReader::readElement(int element_depth) {
+	ASSERT( element_depth == depth+1 );
+	if( element_depth >= (int)nodes.size() ) {
+		nodes.push_back(new BinarySaveNode(this, element_depth));
+	}
+	BinarySaveNode *node = nodes[element_depth];
+	node->finished = false;
+	node->name = readName();
+	node->attributes.clear();
+	node->text.clear();
+	vector<size_t> text_attributes;
+	vector<size_t> text_offsets;
+	while( ptr < end && ( *ptr == BINARYSAVE_INT_ATTRIBUTE || *ptr == BINARYSAVE_STRING_ATTRIBUTE ) ) {
+		unsigned char opcode = *ptr++;
+		const char *attribute_name = readName();
+		unsigned int raw = readVarint();
+		if( opcode == BINARYSAVE_INT_ATTRIBUTE ) {
+			node->attributes.push_back(SaveAttribute(attribute_name, (int)(raw >> 1) ^ -(int)(raw & 1)));
+		}
+		else {
+			if( raw > (unsigned int)(end - ptr) ) {
+				throw std::runtime_error("binary save state is truncated");
+			}
+			text_attributes.push_back(node->attributes.size());
+			text_offsets.push_back(node->text.size());
+			node->text.insert(node->text.end(), ptr, ptr + raw);
+			node->text.push_back('\0');
+			ptr += raw;
+			node->attributes.push_back(SaveAttribute(attribute_name, ""));
+		}
+	}
+	// now the text won't move, point the string attributes at it
+	for(size_t i=0;i<text_attributes.size();i++) {
+		node->attributes[text_attributes[i]].value = &node->text[text_offsets[i]];
+	}
+	node->endAttributes();
+	depth = element_depth;
+	return node;
+}
+
+void BinarySaveReader::closeTo(int close_depth) {
+	while( depth > close_depth ) {
+		unsigned char opcode = readByte();
+		if( opcode == BINARYSAVE_START_ELEMENT ) {
+			readElement(depth+1);
+		}
+		else if( opcode == BINARYSAVE_END_ELEMENT ) {
+			nodes[depth]->finished = true;
+			depth--;
+		}
+		else {
+			LOG("binary save state: unexpected opcode %d when skipping an element\n", opcode);
+			throw std::runtime_error("binary save state: unexpected opcode");
+		}
+	}
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+/** Writing and reading of the saved game state. The state is a tree of
+*   elements, each with integer or string attributes. It can be written
+*   either as XML (human readable, useful for debugging, and the format of
+*   older saves) or as a compact binary format. Both formats are loaded by
+*   the same loadStateParseXMLNode() functions, which walk SaveNodes: an
+*   XML save is parsed by TinyXML first, but a binary save is read straight
+*   from its records, without building a document.
+*/
+
+#include <cstdio>
+
+#include <vector>
+using std::vector;
+
+#include <string>
+using std::string;
+
+#include "TinyXML/tinyxml.h"
+
+/* Somewhere to send the bytes of a save.
+*/
+class SaveSink {
+public:
+	virtual ~SaveSink() {
+	}
+
+	virtual bool write(const void *data, size_t length)=0;
+};
+
+/* Writes to a temporary file via a fixed size buffer, so memory use doesn't
+*  depend on the size of the save. commit() flushes the file to disk before
+*  renaming it into place, so a crash part way through saving never leaves a
+*  partially written file under the real filename.
+*/
+class FileSaveSink : public SaveSink {
+	static const size_t buffer_size_c = 16384;
+	char *buffer;
+	size_t buffer_used;
+	FILE *file;
+	string filename;
+	string temp_filename;
+	bool ok;
+
+	FileSaveSink(const FileSaveSink &); // not copyable
+	FileSaveSink &operator=(const FileSaveSink &);
+
+	bool flushBuffer();
+public:
+	FileSaveSink(const char *filename);
+	virtual ~FileSaveSink();
+
+	bool isOpen() const {
+		return this->file != NULL;
+	}
+	virtual bool write(const void *data, size_t length);
+	bool commit(); // atomically replaces any existing file
+};
+
+class MemorySaveSink : public SaveSink {
+	vector<char> data;
+public:
+	MemorySaveSink();
+	virtual ~MemorySaveSink() {
+	}
+
+	virtual bool write(const void *data, size_t length);
+	vector<char> &getData() {
+		return this->data;
+	}
+};
+
+/* Writes saves to disk on a worker thread, so the caller only pays for
+*  serialising the state into memory. If a save is still waiting to be
+*  written when another is submitted, the older one is dropped.
+*/
+class BackgroundSaver {
+	SDL_Thread *thread;
+	SDL_mutex *mutex;
+	SDL_cond *cond;
+	bool quit;
+	bool has_pending;
+	vector<char> pending_data;
+	string pending_filename;
+
+	BackgroundSaver(const BackgroundSaver &); // not copyable
+	BackgroundSaver &operator=(const BackgroundSaver &);
+
+	static int threadFunction(void *data);
+	void run();
+public:
+	BackgroundSaver();
+	~BackgroundSaver(); // waits for any pending save to be written
+
+	void submit(vector<char> &data, const char *filename); // takes the contents of data
+	static bool writeFile(const vector<char> &data, const char *filename);
+};
+
+class SaveWriter {
+protected:
+	SaveSink *sink;
+	bool ok;
+
+	void write(const void *data, size_t length) {
+		if( ok && length > 0 && !sink->write(data, length) ) {
+			ok = false;
+		}
+	}
+public:
+	SaveWriter(SaveSink *sink) : sink(sink), ok(true) {
+	}
+	virtual ~SaveWriter() {
+	}
+
+	// n.b., names should be string literals (or otherwise remain valid until the writer is destroyed)
+	virtual void startElement(const char *name)=0;
+	virtual void addAttribute(const char *name, int value)=0;
+	virtual void addAttribute(const char *name, const char *value)=0;
+	virtual void endElement()=0;
+	virtual void finish()=0;
+
+	bool isOk() const {
+		return this->ok;
+	}
+};
+
+class XMLSaveWriter : public SaveWriter {
+	static const int max_depth_c = 16;
+	const char *open_elements[max_depth_c];
+	int depth;
+	bool tag_open; // whether the start tag of the current element still needs closing
+public:
+	XMLSaveWriter(SaveSink *sink);
+	virtual ~XMLSaveWriter() {
+	}
+
+	virtual void startElement(const char *name);
+	virtual void addAttribute(const char *name, int value);
+	virtual void addAttribute(const char *name, const char *value);
+	virtual void endElement();
+	virtual void finish();
+};
+
+/* The binary format is a header ("GIGS" followed by a version byte), then a
+*  sequence of records, each starting with a one byte opcode. Integers are
+*  written as zigzag varints. Element and attribute names are written out in
+*  full the first time they're used, and afterwards by index.
+*/
+class BinarySaveWriter : public SaveWriter {
+	vector<const char *> names;
+	int depth;
+
+	void writeByte(unsigned char value);
+	void writeVarint(unsigned int value);
+	void writeName(const char *name);
+public:
+	BinarySaveWriter(SaveSink *sink);
+	virtual ~BinarySaveWriter() {
+	}
+
+	virtual void startElement(const char *name);
+	virtual void addAttribute(const char *name, int value);
+	virtual void addAttribute(const char *name, const char *value);
+	virtual void endElement();
+	virtual void finish();
+};
+
+/* An attribute of a SaveNode. Integer attributes of a binary save are kept as
+*  integers, so they aren't converted to text and back when loading.
+*/
+class SaveAttribute {
+	friend class SaveNode;
+	friend class BinarySaveReader;
+
+	const char *name;
+	const char *value; // NULL for integer attributes
+	int int_value;
+	bool is_last;
+	mutable char int_text[16];
+public:
+	SaveAttribute(const char *name, const char *value) : name(name), value(value), int_value(0), is_last(false) {
+	}
+	SaveAttribute(const char *name, int int_value) : name(name), value(NULL), int_value(int_value), is_last(false) {
+	}
+
+	const char *getName() const {
+		return this->name;
+	}
+	const char *getValue() const;
+	int getIntValue() const;
+	const SaveAttribute *next() const {
+		return this->is_last ? NULL : this+1;
+	}
+};
+
+/* An element of a saved state being loaded, or the document as a whole.
+*  Children are read one at a time, and a child is only valid until the next
+*  call to nextChild() on its parent; any of its own children that weren't
+*  read are skipped.
+*/
+class SaveNode {
+protected:
+	const char *name; // NULL for the document
+	vector<SaveAttribute> attributes;
+
+	void endAttributes();
+public:
+	enum Type {
+		SAVENODE_DOCUMENT = 0,
+		SAVENODE_ELEMENT = 1
+	};
+
+	SaveNode() : name(NULL) {
+	}
+	virtual ~SaveNode() {
+	}
+
+	Type getType() const {
+		return this->name == NULL ? SAVENODE_DOCUMENT : SAVENODE_ELEMENT;
+	}
+	const char *getName() const {
+		return this->name;
+	}
+	const SaveAttribute *getFirstAttribute() const {
+		return this->attributes.empty() ? NULL : &this->attributes[0];
+	}
+	virtual SaveNode *nextChild()=0; // returns NULL when there are no more children
+};
+
+/* Walks a parsed TinyXML document. Nodes other than elements (comments,
+*  text, the declaration) are skipped.
+*/
+class XMLSaveNode : public SaveNode {
+	const TiXmlNode *next_child;
+	XMLSaveNode *child;
+
+	XMLSaveNode(const XMLSaveNode &); // not copyable
+	XMLSaveNode &operator=(const XMLSaveNode &);
+public:
+	XMLSaveNode() : next_child(NULL), child(NULL) {
+	}
+	virtual ~XMLSaveNode() {
+		delete child;
+	}
+
+	void set(const TiXmlNode *node);
+	virtual SaveNode *nextChild();
+};
+
+class BinarySaveNode;
+
+/* Reads a binary save (see BinarySaveWriter) directly from its records. A
+*  malformed save throws std::runtime_error from nextChild(), as with the
+*  errors found by the loadStateParseXMLNode() functions.
+*/
+class BinarySaveReader {
+	friend class BinarySaveNode;
+
+	const unsigned char *ptr;
+	const unsigned char *end;
+	vector<char *> names;
+	vector<BinarySaveNode *> nodes; // the open element at each depth, reused for each new element
+	int depth; // depth of the innermost open element, 0 for the document
+	bool valid;
+
+	BinarySaveReader(const BinarySaveReader &); // not copyable
+	BinarySaveReader &operator=(const BinarySaveReader &);
+
+	unsigned char readByte();
+	unsigned int readVarint();
+	const char *readName();
+	BinarySaveNode *readElement(int element_depth);
+	void closeTo(int close_depth);
+public:
+	BinarySaveReader(const char *buffer, size_t length);
+	~BinarySaveReader();
+
+	SaveNode *getDocument(); // returns NULL if this isn't a binary save of a supported version
+};
+
+bool isBinarySaveState(const char *buffer, size_t length);
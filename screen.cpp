@@ -3,6 +3,7 @@
 
 #include <cassert>
 #include <ctime>
+#include <algorithm>
 
 #include "screen.h"
 #include "sound.h"
@@ -25,7 +26,12 @@ Gigalomania::Screen::Screen() : m_pos_x(0), m_pos_y(0), m_down_left(false), m_do
 	sdlRenderer = NULL;
 	width = 0;
 	height = 0;
+	vsync = false;
+	refresh_rate = 0;
+	present_waited = false;
 #endif
+	defer_present = false;
+	present_pending = false;
 }
 
 Gigalomania::Screen::~Screen() {
@@ -53,12 +59,24 @@ bool Gigalomania::Screen::open(int screen_width, int screen_height, bool fullscr
 		return false;
 	}
 #else
+	SDL_SetHint(SDL_HINT_RENDER_VSYNC, "1"); // if available, lets Application::wait() leave frame pacing to the display
 	if( SDL_CreateWindowAndRenderer(screen_width, screen_height, fullscreen ? SDL_WINDOW_FULLSCREEN_DESKTOP : SDL_WINDOW_RESIZABLE, &sdlWindow, &sdlRenderer) != 0 ) {
 		LOG("failed to open screen at this resolution\n");
 		return false;
 	}
 	this->width = screen_width;
 	this->height = screen_height;
+	{
+		SDL_RendererInfo info;
+		if( SDL_GetRendererInfo(sdlRenderer, &info) == 0 ) {
+			vsync = ( info.flags & SDL_RENDERER_PRESENTVSYNC ) != 0;
+		}
+		SDL_DisplayMode mode;
+		if( SDL_GetWindowDisplayMode(sdlWindow, &mode) == 0 ) {
+			refresh_rate = mode.refresh_rate;
+		}
+		LOG("vsync: %s, refresh rate: %d\n", vsync ? "yes" : "no", refresh_rate);
+	}
 	{
 		SDL_BlendMode blendMode = SDL_BLENDMODE_NONE;
 		SDL_GetRenderDrawBlendMode(sdlRenderer, &blendMode);
@@ -126,16 +144,38 @@ void Gigalomania::Screen::clear() {
 	rect.h = getHeight();
 	SDL_FillRect(surface, &rect, 0);
 #else
+	SpriteBatch::flush();
 	SDL_SetRenderDrawColor(sdlRenderer, 0, 0, 0, 255);
 	SDL_RenderClear(sdlRenderer);
 #endif
 }
 
 void Gigalomania::Screen::refresh() {
+#if SDL_MAJOR_VERSION == 1
+#else
+	SpriteBatch::flush();
+	SpriteBatch::endFrame();
+#endif
+	present_pending = true;
+	if( !defer_present ) {
+		presentPending();
+	}
+}
+
+void Gigalomania::Screen::presentPending() {
+	if( !present_pending ) {
+		return;
+	}
+	present_pending = false;
 #if SDL_MAJOR_VERSION == 1
 	SDL_Flip(surface);
 #else
-	SDL_RenderPresent(sdlRenderer);
+	Uint64 start = SDL_GetPerformanceCounter();
+	SDL_RenderPresent(sdlRenderer); // n.b., with vsync, this blocks until the next refresh
+	// but not always, e.g., when the window is minimised or hidden, so check whether it actually waited (at least 1ms)
+	if( vsync && (SDL_GetPerformanceCounter() - start) * 1000 >= SDL_GetPerformanceFrequency() ) {
+		present_waited = true;
+	}
 #endif
 }
 
@@ -173,6 +213,7 @@ void Gigalomania::Screen::fillRect(short x, short y, short w, short h, unsigned
 	Uint32 col = SDL_MapRGB(surface->format, r, g, b);
 	SDL_FillRect(surface, &rect, col);
 #else
+	SpriteBatch::flush();
 	SDL_SetRenderDrawColor(sdlRenderer, r, g, b, 255);
 	SDL_RenderFillRect(sdlRenderer, &rect);
 #endif
@@ -188,6 +229,7 @@ void Gigalomania::Screen::fillRectWithAlpha(short x, short y, short w, short h,
 	rect.w = w;
 	rect.h = h;
 	//LOG("fill rect %d %d %d %d\n", r, g, b, alpha);
+	SpriteBatch::flush();
 	SDL_SetRenderDrawColor(sdlRenderer, r, g, b, alpha);
 	SDL_RenderFillRect(sdlRenderer, &rect);
 }
@@ -197,6 +239,7 @@ void Gigalomania::Screen::fillRectWithAlpha(short x, short y, short w, short h,
 // not supported with SDL 1.2
 #else
 void Gigalomania::Screen::drawLine(short x1, short y1, short x2, short y2, unsigned char r, unsigned char g, unsigned char b) {
+	SpriteBatch::flush();
 	SDL_SetRenderDrawColor(sdlRenderer, r, g, b, 255);
 	SDL_RenderDrawLine(sdlRenderer, x1, y1, x2, y2);
 }
@@ -260,13 +303,114 @@ bool Gigalomania::Screen::getMouseState(int *m_x, int *m_y, bool *m_left, bool *
 	return ( *m_left || *m_middle || *m_right );
 }
 
-Application::Application() : quit(false), blank_mouse(false), compute_fps(false), fps(0.0f), last_time(0) {
+int Gigalomania::RenderLayer::current_generation = 0;
+
+Gigalomania::RenderLayer::RenderLayer(Screen *screen) : screen(screen), valid(false), generation(0) {
+#if SDL_MAJOR_VERSION == 1
+#else
+	texture = NULL;
+	previous_target = NULL;
+	texture_w = 0;
+	texture_h = 0;
+	unsupported = false;
+	updating = false;
+#endif
+}
+
+Gigalomania::RenderLayer::~RenderLayer() {
+#if SDL_MAJOR_VERSION == 1
+#else
+	if( texture != NULL ) {
+		SDL_DestroyTexture(texture);
+	}
+#endif
+}
+
+/* Returns true if the layer's content needs to be drawn, in which case the caller should draw it and then call endUpdate().
+*/
+bool Gigalomania::RenderLayer::beginUpdate() {
+	if( this->isValid() ) {
+		return false;
+	}
+#if SDL_MAJOR_VERSION == 1
+	// no render targets, so always draw directly to the screen
+#else
+	int w = screen->getWidth();
+	int h = screen->getHeight();
+	if( texture != NULL && ( texture_w != w || texture_h != h ) ) {
+		SDL_DestroyTexture(texture);
+		texture = NULL;
+	}
+	if( texture == NULL && !unsupported ) {
+		if( SDL_RenderTargetSupported(screen->sdlRenderer) ) {
+			texture = SDL_CreateTexture(screen->sdlRenderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h);
+		}
+		if( texture == NULL ) {
+			LOG("render targets not available, layers will be drawn directly: %s\n", SDL_GetError());
+			unsupported = true;
+		}
+		else {
+			texture_w = w;
+			texture_h = h;
+			SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE); // layers are opaque
+		}
+	}
+	if( texture == NULL ) {
+		return true;
+	}
+	// anything batched so far belongs to the screen, not the layer
+	SpriteBatch::flush();
+	previous_target = SDL_GetRenderTarget(screen->sdlRenderer);
+	if( SDL_SetRenderTarget(screen->sdlRenderer, texture) != 0 ) {
+		LOG("failed to set render target: %s\n", SDL_GetError());
+		return true;
+	}
+	SDL_SetRenderDrawColor(screen->sdlRenderer, 0, 0, 0, 255);
+	SDL_RenderClear(screen->sdlRenderer);
+	updating = true;
+#endif
+	return true;
+}
+
+void Gigalomania::RenderLayer::endUpdate() {
+#if SDL_MAJOR_VERSION == 1
+#else
+	if( !updating ) {
+		// we drew directly to the screen, so there's nothing cached
+		return;
+	}
+	SpriteBatch::flush();
+	SDL_SetRenderTarget(screen->sdlRenderer, previous_target);
+	previous_target = NULL;
+	updating = false;
+	this->valid = true;
+	this->generation = current_generation;
+#endif
+}
+
+void Gigalomania::RenderLayer::draw() {
+#if SDL_MAJOR_VERSION == 1
+#else
+	if( !this->isValid() ) {
+		// drawn directly, or nothing drawn
+		return;
+	}
+	SpriteBatch::flush();
+	SDL_RenderCopy(screen->sdlRenderer, texture, NULL, NULL);
+#endif
+}
+
+Application::Application() : quit(false), blank_mouse(false), compute_fps(false), fps(0.0f), last_time(0), n_frame_times(0), frame_times_pos(0) {
 	// uncomment to display fps
 	//compute_fps = true;
 }
 
 Application::~Application() {
 	LOG("quit SDL\n");
+#if SDL_MAJOR_VERSION == 1
+#else
+	IMG_Quit(); // for IMG_Init() in Image::prefetchImages()
+#endif
 	SDL_Quit();
 }
 
@@ -288,24 +432,67 @@ unsigned int Application::getTicks() const {
 	return SDL_GetTicks();
 }
 
+/* Returns a monotonic wall clock time in ms, with sub-millisecond resolution where available.
+*/
+double Application::getPreciseTicks() const {
+#if SDL_MAJOR_VERSION == 1
+	return SDL_GetTicks();
+#else
+	static const double ms_per_count = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	return SDL_GetPerformanceCounter() * ms_per_count;
+#endif
+}
+
+/* Returns the given percentile (0 to 100) of the recent frame times in ms, or 0 if none have been recorded yet.
+*/
+float Application::getFrameTimePercentile(float percentile) const {
+	if( n_frame_times == 0 ) {
+		return 0.0f;
+	}
+	std::vector<float> sorted(frame_times, frame_times + n_frame_times);
+	int index = (int)(percentile * (n_frame_times - 1) / 100.0f + 0.5f);
+	index = std::max(0, std::min(n_frame_times - 1, index));
+	std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+	return sorted[index];
+}
+
 void Application::delay(unsigned int time) {
 	SDL_Delay(time);
 }
 
 const int TICK_INTERVAL = 16; // 62.5 fps max
+const int IDLE_TICK_INTERVAL = 100; // when nothing is animating; must be less than the maximum step in Game::updateTime()
 
 void Application::wait() {
 	unsigned int now = game_g->getApplication()->getTicks();
 	// use unsigned int and compare by subtraction to avoid overflow problems - see http://blogs.msdn.com/b/oldnewthing/archive/2005/05/31/423407.aspx, http://www.gammon.com.au/millis
 	unsigned int elapsed = now - last_time;
 	unsigned int delay = 0;
-	if( elapsed >= TICK_INTERVAL ) {
+	// with vsync at no more than our maximum frame rate, presenting the frame has already waited long enough - but only
+	// if a frame was presented since the last wait() and the present did wait (not if the world was locked, or the
+	// window is minimised), otherwise we'd loop without ever delaying
+	Gigalomania::Screen *screen = game_g->getScreen();
+	bool vsync_paced = screen != NULL && screen->takePresentWaited() && screen->getRefreshRate() > 0 && screen->getRefreshRate() * TICK_INTERVAL <= 1000;
+	if( elapsed >= TICK_INTERVAL || vsync_paced ) {
 		// fine, we've already passed TICK_INTERVAL
 	}
 	else {
 		delay = TICK_INTERVAL - elapsed;
 		game_g->getApplication()->delay(delay);
 	}
+#if SDL_MAJOR_VERSION == 1
+	// no SDL_WaitEventTimeout, so we can't idle without delaying input
+#else
+	if( game_g->isIdle() ) {
+		// nothing will change until there's input, but still redraw occasionally (e.g., for popups timing out)
+		elapsed = game_g->getApplication()->getTicks() - last_time;
+		if( elapsed < IDLE_TICK_INTERVAL ) {
+			SDL_WaitEventTimeout(NULL, IDLE_TICK_INTERVAL - elapsed); // returns as soon as an event is queued, leaving it for the event loop
+		}
+		last_time = game_g->getApplication()->getTicks();
+		return;
+	}
+#endif
 	last_time = now + delay;
 }
 
@@ -314,24 +501,58 @@ void Application::runMainLoop() {
 
 	SDL_Event event;
 	quit = false;
-	int last_fps_time = clock();
+	double last_fps_time = getPreciseTicks();
+	double last_frame_time = last_fps_time;
 	const int fps_frames_c = 50;
 	int frames = 0;
+	// with the simulation thread, each frame is also kept, so it can be shown again if the world is locked when the next frame is due
+	Gigalomania::RenderLayer *frame_layer = NULL;
 	while(!quit) {
+		double frame_time = getPreciseTicks();
+		if( frames > 0 ) {
+			frame_times[frame_times_pos] = (float)(frame_time - last_frame_time);
+			frame_times_pos = (frame_times_pos + 1) % n_frame_times_c;
+			n_frame_times = std::min(n_frame_times + 1, n_frame_times_c);
+		}
+		last_frame_time = frame_time;
 		if( compute_fps && frames == fps_frames_c ) {
-			int new_fps_time = clock();
-			float t = ((float)(new_fps_time - last_fps_time)) / (float)CLOCKS_PER_SEC;
-			this->fps = fps_frames_c / t;
+			this->fps = (float)(1000.0 * fps_frames_c / (frame_time - last_fps_time));
 			//LOG("FPS: %f\n", fps);
 			frames = 0;
-			last_fps_time = new_fps_time;
+			last_fps_time = frame_time;
 		}
 		frames++;
 
 		updateSound();
 
 		// draw screen
-		game_g->drawGame();
+		Gigalomania::Screen *screen = game_g->getScreen();
+		if( game_g->isSimulationThreaded() && frame_layer == NULL ) {
+			frame_layer = new Gigalomania::RenderLayer(screen);
+		}
+		if( game_g->lockWorld(false) ) {
+			screen->setDeferPresent(true);
+			bool to_layer = false;
+			if( frame_layer != NULL ) {
+				frame_layer->invalidate();
+				to_layer = frame_layer->beginUpdate();
+			}
+			game_g->drawGame();
+			if( to_layer ) {
+				frame_layer->endUpdate();
+				frame_layer->draw(); // does nothing if render targets aren't available, in which case we drew to the screen
+			}
+			screen->setDeferPresent(false);
+			game_g->unlockWorld();
+			// with vsync this may block until the next refresh, so do it without holding the world lock
+			screen->presentPending();
+		}
+		else if( frame_layer != NULL && frame_layer->isValid() ) {
+			// the simulation thread is part way through a step, so show the last frame again rather than stall or skip the frame
+			frame_layer->draw();
+			screen->refresh();
+		}
+		game_g->writePendingAutosave();
 
 		/* wait() to avoid 100% CPU - it's debatable whether we should do this,
 		 * due to risk of SDL_Delay waiting too long, but since Gigalomania
@@ -345,13 +566,22 @@ void Application::runMainLoop() {
 
 		unsigned int new_time = game_g->getApplication()->getTicks();
 		//LOG("%d, %d\n", new_time, new_time - elapsed_time);
-		if( !game_g->isPaused() ) {
+		if( game_g->isSimulationThreaded() ) {
+			// the simulation thread keeps the time
+		}
+		else if( !game_g->isPaused() ) {
 			game_g->updateTime(new_time - elapsed_time);
 		}
 		else
 			game_g->updateTime(0);
 		elapsed_time = new_time;
 
+		if( !game_g->lockWorld(false) ) {
+			// simulation thread is busy; leave input queued until the next iteration, but keep the window responsive
+			SDL_PumpEvents();
+			continue;
+		}
+
 		// user input
 		while( SDL_PollEvent(&event) == 1 ) {
 			switch (event.type) {
@@ -541,13 +771,22 @@ void Application::runMainLoop() {
 					game_g->deactivate();
 				}
 				break;
+#if SDL_VERSION_ATLEAST(2, 0, 4)
+			case SDL_RENDER_TARGETS_RESET:
+			case SDL_RENDER_DEVICE_RESET:
+				// the contents of render target textures have been lost (e.g., Direct3D device lost)
+				Gigalomania::RenderLayer::invalidateAll();
+				break;
+#endif
 #endif
 			}
 		}
 		SDL_PumpEvents();
 
 		game_g->updateGame();
+		game_g->unlockWorld();
 	}
+	delete frame_layer;
 }
 
 //#endif
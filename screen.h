@@ -6,13 +6,19 @@
 
 namespace Gigalomania {
 	class Screen {
+		friend class RenderLayer;
 #if SDL_MAJOR_VERSION == 1
 		SDL_Surface *surface;
 #else
 		SDL_Window *sdlWindow;
 		SDL_Renderer *sdlRenderer;
 		int width, height; // this stores the logical size rather than the window size
+		bool vsync;
+		int refresh_rate; // 0 if unknown
+		bool present_waited; // whether a present has waited for vsync, since takePresentWaited() was last called
 #endif
+		bool defer_present;
+		bool present_pending;
 		int m_pos_x;
 		int m_pos_y;
 		bool m_down_left;
@@ -32,6 +38,34 @@ namespace Gigalomania {
 		void setTitle(const char *title);
 		void clear();
 		void refresh();
+		// whilst set, refresh() doesn't show the frame until presentPending() is called (so we can wait for vsync after releasing locks)
+		void setDeferPresent(bool defer_present) {
+			this->defer_present = defer_present;
+		}
+		void presentPending();
+#if SDL_MAJOR_VERSION == 1
+		bool hasVSync() const {
+			return false;
+		}
+		bool takePresentWaited() {
+			return false;
+		}
+		int getRefreshRate() const {
+			return 0;
+		}
+#else
+		bool hasVSync() const {
+			return this->vsync;
+		}
+		bool takePresentWaited() {
+			bool present_waited = this->present_waited;
+			this->present_waited = false;
+			return present_waited;
+		}
+		int getRefreshRate() const {
+			return this->refresh_rate;
+		}
+#endif
 		// in SDL2, these return the logical size rather than the window size
 		int getWidth() const;
 		int getHeight() const;
@@ -64,6 +98,49 @@ namespace Gigalomania {
 		void getMouseCoords(int *m_x, int *m_y) const;
 		bool getMouseState(int *m_x, int *m_y, bool *m_left, bool *m_middle, bool *m_right) const;
 	};
+
+	/** An opaque full screen layer of the scene, cached in a render target texture, so that
+	*   content that rarely changes need only be redrawn when it's invalidated. Usage:
+	*       if( layer->beginUpdate() ) {
+	*           // draw the layer's content
+	*           layer->endUpdate();
+	*       }
+	*       layer->draw();
+	*   If render targets aren't available (including SDL 1.2), beginUpdate() always returns
+	*   true and the content is drawn directly to the screen.
+	*/
+	class RenderLayer {
+		Screen *screen;
+#if SDL_MAJOR_VERSION == 1
+#else
+		SDL_Texture *texture;
+		SDL_Texture *previous_target; // restored by endUpdate(), so layers can be drawn within a layer
+		int texture_w, texture_h;
+		bool unsupported; // set if we failed to create a render target
+		bool updating;
+#endif
+		bool valid;
+		int generation;
+		static int current_generation;
+
+	public:
+		RenderLayer(Screen *screen);
+		~RenderLayer();
+
+		bool beginUpdate();
+		void endUpdate();
+		void draw();
+		void invalidate() {
+			this->valid = false;
+		}
+		bool isValid() const {
+			return this->valid && this->generation == current_generation;
+		}
+		// call when the contents of render targets are lost (e.g., SDL_RENDER_TARGETS_RESET)
+		static void invalidateAll() {
+			current_generation++;
+		}
+	};
 }
 
 class Application {
@@ -72,6 +149,11 @@ class Application {
 	bool compute_fps;
 	float fps;
 	unsigned int last_time;
+	// durations of the most recent frames in ms, as a ring buffer
+	static const int n_frame_times_c = 128;
+	float frame_times[n_frame_times_c];
+	int n_frame_times;
+	int frame_times_pos;
 
 public:
 	Application();
@@ -80,6 +162,7 @@ public:
 	bool init();
 
 	unsigned int getTicks() const;
+	double getPreciseTicks() const;
 	void delay(unsigned int time);
 	void wait();
 	void runMainLoop();
@@ -92,6 +175,7 @@ public:
 	float getFPS() const {
 		return fps;
 	}
+	float getFrameTimePercentile(float percentile) const;
 	bool isBlankMouse() const {
 		return this->blank_mouse;
 	}
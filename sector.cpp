@@ -22,6 +22,9 @@ using std::max;
 #include "image.h"
 #include "sound.h"
 #include "tutorial.h"
+#include "savestate.h"
+#include "resources.h"
+#include "network.h"
 
 //---------------------------------------------------------------------------
 
@@ -41,6 +44,40 @@ const int DEFENDER_DIR_N = 1;
 const int DEFENDER_DIR_E = 2;
 const int DEFENDER_DIR_W = 3;*/
 
+Gigalomania::Arena island_arena("island");
+
+void *Army::operator new(size_t size) {
+	return island_arena.allocate(size);
+}
+
+void Army::operator delete(void *ptr, size_t size) {
+	island_arena.deallocate(ptr, size);
+}
+
+void *Building::operator new(size_t size) {
+	return island_arena.allocate(size);
+}
+
+void Building::operator delete(void *ptr, size_t size) {
+	island_arena.deallocate(ptr, size);
+}
+
+void *Sector::operator new(size_t size) {
+	return island_arena.allocate(size);
+}
+
+void Sector::operator delete(void *ptr, size_t size) {
+	island_arena.deallocate(ptr, size);
+}
+
+void *Feature::operator new(size_t size) {
+	return island_arena.allocate(size);
+}
+
+void Feature::operator delete(void *ptr, size_t size) {
+	island_arena.deallocate(ptr, size);
+}
+
 bool isAirUnit(int epoch) {
 	ASSERT_S_EPOCH(epoch);
 	if( epoch == n_epochs_c || epoch < 6 ) {
@@ -335,27 +372,43 @@ int Army::getIndividualBombardStrength(int i) {
 	return str;
 }
 
-void Army::saveState(stringstream &stream) const {
+void Army::saveState(SaveWriter &writer) const {
 	// caller should write the <Army> ... </Army> enclosing tags
 	for(int i=0;i<=n_epochs_c;i++) {
-		stream << "<soldiers epoch=\"" << i << "\" n=\"" << this->soldiers[i] << "\"/>\n";
+		writer.startElement("soldiers");
+		writer.addAttribute("epoch", i);
+		writer.addAttribute("n", this->soldiers[i]);
+		writer.endElement();
 	}
 }
 
-void Army::loadStateParseXMLNode(const TiXmlNode *parent) {
+bool Army::netFields(NetFields &fields) {
+	// returns whether any of the soldiers were changed (only when writing)
+	fields.beginObject();
+	bool changed = false;
+	for(int i=0;i<=n_epochs_c;i++) {
+		int n = this->soldiers[i];
+		fields.field(this->soldiers[i]);
+		if( this->soldiers[i] != n ) {
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+void Army::loadStateParseXMLNode(SaveNode *parent) {
 	if( parent == NULL ) {
 		return;
 	}
 	bool read_children = true;
 
-	switch( parent->Type() ) {
-		case TiXmlNode::TINYXML_DOCUMENT:
+	switch( parent->getType() ) {
+		case SaveNode::SAVENODE_DOCUMENT:
 			break;
-		case TiXmlNode::TINYXML_ELEMENT:
+		case SaveNode::SAVENODE_ELEMENT:
 			{
-				const char *element_name = parent->Value();
-				const TiXmlElement *element = parent->ToElement();
-				const TiXmlAttribute *attribute = element->FirstAttribute();
+				const char *element_name = parent->getName();
+				const SaveAttribute *attribute = parent->getFirstAttribute();
 				if( strcmp(element_name, "army") == 0 )  {
 					// handled entirely by caller
 				}
@@ -366,19 +419,19 @@ void Army::loadStateParseXMLNode(const TiXmlNode *parent) {
 					int epoch = -1;
 					int n = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "epoch") == 0 ) {
-							epoch = atoi(attribute->Value());
+							epoch = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "n") == 0 ) {
-							n = atoi(attribute->Value());
+							n = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown army/soldiers attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( epoch == -1 || n == -1 ) {
 						throw std::runtime_error("soldiers missing attributes");
@@ -395,19 +448,9 @@ void Army::loadStateParseXMLNode(const TiXmlNode *parent) {
 				}
 			}
 			break;
-		case TiXmlNode::TINYXML_COMMENT:
-			break;
-		case TiXmlNode::TINYXML_UNKNOWN:
-			break;
-		case TiXmlNode::TINYXML_TEXT:
-			{
-			}
-			break;
-		case TiXmlNode::TINYXML_DECLARATION:
-			break;
 	}
 
-	for(const TiXmlNode *child=parent->FirstChild();child!=NULL && read_children;child=child->NextSibling())  {
+	for(SaveNode *child=read_children ? parent->nextChild() : NULL;child!=NULL;child=parent->nextChild()) {
 		loadStateParseXMLNode(child);
 	}
 }
@@ -714,65 +757,74 @@ void Building::setTurretMan(int turret, int epoch) {
 	this->turret_man[turret] = epoch;
 }
 
-void Building::saveState(stringstream &stream) const {
-	stream << "<building ";
-	stream << "building_id=\"" << type << "\" ";
-	stream << "health=\"" << health << "\" ";
-	stream << ">\n";
+void Building::saveState(SaveWriter &writer) const {
+	writer.startElement("building");
+	writer.addAttribute("building_id", type);
+	writer.addAttribute("health", health);
 	for(int i=0;i<max_building_turrets_c;i++) {
-		stream << "<turret_soldier turret_id=\"" << i << "\" epoch=\"" << turret_man[i] <<"\"/>\n";
+		writer.startElement("turret_soldier");
+		writer.addAttribute("turret_id", i);
+		writer.addAttribute("epoch", turret_man[i]);
+		writer.endElement();
 	}
-	stream << "</building>\n";
+	writer.endElement();
 }
 
-void Building::loadStateParseXMLNode(const TiXmlNode *parent) {
+void Building::netFields(NetFields &fields) {
+	fields.beginObject();
+	fields.field(this->health);
+	for(int i=0;i<max_building_turrets_c;i++) {
+		fields.field(this->turret_man[i]);
+	}
+}
+
+void Building::loadStateParseXMLNode(SaveNode *parent) {
 	if( parent == NULL ) {
 		return;
 	}
 	bool read_children = true;
 
-	switch( parent->Type() ) {
-		case TiXmlNode::TINYXML_DOCUMENT:
+	switch( parent->getType() ) {
+		case SaveNode::SAVENODE_DOCUMENT:
 			break;
-		case TiXmlNode::TINYXML_ELEMENT:
+		case SaveNode::SAVENODE_ELEMENT:
 			{
-				const char *element_name = parent->Value();
-				const TiXmlElement *element = parent->ToElement();
-				const TiXmlAttribute *attribute = element->FirstAttribute();
+				const char *element_name = parent->getName();
+				const SaveAttribute *attribute = parent->getFirstAttribute();
 				if( strcmp(element_name, "building") == 0 ) {
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "building_id") == 0 ) {
 							// handled by caller
 						}
 						else if( strcmp(attribute_name, "health") == 0 ) {
-							health = atoi(attribute->Value());
+							health = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown building/building attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 				}
 				else if( strcmp(element_name, "turret_soldier") == 0 ) {
 					int turret_id = -1;
 					int epoch = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "turret_id") == 0 ) {
-							turret_id = atoi(attribute->Value());
+							turret_id = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "epoch") == 0 ) {
-							epoch = atoi(attribute->Value());
+							epoch = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown building/turret_soldier attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( turret_id == -1  ) { // epoch allowed to be -1
 						throw std::runtime_error("turret_soldier missing attributes");
@@ -792,19 +844,9 @@ void Building::loadStateParseXMLNode(const TiXmlNode *parent) {
 				}
 			}
 			break;
-		case TiXmlNode::TINYXML_COMMENT:
-			break;
-		case TiXmlNode::TINYXML_UNKNOWN:
-			break;
-		case TiXmlNode::TINYXML_TEXT:
-			{
-			}
-			break;
-		case TiXmlNode::TINYXML_DECLARATION:
-			break;
 	}
 
-	for(const TiXmlNode *child=parent->FirstChild();child!=NULL && read_children;child=child->NextSibling())  {
+	for(SaveNode *child=read_children ? parent->nextChild() : NULL;child!=NULL;child=parent->nextChild()) {
 		loadStateParseXMLNode(child);
 	}
 }
@@ -999,28 +1041,10 @@ void Sector::destroyTower(bool nuked, int client_player) {
 	if( !nuked ) {
 		this->evacuate();
 	}
-	/*delete this->buildings[BUILDING_TOWER];
-	this->buildings[BUILDING_TOWER] = NULL;*/
-	for(int i=0;i<N_BUILDINGS;i++) {
-		if(this->buildings[i] != NULL) {
-			delete this->buildings[i];
-			this->buildings[i] = NULL;
-		}
-	}
-
-	delete this->assembled_army;
-	this->assembled_army = NULL;
-	delete this->stored_army;
-	this->stored_army = NULL;
 
 	int this_player = this->player; // keep a copy
 
-	initTowerStuff();
-	if( this == gamestate->getCurrentSector() ) {
-		gamestate->getGamePanel()->setPage(GamePanel::STATE_SECTORCONTROL);
-		gamestate->getGamePanel()->setup();
-	}
-	gamestate->getGamePanel()->refreshShutdown();
+	clearTower();
 
 	if( nuked || game_g->playerAlive(this_player) ) {
 		// player has other sectors
@@ -1047,6 +1071,30 @@ void Sector::destroyTower(bool nuked, int client_player) {
 	LOG("Sector::destroyTower() exit\n");
 }
 
+void Sector::clearTower() {
+	// removes the tower and everything belonging to it, leaving the sector unowned
+	/*delete this->buildings[BUILDING_TOWER];
+	this->buildings[BUILDING_TOWER] = NULL;*/
+	for(int i=0;i<N_BUILDINGS;i++) {
+		if(this->buildings[i] != NULL) {
+			delete this->buildings[i];
+			this->buildings[i] = NULL;
+		}
+	}
+
+	delete this->assembled_army;
+	this->assembled_army = NULL;
+	delete this->stored_army;
+	this->stored_army = NULL;
+
+	initTowerStuff();
+	if( this == gamestate->getCurrentSector() ) {
+		gamestate->getGamePanel()->setPage(GamePanel::STATE_SECTORCONTROL);
+		gamestate->getGamePanel()->setup();
+	}
+	gamestate->getGamePanel()->refreshShutdown();
+}
+
 void Sector::destroyBuilding(Type building_type,int client_player) {
 	this->destroyBuilding(building_type, false, client_player);
 }
@@ -2423,14 +2471,18 @@ int Sector::getEpoch() const {
 }
 
 int Sector::getBuildingEpoch() const {
-	int eph = this->getEpoch();
-	/*if( this->is_shutdown )
+	return getBuildingEpoch(this->getEpoch(), this->is_shutdown);
+}
+
+int Sector::getBuildingEpoch(int epoch, bool is_shutdown) {
+	int eph = epoch;
+	/*if( is_shutdown )
 		eph = end_epoch_c;
 	else if( game_g->getStartEpoch() == end_epoch_c )
 		eph = end_epoch_c;
 	else if( eph == n_epochs_c-1 )
 		eph = n_epochs_c-2;*/
-	if( this->is_shutdown )
+	if( is_shutdown )
 		eph = n_epochs_c-1;
 	else if( game_g->getStartEpoch() == end_epoch_c )
 		eph = n_epochs_c-1;
@@ -2896,107 +2948,122 @@ void Sector::assembleAll(bool include_unarmed) {
 	}
 }
 
-void Sector::saveState(stringstream &stream) const {
-	stream << "<sector ";
-	stream << "x=\"" << xpos << "\" ";
-	stream << "y=\"" << ypos << "\" ";
-	stream << "epoch=\"" << epoch << "\" ";
-	stream << "player=\"" << player << "\" ";
-	stream << "is_shutdown=\"" << (is_shutdown?1:0) << "\" ";
-	stream << "nuked=\"" << (nuked?1:0) << "\" ";
-	stream << "nuke_by_player=\"" << nuke_by_player << "\" ";
-	stream << "nuke_time=\"" << nuke_time << "\" ";
-	stream << "nuke_defence_animation=\"" << (nuke_defence_animation?1:0) << "\" ";
-	stream << "nuke_defence_time=\"" << nuke_defence_time << "\" ";
-	stream << "nuke_defence_x=\"" << nuke_defence_x << "\" ";
-	stream << "nuke_defence_y=\"" << nuke_defence_y << "\" ";
-	stream << "population=\"" << population << "\" ";
-	stream << "n_designers=\"" << n_designers << "\" ";
-	stream << "n_workers=\"" << n_workers << "\" ";
-	stream << "n_famount=\"" << n_famount << "\" ";
-	stream << "researched=\"" << researched << "\" ";
-
-	stream << "researched_lasttime=\"" << researched_lasttime << "\" ";
-	stream << "manufactured=\"" << manufactured << "\" ";
-	stream << "manufactured_lasttime=\"" << manufactured_lasttime << "\" ";
-	stream << "growth_lasttime=\"" << growth_lasttime << "\" ";
-	stream << "mined_lasttime=\"" << mined_lasttime << "\" ";
-	stream << "built_lasttime=\"" << built_lasttime << "\" ";
-	stream << ">\n";
+static void saveStateDesign(SaveWriter &writer, const char *name, const Design *design) {
+	writer.startElement(name);
+	writer.addAttribute("invention_type", design->getInvention()->getType());
+	writer.addAttribute("invention_epoch", design->getInvention()->getEpoch());
+	writer.addAttribute("design_id", design->getSaveId());
+	writer.endElement();
+}
+
+static void saveStateCount(SaveWriter &writer, const char *name, const char *id_name, int id, int n) {
+	writer.startElement(name);
+	writer.addAttribute(id_name, id);
+	writer.addAttribute("n", n);
+	writer.endElement();
+}
+
+void Sector::saveState(SaveWriter &writer) const {
+	writer.startElement("sector");
+	writer.addAttribute("x", xpos);
+	writer.addAttribute("y", ypos);
+	writer.addAttribute("epoch", epoch);
+	writer.addAttribute("player", player);
+	writer.addAttribute("is_shutdown", is_shutdown?1:0);
+	writer.addAttribute("nuked", nuked?1:0);
+	writer.addAttribute("nuke_by_player", nuke_by_player);
+	writer.addAttribute("nuke_time", nuke_time);
+	writer.addAttribute("nuke_defence_animation", nuke_defence_animation?1:0);
+	writer.addAttribute("nuke_defence_time", nuke_defence_time);
+	writer.addAttribute("nuke_defence_x", nuke_defence_x);
+	writer.addAttribute("nuke_defence_y", nuke_defence_y);
+	writer.addAttribute("population", population);
+	writer.addAttribute("n_designers", n_designers);
+	writer.addAttribute("n_workers", n_workers);
+	writer.addAttribute("n_famount", n_famount);
+	writer.addAttribute("researched", researched);
+
+	writer.addAttribute("researched_lasttime", researched_lasttime);
+	writer.addAttribute("manufactured", manufactured);
+	writer.addAttribute("manufactured_lasttime", manufactured_lasttime);
+	writer.addAttribute("growth_lasttime", growth_lasttime);
+	writer.addAttribute("mined_lasttime", mined_lasttime);
+	writer.addAttribute("built_lasttime", built_lasttime);
 
 	for(int i=0;i<N_ID;i++) {
-		stream << "<n_miners element_id=\"" << i << "\" n=\"" << n_miners[i] << "\"/>\n";
-		stream << "<elements element_id=\"" << i << "\" n=\"" << elements[i] << "\"/>\n";
-		stream << "<elementstocks element_id=\"" << i << "\" n=\"" << elementstocks[i] << "\"/>\n";
-		stream << "<partial_elementstocks element_id=\"" << i << "\" n=\"" << partial_elementstocks[i] << "\"/>\n";
+		saveStateCount(writer, "n_miners", "element_id", i, n_miners[i]);
+		saveStateCount(writer, "elements", "element_id", i, elements[i]);
+		saveStateCount(writer, "elementstocks", "element_id", i, elementstocks[i]);
+		saveStateCount(writer, "partial_elementstocks", "element_id", i, partial_elementstocks[i]);
 	}
 	for(int i=0;i<N_BUILDINGS;i++) {
-		stream << "<n_builders building_id=\"" << i << "\" n=\"" << n_builders[i] << "\"/>\n";
+		saveStateCount(writer, "n_builders", "building_id", i, n_builders[i]);
 	}
 	if( current_design != NULL ) {
-		stream << "<current_design invention_type=\"" << current_design->getInvention()->getType() << "\" invention_epoch=\"" << current_design->getInvention()->getEpoch() << "\" design_id=\"" << current_design->getSaveId() << "\"/>\n";
+		saveStateDesign(writer, "current_design", current_design);
 	}
 	if( current_manufacture != NULL ) {
-		stream << "<current_manufacture invention_type=\"" << current_manufacture->getInvention()->getType() << "\" invention_epoch=\"" << current_manufacture->getInvention()->getEpoch() << "\" design_id=\"" << current_manufacture->getSaveId() << "\"/>\n";
+		saveStateDesign(writer, "current_manufacture", current_manufacture);
 	}
 	for(int i=0;i<n_players_c;i++) {
-		stream << "<built_towers player_id=\"" << i << "\" n=\"" << built_towers[i] << "\"/>\n";
+		saveStateCount(writer, "built_towers", "player_id", i, built_towers[i]);
 	}
 	for(int i=0;i<N_BUILDINGS;i++) {
-		stream << "<built building_id=\"" << i << "\" n=\"" << built[i] << "\"/>\n";
+		saveStateCount(writer, "built", "building_id", i, built[i]);
 	}
 	for(size_t i=0;i<designs.size();i++) {
 		const Design *design = designs.at(i);
-		stream << "<design invention_type=\"" << design->getInvention()->getType() << "\" invention_epoch=\"" << design->getInvention()->getEpoch() << "\" design_id=\"" << design->getSaveId() << "\"/>\n";
+		saveStateDesign(writer, "design", design);
 	}
 	for(int i=0;i<N_BUILDINGS;i++) {
 		if( buildings[i] != NULL ) {
-			buildings[i]->saveState(stream);
+			buildings[i]->saveState(writer);
 		}
 	}
 	if( stored_army != NULL ) {
-		stream << "<stored_army>\n";
-		stored_army->saveState(stream);
-		stream << "</stored_army>\n";
+		writer.startElement("stored_army");
+		stored_army->saveState(writer);
+		writer.endElement();
 	}
 	for(int i=0;i<n_players_c;i++) {
 		if( armies[i] != NULL ) {
-			stream << "<army player_id=\"" << i << "\">\n";
-			armies[i]->saveState(stream);
-			stream << "</army>\n";
+			writer.startElement("army");
+			writer.addAttribute("player_id", i);
+			armies[i]->saveState(writer);
+			writer.endElement();
 		}
 	}
 	for(int i=0;i<n_epochs_c;i++) {
-		stream << "<stored_defenders epoch=\"" << i << "\" n=\"" << stored_defenders[i] << "\"/>\n";
+		saveStateCount(writer, "stored_defenders", "epoch", i, stored_defenders[i]);
 	}
 	for(int i=0;i<4;i++) {
-		stream << "<stored_shields relative_epoch=\"" << i << "\" n=\"" << stored_shields[i] << "\"/>\n";
+		saveStateCount(writer, "stored_shields", "relative_epoch", i, stored_shields[i]);
 	}
 
-	stream << "</sector>\n";
+	writer.endElement();
 }
 
-Design *Sector::loadStateParseXMLDesign(const TiXmlAttribute *attribute) {
+Design *Sector::loadStateParseXMLDesign(const SaveAttribute *attribute) {
 	Invention::Type invention_type = Invention::UNKNOWN_TYPE;
 	int invention_epoch = -1;
 	int design_id = -1;
 	while( attribute != NULL ) {
-		const char *attribute_name = attribute->Name();
+		const char *attribute_name = attribute->getName();
 		if( strcmp(attribute_name, "invention_type") == 0 ) {
-			invention_type = static_cast<Invention::Type>(atoi(attribute->Value()));
+			invention_type = static_cast<Invention::Type>(attribute->getIntValue());
 		}
 		else if( strcmp(attribute_name, "invention_epoch") == 0 ) {
-			invention_epoch = atoi(attribute->Value());
+			invention_epoch = attribute->getIntValue();
 		}
 		else if( strcmp(attribute_name, "design_id") == 0 ) {
-			design_id = atoi(attribute->Value());
+			design_id = attribute->getIntValue();
 		}
 		else {
 			// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 			LOG("unknown sector/current_design attribute: %s\n", attribute_name);
 			ASSERT(false);
 		}
-		attribute = attribute->Next();
+		attribute = attribute->next();
 	}
 	if( invention_type == Invention::UNKNOWN_TYPE || invention_type >= Invention::N_TYPES ) {
 		throw std::runtime_error("current_design invalid type");
@@ -3015,25 +3082,24 @@ Design *Sector::loadStateParseXMLDesign(const TiXmlAttribute *attribute) {
 	return design;
 }
 
-void Sector::loadStateParseXMLNode(const TiXmlNode *parent) {
+void Sector::loadStateParseXMLNode(SaveNode *parent) {
 	if( parent == NULL ) {
 		return;
 	}
 	bool read_children = true;
 
-	switch( parent->Type() ) {
-		case TiXmlNode::TINYXML_DOCUMENT:
+	switch( parent->getType() ) {
+		case SaveNode::SAVENODE_DOCUMENT:
 			break;
-		case TiXmlNode::TINYXML_ELEMENT:
+		case SaveNode::SAVENODE_ELEMENT:
 			{
-				const char *element_name = parent->Value();
-				const TiXmlElement *element = parent->ToElement();
-				const TiXmlAttribute *attribute = element->FirstAttribute();
+				const char *element_name = parent->getName();
+				const SaveAttribute *attribute = parent->getFirstAttribute();
 				if( strcmp(element_name, "sector") == 0 ) {
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "epoch") == 0 ) {
-							this->epoch = atoi(attribute->Value());
+							this->epoch = attribute->getIntValue();
 							if( epoch < 0 || epoch >= n_epochs_c+1 ) {
 								throw std::runtime_error("sector invalid epoch");
 							}
@@ -3045,7 +3111,7 @@ void Sector::loadStateParseXMLNode(const TiXmlNode *parent) {
 							// handled by caller
 						}
 						else if( strcmp(attribute_name, "player") == 0 ) {
-							this->player = atoi(attribute->Value());
+							this->player = attribute->getIntValue();
 							if( player < -1 || player >= n_players_c ) {
 								throw std::runtime_error("sector invalid player");
 							}
@@ -3054,99 +3120,99 @@ void Sector::loadStateParseXMLNode(const TiXmlNode *parent) {
 							}
 						}
 						else if( strcmp(attribute_name, "is_shutdown") == 0 ) {
-							this->is_shutdown = atoi(attribute->Value()) == 1;
+							this->is_shutdown = attribute->getIntValue() == 1;
 						}
 						else if( strcmp(attribute_name, "nuked") == 0 ) {
-							this->nuked = atoi(attribute->Value()) == 1;
+							this->nuked = attribute->getIntValue() == 1;
 						}
 						else if( strcmp(attribute_name, "nuke_by_player") == 0 ) {
-							this->nuke_by_player = atoi(attribute->Value());
+							this->nuke_by_player = attribute->getIntValue();
 							if( nuke_by_player < -1 || nuke_by_player >= n_players_c ) {
 								throw std::runtime_error("sector invalid nuke_by_player");
 							}
 						}
 						else if( strcmp(attribute_name, "nuke_time") == 0 ) {
-							this->nuke_time = atoi(attribute->Value());
+							this->nuke_time = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "nuke_defence_animation") == 0 ) {
-							this->nuke_defence_animation = atoi(attribute->Value()) == 1;
+							this->nuke_defence_animation = attribute->getIntValue() == 1;
 						}
 						else if( strcmp(attribute_name, "nuke_defence_time") == 0 ) {
-							this->nuke_defence_time = atoi(attribute->Value());
+							this->nuke_defence_time = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "nuke_defence_x") == 0 ) {
-							this->nuke_defence_x = atoi(attribute->Value());
+							this->nuke_defence_x = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "nuke_defence_y") == 0 ) {
-							this->nuke_defence_y = atoi(attribute->Value());
+							this->nuke_defence_y = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "population") == 0 ) {
-							this->population = atoi(attribute->Value());
+							this->population = attribute->getIntValue();
 							if( population < 0 ) {
 								throw std::runtime_error("sector invalid population");
 							}
 						}
 						else if( strcmp(attribute_name, "n_designers") == 0 ) {
-							this->n_designers = atoi(attribute->Value());
+							this->n_designers = attribute->getIntValue();
 							if( n_designers < 0 || n_designers > population ) {
 								throw std::runtime_error("sector invalid n_designers");
 							}
 						}
 						else if( strcmp(attribute_name, "n_workers") == 0 ) {
-							this->n_workers = atoi(attribute->Value());
+							this->n_workers = attribute->getIntValue();
 							if( n_workers < 0 || n_workers > population ) {
 								throw std::runtime_error("sector invalid n_workers");
 							}
 						}
 						else if( strcmp(attribute_name, "n_famount") == 0 ) {
-							this->n_famount = atoi(attribute->Value());
+							this->n_famount = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "researched") == 0 ) {
-							this->researched = atoi(attribute->Value());
+							this->researched = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "researched_lasttime") == 0 ) {
-							this->researched_lasttime = atoi(attribute->Value());
+							this->researched_lasttime = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "manufactured") == 0 ) {
-							this->manufactured = atoi(attribute->Value());
+							this->manufactured = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "manufactured_lasttime") == 0 ) {
-							this->manufactured_lasttime = atoi(attribute->Value());
+							this->manufactured_lasttime = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "growth_lasttime") == 0 ) {
-							this->growth_lasttime = atoi(attribute->Value());
+							this->growth_lasttime = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "mined_lasttime") == 0 ) {
-							this->mined_lasttime = atoi(attribute->Value());
+							this->mined_lasttime = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "built_lasttime") == 0 ) {
-							this->built_lasttime = atoi(attribute->Value());
+							this->built_lasttime = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown sector/sector attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 				}
 				else if( strcmp(element_name, "n_miners") == 0 || strcmp(element_name, "elements") == 0 || strcmp(element_name, "elementstocks") == 0 || strcmp(element_name, "partial_elementstocks") == 0 ) {
 					int element_id = -1;
 					int n = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "element_id") == 0 ) {
-							element_id = atoi(attribute->Value());
+							element_id = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "n") == 0 ) {
-							n = atoi(attribute->Value());
+							n = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown sector/n_miners/etc attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( element_id == -1 || n == -1 ) {
 						throw std::runtime_error("n_miners/elements/partial_elementstocks missing attributes");
@@ -3167,19 +3233,19 @@ void Sector::loadStateParseXMLNode(const TiXmlNode *parent) {
 					int building_id = -1;
 					int n = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "building_id") == 0 ) {
-							building_id = atoi(attribute->Value());
+							building_id = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "n") == 0 ) {
-							n = atoi(attribute->Value());
+							n = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown sector/n_builders/etc attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( building_id == -1 || n == -1 ) {
 						throw std::runtime_error("n_builders/built missing attributes");
@@ -3207,19 +3273,19 @@ void Sector::loadStateParseXMLNode(const TiXmlNode *parent) {
 					int player_id = -1;
 					int n = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "player_id") == 0 ) {
-							player_id = atoi(attribute->Value());
+							player_id = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "n") == 0 ) {
-							n = atoi(attribute->Value());
+							n = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown sector/built_towers attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( player_id == -1 || n == -1 ) {
 						throw std::runtime_error("built_towers missing attributes");
@@ -3232,14 +3298,14 @@ void Sector::loadStateParseXMLNode(const TiXmlNode *parent) {
 				else if( strcmp(element_name, "building") == 0 ) {
 					int building_id = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "building_id") == 0 ) {
-							building_id = atoi(attribute->Value());
+							building_id = attribute->getIntValue();
 						}
 						else {
 							// everything else handed by sub-function
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( building_id < 0 || building_id >= N_BUILDINGS ) {
 						throw std::runtime_error("building invalid building_id");
@@ -3261,14 +3327,14 @@ void Sector::loadStateParseXMLNode(const TiXmlNode *parent) {
 				else if( strcmp(element_name, "army") == 0 ) {
 					int player_id = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "player_id") == 0 ) {
-							player_id = atoi(attribute->Value());
+							player_id = attribute->getIntValue();
 						}
 						else {
 							// everything else handed by sub-function
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( player_id < 0 || player_id >= n_players_c ) {
 						throw std::runtime_error("army invalid player_id");
@@ -3280,19 +3346,19 @@ void Sector::loadStateParseXMLNode(const TiXmlNode *parent) {
 					int epoch = -1;
 					int n = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "epoch") == 0 ) {
-							epoch = atoi(attribute->Value());
+							epoch = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "n") == 0 ) {
-							n = atoi(attribute->Value());
+							n = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown sector/stored_defenders attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( epoch == -1 || n == -1 ) {
 						throw std::runtime_error("stored_defenders missing attributes");
@@ -3306,19 +3372,19 @@ void Sector::loadStateParseXMLNode(const TiXmlNode *parent) {
 					int relative_epoch = -1;
 					int n = -1;
 					while( attribute != NULL ) {
-						const char *attribute_name = attribute->Name();
+						const char *attribute_name = attribute->getName();
 						if( strcmp(attribute_name, "relative_epoch") == 0 ) {
-							relative_epoch = atoi(attribute->Value());
+							relative_epoch = attribute->getIntValue();
 						}
 						else if( strcmp(attribute_name, "n") == 0 ) {
-							n = atoi(attribute->Value());
+							n = attribute->getIntValue();
 						}
 						else {
 							// don't throw an error here, to help backwards compatibility, but should throw an error in debug mode in case this is a sign of not loading something that we've saved
 							LOG("unknown sector/stored_shields attribute: %s\n", attribute_name);
 							ASSERT(false);
 						}
-						attribute = attribute->Next();
+						attribute = attribute->next();
 					}
 					if( relative_epoch == -1 || n == -1 ) {
 						throw std::runtime_error("stored_shields missing attributes");
@@ -3335,23 +3401,208 @@ void Sector::loadStateParseXMLNode(const TiXmlNode *parent) {
 				}
 			}
 			break;
-		case TiXmlNode::TINYXML_COMMENT:
-			break;
-		case TiXmlNode::TINYXML_UNKNOWN:
-			break;
-		case TiXmlNode::TINYXML_TEXT:
-			{
-			}
-			break;
-		case TiXmlNode::TINYXML_DECLARATION:
-			break;
 	}
 
-	for(const TiXmlNode *child=parent->FirstChild();child!=NULL && read_children;child=child->NextSibling())  {
+	for(SaveNode *child=read_children ? parent->nextChild() : NULL;child!=NULL;child=parent->nextChild()) {
 		loadStateParseXMLNode(child);
 	}
 }
 
+static int netDesignCode(const Design *design) {
+	// 0 for no design
+	if( design == NULL ) {
+		return 0;
+	}
+	ASSERT( design->getSaveId() >= 0 && design->getSaveId() < 256 );
+	const Invention *invention = design->getInvention();
+	return 1 + ( ( invention->getType() * n_epochs_c + invention->getEpoch() ) << 8 ) + design->getSaveId();
+}
+
+static Design *netDesign(int code) {
+	if( code <= 0 ) {
+		return NULL;
+	}
+	code--;
+	int invention_index = code >> 8;
+	if( invention_index >= Invention::N_TYPES * n_epochs_c ) {
+		return NULL;
+	}
+	Invention *invention = Invention::getInvention(static_cast<Invention::Type>(invention_index / n_epochs_c), invention_index % n_epochs_c);
+	return invention == NULL ? NULL : invention->findDesign(code & 255);
+}
+
+/* The replicated fields of the sector, see NetFields. The tower, buildings
+*  and designs come first, as they decide which objects the later fields
+*  belong to; when writing (on a client), changes to them are applied with the
+*  same functions the simulation uses, so the GUI is kept up to date.
+*/
+void Sector::netFields(NetFields &fields, int client_player) {
+	bool refresh = false;
+	fields.beginObject();
+
+	int net_player = this->player;
+	fields.field(net_player);
+	if( fields.isWriting() && net_player != this->player ) {
+		if( net_player != PLAYER_NONE && !game_g->validPlayer(net_player) ) {
+			// n.b., the server's values aren't to be trusted any more than the client's commands
+			LOG("net sector %d, %d has invalid player %d\n", xpos, ypos, net_player);
+			fields.reject();
+			return;
+		}
+		if( this->player != PLAYER_NONE ) {
+			this->clearTower();
+		}
+		if( net_player != PLAYER_NONE ) {
+			this->createTower(net_player, 0);
+		}
+		refresh = true;
+	}
+	int net_epoch = this->epoch;
+	fields.field(net_epoch);
+	if( fields.isWriting() && net_epoch != this->epoch && net_epoch >= 0 && net_epoch < n_epochs_c ) {
+		this->setEpoch(net_epoch);
+	}
+	fields.field(this->is_shutdown);
+	fields.field(this->nuked);
+
+	int building_mask = 0;
+	for(int i=0;i<N_BUILDINGS;i++) {
+		if( this->buildings[i] != NULL ) {
+			building_mask |= 1 << i;
+		}
+	}
+	fields.field(building_mask);
+	if( fields.isWriting() && this->player != PLAYER_NONE ) {
+		for(int i=0;i<N_BUILDINGS;i++) {
+			Type type = static_cast<Type>(i);
+			bool exists = ( building_mask & (1 << i) ) != 0;
+			if( type == BUILDING_TOWER ) {
+				// comes and goes with the player
+			}
+			else if( exists && this->buildings[i] == NULL ) {
+				this->buildings[i] = new Building(gamestate, this, type);
+				this->updateForNewBuilding(type);
+				refresh = true;
+			}
+			else if( !exists && this->buildings[i] != NULL ) {
+				this->destroyBuilding(type, true, client_player);
+				refresh = true;
+			}
+		}
+	}
+
+	bool designs_changed = false;
+	Design *net_designs[Invention::N_TYPES][n_epochs_c];
+	for(int i=0;i<Invention::N_TYPES;i++) {
+		for(int j=0;j<n_epochs_c;j++) {
+			net_designs[i][j] = this->knownDesign(static_cast<Invention::Type>(i), j);
+			int code = netDesignCode(net_designs[i][j]);
+			fields.field(code);
+			if( fields.isWriting() && code != netDesignCode(net_designs[i][j]) ) {
+				net_designs[i][j] = netDesign(code);
+				designs_changed = true;
+			}
+		}
+	}
+	if( designs_changed ) {
+		this->designs.clear();
+		for(int i=0;i<Invention::N_TYPES;i++) {
+			for(int j=0;j<n_epochs_c;j++) {
+				this->inventions_known[i][j] = net_designs[i][j] != NULL;
+				if( net_designs[i][j] != NULL ) {
+					this->designs.push_back(net_designs[i][j]);
+				}
+			}
+		}
+		refresh = true;
+	}
+	int current_design_code = netDesignCode(this->current_design);
+	fields.field(current_design_code);
+	if( fields.isWriting() && current_design_code != netDesignCode(this->current_design) ) {
+		this->current_design = netDesign(current_design_code);
+		refresh = true;
+	}
+	int current_manufacture_code = netDesignCode(this->current_manufacture);
+	fields.field(current_manufacture_code);
+	if( fields.isWriting() && current_manufacture_code != netDesignCode(this->current_manufacture) ) {
+		this->current_manufacture = netDesign(current_manufacture_code);
+		refresh = true;
+	}
+
+	fields.field(this->population);
+	fields.field(this->n_designers);
+	int n_workers = this->n_workers;
+	fields.field(n_workers);
+	if( fields.isWriting() && n_workers != this->n_workers ) {
+		this->n_workers = n_workers;
+		this->updateWorkers(); // also sets the particle system rate
+	}
+	fields.field(this->n_famount);
+	fields.field(this->researched);
+	fields.field(this->manufactured);
+	for(int i=0;i<N_ID;i++) {
+		fields.field(this->n_miners[i]);
+		fields.field(this->elements[i]);
+		fields.field(this->elementstocks[i]);
+		fields.field(this->partial_elementstocks[i]);
+	}
+	for(int i=0;i<N_BUILDINGS;i++) {
+		fields.field(this->n_builders[i]);
+		fields.field(this->built[i]);
+	}
+	for(int i=0;i<n_players_c;i++) {
+		fields.field(this->built_towers[i]);
+	}
+	for(int i=0;i<n_epochs_c;i++) {
+		fields.field(this->stored_defenders[i]);
+	}
+	for(int i=0;i<4;i++) {
+		fields.field(this->stored_shields[i]);
+	}
+	fields.field(this->nuke_by_player);
+	fields.field(this->nuke_time);
+	fields.field(this->nuke_defence_animation);
+	fields.field(this->nuke_defence_time);
+	fields.field(this->nuke_defence_x);
+	fields.field(this->nuke_defence_y);
+
+	bool armies_changed = false;
+	for(int i=0;i<n_players_c;i++) {
+		if( this->armies[i]->netFields(fields) ) {
+			armies_changed = true;
+		}
+	}
+	if( this->stored_army != NULL ) {
+		this->stored_army->netFields(fields);
+	}
+	else {
+		fields.skipObject(Army::n_net_fields_c);
+	}
+	if( this->assembled_army != NULL ) {
+		this->assembled_army->netFields(fields);
+	}
+	else {
+		fields.skipObject(Army::n_net_fields_c);
+	}
+	for(int i=0;i<N_BUILDINGS;i++) {
+		if( this->buildings[i] != NULL ) {
+			this->buildings[i]->netFields(fields);
+		}
+		else {
+			fields.skipObject(Building::n_net_fields_c);
+		}
+	}
+
+	if( this == gamestate->getCurrentSector() ) {
+		if( refresh ) {
+			gamestate->getGamePanel()->refresh();
+		}
+		if( armies_changed ) {
+			gamestate->refreshSoldiers(true);
+		}
+	}
+}
+
 void Sector::printDebugInfo() const {
 #ifdef _DEBUG
 	printf("*** Sector Information        ***\n");
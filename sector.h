@@ -7,6 +7,7 @@ namespace Gigalomania {
 	class Image;
 	class PanelPage;
 	class Button;
+	class Arena;
 }
 
 using Gigalomania::PanelPage;
@@ -15,11 +16,18 @@ class Feature;
 class Sector;
 class PlayingGameState;
 class Invention;
+class SaveWriter;
+class SaveNode;
+class SaveAttribute;
+class NetFields;
 
 using std::vector;
 using std::string;
 using std::stringstream;
 
+// owns the memory of the current island's sectors, and the objects belonging to them; released by Map::freeSectors()
+extern Gigalomania::Arena island_arena;
+
 #include "TinyXML/tinyxml.h"
 
 #include "common.h"
@@ -106,6 +114,9 @@ class Army {
 	PlayingGameState *gamestate;
 
 public:
+	// allocated from island_arena
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
 	Army(PlayingGameState *gamestate, Sector *sector, int player);
 	~Army() {
 	}
@@ -139,8 +150,10 @@ public:
 	static int getIndividualStrength(int player, int i);
 	static int getIndividualBombardStrength(int i);
 
-	void saveState(stringstream &stream) const;
-	void loadStateParseXMLNode(const TiXmlNode *parent);
+	void saveState(SaveWriter &writer) const;
+	void loadStateParseXMLNode(SaveNode *parent);
+	static const int n_net_fields_c = n_epochs_c+1;
+	bool netFields(NetFields &fields);
 };
 
 class Element {
@@ -273,6 +286,9 @@ private:
 	PlayingGameState *gamestate;
 
 public:
+	// allocated from island_arena
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
 	Building(PlayingGameState *gamestate, Sector *sector, Type type);
 	~Building();
 
@@ -329,8 +345,10 @@ public:
 	void clearTurretMan(int turret);
 	void setTurretMan(int turret, int epoch);
 
-	void saveState(stringstream &stream) const;
-	void loadStateParseXMLNode(const TiXmlNode *parent);
+	void saveState(SaveWriter &writer) const;
+	void loadStateParseXMLNode(SaveNode *parent);
+	static const int n_net_fields_c = 1+max_building_turrets_c;
+	void netFields(NetFields &fields);
 };
 
 class Sector {
@@ -388,7 +406,7 @@ class Sector {
 	void doCombat(int client_player);
 	void doPlayer(int client_player);
 
-	Design *loadStateParseXMLDesign(const TiXmlAttribute *attribute);
+	Design *loadStateParseXMLDesign(const SaveAttribute *attribute);
 
 	Building *buildings[N_BUILDINGS]; // saved
 	Army *assembled_army;
@@ -403,12 +421,16 @@ class Sector {
 
 	PlayingGameState *gamestate;
 public:
+	// allocated from island_arena
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
 
 	Sector(PlayingGameState *gamestate, int epoch, int xpos, int ypos, MapColour map_colour);
 	~Sector();
 
 	void createTower(int player,int population);
 	void destroyTower(bool nuked, int client_player);
+	void clearTower();
 	bool canShutdown() const;
 	void shutdown(int client_player);
 	bool isShutdown() const {
@@ -474,6 +496,7 @@ public:
 	void setEpoch(int epoch);
 	int getEpoch() const;
 	int getBuildingEpoch() const;
+	static int getBuildingEpoch(int epoch, bool is_shutdown);
 	int getXPos() const {
 		return xpos;
 	}
@@ -568,8 +591,9 @@ public:
 	void buildBuilding(Type type);
 	void updateForNewBuilding(Type type);
 
-	void saveState(stringstream &stream) const;
-	void loadStateParseXMLNode(const TiXmlNode *parent);
+	void saveState(SaveWriter &writer) const;
+	void loadStateParseXMLNode(SaveNode *parent);
+	void netFields(NetFields &fields, int client_player);
 
 	void printDebugInfo() const;
 };
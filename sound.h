@@ -29,11 +29,11 @@ namespace Gigalomania {
 
 		string text;
 
-		Sample(bool is_music, Mix_Music *music, Mix_Chunk *chunk) : is_music(is_music), music(music), chunk(chunk) {
+		Sample(bool is_music, Mix_Music *music, Mix_Chunk *chunk) : TrackedObject(TRACKED_SAMPLE), is_music(is_music), music(music), chunk(chunk) {
 			channel = -1;
 		}
 	public:
-		Sample() : is_music(false), music(NULL), chunk(NULL) {
+		Sample() : TrackedObject(TRACKED_SAMPLE), is_music(false), music(NULL), chunk(NULL) {
 			// create dummy Sample
 		}
 		virtual ~Sample();
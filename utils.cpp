@@ -22,6 +22,12 @@
 #include <unistd.h> // for access
 #endif
 
+#if defined(__linux) && !defined(__ANDROID__)
+#define TEXTREADER_MMAP
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+
 #if defined(__ANDROID__)
 #include <android/log.h>
 #endif
@@ -32,6 +38,12 @@
 #include "utils.h"
 #include "common.h"
 
+#if defined(USE_SSE2)
+#include <emmintrin.h>
+#elif defined(USE_NEON)
+#include <arm_neon.h>
+#endif
+
 //---------------------------------------------------------------------------
 
 //const bool DEBUG = true;
@@ -455,6 +467,235 @@ float perlin_noise2(float vec[2]) {
 	return lerp(sy, a, b);
 }
 
+void perlin_noise2_init() {
+	if (start) {
+		initPerlin();
+	}
+}
+
+/* Evaluates perlin_noise2 at (vec0, vec1[i]) for i = 0 to n-1.
+* The vec0 lookups are the same for every point, so are only done once; with SIMD, the rest is done for 4 points at a time,
+* with the same operations as perlin_noise2, and so the same results. Only the table lookups are done per point.
+*/
+void perlin_noise2_row(float *out, float vec0, const float *vec1, int n, bool simd) {
+	int k = 0;
+#if defined(USE_SSE2) || defined(USE_NEON)
+	if( simd && n >= 4 ) {
+		int bx0, bx1, i, j;
+		float rx0, rx1, sx, t;
+		float vec[1] = {vec0};
+
+		perlin_noise2_init();
+
+		setup(0, bx0,bx1, rx0,rx1);
+		sx = s_curve(rx0);
+		i = p[ bx0 ];
+		j = p[ bx1 ];
+
+		for(;k+4<=n;k+=4) {
+			int by0[4];
+			float q00[2][4], q10[2][4], q01[2][4], q11[2][4];
+#if defined(USE_SSE2)
+			__m128 ty = _mm_add_ps(_mm_loadu_ps(&vec1[k]), _mm_set1_ps((float)N));
+			__m128i ity = _mm_cvttps_epi32(ty);
+			_mm_storeu_si128((__m128i *)by0, _mm_and_si128(ity, _mm_set1_epi32(BM)));
+			__m128 ry0 = _mm_sub_ps(ty, _mm_cvtepi32_ps(ity));
+#elif defined(USE_NEON)
+			float32x4_t ty = vaddq_f32(vld1q_f32(&vec1[k]), vdupq_n_f32((float)N));
+			int32x4_t ity = vcvtq_s32_f32(ty);
+			vst1q_s32(by0, vandq_s32(ity, vdupq_n_s32(BM)));
+			float32x4_t ry0 = vsubq_f32(ty, vcvtq_f32_s32(ity));
+#endif
+			for(int l=0;l<4;l++) {
+				int by1 = (by0[l]+1) & BM;
+				const float *q = g2[ p[ i + by0[l] ] ];
+				q00[0][l] = q[0]; q00[1][l] = q[1];
+				q = g2[ p[ j + by0[l] ] ];
+				q10[0][l] = q[0]; q10[1][l] = q[1];
+				q = g2[ p[ i + by1 ] ];
+				q01[0][l] = q[0]; q01[1][l] = q[1];
+				q = g2[ p[ j + by1 ] ];
+				q11[0][l] = q[0]; q11[1][l] = q[1];
+			}
+#if defined(USE_SSE2)
+			__m128 ry1 = _mm_sub_ps(ry0, _mm_set1_ps(1.0f));
+			__m128 sy = _mm_mul_ps(_mm_mul_ps(ry0, ry0), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), ry0)));
+			__m128 vrx0 = _mm_set1_ps(rx0);
+			__m128 vrx1 = _mm_set1_ps(rx1);
+			__m128 vsx = _mm_set1_ps(sx);
+#define at2_ps(rx,ry,q) _mm_add_ps(_mm_mul_ps(rx, _mm_loadu_ps(q[0])), _mm_mul_ps(ry, _mm_loadu_ps(q[1])))
+#define lerp_ps(t,a,b) _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)))
+			__m128 u = at2_ps(vrx0, ry0, q00);
+			__m128 v = at2_ps(vrx1, ry0, q10);
+			__m128 a = lerp_ps(vsx, u, v);
+			u = at2_ps(vrx0, ry1, q01);
+			v = at2_ps(vrx1, ry1, q11);
+			__m128 b = lerp_ps(vsx, u, v);
+			_mm_storeu_ps(&out[k], lerp_ps(sy, a, b));
+#undef at2_ps
+#undef lerp_ps
+#elif defined(USE_NEON)
+			float32x4_t ry1 = vsubq_f32(ry0, vdupq_n_f32(1.0f));
+			float32x4_t sy = vmulq_f32(vmulq_f32(ry0, ry0), vsubq_f32(vdupq_n_f32(3.0f), vmulq_f32(vdupq_n_f32(2.0f), ry0)));
+			float32x4_t vrx0 = vdupq_n_f32(rx0);
+			float32x4_t vrx1 = vdupq_n_f32(rx1);
+			float32x4_t vsx = vdupq_n_f32(sx);
+#define at2_f32(rx,ry,q) vaddq_f32(vmulq_f32(rx, vld1q_f32(q[0])), vmulq_f32(ry, vld1q_f32(q[1])))
+#define lerp_f32(t,a,b) vaddq_f32(a, vmulq_f32(t, vsubq_f32(b, a)))
+			float32x4_t u = at2_f32(vrx0, ry0, q00);
+			float32x4_t v = at2_f32(vrx1, ry0, q10);
+			float32x4_t a = lerp_f32(vsx, u, v);
+			u = at2_f32(vrx0, ry1, q01);
+			v = at2_f32(vrx1, ry1, q11);
+			float32x4_t b = lerp_f32(vsx, u, v);
+			vst1q_f32(&out[k], lerp_f32(sy, a, b));
+#undef at2_f32
+#undef lerp_f32
+#endif
+		}
+	}
+#endif
+	for(;k<n;k++) {
+		float vec[2] = {vec0, vec1[k]};
+		out[k] = perlin_noise2(vec);
+	}
+}
+
+bool TextToken::equals(const char *text) const {
+	return strlen(text) == length && memcmp(str, text, length) == 0;
+}
+
+bool TextToken::startsWith(const char *text) const {
+	size_t text_length = strlen(text);
+	return length >= text_length && strncmp(str, text, text_length) == 0;
+}
+
+/* As atoi, so trailing non-digits are ignored, and 0 is returned if there isn't a number.
+*/
+int TextToken::toInt() const {
+	size_t i = 0;
+	bool negative = false;
+	if( i < length && ( str[i] == '-' || str[i] == '+' ) ) {
+		negative = str[i] == '-';
+		i++;
+	}
+	int value = 0;
+	for(;i<length && str[i] >= '0' && str[i] <= '9';i++) {
+		value = 10 * value + ( str[i] - '0' );
+	}
+	return negative ? -value : value;
+}
+
+std::string TextToken::toString() const {
+	return std::string(str, length);
+}
+
+void TextToken::trimLeft() {
+	while( length > 0 && ( *str == ' ' || *str == '\t' ) ) {
+		str++;
+		length--;
+	}
+}
+
+/* Splits off the next word, separated by spaces or tabs, and removes it from this token. Returns false if there are
+*  no more words. Unlike strtok, this doesn't modify the text, and keeps no state of its own.
+*/
+bool TextToken::nextToken(TextToken *token) {
+	trimLeft();
+	if( length == 0 ) {
+		return false;
+	}
+	size_t token_length = 0;
+	while( token_length < length && str[token_length] != ' ' && str[token_length] != '\t' ) {
+		token_length++;
+	}
+	*token = TextToken(str, token_length);
+	str += token_length;
+	length -= token_length;
+	return true;
+}
+
+TextReader::TextReader() : data(NULL), size(0), pos(0), mapping(NULL) {
+}
+
+TextReader::~TextReader() {
+	close();
+}
+
+bool TextReader::open(const char *filename) {
+	close();
+#ifdef TEXTREADER_MMAP
+	int fd = ::open(filename, O_RDONLY);
+	if( fd != -1 ) {
+		struct stat file_stat;
+		if( fstat(fd, &file_stat) == 0 && file_stat.st_size > 0 ) {
+			void *ptr = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if( ptr != MAP_FAILED ) {
+				mapping = ptr;
+				data = (const char *)ptr;
+				size = file_stat.st_size;
+			}
+		}
+		::close(fd);
+		if( mapping != NULL ) {
+			return true;
+		}
+		// otherwise fall back to reading the file (e.g., empty files can't be mapped)
+	}
+#endif
+	// open in binary mode, so that we parse files in an OS-independent manner
+	SDL_RWops *file = SDL_RWFromFile(filename, "rb");
+	if( file == NULL ) {
+		return false;
+	}
+	const size_t chunk_size_c = 4096;
+	for(;;) {
+		size_t offset = buffer.size();
+		buffer.resize(offset + chunk_size_c);
+		int n_read = SDL_RWread(file, &buffer[offset], 1, chunk_size_c);
+		if( n_read <= 0 ) {
+			buffer.resize(offset);
+			break;
+		}
+		buffer.resize(offset + n_read);
+	}
+	SDL_RWclose(file);
+	data = buffer.size() > 0 ? &buffer[0] : NULL;
+	size = buffer.size();
+	return true;
+}
+
+void TextReader::close() {
+#ifdef TEXTREADER_MMAP
+	if( mapping != NULL ) {
+		munmap(mapping, size);
+	}
+#endif
+	mapping = NULL;
+	buffer.clear();
+	data = NULL;
+	size = 0;
+	pos = 0;
+}
+
+/* Returns the next line, without its line ending (either "\n" or "\r\n"), or false if the end of the file has been
+*  reached.
+*/
+bool TextReader::readLine(TextToken *line) {
+	if( pos >= size ) {
+		return false;
+	}
+	const char *start = &data[pos];
+	const char *newline = (const char *)memchr(start, '\n', size - pos);
+	size_t length = newline != NULL ? newline - start : size - pos;
+	pos += newline != NULL ? length + 1 : length;
+	if( length > 0 && start[length-1] == '\r' ) {
+		length--;
+	}
+	*line = TextToken(start, length);
+	return true;
+}
+
 #if defined(AROS) || defined(__MORPHOS__)
 #ifdef __amigaos4__
 #undef __USE_AMIGAOS_NAMESPACE__
@@ -13,6 +13,13 @@ const bool LOGGING = true; // enable logging even for release builds, for now
 #define LOG if( !LOGGING ) ((void)0); else log
 #endif
 
+// SIMD instruction sets available for the image processing and noise kernels
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define USE_NEON
+#endif
+
 void initFolderPaths();
 const char *getApplicationFilename(const char *name, bool survive_uninstall);
 void initLogFile();
@@ -108,6 +115,8 @@ int n_digits(int number);
 void textLines(int *n_lines,int *max_wid,const char *text, int lower_w, int upper_w);
 
 float perlin_noise2(float vec[2]);
+void perlin_noise2_init(); // called by the first use of perlin noise, but must be called before using it from more than one thread
+void perlin_noise2_row(float *out, float vec0, const float *vec1, int n, bool simd); // out[i] = perlin_noise2({vec0, vec1[i]}), using SSE2/NEON if simd is true
 
 #include <vector>
 using std::vector;
@@ -123,6 +132,53 @@ bool remove_vec(vector<T> *vec,const T& value) {
 	return false;
 }
 
+/** A run of characters within a TextReader's data (or any other string), that isn't null terminated, so text can be
+*   parsed without copying it.
+*/
+class TextToken {
+public:
+	const char *str;
+	size_t length;
+
+	TextToken() : str(NULL), length(0) {
+	}
+	TextToken(const char *str, size_t length) : str(str), length(length) {
+	}
+
+	bool empty() const {
+		return length == 0;
+	}
+	bool equals(const char *text) const;
+	bool startsWith(const char *text) const;
+	int toInt() const;
+	std::string toString() const;
+	void trimLeft();
+	bool nextToken(TextToken *token);
+};
+
+/** Reads a text file a line at a time. The file is memory mapped where possible, otherwise read into memory in one go
+*   through SDL_RWops (which also handles Android assets). Lines returned by readLine() point into the file's data, so
+*   are valid until the reader is closed. Each reader is independent, so different files can be parsed on different
+*   threads.
+*/
+class TextReader {
+	const char *data;
+	size_t size;
+	size_t pos;
+	vector<char> buffer; // holds the data when the file isn't mapped
+	void *mapping;
+
+	TextReader(const TextReader &); // not allowed
+	TextReader &operator=(const TextReader &); // not allowed
+public:
+	TextReader();
+	~TextReader();
+
+	bool open(const char *filename);
+	void close();
+	bool readLine(TextToken *line);
+};
+
 #if defined(AROS) || defined(__MORPHOS__)
 
 void getAROSScreenSize(int *user_width, int *user_height);